@@ -0,0 +1,96 @@
+#include "ao.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef unsigned int            uint;
+
+char const* const ao_names[AO_MODES] = {
+        "marched", "screen space"
+};
+
+// Positions need the range and precision of full floats, the rest is
+// lighting and unit vectors
+static GLenum const buffer_formats[AO_BUFFERS] = {
+        GL_RGBA16F, GL_RGBA16F, GL_RGBA32F, GL_RGBA16F
+};
+
+void
+create_ao_targets(struct ao_targets* const targets)
+{
+        glGenFramebuffers(1, &targets->framebuffer);
+        glGenTextures(AO_BUFFERS, targets->textures);
+        glGenTextures(1, &targets->depth);
+
+        targets->size[0] = 0;
+        targets->size[1] = 0;
+        targets->layers = 0;
+}
+
+void
+resize_ao_targets(struct ao_targets* const targets, int const* const size, uint layers)
+{
+        if (size[0] == targets->size[0] && size[1] == targets->size[1] &&
+            layers == targets->layers) {
+                return;
+        }
+        targets->size[0] = size[0];
+        targets->size[1] = size[1];
+        targets->layers = layers;
+
+        // Immutable storage, so a new size needs new textures
+        glDeleteTextures(AO_BUFFERS, targets->textures);
+        glDeleteTextures(1, &targets->depth);
+        glGenTextures(AO_BUFFERS, targets->textures);
+        glGenTextures(1, &targets->depth);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, targets->framebuffer);
+
+        glActiveTexture(GL_TEXTURE0 + AO_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, targets->depth);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, size[0] < 1 ? 1 : size[0],
+                       size[1] < 1 ? 1 : size[1], (GLsizei)layers);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targets->depth, 0);
+
+        GLenum attachments[AO_BUFFERS];
+        for (uint i = 0; i < AO_BUFFERS; i++) {
+                glActiveTexture(GL_TEXTURE0 + AO_UNIT + i);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, targets->textures[i]);
+                glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, buffer_formats[i], size[0] < 1 ? 1 : size[0],
+                               size[1] < 1 ? 1 : size[1], (GLsizei)layers);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+                // Whole arrays, so a single view draws into layer 0 and
+                // several views into their own layers
+                attachments[i] = GL_COLOR_ATTACHMENT0 + i;
+                glFramebufferTexture(GL_FRAMEBUFFER, attachments[i], targets->textures[i], 0);
+        }
+        glDrawBuffers(AO_BUFFERS, attachments);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                fprintf(stderr, "ERROR: The ambient occlusion framebuffer is incomplete\n");
+                exit(EXIT_FAILURE);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void
+bind_ao_textures(struct ao_targets const* const targets)
+{
+        for (uint i = 0; i < AO_BUFFERS; i++) {
+                glActiveTexture(GL_TEXTURE0 + AO_UNIT + i);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, targets->textures[i]);
+        }
+}
+
+void
+delete_ao_targets(struct ao_targets* const targets)
+{
+        glDeleteFramebuffers(1, &targets->framebuffer);
+        glDeleteTextures(AO_BUFFERS, targets->textures);
+        glDeleteTextures(1, &targets->depth);
+}
@@ -0,0 +1,37 @@
+#ifndef AO_H
+#define AO_H
+
+#include <glad/glad.h>
+
+// Ambient occlusion, marched from every hit for every light, or estimated in
+// screen space. Then the march pass renders into a G-buffer of layered
+// textures, one layer per view, and a second pass darkens it from the
+// horizons it finds in the position buffer.
+#define AO_MARCHED              0
+#define AO_SCREEN               1
+#define AO_MODES                2
+
+// Linear colour without AO, the part of it AO darkens, world position with w
+// set on a hit and normal. Matching the outputs of
+// shaders/fragment_shader.glsl and the samplers of shaders/ao_shader.glsl.
+#define AO_BUFFERS              4
+#define AO_UNIT                 7
+
+// Render targets of the G-buffer, GL objects of the render thread
+struct ao_targets {
+        GLuint          framebuffer;
+        GLuint          textures[AO_BUFFERS];
+        GLuint          depth;          // for the proxy pass
+        int             size[2];        // per layer, 0 until first resized
+        unsigned int    layers;
+};
+
+extern char const* const ao_names[AO_MODES];
+
+void    create_ao_targets(struct ao_targets* const targets);
+void    resize_ao_targets(struct ao_targets* const targets, int const* const size,
+                          unsigned int layers);
+void    bind_ao_textures(struct ao_targets const* const targets);
+void    delete_ao_targets(struct ao_targets* const targets);
+
+#endif
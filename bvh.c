@@ -0,0 +1,444 @@
+#include "bvh.h"
+
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef unsigned int            uint;
+
+// Node of the tree while it is built, flattened into struct bvh_node after
+struct build_node {
+        float                   min[3];
+        float                   max[3];
+        struct build_node*      children[2];
+        uint                    first;
+        uint                    count;
+        uint                    size;
+};
+
+// Shared, read-only inputs of the build. Every subtree owns a disjoint range
+// of indices, so threads never write to the same memory.
+struct build_context {
+        float*  bounds;         // min xyz, max xyz per primitive
+        float*  centroids;      // xyz per primitive
+        uint*   indices;
+        uint    parallel_depth;
+};
+
+struct build_job {
+        struct build_context const*     context;
+        struct build_node*              node;
+        uint                            first;
+        uint                            count;
+        uint                            depth;
+};
+
+static void*
+allocate(size_t size)
+{
+        void* memory = malloc(size);
+        if (!memory) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the BVH\n");
+                exit(EXIT_FAILURE);
+        }
+
+        return memory;
+}
+
+static void
+grow(float* const min, float* const max, float const* const box_min, float const* const box_max)
+{
+        for (uint axis = 0; axis < 3; axis++) {
+                min[axis] = fminf(min[axis], box_min[axis]);
+                max[axis] = fmaxf(max[axis], box_max[axis]);
+        }
+}
+
+static void
+reset(float* const min, float* const max)
+{
+        for (uint axis = 0; axis < 3; axis++) {
+                min[axis] = FLT_MAX;
+                max[axis] = -FLT_MAX;
+        }
+}
+
+static float
+half_area(float const* const min, float const* const max)
+{
+        float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+        if (x < 0.0f || y < 0.0f || z < 0.0f) {
+                return 0.0f;
+        }
+
+        return x * y + y * z + z * x;
+}
+
+static void* build_subtree(void* argument);
+
+// Splits a node with the binned surface area heuristic, or leaves it a leaf
+// when no split is cheaper than intersecting all of its primitives.
+static void
+build_node(struct build_context const* const context, struct build_node* const node,
+           uint first, uint count, uint depth)
+{
+        uint* indices = context->indices;
+
+        float centroid_min[3], centroid_max[3];
+        reset(node->min, node->max);
+        reset(centroid_min, centroid_max);
+
+        for (uint i = first; i < first + count; i++) {
+                float const* box = context->bounds + 6 * indices[i];
+                float const* centroid = context->centroids + 3 * indices[i];
+
+                grow(node->min, node->max, box, box + 3);
+                grow(centroid_min, centroid_max, centroid, centroid);
+        }
+
+        node->children[0] = node->children[1] = NULL;
+        node->first = first;
+        node->count = count;
+        node->size = 1;
+
+        if (count <= BVH_LEAF_SIZE) {
+                return;
+        }
+
+        // Best split over the bins of all three axes
+        float best_cost = FLT_MAX;
+        uint best_axis = 0, best_split = 0;
+
+        for (uint axis = 0; axis < 3; axis++) {
+                float extent = centroid_max[axis] - centroid_min[axis];
+                if (extent <= 0.0f) {
+                        continue;
+                }
+
+                uint bin_counts[BVH_BINS] = { 0 };
+                float bin_min[BVH_BINS][3], bin_max[BVH_BINS][3];
+                for (uint bin = 0; bin < BVH_BINS; bin++) {
+                        reset(bin_min[bin], bin_max[bin]);
+                }
+
+                float scale = BVH_BINS / extent;
+                for (uint i = first; i < first + count; i++) {
+                        float const* box = context->bounds + 6 * indices[i];
+                        float centroid = context->centroids[3 * indices[i] + axis];
+                        uint bin = (uint)((centroid - centroid_min[axis]) * scale);
+                        bin = bin < BVH_BINS ? bin : BVH_BINS - 1;
+
+                        bin_counts[bin]++;
+                        grow(bin_min[bin], bin_max[bin], box, box + 3);
+                }
+
+                // Sweep from the right, then evaluate each split from the left
+                float right_area[BVH_BINS];
+                uint right_count[BVH_BINS];
+                float min[3], max[3];
+                reset(min, max);
+
+                uint total = 0;
+                for (uint bin = BVH_BINS - 1; bin > 0; bin--) {
+                        total += bin_counts[bin];
+                        grow(min, max, bin_min[bin], bin_max[bin]);
+                        right_count[bin] = total;
+                        right_area[bin] = half_area(min, max);
+                }
+
+                reset(min, max);
+                total = 0;
+                for (uint split = 1; split < BVH_BINS; split++) {
+                        total += bin_counts[split - 1];
+                        grow(min, max, bin_min[split - 1], bin_max[split - 1]);
+
+                        float cost = half_area(min, max) * (float)total +
+                                     right_area[split] * (float)right_count[split];
+                        if (total && right_count[split] && cost < best_cost) {
+                                best_cost = cost;
+                                best_axis = axis;
+                                best_split = split;
+                        }
+                }
+        }
+
+        uint middle;
+
+        if (best_split) {
+                float leaf_cost = half_area(node->min, node->max) * (float)count;
+                if (best_cost >= leaf_cost && count <= BVH_MAX_LEAF_SIZE) {
+                        return;
+                }
+
+                // Partition the indices around the chosen bin boundary
+                float scale = BVH_BINS / (centroid_max[best_axis] - centroid_min[best_axis]);
+                uint left = first, right = first + count;
+
+                while (left < right) {
+                        float centroid = context->centroids[3 * indices[left] + best_axis];
+                        uint bin = (uint)((centroid - centroid_min[best_axis]) * scale);
+
+                        if ((bin < BVH_BINS ? bin : BVH_BINS - 1) < best_split) {
+                                left++;
+                        } else {
+                                uint swap = indices[left];
+                                indices[left] = indices[--right];
+                                indices[right] = swap;
+                        }
+                }
+                middle = left;
+        } else {
+                // All centroids coincide, split by count
+                if (count <= BVH_MAX_LEAF_SIZE) {
+                        return;
+                }
+                middle = first + count / 2;
+        }
+
+        node->children[0] = allocate(sizeof(*node->children[0]));
+        node->children[1] = allocate(sizeof(*node->children[1]));
+
+        struct build_job jobs[2] = {
+                { context, node->children[0], first, middle - first, depth + 1 },
+                { context, node->children[1], middle, first + count - middle, depth + 1 }
+        };
+
+        // Hand the left subtree to another thread near the root
+        pthread_t thread;
+        int threaded = depth < context->parallel_depth && count >= BVH_PARALLEL_THRESHOLD &&
+                       !pthread_create(&thread, NULL, build_subtree, &jobs[0]);
+
+        if (!threaded) {
+                build_subtree(&jobs[0]);
+        }
+        build_subtree(&jobs[1]);
+
+        if (threaded) {
+                pthread_join(thread, NULL);
+        }
+
+        node->size = 1 + node->children[0]->size + node->children[1]->size;
+}
+
+static void*
+build_subtree(void* argument)
+{
+        struct build_job const* job = argument;
+        build_node(job->context, job->node, job->first, job->count, job->depth);
+
+        return NULL;
+}
+
+// Writes the subtree depth first and frees it, returns the next free slot
+static uint
+flatten(struct bvh* const bvh, struct build_node* const node, uint index)
+{
+        struct bvh_node* flat = &bvh->nodes[index];
+
+        for (uint axis = 0; axis < 3; axis++) {
+                flat->min[axis] = node->min[axis];
+                flat->max[axis] = node->max[axis];
+        }
+
+        uint next;
+
+        if (node->children[0]) {
+                uint right = flatten(bvh, node->children[0], index + 1);
+                flat->offset = right;
+                flat->count = 0;
+                next = flatten(bvh, node->children[1], right);
+        } else {
+                flat->offset = node->first;
+                flat->count = node->count;
+                next = index + 1;
+        }
+
+        free(node->children[0]);
+        free(node->children[1]);
+
+        return next;
+}
+
+void
+build_bvh(struct bvh* const bvh, struct primitive const* const primitives, uint count)
+{
+        struct build_context context;
+        context.bounds = allocate(sizeof(*context.bounds) * 6 * (count ? count : 1));
+        context.centroids = allocate(sizeof(*context.centroids) * 3 * (count ? count : 1));
+        context.indices = allocate(sizeof(*context.indices) * (count ? count : 1));
+
+        for (uint i = 0; i < count; i++) {
+                float* box = context.bounds + 6 * i;
+                primitive_bounds(&primitives[i], box, box + 3);
+
+                for (uint axis = 0; axis < 3; axis++) {
+                        context.centroids[3 * i + axis] = .5f * (box[axis] + box[3 + axis]);
+                }
+                context.indices[i] = i;
+        }
+
+        // One level of threads per doubling of the core count
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        cores = cores < 1 ? 1 : cores > MAX_BVH_THREADS ? MAX_BVH_THREADS : cores;
+        context.parallel_depth = 0;
+        while ((1L << context.parallel_depth) < cores) {
+                context.parallel_depth++;
+        }
+
+        struct build_node root;
+        build_node(&context, &root, 0, count, 0);
+
+        bvh->node_count = root.size;
+        bvh->nodes = allocate(sizeof(*bvh->nodes) * bvh->node_count);
+        bvh->indices = context.indices;
+        bvh->index_count = count;
+
+        flatten(bvh, &root, 0);
+
+        bvh->parents = allocate(sizeof(*bvh->parents) * bvh->node_count);
+        bvh->leaves = allocate(sizeof(*bvh->leaves) * (count ? count : 1));
+        bvh->dirty_nodes = allocate(sizeof(*bvh->dirty_nodes) * bvh->node_count);
+        bvh->dirty = calloc(bvh->node_count, sizeof(*bvh->dirty));
+        bvh->dirty_count = 0;
+        if (!bvh->dirty) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the BVH\n");
+                exit(EXIT_FAILURE);
+        }
+
+        // Parents come before their children, so their depth is known first
+        uint* depths = allocate(sizeof(*depths) * bvh->node_count);
+        bvh->parents[0] = 0;
+        depths[0] = 0;
+        bvh->depth = 0;
+        for (uint i = 0; i < bvh->node_count; i++) {
+                struct bvh_node const* node = &bvh->nodes[i];
+                if (node->count) {
+                        for (uint j = node->offset; j < node->offset + node->count; j++) {
+                                bvh->leaves[bvh->indices[j]] = i;
+                        }
+                        bvh->depth = depths[i] > bvh->depth ? depths[i] : bvh->depth;
+                } else {
+                        bvh->parents[i + 1] = i;
+                        bvh->parents[node->offset] = i;
+                        depths[i + 1] = depths[i] + 1;
+                        depths[node->offset] = depths[i] + 1;
+                }
+        }
+        free(depths);
+
+        free(context.bounds);
+        free(context.centroids);
+}
+
+static int
+compare_nodes(void const* a, void const* b)
+{
+        uint first = *(uint const*)a, second = *(uint const*)b;
+        return first < second ? -1 : first > second;
+}
+
+// Only the leaves of the first moved primitives and the nodes above them
+// change, the rest of the tree keeps its boxes
+void
+refit_bvh(struct bvh* const bvh, struct primitive const* const primitives, uint moved)
+{
+        for (uint i = 0; i < bvh->dirty_count; i++) {
+                bvh->dirty[bvh->dirty_nodes[i]] = 0;
+        }
+        bvh->dirty_count = 0;
+
+        // Up from every leaf until a node already marked, which has its
+        // ancestors marked too
+        for (uint i = 0; i < moved && i < bvh->index_count; i++) {
+                uint node = bvh->leaves[i];
+                while (!bvh->dirty[node]) {
+                        bvh->dirty[node] = 1;
+                        bvh->dirty_nodes[bvh->dirty_count++] = node;
+                        if (!node) {
+                                break;
+                        }
+                        node = bvh->parents[node];
+                }
+        }
+
+        // Children always come after their parent, so walking backwards
+        // updates every child before the node that contains it
+        qsort(bvh->dirty_nodes, bvh->dirty_count, sizeof(*bvh->dirty_nodes), compare_nodes);
+
+        for (uint k = bvh->dirty_count; k-- > 0;) {
+                uint i = bvh->dirty_nodes[k];
+                struct bvh_node* node = &bvh->nodes[i];
+                reset(node->min, node->max);
+
+                if (node->count) {
+                        for (uint j = node->offset; j < node->offset + node->count; j++) {
+                                float min[3], max[3];
+                                primitive_bounds(&primitives[bvh->indices[j]], min, max);
+                                grow(node->min, node->max, min, max);
+                        }
+                } else {
+                        struct bvh_node const* left = &bvh->nodes[i + 1];
+                        struct bvh_node const* right = &bvh->nodes[node->offset];
+                        grow(node->min, node->max, left->min, left->max);
+                        grow(node->min, node->max, right->min, right->max);
+                }
+        }
+}
+
+void
+upload_bvh(GLuint const* const buffers, struct bvh const* const bvh)
+{
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(sizeof(*bvh->nodes) * bvh->node_count),
+                     bvh->nodes, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BVH_NODES_BINDING, buffers[0]);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     (GLsizeiptr)(sizeof(*bvh->indices) * (bvh->index_count ? bvh->index_count : 1)),
+                     bvh->indices, GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BVH_INDICES_BINDING, buffers[1]);
+}
+
+void
+update_bvh(GLuint const* const buffers, struct bvh const* const bvh)
+{
+        // A refit only moves boxes, the topology and indices stay as uploaded.
+        // Only the nodes it changed are sent, runs of them close together as
+        // one range.
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+
+        for (uint k = 0; k < bvh->dirty_count;) {
+                uint first = bvh->dirty_nodes[k];
+                uint last = first;
+                while (++k < bvh->dirty_count && bvh->dirty_nodes[k] - last <= BVH_UPLOAD_GAP) {
+                        last = bvh->dirty_nodes[k];
+                }
+
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+                                (GLintptr)(sizeof(*bvh->nodes) * first),
+                                (GLsizeiptr)(sizeof(*bvh->nodes) * (last - first + 1)),
+                                &bvh->nodes[first]);
+        }
+}
+
+void
+free_bvh(struct bvh* const bvh)
+{
+        free(bvh->nodes);
+        free(bvh->indices);
+        free(bvh->parents);
+        free(bvh->leaves);
+        free(bvh->dirty_nodes);
+        free(bvh->dirty);
+
+        bvh->nodes = NULL;
+        bvh->indices = NULL;
+        bvh->parents = NULL;
+        bvh->leaves = NULL;
+        bvh->dirty_nodes = NULL;
+        bvh->dirty = NULL;
+}
@@ -0,0 +1,62 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "primitives.h"
+
+// Binned SAH build settings
+#define BVH_BINS                16
+#define BVH_LEAF_SIZE           4
+#define BVH_MAX_LEAF_SIZE       16
+
+// Subtrees at least this large are built on their own thread
+#define BVH_PARALLEL_THRESHOLD  4096
+#define MAX_BVH_THREADS         64
+
+// Deepest tree the traversal stacks of shaders/instances.glsl are sized for,
+// the host injects the depth of the built one as BVH_STACK_SIZE
+#define MAX_BVH_STACK_SIZE      64
+
+// Dirty nodes this close together are uploaded as one range
+#define BVH_UPLOAD_GAP          32
+
+// Shader storage bindings, matching shaders/instances.glsl
+#define BVH_NODES_BINDING       3
+#define BVH_INDICES_BINDING     4
+
+// Flattened node, laid out as std430 { vec3 min; uint offset; vec3 max; uint count; }.
+// Nodes are stored depth first, so the left child of an interior node directly
+// follows it and offset holds the right child. Leaves list count primitives
+// starting at indices[offset].
+struct bvh_node {
+        float           min[3];
+        unsigned int    offset;
+        float           max[3];
+        unsigned int    count;
+};
+
+struct bvh {
+        struct bvh_node*        nodes;
+        unsigned int*           indices;
+        unsigned int            node_count;
+        unsigned int            index_count;
+        unsigned int            depth;          // of the deepest leaf, the root is 0
+
+        // For refits: the parent of every node, the root its own, and the leaf
+        // of every primitive. The nodes the last refit moved, in ascending
+        // order, are flagged in dirty.
+        unsigned int*           parents;
+        unsigned int*           leaves;
+        unsigned int*           dirty_nodes;
+        unsigned int            dirty_count;
+        unsigned char*          dirty;
+};
+
+void    build_bvh(struct bvh* const bvh, struct primitive const* const primitives,
+                  unsigned int count);
+void    refit_bvh(struct bvh* const bvh, struct primitive const* const primitives,
+                  unsigned int moved);
+void    upload_bvh(GLuint const* const buffers, struct bvh const* const bvh);
+void    update_bvh(GLuint const* const buffers, struct bvh const* const bvh);
+void    free_bvh(struct bvh* const bvh);
+
+#endif
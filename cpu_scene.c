@@ -0,0 +1,758 @@
+#include "cpu_scene.h"
+
+#include <math.h>
+#include <stddef.h>
+
+typedef unsigned int            uint;
+typedef unsigned char           uchar;
+
+// The main camera looks at a point this far below and in front of it, as in
+// views.c
+static float const camera_target[3] = { 0.f, -1.f, -3.f };
+
+struct vec3 {
+        float   x, y, z;
+};
+
+struct material {
+        struct vec3     ambient;
+        struct vec3     diffuse;
+        struct vec3     specular;
+        float           alpha;
+};
+
+static struct vec3
+vec3(float x, float y, float z)
+{
+        return (struct vec3){ x, y, z };
+}
+
+static struct vec3
+add(struct vec3 a, struct vec3 b)
+{
+        return vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+static struct vec3
+sub(struct vec3 a, struct vec3 b)
+{
+        return vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static struct vec3
+scale(struct vec3 a, float s)
+{
+        return vec3(a.x * s, a.y * s, a.z * s);
+}
+
+static float
+dot(struct vec3 a, struct vec3 b)
+{
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static float
+length(struct vec3 a)
+{
+        return sqrtf(dot(a, a));
+}
+
+static struct vec3
+normalize(struct vec3 a)
+{
+        return scale(a, 1.f / length(a));
+}
+
+static struct vec3
+cross(struct vec3 a, struct vec3 b)
+{
+        return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static float
+clamp(float x, float low, float high)
+{
+        return x < low ? low : x > high ? high : x;
+}
+
+static struct vec3
+load(float const* const vector)
+{
+        return vec3(vector[0], vector[1], vector[2]);
+}
+
+static void
+store(float* const vector, struct vec3 a)
+{
+        vector[0] = a.x;
+        vector[1] = a.y;
+        vector[2] = a.z;
+}
+
+static float
+sphere_radius(float time)
+{
+        return sinf(time) * .5f + .5f + .5f;
+}
+
+static uint
+add_node(struct sdf_tree* const tree, uint op, uint material, uint first, uint second,
+         float const* const parameters)
+{
+        struct sdf_node* node = &tree->nodes[tree->count];
+        node->op = op;
+        node->material = material;
+        node->children[0] = first;
+        node->children[1] = second;
+        for (uint i = 0; i < 4; i++) {
+                node->parameters[i] = parameters ? parameters[i] : 0.f;
+        }
+
+        return tree->count++;
+}
+
+void
+setup_cpu_scene(struct cpu_scene* const scene, float const* const camera, float time, int terrain,
+                struct sdf_tree const* const tree, int const* const size)
+{
+        struct vec3 forward = normalize(load(camera_target));
+        struct vec3 right = normalize(cross(forward, vec3(0.f, 1.f, 0.f)));
+
+        store(scene->origin, load(camera));
+        store(scene->forward, forward);
+        store(scene->right, right);
+        store(scene->up, cross(right, forward));
+        scene->focal_length = 1.5f;
+
+        scene->time = time;
+        scene->terrain = terrain;
+        scene->size[0] = size[0];
+        scene->size[1] = size[1];
+        scene->pixel_angle = 2.f / ((float)size[1] * scene->focal_length);
+        scene->prune = 1;
+        scene->native = NULL;
+
+        if (tree) {
+                scene->tree = *tree;
+        } else {
+                // The gold sphere and the ground
+                float const sphere[4] = { 0.f, 0.f, 0.f, sphere_radius(time) };
+                float const plane[4] = { 1.f };
+
+                scene->tree.count = 0;
+                uint first = add_node(&scene->tree, SDF_SPHERE, MATERIAL_GOLD, 0, 0, sphere);
+                uint second = add_node(&scene->tree, terrain ? SDF_TERRAIN : SDF_PLANE,
+                                       MATERIAL_CHECKERBOARD, 0, 0, plane);
+                add_node(&scene->tree, SDF_UNION, MATERIAL_BACKGROUND, first, second, NULL);
+        }
+
+        compile_tape(&scene->tape, &scene->tree, scene->origin, scene->pixel_angle);
+}
+
+static struct material
+surface_material(uint material, struct vec3 point)
+{
+        if (material == MATERIAL_GOLD) {
+                return (struct material){
+                        vec3(.5f * .7f, .5f * .5f, 0.f), vec3(.6f * .7f, .6f * .7f, 0.f),
+                        vec3(.6f, .6f, .6f), 5.f
+                };
+        } else if (material == MATERIAL_SILVER) {
+                return (struct material){
+                        vec3(.4f * .8f, .4f * .8f, .4f * .8f), vec3(.5f * .7f, .5f * .7f, .5f * .7f),
+                        vec3(.6f, .6f, .6f), 5.f
+                };
+        }
+
+        float checker = .8f * fmodf(floorf(point.x) + floorf(point.z), 2.f) * .3f;
+        if (checker < 0.f) {
+                // GLSL mod() takes the sign of the divisor
+                checker += .8f * 2.f * .3f;
+        }
+        return (struct material){
+                vec3(checker, checker, checker), vec3(.1f, .1f, .1f), vec3(0.f, 0.f, 0.f), 1.f
+        };
+}
+
+// =========================================================================================================
+// Pruning
+// =========================================================================================================
+
+// Points in the box of a slab the march and the normals can still evaluate
+// from it, past its depths by the precision and the normal offsets
+#define SLAB_MARGIN             .01f
+
+// Slack for the rounding of the distances, a child is only dropped when it
+// loses by more
+#define PRUNE_MARGIN            .001f
+
+struct box {
+        struct vec3     min;
+        struct vec3     max;
+};
+
+// The box in the space of the child of a transform
+static struct box
+child_box(struct sdf_node const* const node, struct box const* const box)
+{
+        float const* parameters = node->parameters;
+        if (node->op == SDF_TRANSLATE) {
+                return (struct box){ sub(box->min, load(parameters)), sub(box->max, load(parameters)) };
+        }
+
+        return (struct box){ scale(box->min, 1.f / parameters[0]), scale(box->max, 1.f / parameters[0]) };
+}
+
+// Bounds of the distance over the box. fBM stays within +-1, so the terrain
+// within +-TERRAIN_HEIGHT of its plane. Smooth operations reach up to k / 4
+// past their sharp counterparts.
+static void
+node_range(struct sdf_tree const* const tree, uint index, struct box const* const box,
+           float* const range)
+{
+        struct sdf_node const* node = &tree->nodes[index];
+        float const* parameters = node->parameters;
+
+        if (node->op == SDF_SPHERE) {
+                // Nearest point of the box, and the farthest corner
+                struct vec3 center = load(parameters);
+                struct vec3 nearest = vec3(clamp(center.x, box->min.x, box->max.x),
+                                           clamp(center.y, box->min.y, box->max.y),
+                                           clamp(center.z, box->min.z, box->max.z));
+                struct vec3 low = sub(center, box->min), high = sub(center, box->max);
+                struct vec3 farthest = vec3(fmaxf(fabsf(low.x), fabsf(high.x)),
+                                            fmaxf(fabsf(low.y), fabsf(high.y)),
+                                            fmaxf(fabsf(low.z), fabsf(high.z)));
+                range[0] = length(sub(center, nearest)) - parameters[3];
+                range[1] = length(farthest) - parameters[3];
+                return;
+        } else if (node->op == SDF_PLANE) {
+                range[0] = box->min.y + parameters[0];
+                range[1] = box->max.y + parameters[0];
+                return;
+        } else if (node->op == SDF_TERRAIN) {
+                range[0] = .6f * (box->min.y - TERRAIN_HEIGHT + parameters[0]);
+                range[1] = .6f * (box->max.y + TERRAIN_HEIGHT + parameters[0]);
+                return;
+        } else if (node->op == SDF_TRANSLATE || node->op == SDF_SCALE) {
+                struct box moved = child_box(node, box);
+                node_range(tree, node->children[0], &moved, range);
+                if (node->op == SDF_SCALE) {
+                        range[0] *= parameters[0];
+                        range[1] *= parameters[0];
+                }
+                return;
+        }
+
+        float a[2], b[2];
+        node_range(tree, node->children[0], box, a);
+        node_range(tree, node->children[1], box, b);
+
+        if (node->op == SDF_SUBTRACTION || node->op == SDF_SMOOTH_SUBTRACTION) {
+                float negated = -a[0];
+                a[0] = -a[1];
+                a[1] = negated;
+        }
+
+        float blend = node->op >= SDF_SMOOTH_UNION ? parameters[0] * .25f : 0.f;
+        if (node->op == SDF_UNION || node->op == SDF_SMOOTH_UNION) {
+                range[0] = fminf(a[0], b[0]) - blend;
+                range[1] = fminf(a[1], b[1]);
+        } else {
+                range[0] = fmaxf(a[0], b[0]);
+                range[1] = fmaxf(a[1], b[1]) + blend;
+        }
+}
+
+// Copies the subtree into pruned, children first, leaving out the children
+// of operations that cannot win anywhere in the box. A smooth operation is
+// decided once the children are further apart than its k. The rest evaluates
+// to the same distance there, bit for bit. Returns the index of the copy.
+static uint
+prune_node(struct sdf_tree const* const tree, uint index, struct box const* const box,
+           struct sdf_tree* const pruned)
+{
+        struct sdf_node node = tree->nodes[index];
+
+        if (node.op == SDF_TRANSLATE || node.op == SDF_SCALE) {
+                struct box moved = child_box(&node, box);
+                node.children[0] = prune_node(tree, node.children[0], &moved, pruned);
+        } else if (node.op >= SDF_UNION) {
+                float a[2], b[2];
+                node_range(tree, node.children[0], box, a);
+                node_range(tree, node.children[1], box, b);
+
+                // Which child is always the result, if either. A subtraction
+                // left with its first child would need a negation, so only
+                // drops that one.
+                float gap = (node.op >= SDF_SMOOTH_UNION ? node.parameters[0] : 0.f) + PRUNE_MARGIN;
+                int winner = -1;
+                if (node.op == SDF_UNION || node.op == SDF_SMOOTH_UNION) {
+                        winner = b[0] - a[1] > gap ? 0 : a[0] - b[1] > gap ? 1 : -1;
+                } else if (node.op == SDF_INTERSECTION || node.op == SDF_SMOOTH_INTERSECTION) {
+                        winner = a[0] - b[1] > gap ? 0 : b[0] - a[1] > gap ? 1 : -1;
+                } else if (b[0] + a[0] > gap) {
+                        winner = 1;
+                }
+
+                if (winner >= 0) {
+                        return prune_node(tree, node.children[winner], box, pruned);
+                }
+
+                node.children[0] = prune_node(tree, node.children[0], box, pruned);
+                node.children[1] = prune_node(tree, node.children[1], box, pruned);
+        }
+
+        pruned->nodes[pruned->count] = node;
+        return pruned->count++;
+}
+
+// Depth slab i starts at, closer slabs are thinner as their rays spread less
+static float
+slab_depth(uint slab)
+{
+        float fraction = (float)slab / (float)TILE_SLABS;
+        return CPU_MAX_DEPTH * fraction * fraction;
+}
+
+// Box around the points between depths near and far on the rays through the
+// image plane rectangle u, v. The point at depth t on the ray through uv is
+// t / |n| * n, with n = uv.x * right + uv.y * up + focal_length * forward.
+// That is linear in each of t / |n|, uv.x and uv.y, so the corners of their
+// ranges bound it.
+static void
+frustum_box(struct cpu_scene const* const scene, float const* const u, float const* const v,
+            float near, float far, struct box* const box)
+{
+        float focal = scene->focal_length * scene->focal_length;
+
+        // |n| is smallest at the point of the rectangle nearest to its centre
+        float closest[2] = { clamp(0.f, u[0], u[1]), clamp(0.f, v[0], v[1]) };
+        float shortest = sqrtf(closest[0] * closest[0] + closest[1] * closest[1] + focal);
+        float longest = 0.f;
+        for (uint corner = 0; corner < 4; corner++) {
+                float x = u[corner & 1], y = v[corner >> 1];
+                longest = fmaxf(longest, sqrtf(x * x + y * y + focal));
+        }
+        float scales[2] = { near / longest, far / shortest };
+
+        struct vec3 origin = load(scene->origin);
+        box->min = vec3(INFINITY, INFINITY, INFINITY);
+        box->max = vec3(-INFINITY, -INFINITY, -INFINITY);
+        for (uint corner = 0; corner < 8; corner++) {
+                struct vec3 n = add(add(scale(load(scene->right), u[corner & 1]),
+                                        scale(load(scene->up), v[(corner >> 1) & 1])),
+                                    scale(load(scene->forward), scene->focal_length));
+                struct vec3 point = add(origin, scale(n, scales[corner >> 2]));
+
+                box->min = vec3(fminf(box->min.x, point.x), fminf(box->min.y, point.y),
+                                fminf(box->min.z, point.z));
+                box->max = vec3(fmaxf(box->max.x, point.x), fmaxf(box->max.y, point.y),
+                                fmaxf(box->max.z, point.z));
+        }
+
+        box->min = sub(box->min, vec3(SLAB_MARGIN, SLAB_MARGIN, SLAB_MARGIN));
+        box->max = add(box->max, vec3(SLAB_MARGIN, SLAB_MARGIN, SLAB_MARGIN));
+}
+
+static void
+prune_slabs(struct cpu_scene const* const scene, float const* const u, float const* const v,
+            struct tape* const slabs)
+{
+        struct sdf_tree const* tree = &scene->tree;
+        uint root = tree->count - 1;
+
+        for (uint slab = 0; slab < TILE_SLABS; slab++) {
+                struct box box;
+                frustum_box(scene, u, v, slab_depth(slab), slab_depth(slab + 1), &box);
+
+                // Nothing in reach, the slab is background
+                struct sdf_tree pruned;
+                pruned.count = 0;
+                if (tree->count) {
+                        float range[2];
+                        node_range(tree, root, &box, range);
+                        if (range[0] < CPU_MAX_DEPTH + PRUNE_MARGIN) {
+                                prune_node(tree, root, &box, &pruned);
+                        }
+                }
+
+                compile_tape(&slabs[slab], &pruned, scene->origin, scene->pixel_angle);
+        }
+}
+
+// =========================================================================================================
+// Packets
+// =========================================================================================================
+
+// Rays of neighbouring pixels, traced together. Every query runs a tape
+// once for all the points the packet needs.
+struct packet {
+        uint            count;
+        struct vec3     directions[TAPE_LANES];
+        float           depths[TAPE_LANES];
+        uint            materials[TAPE_LANES];
+        uint            slabs[TAPE_LANES];
+};
+
+static void
+query(struct cpu_scene const* const scene, struct tape const* const tape,
+      struct vec3 const* const points, uint count, float lod_scale, float* const distances,
+      uint* const materials)
+{
+        float x[CPU_AO_SAMPLES * TAPE_LANES], y[CPU_AO_SAMPLES * TAPE_LANES];
+        float z[CPU_AO_SAMPLES * TAPE_LANES];
+        for (uint i = 0; i < count; i++) {
+                x[i] = points[i].x;
+                y[i] = points[i].y;
+                z[i] = points[i].z;
+        }
+
+        if (tape == &scene->tape && scene->native) {
+                scene->native(x, y, z, lod_scale, scene->origin, scene->pixel_angle, distances,
+                              materials, count);
+        } else {
+                run_tape(tape, x, y, z, lod_scale, distances, materials, count);
+        }
+}
+
+// The tape of the slab the lanes are in, the whole scene when they are in
+// different ones or without pruning
+static struct tape const*
+packet_tape(struct cpu_scene const* const scene, struct tape const* const slabs,
+            uint const* const lanes, uint const* const lane_slabs, uint count)
+{
+        if (!slabs) {
+                return &scene->tape;
+        }
+
+        for (uint i = 1; i < count; i++) {
+                if (lane_slabs[lanes[i]] != lane_slabs[lanes[0]]) {
+                        return &scene->tape;
+                }
+        }
+        return &slabs[lane_slabs[lanes[0]]];
+}
+
+// The slab of a lane only changes every few steps, it is followed rather
+// than looked up
+static uint
+follow_slab(uint slab, float depth)
+{
+        if (!(depth >= 0.f) || depth >= CPU_MAX_DEPTH) {
+                return TILE_SLABS;
+        }
+
+        slab = slab < TILE_SLABS ? slab : 0;
+        while (slab + 1 < TILE_SLABS && depth >= slab_depth(slab + 1)) {
+                slab++;
+        }
+        while (slab > 0 && depth < slab_depth(slab)) {
+                slab--;
+        }
+        return slab;
+}
+
+// rayMarch() for every lane, the lanes that are done drop out
+static void
+march_packet(struct cpu_scene const* const scene, struct tape const* const slabs,
+             struct packet* const packet)
+{
+        struct vec3 origin = load(scene->origin);
+        uint lanes[TAPE_LANES], count = packet->count;
+        for (uint lane = 0; lane < count; lane++) {
+                lanes[lane] = lane;
+                packet->depths[lane] = 0.f;
+                packet->slabs[lane] = 0;
+        }
+
+        for (uint step = 0; step < CPU_MAX_MARCHING_STEPS && count; step++) {
+                struct vec3 points[TAPE_LANES];
+                for (uint i = 0; i < count; i++) {
+                        uint lane = lanes[i];
+                        points[i] = add(origin, scale(packet->directions[lane], packet->depths[lane]));
+                        packet->slabs[lane] = follow_slab(packet->slabs[lane], packet->depths[lane]);
+                }
+
+                // The whole scene outside the slabs
+                struct tape const* tape = &scene->tape;
+                if (packet->slabs[lanes[0]] < TILE_SLABS) {
+                        tape = packet_tape(scene, slabs, lanes, packet->slabs, count);
+                }
+
+                float distances[TAPE_LANES];
+                uint materials[TAPE_LANES];
+                query(scene, tape, points, count, 1.f, distances, materials);
+
+                uint remaining = 0;
+                for (uint i = 0; i < count; i++) {
+                        uint lane = lanes[i];
+                        packet->depths[lane] += distances[i];
+                        packet->materials[lane] = materials[i];
+                        if (!(fabsf(distances[i]) < CPU_PRECISION || packet->depths[lane] > CPU_MAX_DEPTH)) {
+                                lanes[remaining++] = lane;
+                        }
+                }
+                count = remaining;
+        }
+}
+
+// getSurfaceNormal() at every hit, all four samples of all lanes in one run
+static void
+packet_normals(struct cpu_scene const* const scene, struct tape const* const tape,
+               struct vec3 const* const points, uint count, struct vec3* const normals)
+{
+        float const epsilon = .0001f;
+        struct vec3 samples[4 * TAPE_LANES];
+        for (uint i = 0; i < count; i++) {
+                samples[4 * i] = points[i];
+                samples[4 * i + 1] = sub(points[i], vec3(epsilon, 0.f, 0.f));
+                samples[4 * i + 2] = sub(points[i], vec3(0.f, epsilon, 0.f));
+                samples[4 * i + 3] = sub(points[i], vec3(0.f, 0.f, epsilon));
+        }
+
+        float distances[4 * TAPE_LANES];
+        query(scene, tape, samples, 4 * count, 1.f, distances, NULL);
+
+        for (uint i = 0; i < count; i++) {
+                float const* d = &distances[4 * i];
+                normals[i] = normalize(vec3(d[0] - d[1], d[0] - d[2], d[0] - d[3]));
+        }
+}
+
+// softShadow() from every hit towards its light. Shadows and occlusion leave
+// the frustum, they evaluate the whole scene.
+static void
+packet_shadows(struct cpu_scene const* const scene, struct vec3 const* const points,
+               struct vec3 const* const lights, uint count, float mint, float maxt, float w,
+               float* const shadows)
+{
+        uint lanes[TAPE_LANES];
+        float t[TAPE_LANES], res[TAPE_LANES];
+        for (uint i = 0; i < count; i++) {
+                lanes[i] = i;
+                t[i] = mint;
+                res[i] = 1.f;
+        }
+
+        uint active = mint < maxt ? count : 0;
+        for (uint step = 0; step < CPU_SHADOW_STEPS && active; step++) {
+                struct vec3 samples[TAPE_LANES];
+                for (uint i = 0; i < active; i++) {
+                        samples[i] = add(points[lanes[i]], scale(lights[lanes[i]], t[lanes[i]]));
+                }
+
+                float distances[TAPE_LANES];
+                query(scene, &scene->tape, samples, active, 2.f, distances, NULL);
+
+                uint remaining = 0;
+                for (uint i = 0; i < active; i++) {
+                        uint lane = lanes[i];
+                        float h = distances[i];
+                        res[lane] = fminf(res[lane], h / (w * t[lane]));
+                        t[lane] += clamp(h, .005f, .5f);
+                        if (!(res[lane] < -1.f || t[lane] > maxt) && t[lane] < maxt) {
+                                lanes[remaining++] = lane;
+                        }
+                }
+                active = remaining;
+        }
+
+        for (uint i = 0; i < count; i++) {
+                float r = fmaxf(res[i], -1.f);
+                shadows[i] = .25f * (1.f + r) * (1.f + r) * (2.f - r);
+        }
+}
+
+// ambientOcclusion() at every hit, every sample of every lane in one run
+static void
+packet_occlusion(struct cpu_scene const* const scene, struct vec3 const* const points,
+                 struct vec3 const* const normals, uint count, float* const occlusions)
+{
+        struct vec3 samples[CPU_AO_SAMPLES * TAPE_LANES];
+        for (uint i = 0; i < count; i++) {
+                for (uint sample = 0; sample < CPU_AO_SAMPLES; sample++) {
+                        float len = .01f + .02f * (float)(sample * sample);
+                        samples[i * CPU_AO_SAMPLES + sample] = add(points[i], scale(normals[i], len));
+                }
+        }
+
+        float distances[CPU_AO_SAMPLES * TAPE_LANES];
+        query(scene, &scene->tape, samples, count * CPU_AO_SAMPLES, 4.f, distances, NULL);
+
+        for (uint i = 0; i < count; i++) {
+                float occlusion = 0.f;
+                float weight = 1.f;
+                for (uint sample = 0; sample < CPU_AO_SAMPLES; sample++) {
+                        float len = .01f + .02f * (float)(sample * sample);
+                        occlusion += (len - distances[i * CPU_AO_SAMPLES + sample]) * weight;
+                        weight *= .85f;
+                }
+                occlusions[i] = 1.f - clamp(.6f * occlusion, 0.f, 1.f);
+        }
+}
+
+// =========================================================================================================
+// Lighting
+// =========================================================================================================
+
+static struct vec3
+phong_light(struct vec3 normal, struct vec3 direction, struct material const* const material,
+            struct vec3 light, float shadow, float occlusion)
+{
+        struct vec3 ambient = scale(material->ambient, .6f);
+
+        float dot_ln = clamp(dot(light, normal), 0.f, 1.f);
+        struct vec3 diffuse = scale(material->diffuse, .5f * dot_ln);
+
+        struct vec3 reflected = sub(light, scale(normal, 2.f * dot(normal, light)));
+        float dot_rv = clamp(dot(reflected, direction), 0.f, 1.f);
+        struct vec3 specular = scale(material->specular, .6f * powf(dot_rv, material->alpha));
+
+        shadow = clamp(shadow, 0.f, 1.f);
+
+        struct vec3 reflect_back = scale(material->ambient, .05f * dot_ln);
+
+        return add(scale(add(reflect_back, ambient), occlusion),
+                   scale(add(scale(specular, occlusion), diffuse), shadow));
+}
+
+// render() for a packet. The normal and the occlusion are the same for both
+// lights, so are found once.
+static void
+shade_packet(struct cpu_scene const* const scene, struct tape const* const slabs,
+             struct packet const* const packet, struct vec3* const colors)
+{
+        struct vec3 const background = vec3(.3f, .5f, .9f);
+        struct vec3 origin = load(scene->origin);
+
+        // The hits, packed
+        uint hits[TAPE_LANES], slab_lanes[TAPE_LANES], count = 0;
+        struct vec3 points[TAPE_LANES];
+        for (uint lane = 0; lane < packet->count; lane++) {
+                struct vec3 direction = packet->directions[lane];
+                float depth = packet->depths[lane];
+                if (depth < CPU_MAX_DEPTH) {
+                        points[count] = add(origin, scale(direction, depth));
+                        slab_lanes[count] = follow_slab(packet->slabs[lane], depth);
+                        hits[count++] = lane;
+                } else {
+                        float sky = fmaxf(.9f * direction.y, 0.f);
+                        colors[lane] = sub(background, vec3(sky, sky, sky));
+                }
+        }
+        if (!count) {
+                return;
+        }
+
+        uint order[TAPE_LANES];
+        for (uint i = 0; i < count; i++) {
+                order[i] = i;
+        }
+        struct tape const* tape = &scene->tape;
+        if (slab_lanes[0] < TILE_SLABS) {
+                tape = packet_tape(scene, slabs, order, slab_lanes, count);
+        }
+
+        struct vec3 normals[TAPE_LANES];
+        packet_normals(scene, tape, points, count, normals);
+
+        float occlusions[TAPE_LANES];
+        packet_occlusion(scene, points, normals, count, occlusions);
+
+        struct vec3 light_positions[2] = {
+                vec3(sinf(scene->time * 3.f) + 1.f, 5.f, cosf(scene->time * 3.f)),
+                vec3(5.f, 3.f, -3.f)
+        };
+        float const intensities[2] = { .9f, .7f };
+
+        struct vec3 lights[2][TAPE_LANES];
+        float shadows[2][TAPE_LANES];
+        for (uint light = 0; light < 2; light++) {
+                for (uint i = 0; i < count; i++) {
+                        lights[light][i] = normalize(sub(light_positions[light], points[i]));
+                }
+                packet_shadows(scene, points, lights[light], count, .02f, 5.f, CPU_SHADOW_SOFTNESS,
+                               shadows[light]);
+        }
+
+        for (uint i = 0; i < count; i++) {
+                uint lane = hits[i];
+                struct vec3 direction = packet->directions[lane];
+                struct material material = surface_material(packet->materials[lane], points[i]);
+
+                struct vec3 light = vec3(0.f, 0.f, 0.f);
+                for (uint l = 0; l < 2; l++) {
+                        struct vec3 color = phong_light(normals[i], direction, &material, lights[l][i],
+                                                        shadows[l][i], occlusions[i]);
+                        light = l ? add(light, scale(color, intensities[l])) : scale(color, intensities[l]);
+                }
+
+                float depth = packet->depths[lane];
+                float fog = 1.f - expf(-.001f * depth * depth);
+                colors[lane] = add(scale(light, 1.f - fog), scale(background, fog));
+        }
+}
+
+static uchar
+quantize(float value)
+{
+        return (uchar)(clamp(powf(value, .4545f), 0.f, 1.f) * 255.f + .5f);
+}
+
+// Image plane coordinate of a pixel centre, rows go down and gl_FragCoord
+// goes up
+static float
+image_u(struct cpu_scene const* const scene, int column)
+{
+        return (2.f * ((float)column + .5f) - (float)scene->size[0]) / (float)scene->size[1];
+}
+
+static float
+image_v(struct cpu_scene const* const scene, int row)
+{
+        return (2.f * ((float)(scene->size[1] - 1 - row) + .5f) - (float)scene->size[1]) /
+               (float)scene->size[1];
+}
+
+void
+render_cpu_pixels(struct cpu_scene const* const scene, int x, int y, int width, int height,
+                  uchar* const image)
+{
+        struct tape slabs[TILE_SLABS];
+        if (scene->prune) {
+                float u[2] = { image_u(scene, x), image_u(scene, x + width - 1) };
+                float v[2] = { image_v(scene, y + height - 1), image_v(scene, y) };
+                prune_slabs(scene, u, v, slabs);
+        }
+
+        struct vec3 right = load(scene->right), up = load(scene->up);
+        struct vec3 forward = scale(load(scene->forward), scene->focal_length);
+
+        // Runs of a row
+        for (int row = y; row < y + height; row++) {
+                float v = image_v(scene, row);
+
+                for (int column = x; column < x + width; column += TAPE_LANES) {
+                        struct packet packet;
+                        packet.count = (uint)(x + width - column < TAPE_LANES ? x + width - column : TAPE_LANES);
+                        for (uint lane = 0; lane < packet.count; lane++) {
+                                float u = image_u(scene, column + (int)lane);
+                                packet.directions[lane] = normalize(add(add(scale(right, u), scale(up, v)),
+                                                                        forward));
+                        }
+
+                        march_packet(scene, scene->prune ? slabs : NULL, &packet);
+
+                        struct vec3 colors[TAPE_LANES];
+                        shade_packet(scene, scene->prune ? slabs : NULL, &packet, colors);
+
+                        uchar* pixel = image + ((long)row * scene->size[0] + column) * 3;
+                        for (uint lane = 0; lane < packet.count; lane++, pixel += 3) {
+                                pixel[0] = quantize(colors[lane].x);
+                                pixel[1] = quantize(colors[lane].y);
+                                pixel[2] = quantize(colors[lane].z);
+                        }
+                }
+        }
+}
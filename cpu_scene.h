@@ -0,0 +1,57 @@
+#ifndef CPU_SCENE_H
+#define CPU_SCENE_H
+
+#include "tape.h"
+
+// The scene of shaders/fragment_shader.glsl traced on the CPU: the gold
+// sphere over the checkerboard or the fBM terrain, the same two lights with
+// marched soft shadows and ambient occlusion, at the settings of the high
+// preset. Every object is sphere traced, as the shader does without
+// dedicated marchers, so the cost of a pixel spans the same range: the sky
+// leaves at once, grazing hits on the ground and penumbrae run to the step
+// limits.
+#define CPU_MAX_MARCHING_STEPS  200
+#define CPU_PRECISION           .005f
+#define CPU_MAX_DEPTH           50.f
+#define CPU_SHADOW_STEPS        256
+#define CPU_SHADOW_SOFTNESS     .3f
+#define CPU_AO_SAMPLES          8
+#define CPU_FBM_OCTAVES         5
+
+// The view frustum of every tile is cut into this many slabs of depth, each
+// marched with its own pruned tree
+#define TILE_SLABS              16
+
+struct cpu_scene {
+        // Camera basis, as struct view builds it without the mouse look
+        float   origin[3];
+        float   right[3];
+        float   up[3];
+        float   forward[3];
+        float   focal_length;
+
+        float   time;
+        int     terrain;
+        int     size[2];
+        float   pixel_angle;    // for the noise LOD
+
+        struct sdf_tree tree;
+        struct tape     tape;
+        int             prune;
+
+        // Runs in place of the tape of the whole tree when set, see sdfc.c
+        native_scene_function native;
+};
+
+// The sphere over the plane, or the terrain, without a tree of its own
+void    setup_cpu_scene(struct cpu_scene* const scene, float const* const camera, float time,
+                        int terrain, struct sdf_tree const* const tree, int const* const size);
+
+// Pixels of the rectangle, into an RGB image of the scene size stored top
+// row first, in packets of TAPE_LANES rays. With prune set, the rays of the
+// rectangle march tapes without the operations whose outcome is already
+// known in their slab of the frustum, found with interval arithmetic.
+void    render_cpu_pixels(struct cpu_scene const* const scene, int x, int y, int width,
+                          int height, unsigned char* const image);
+
+#endif
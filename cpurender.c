@@ -0,0 +1,162 @@
+// Renders frames of the scene on the CPU, see cpu_scene.h, with the work
+// stealing tile scheduler of tiles.h, and writes the last one as a PPM.
+//
+//     cpurender [-w workers] [-f frames] [-s WxH] [-T] [-U] [-S scene | -N] [out.ppm]
+//
+// Every frame advances the scene time by 1/60 s. The first is split into
+// TILE_SIZE tiles only, the next ones after the costs measured in the frame
+// before. -T renders the fBM terrain instead of the plane, -U marches the
+// whole scene tree in every tile instead of the pruned ones. -S renders the
+// scene file instead, see load_sdf_tree() in tape.h, and -N the one built in
+// as C with make cpurender SCENE=<scene>. For every frame
+// it prints the time, the tiles after splitting, the steals and the balance,
+// the busiest worker over the mean.
+#include "cpu_scene.h"
+#include "scene_emit.h"
+#include "tiles.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef unsigned int            uint;
+typedef unsigned char           uchar;
+
+#define DEFAULT_FRAMES          8
+#define DEFAULT_WIDTH           1280
+#define DEFAULT_HEIGHT          720
+#define FRAME_TIME              (1.f / 60.f)
+
+static float const camera[3] = { 0.f, 1.f, 3.f };
+
+struct frame {
+        struct cpu_scene        scene;
+        uchar*                  image;
+};
+
+static double
+now(void)
+{
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static void
+render_tile(void* context, struct tile const* tile)
+{
+        struct frame const* frame = context;
+        render_cpu_pixels(&frame->scene, tile->x, tile->y, tile->width, tile->height, frame->image);
+}
+
+static void
+write_image(char const* const path, uchar const* const image, int const* const size)
+{
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+
+        fprintf(file, "P6\n%d %d\n255\n", size[0], size[1]);
+        size_t length = (size_t)size[0] * (size_t)size[1] * 3;
+        if (fwrite(image, 1, length, file) != length || fclose(file)) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+}
+
+int
+main(int argc, char** argv)
+{
+        long workers = 0, frames = DEFAULT_FRAMES;
+        int size[2] = { DEFAULT_WIDTH, DEFAULT_HEIGHT };
+        int terrain = 0, prune = 1;
+        char const* scene = NULL;
+        int native = 0;
+        int option, usage = 0;
+
+        while ((option = getopt(argc, argv, "w:f:s:TUS:N")) != -1) {
+                if (option == 'w') {
+                        workers = strtol(optarg, NULL, 10);
+                } else if (option == 'f') {
+                        frames = strtol(optarg, NULL, 10);
+                } else if (option == 's') {
+                        usage |= sscanf(optarg, "%dx%d", &size[0], &size[1]) != 2;
+                } else if (option == 'T') {
+                        terrain = 1;
+                } else if (option == 'U') {
+                        prune = 0;
+                } else if (option == 'S') {
+                        scene = optarg;
+                } else if (option == 'N') {
+                        native = 1;
+                } else {
+                        usage = 1;
+                }
+        }
+
+        if (usage || argc - optind > 1 || workers < 0 || workers > MAX_TILE_WORKERS ||
+            frames < 1 || size[0] < 1 || size[1] < 1 || (scene && native)) {
+                fprintf(stderr, "Usage: %s [-w workers] [-f frames] [-s WxH] [-T] [-U] "
+                        "[-S scene | -N] [out.ppm]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        struct sdf_tree tree;
+        if (scene) {
+                load_sdf_tree(&tree, scene);
+        } else if (native) {
+#ifdef NATIVE_SCENE
+                tree = native_tree;
+#else
+                fprintf(stderr, "ERROR: Built without a native scene, see SCENE in the Makefile\n");
+                return EXIT_FAILURE;
+#endif
+        }
+
+        struct frame frame;
+        frame.image = malloc((size_t)size[0] * (size_t)size[1] * 3);
+        if (!frame.image) {
+                fprintf(stderr, "ERROR: Out of memory\n");
+                return EXIT_FAILURE;
+        }
+
+        struct tile_scheduler scheduler;
+        create_tile_scheduler(&scheduler, size, (uint)workers, render_tile, &frame);
+        printf("%dx%d, %u workers on %u NUMA nodes\n", size[0], size[1], scheduler.worker_count,
+               scheduler.nodes);
+
+        double total = 0.;
+        for (long i = 0; i < frames; i++) {
+                setup_cpu_scene(&frame.scene, camera, (float)i * FRAME_TIME, terrain,
+                                scene || native ? &tree : NULL, size);
+                frame.scene.prune = prune;
+#ifdef NATIVE_SCENE
+                frame.scene.native = native ? native_scene : NULL;
+#endif
+
+                struct tile_stats stats;
+                double start = now();
+                render_tiles(&scheduler, &stats);
+                double seconds = now() - start;
+                total += seconds;
+
+                double mean = stats.busy / (double)scheduler.worker_count;
+                printf("Frame %ld: %.2f ms, %u tiles, %u splits, %u steals, balance %.2f\n", i,
+                       seconds * 1e3, stats.tiles, stats.splits, stats.steals,
+                       mean > 0. ? stats.slowest / mean : 1.);
+        }
+        printf("%.2f ms per frame\n", total * 1e3 / (double)frames);
+
+        delete_tile_scheduler(&scheduler);
+
+        if (argc - optind == 1) {
+                write_image(argv[optind], frame.image, size);
+        }
+        free(frame.image);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+#include "grid.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned int            uint;
+
+static void*
+allocate(size_t size)
+{
+        void* memory = malloc(size);
+        if (!memory) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the primitive grid\n");
+                exit(EXIT_FAILURE);
+        }
+
+        return memory;
+}
+
+// Range of cells overlapped by the bounds of a primitive
+static void
+cell_range(struct grid_header const* const header, struct primitive const* const primitive,
+           int* const first, int* const last)
+{
+        float min[3], max[3];
+        primitive_bounds(primitive, min, max);
+
+        for (uint axis = 0; axis < 3; axis++) {
+                int lo = (int)floorf((min[axis] - header->min[axis]) / header->cell_size[axis]);
+                int hi = (int)floorf((max[axis] - header->min[axis]) / header->cell_size[axis]);
+
+                first[axis] = lo < 0 ? 0 : lo >= header->dims[axis] ? header->dims[axis] - 1 : lo;
+                last[axis] = hi < 0 ? 0 : hi >= header->dims[axis] ? header->dims[axis] - 1 : hi;
+        }
+}
+
+static uint
+cell_index(struct grid_header const* const header, int x, int y, int z)
+{
+        return (uint)((z * header->dims[1] + y) * header->dims[0] + x);
+}
+
+void
+build_grid(struct grid* const grid, struct primitive const* const primitives, uint count)
+{
+        struct grid_header* header = &grid->header;
+        memset(header, 0, sizeof(*header));
+
+        // Bounds of all primitives
+        float min[3] = { INFINITY, INFINITY, INFINITY };
+        float max[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+        for (uint i = 0; i < count; i++) {
+                float lo[3], hi[3];
+                primitive_bounds(&primitives[i], lo, hi);
+
+                for (uint axis = 0; axis < 3; axis++) {
+                        min[axis] = fminf(min[axis], lo[axis]);
+                        max[axis] = fmaxf(max[axis], hi[axis]);
+                }
+        }
+
+        // Cubic cells sized for GRID_PRIMITIVES_PER_CELL on average, then
+        // stretched so a whole number of them covers each axis
+        double volume = 1.0;
+        for (uint axis = 0; axis < 3; axis++) {
+                if (!count || max[axis] - min[axis] < 1e-4f) {
+                        min[axis] = count ? min[axis] - 5e-5f : 0.0f;
+                        max[axis] = min[axis] + 1e-4f;
+                }
+                volume *= max[axis] - min[axis];
+        }
+
+        double cell = cbrt(volume * GRID_PRIMITIVES_PER_CELL / (count ? count : 1));
+
+        for (uint axis = 0; axis < 3; axis++) {
+                double extent = max[axis] - min[axis];
+                double dims = ceil(extent / cell);
+
+                header->dims[axis] = dims < 1 ? 1 : dims > MAX_GRID_RESOLUTION ? MAX_GRID_RESOLUTION : (int)dims;
+                header->min[axis] = min[axis];
+                header->cell_size[axis] = (float)(extent / header->dims[axis]);
+        }
+
+        grid->cell_count = (uint)(header->dims[0] * header->dims[1] * header->dims[2]);
+        grid->cell_offsets = allocate(sizeof(*grid->cell_offsets) * (grid->cell_count + 1));
+        memset(grid->cell_offsets, 0, sizeof(*grid->cell_offsets) * (grid->cell_count + 1));
+
+        // Count the primitives of every cell, shifted by one for the prefix sum
+        int first[3], last[3];
+
+        for (uint i = 0; i < count; i++) {
+                cell_range(header, &primitives[i], first, last);
+
+                for (int z = first[2]; z <= last[2]; z++)
+                        for (int y = first[1]; y <= last[1]; y++)
+                                for (int x = first[0]; x <= last[0]; x++)
+                                        grid->cell_offsets[cell_index(header, x, y, z) + 1]++;
+        }
+
+        for (uint i = 0; i < grid->cell_count; i++) {
+                grid->cell_offsets[i + 1] += grid->cell_offsets[i];
+        }
+
+        grid->index_count = grid->cell_offsets[grid->cell_count];
+        grid->indices = allocate(sizeof(*grid->indices) * (grid->index_count ? grid->index_count : 1));
+
+        // Fill the cells, advancing a cursor per cell
+        uint* cursors = allocate(sizeof(*cursors) * grid->cell_count);
+        memcpy(cursors, grid->cell_offsets, sizeof(*cursors) * grid->cell_count);
+
+        for (uint i = 0; i < count; i++) {
+                cell_range(header, &primitives[i], first, last);
+
+                for (int z = first[2]; z <= last[2]; z++)
+                        for (int y = first[1]; y <= last[1]; y++)
+                                for (int x = first[0]; x <= last[0]; x++)
+                                        grid->indices[cursors[cell_index(header, x, y, z)]++] = i;
+        }
+
+        free(cursors);
+}
+
+void
+upload_grid(GLuint const* const buffers, struct grid const* const grid)
+{
+        GLsizeiptr offsets_size = (GLsizeiptr)(sizeof(*grid->cell_offsets) * (grid->cell_count + 1));
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)sizeof(grid->header) + offsets_size,
+                     NULL, GL_STATIC_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(grid->header), &grid->header);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(grid->header), offsets_size,
+                        grid->cell_offsets);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GRID_CELLS_BINDING, buffers[0]);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     (GLsizeiptr)(sizeof(*grid->indices) * (grid->index_count ? grid->index_count : 1)),
+                     grid->indices, GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GRID_INDICES_BINDING, buffers[1]);
+}
+
+void
+free_grid(struct grid* const grid)
+{
+        free(grid->cell_offsets);
+        free(grid->indices);
+
+        grid->cell_offsets = NULL;
+        grid->indices = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "primitives.h"
+
+// Average number of primitives per cell the resolution is chosen for
+#define GRID_PRIMITIVES_PER_CELL        2
+#define MAX_GRID_RESOLUTION             1024
+
+// Header of the cells buffer, laid out as std430 vec4, vec4, ivec4
+struct grid_header {
+        float   min[4];
+        float   cell_size[4];
+        int     dims[4];
+};
+
+// Uniform grid of primitive indices. Cell i lists
+// indices[cell_offsets[i]] .. indices[cell_offsets[i + 1] - 1], and every
+// primitive is listed in each cell its bounds overlap.
+struct grid {
+        struct grid_header      header;
+        unsigned int*           cell_offsets;
+        unsigned int*           indices;
+        unsigned int            cell_count;
+        unsigned int            index_count;
+};
+
+void    build_grid(struct grid* const grid, struct primitive const* const primitives,
+                   unsigned int count);
+void    upload_grid(GLuint const* const buffers, struct grid const* const grid);
+void    free_grid(struct grid* const grid);
+
+#endif
@@ -0,0 +1,97 @@
+#include "history.h"
+
+#include <stddef.h>
+
+typedef unsigned int            uint;
+
+void
+create_depth_history(struct depth_history* const history)
+{
+        glGenTextures(2, history->textures);
+        glGenBuffers(1, &history->buffer);
+
+        history->current = 0;
+        history->size[0] = 0;
+        history->size[1] = 0;
+        history->layers = 0;
+        history->frame = 0;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, history->buffer);
+        glBufferData(GL_UNIFORM_BUFFER, HISTORY_VIEWS_OFFSET + sizeof(struct view) * MAX_VIEWS, NULL,
+                     GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, HISTORY_BINDING, history->buffer);
+}
+
+void
+resize_depth_history(struct depth_history* const history, int const* const size, uint layers)
+{
+        if (size[0] == history->size[0] && size[1] == history->size[1] &&
+            layers == history->layers) {
+                return;
+        }
+        history->size[0] = size[0];
+        history->size[1] = size[1];
+        history->layers = layers;
+
+        // Immutable storage, so a new size needs new textures
+        glDeleteTextures(2, history->textures);
+        glGenTextures(2, history->textures);
+
+        for (uint i = 0; i < 2; i++) {
+                glBindTexture(GL_TEXTURE_2D_ARRAY, history->textures[i]);
+                glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32F, size[0] < 1 ? 1 : size[0],
+                               size[1] < 1 ? 1 : size[1], (GLsizei)layers);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        clear_depth_history(history);
+}
+
+// No distance is known, every ray of the next frame marches from its start.
+// For new targets, and when what the last frame drew no longer holds.
+void
+clear_depth_history(struct depth_history* const history)
+{
+        if (!history->layers) {
+                return;
+        }
+
+        float const unknown = 0.f;
+        for (uint i = 0; i < 2; i++) {
+                glClearTexImage(history->textures[i], 0, GL_RED, GL_FLOAT, &unknown);
+        }
+}
+
+// The last frame to read, this one to write
+void
+bind_depth_history(struct depth_history const* const history)
+{
+        glBindImageTexture(HISTORY_IMAGE, history->textures[1 - history->current], 0, GL_TRUE, 0,
+                           GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(HISTORY_IMAGE + 1, history->textures[history->current], 0, GL_TRUE, 0,
+                           GL_WRITE_ONLY, GL_R32F);
+}
+
+// After the march pass, this frame becomes the last one with the views it
+// was drawn from
+void
+advance_depth_history(struct depth_history* const history, struct view const* const views,
+                      uint count)
+{
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        history->frame++;
+        glBindBuffer(GL_UNIFORM_BUFFER, history->buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(history->frame), &history->frame);
+        glBufferSubData(GL_UNIFORM_BUFFER, HISTORY_VIEWS_OFFSET, (GLsizeiptr)(sizeof(*views) * count),
+                        views);
+
+        history->current = 1 - history->current;
+}
+
+void
+delete_depth_history(struct depth_history* const history)
+{
+        glDeleteTextures(2, history->textures);
+        glDeleteBuffers(1, &history->buffer);
+}
@@ -0,0 +1,40 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "views.h"
+
+#include <glad/glad.h>
+
+// Hit distances of the primary rays, kept from one frame to the next. The
+// march pass reads those of the last frame, reprojected with the views that
+// drew them, to start every ray near its surface, and writes its own into
+// the other image. One layer per view, as the G-buffer.
+//
+// Matching the PreviousViews block and the images of
+// shaders/fragment_shader.glsl. The images are units of their own, apart
+// from the samplers. The block starts with the frame count, the views
+// follow at the next std140 vec4.
+#define HISTORY_BINDING         1
+#define HISTORY_IMAGE           0
+#define HISTORY_VIEWS_OFFSET    16
+
+// Render targets and the last views, GL objects of the render thread
+struct depth_history {
+        GLuint          textures[2];
+        GLuint          buffer;
+        unsigned int    current;        // written this frame
+        int             size[2];        // per layer, 0 until first resized
+        unsigned int    layers;
+        unsigned int    frame;          // advanced so far, picks the rays marched in full
+};
+
+void    create_depth_history(struct depth_history* const history);
+void    resize_depth_history(struct depth_history* const history, int const* const size,
+                             unsigned int layers);
+void    clear_depth_history(struct depth_history* const history);
+void    bind_depth_history(struct depth_history const* const history);
+void    advance_depth_history(struct depth_history* const history, struct view const* const views,
+                              unsigned int count);
+void    delete_depth_history(struct depth_history* const history);
+
+#endif
@@ -0,0 +1,36 @@
+#include "input.h"
+
+void
+init_input_buffer(struct input_buffer* const buffer, struct input_state const* state)
+{
+        for (unsigned int i = 0; i < 3; i++) {
+                buffer->slots[i] = *state;
+        }
+
+        buffer->front = 0;
+        buffer->back = 1;
+        atomic_init(&buffer->middle, 2);
+}
+
+void
+publish_input(struct input_buffer* const buffer, struct input_state const* state)
+{
+        buffer->slots[buffer->back] = *state;
+
+        // Release makes the slot contents visible with the index
+        unsigned int middle = atomic_exchange_explicit(&buffer->middle, buffer->back | INPUT_FRESH,
+                                                       memory_order_acq_rel);
+        buffer->back = middle & ~INPUT_FRESH;
+}
+
+struct input_state const*
+latest_input(struct input_buffer* const buffer)
+{
+        if (atomic_load_explicit(&buffer->middle, memory_order_relaxed) & INPUT_FRESH) {
+                unsigned int middle = atomic_exchange_explicit(&buffer->middle, buffer->front,
+                                                               memory_order_acq_rel);
+                buffer->front = middle & ~INPUT_FRESH;
+        }
+
+        return &buffer->slots[buffer->front];
+}
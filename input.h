@@ -0,0 +1,46 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdatomic.h>
+
+// Set in the middle slot index until the render thread picks it up
+#define INPUT_FRESH             4u
+
+// Everything the render thread takes from the event loop. Requests that must
+// not be lost between two frames are counters, the render thread acts when
+// one differs from the last value it saw.
+struct input_state {
+        float           camera[3];
+        float           mouse[2];
+        int             framebuffer[2];
+        unsigned int    quality;
+        int             antialiasing;
+        unsigned int    noise_hash;
+        unsigned int    instances;
+        unsigned int    views;
+        unsigned int    ao;
+        int             proxies;
+        int             depth_reuse;
+        unsigned int    reloads;
+        unsigned int    trace_dumps;
+        int             quit;
+};
+
+// Lock-free triple buffer. The event loop fills its back slot and swaps it
+// with the middle one, the render thread swaps its front slot with the middle
+// one when a newer state was published. Neither side ever waits on the other
+// and the render thread always reads the latest complete state.
+struct input_buffer {
+        struct input_state      slots[3];
+        atomic_uint             middle;
+        unsigned int            back;           // owned by the event loop
+        unsigned int            front;          // owned by the render thread
+};
+
+void                            init_input_buffer(struct input_buffer* const buffer,
+                                                  struct input_state const* state);
+void                            publish_input(struct input_buffer* const buffer,
+                                              struct input_state const* state);
+struct input_state const*       latest_input(struct input_buffer* const buffer);
+
+#endif
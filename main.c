@@ -1,12 +1,190 @@
 #include "main.h"
+#include "ao.h"
+#include "bvh.h"
+#include "grid.h"
+#include "history.h"
+#include "input.h"
+#include "noise.h"
+#include "replay.h"
+#include "scene_emit.h"
+#include "shader_pack.h"
+#include "stream.h"
+#include "trace.h"
+#include "tune.h"
+#include "views.h"
+#include "volume.h"
 
-// Cursor state
-double xMousePos = 0.f, yMousePos = 0.f;
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+// Input gathered by the event loop on the main thread, published to the
+// render thread after every batch of events
+struct input_state input = {
+        .camera = { 0.f, 1.f, 3.f },
+        .framebuffer = { (int)WIDTH, (int)HEIGHT },
+        .quality = DEFAULT_QUALITY,
+        .antialiasing = FALSE,
+        .noise_hash = NOISE_TEXTURE,
+        .instances = INSTANCES_OFF,
+        .views = VIEWS_SINGLE,
+        .ao = AO_MARCHED,
+        .depth_reuse = TRUE,
+};
 int inWindow = FALSE;
 
+// Where the mesh volume sits in the scene
+static float const volume_position[3] = { -2.5f, 0.f, 0.f };
+
+// Shaders are read from here instead of the pack when set, to edit them
+// without rebuilding
+char const* shader_dir = NULL;
+
+// Inputs of every frame are written to record_path, or read back from
+// replay_path instead of the window's, see replay.h
+char const* record_path = NULL;
+char const* replay_path = NULL;
+
+// Search the quality settings for this PSNR in dB instead of rendering
+double tune_threshold = 0.;
+
+// Set when a mesh volume was loaded, injected into every variant
+char volume_defines[MAX_DEFINES_LENGTH / 4] = "";
+
+// A scene file in place of the sphere and the ground, see emit_glsl_scene()
+char const* scene_path = NULL;
+char scene_defines[MAX_DEFINES_LENGTH / 2] = "";
+
+// Stack size of the BVH traversals, from the depth of the built tree
+char bvh_defines[32] = "";
+
+// Box around the volume, rasterized in place of the full screen quad for
+// the pixels it covers when proxy geometry is on
+char proxy_defines[MAX_DEFINES_LENGTH / 4] = "";
+float proxy_bounds[2][3];
+
+// Corners of the box by bit, x first, wound counter-clockwise from outside
+static uint const proxy_indices[36] = {
+        0, 4, 6, 0, 6, 2, 1, 3, 7, 1, 7, 5, 0, 1, 5, 0, 5, 4,
+        2, 6, 7, 2, 7, 3, 0, 2, 3, 0, 3, 1, 4, 5, 7, 4, 7, 6
+};
+
+static char const* const noise_hash_names[NOISE_HASHES] = {
+        "sin", "pcg", "texture"
+};
+
+static char const* const instance_names[INSTANCE_MODES] = {
+        "off", "grid", "bvh"
+};
+
+static char const* const instance_defines[INSTANCE_MODES] = {
+        "",
+        "#define INSTANCES\n#define INSTANCES_MARCHER MARCH_GRID\n",
+        "#define INSTANCES\n#define INSTANCES_MARCHER MARCH_BVH\n"
+};
+
+// Defines injected into the fragment shader for each quality preset, the
+// default one can be replaced by tuned settings
+static char const* const quality_names[QUALITY_PRESETS] = {
+        "low", "medium", "high", "ultra"
+};
+
+static char const* quality_defines[QUALITY_PRESETS] = {
+        "#define MAX_MARCHING_STEPS 64.\n"
+        "#define PRECISION .01\n"
+        "#define MAX_DEPTH 30.\n"
+        "#define SHADOW_STEPS 32\n"
+        "#define AO_SAMPLES 3\n"
+        "#define FBM_OCTAVES 3\n"
+        "#define HEIGHTFIELD_STEPS 48\n",
+
+        "#define MAX_MARCHING_STEPS 128.\n"
+        "#define PRECISION .0075\n"
+        "#define MAX_DEPTH 40.\n"
+        "#define SHADOW_STEPS 96\n"
+        "#define AO_SAMPLES 5\n"
+        "#define FBM_OCTAVES 4\n"
+        "#define HEIGHTFIELD_STEPS 96\n",
+
+        "#define MAX_MARCHING_STEPS 200.\n"
+        "#define PRECISION .005\n"
+        "#define MAX_DEPTH 50.\n"
+        "#define SHADOW_STEPS 256\n"
+        "#define AO_SAMPLES 8\n"
+        "#define FBM_OCTAVES 5\n"
+        "#define HEIGHTFIELD_STEPS 128\n",
+
+        "#define MAX_MARCHING_STEPS 400.\n"
+        "#define PRECISION .001\n"
+        "#define MAX_DEPTH 100.\n"
+        "#define SHADOW_STEPS 512\n"
+        "#define AO_SAMPLES 12\n"
+        "#define FBM_OCTAVES 7\n"
+        "#define HEIGHTFIELD_STEPS 256\n"
+};
+
 int
-main(void)
+main(int argc, char** argv)
 {
+        int option, usage = FALSE, hidden = FALSE;
+
+        while ((option = getopt(argc, argv, "s:S:r:p:Ht:q:")) != -1) {
+                if (option == 's') {
+                        shader_dir = optarg;
+                } else if (option == 'S') {
+                        scene_path = optarg;
+                } else if (option == 'r') {
+                        record_path = optarg;
+                } else if (option == 'p') {
+                        replay_path = optarg;
+                } else if (option == 'H') {
+                        hidden = TRUE;
+                } else if (option == 't') {
+                        tune_threshold = strtod(optarg, NULL);
+                        usage |= tune_threshold <= 0.;
+                } else if (option == 'q') {
+                        quality_defines[DEFAULT_QUALITY] = load_tuned(optarg);
+                        printf("Quality preset %s: %s\n", quality_names[DEFAULT_QUALITY], optarg);
+                } else {
+                        usage = TRUE;
+                }
+        }
+
+        if (usage || argc - optind > 1 || (record_path && replay_path) ||
+            (record_path && tune_threshold > 0.)) {
+                fprintf(stderr, "Usage: %s [-s shader_dir] [-S scene] [-q tuned.glsl] "
+                        "[-r recording | -p recording] [-t psnr] [-H] [volume.sdf|volume.sdfb]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        char const* volume_path = argc - optind == 1 ? argv[optind] : NULL;
+
+        // The scene file becomes a macro of the shaders, checked before any
+        // window opens
+        if (scene_path) {
+                struct sdf_tree tree;
+                load_sdf_tree(&tree, scene_path);
+
+                char* text;
+                size_t length;
+                FILE* stream = open_memstream(&text, &length);
+                if (!stream) {
+                        die("Could not emit the scene");
+                }
+                emit_glsl_scene(stream, &tree);
+                fclose(stream);
+
+                if (length >= sizeof(scene_defines)) {
+                        die("The scene is too large for the shaders");
+                }
+                memcpy(scene_defines, text, length + 1);
+                free(text);
+
+                printf("Scene: %s, %u nodes\n", scene_path, tree.count);
+        }
+
         if (!glfwInit()) {
                 die("Could not initialize GLFW");
         }
@@ -14,6 +192,7 @@ main(void)
         glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, MAJOR_VERS);
         glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, MINOR_VERS);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, hidden ? GLFW_FALSE : GLFW_TRUE);
 
         GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, TITLE, NULL, NULL);
 
@@ -22,13 +201,6 @@ main(void)
                 die("Failed to create GLFW window");
         }
 
-        glfwMakeContextCurrent(window);
-
-        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-                die("Failed to initialize GLAD");
-        }
-
-        glViewport(0, 0, WIDTH, HEIGHT);
         glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
         // Mouse
@@ -36,6 +208,66 @@ main(void)
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
         glfwSetCursorEnterCallback(window, cursor_enter_callback);
 
+        // Keyboard
+        glfwSetKeyCallback(window, key_callback);
+
+        trace_thread_name("events");
+
+        struct input_buffer inputs;
+        init_input_buffer(&inputs, &input);
+
+        struct renderer renderer = { window, &inputs, volume_path };
+        pthread_t render_thread;
+        if (pthread_create(&render_thread, NULL, render, &renderer)) {
+                die("Could not start the render thread");
+        }
+
+        // Event loop. Held movement keys need steady updates, otherwise the
+        // thread sleeps until something happens.
+        double last_time = glfwGetTime();
+        int moving = FALSE;
+
+        while (!glfwWindowShouldClose(window)) {
+                glfwWaitEventsTimeout(moving ? INPUT_INTERVAL : IDLE_INTERVAL);
+
+                double time = glfwGetTime();
+                moving = move_camera(window, (float)(time - last_time));
+                last_time = time;
+
+                publish_input(&inputs, &input);
+        }
+
+        input.quit = TRUE;
+        publish_input(&inputs, &input);
+        pthread_join(render_thread, NULL);
+
+        trace_shutdown();
+        glfwTerminate();
+
+        return EXIT_SUCCESS;
+}
+
+// Owns the GL context from the first GL call to the last, so a slow frame
+// never holds up event handling on the main thread
+void*
+render(void* argument)
+{
+        struct renderer const* renderer = argument;
+        struct input_buffer* inputs = renderer->inputs;
+        char const* volume_path = renderer->volume_path;
+
+        trace_thread_name("render");
+
+        glfwMakeContextCurrent(renderer->window);
+
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+                die("Failed to initialize GLAD");
+        }
+
+        trace_gpu_init();
+
+        glViewport(0, 0, WIDTH, HEIGHT);
+
         float vertices[] = {
                 1.0f,  1.0f,  0.0f, // top right
                 1.0f,  -1.0f, 0.0f, // bottom right
@@ -75,80 +307,637 @@ main(void)
 
         glBindVertexArray(0);
 
-        // Shader program
-        GLuint shader_program = glCreateProgram();
-        compile_shaders(&shader_program);
+        // Noise lookup textures, bound for the lifetime of the window
+        GLuint noise_textures[2];
+        trace_begin("create_noise_textures");
+        create_noise_textures(noise_textures);
+        trace_end();
+
+        // Instanced primitives and the grid and BVH that accelerate them
+        struct primitive* primitives = malloc(sizeof(*primitives) * INSTANCE_COUNT);
+        struct primitive* rest_primitives = malloc(sizeof(*primitives) * INSTANCE_ANIMATED);
+        if (!primitives || !rest_primitives) {
+                die("Could not alocate memory for the instanced primitives");
+        }
+        scatter_primitives(primitives, INSTANCE_COUNT);
+        memcpy(rest_primitives, primitives, sizeof(*primitives) * INSTANCE_ANIMATED);
+
+        GLuint instance_buffers[5];
+        glGenBuffers(5, instance_buffers);
+        upload_primitives(instance_buffers[0], primitives, INSTANCE_COUNT);
+
+        struct grid grid;
+        trace_begin("build_grid");
+        build_grid(&grid, primitives, INSTANCE_COUNT);
+        trace_end();
+        upload_grid(&instance_buffers[1], &grid);
+        free_grid(&grid);
+
+        struct bvh bvh;
+        trace_begin("build_bvh");
+        build_bvh(&bvh, primitives, INSTANCE_COUNT);
+        trace_end();
+        if (bvh.depth > MAX_BVH_STACK_SIZE) {
+                die("The BVH is deeper than MAX_BVH_STACK_SIZE");
+        }
+        snprintf(bvh_defines, sizeof(bvh_defines), "#define BVH_STACK_SIZE %u\n",
+                 bvh.depth ? bvh.depth : 1);
+        upload_bvh(&instance_buffers[3], &bvh);
+
+        // Mesh distance volume written by mesh2sdf. Whole volumes go from the
+        // mapped file straight to the driver and the mapping is dropped after,
+        // bricked ones are streamed around the camera.
+        GLuint volume_texture = 0;
+        int streaming = FALSE;
+        struct brick_stream stream;
+
+        if (volume_path && is_brick_file(volume_path)) {
+                open_brick_stream(&stream, volume_path);
+                streaming = TRUE;
+
+                struct brick_header const* header = &stream.header;
+                snprintf(volume_defines, sizeof(volume_defines),
+                         "#define VOLUME_BRICKS\n"
+                         "#define VOLUME_POSITION vec3(%.9g, %.9g, %.9g)\n"
+                         "#define BRICKS_MIN vec3(%.9g, %.9g, %.9g)\n"
+                         "#define BRICKS_VOXEL_SIZE %.9g\n"
+                         "#define BRICKS_COUNTS ivec3(%u, %u, %u)\n"
+                         "#define BRICK_SIZE %u\n"
+                         "#define ATLAS_SLOTS %u\n",
+                         (double)volume_position[0], (double)volume_position[1],
+                         (double)volume_position[2], (double)header->min[0], (double)header->min[1],
+                         (double)header->min[2], (double)header->voxel_size, header->counts[0],
+                         header->counts[1], header->counts[2], BRICK_SIZE, ATLAS_SLOTS);
+
+                for (uint axis = 0; axis < 3; axis++) {
+                        proxy_bounds[0][axis] = volume_position[axis] + header->min[axis];
+                        proxy_bounds[1][axis] = proxy_bounds[0][axis] + header->voxel_size *
+                                (float)(header->counts[axis] * BRICK_SIZE);
+                }
+
+                printf("Volume: %s, %ux%ux%u bricks streamed\n", volume_path, header->counts[0],
+                       header->counts[1], header->counts[2]);
+        } else if (volume_path) {
+                struct volume volume;
+                map_volume(&volume, volume_path);
+                create_volume_texture(&volume_texture, &volume);
+
+                struct volume_header const* header = volume.header;
+                snprintf(volume_defines, sizeof(volume_defines),
+                         "#define VOLUME\n"
+                         "#define VOLUME_POSITION vec3(%.9g, %.9g, %.9g)\n"
+                         "#define VOLUME_MIN vec3(%.9g, %.9g, %.9g)\n"
+                         "#define VOLUME_VOXEL_SIZE %.9g\n"
+                         "#define VOLUME_DIMS vec3(%u., %u., %u.)\n",
+                         (double)volume_position[0], (double)volume_position[1],
+                         (double)volume_position[2], (double)header->min[0], (double)header->min[1],
+                         (double)header->min[2], (double)header->voxel_size, header->dims[0],
+                         header->dims[1], header->dims[2]);
+
+                for (uint axis = 0; axis < 3; axis++) {
+                        proxy_bounds[0][axis] = volume_position[axis] + header->min[axis];
+                        proxy_bounds[1][axis] = proxy_bounds[0][axis] + header->voxel_size *
+                                (float)(header->dims[axis] - 1);
+                }
+
+                printf("Volume: %s, %ux%ux%u samples\n", volume_path, header->dims[0], header->dims[1],
+                       header->dims[2]);
+                unmap_volume(&volume);
+        }
+
+        // Proxy box of the volume
+        GLuint proxy_VAO = 0, proxy_buffers[2] = { 0, 0 };
+
+        if (volume_path) {
+                snprintf(proxy_defines, sizeof(proxy_defines),
+                         "#define PROXY_GEOMETRY\n"
+                         "#define PROXY_MIN vec3(%.9g, %.9g, %.9g)\n"
+                         "#define PROXY_MAX vec3(%.9g, %.9g, %.9g)\n",
+                         (double)proxy_bounds[0][0], (double)proxy_bounds[0][1],
+                         (double)proxy_bounds[0][2], (double)proxy_bounds[1][0],
+                         (double)proxy_bounds[1][1], (double)proxy_bounds[1][2]);
+
+                float corners[8][3];
+                for (uint corner = 0; corner < 8; corner++) {
+                        for (uint axis = 0; axis < 3; axis++) {
+                                corners[corner][axis] = proxy_bounds[(corner >> axis) & 1][axis];
+                        }
+                }
+
+                glGenVertexArrays(1, &proxy_VAO);
+                glGenBuffers(2, proxy_buffers);
+                glBindVertexArray(proxy_VAO);
+
+                glBindBuffer(GL_ARRAY_BUFFER, proxy_buffers[0]);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, proxy_buffers[1]);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(proxy_indices), proxy_indices,
+                             GL_STATIC_DRAW);
+
+                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+                glEnableVertexAttribArray(0);
+
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                glBindVertexArray(0);
+        }
+
+        struct input_state const* state = latest_input(inputs);
+
+        // Recorded inputs take the place of the window's, only quitting and
+        // trace dumps stay live. The first frame is read up front so the
+        // shaders are compiled for it.
+        struct replay replay = { 0 };
+        struct input_state replayed = *state;
+        double replay_time = 0.;
+        double replay_start = 0.;
+
+        if (record_path) {
+                open_recording(&replay, record_path);
+        } else if (replay_path) {
+                open_replay(&replay, replay_path);
+                if (!replay_frame(&replay, &replay_time, &replayed)) {
+                        die("The recording has no frames");
+                }
+                state = &replayed;
+        }
+
+        // Replays and tuning time frames as fast as they can be drawn, not at
+        // the refresh rate
+        int tuning = tune_threshold > 0.;
+        if (replay_path || tuning) {
+                glfwSwapInterval(0);
+        }
+
+        // Shader programs, one per quality preset and anti-aliasing toggle,
+        // and the same for the proxy pass
+        uint reloads = state->reloads;
+        uint trace_dumps = state->trace_dumps;
+        int framebuffer[2] = { state->framebuffer[0], state->framebuffer[1] };
+
+        GLuint shader_programs[SHADER_PROGRAMS];
+        compile_shaders(shader_programs, state);
+        GLuint present_program = compile_present_shader();
+        GLuint ao_program = compile_ao_shader(state);
+
+        // Cameras and the layered target for multi-view rendering
+        struct view_targets view_targets;
+        create_view_targets(&view_targets);
+
+        // G-buffer of the screen space AO
+        struct ao_targets ao_targets;
+        create_ao_targets(&ao_targets);
+
+        // Hit distances of the last frame, for the rays to start near
+        struct depth_history history;
+        create_depth_history(&history);
+
+        // Tuning takes the place of the render loop
+        if (tuning) {
+                tune_quality(state, replay_path ? &replay : NULL, replay_time, &view_targets, VAO);
+                glfwSetWindowShouldClose(renderer->window, TRUE);
+                glfwPostEmptyEvent();
+        }
 
         // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
         // Render loop
-        while (!glfwWindowShouldClose(window)) {
+        while (!state->quit && !tuning) {
+                trace_begin("frame");
+
                 // Input
-                process_input(window, &shader_program);
+                state = latest_input(inputs);
+                if (replay_path) {
+                        replayed.quit = state->quit;
+                        replayed.trace_dumps = state->trace_dumps;
+                        state = &replayed;
+                }
+
+                if (state->reloads != reloads) {
+                        TRACE_SCOPE("reload_shaders");
+                        reloads = state->reloads;
+
+                        for (uint i = 0; i < SHADER_PROGRAMS; i++) {
+                                glDeleteProgram(shader_programs[i]);
+                        }
+                        glDeleteProgram(present_program);
+                        glDeleteProgram(ao_program);
+
+                        compile_shaders(shader_programs, state);
+                        present_program = compile_present_shader();
+                        ao_program = compile_ao_shader(state);
+
+                        // The modes change what is drawn, and the views
+                        clear_depth_history(&history);
+                }
+
+                if (state->framebuffer[0] != framebuffer[0] ||
+                    state->framebuffer[1] != framebuffer[1]) {
+                        framebuffer[0] = state->framebuffer[0];
+                        framebuffer[1] = state->framebuffer[1];
+                        glViewport(0, 0, framebuffer[0], framebuffer[1]);
+                }
 
                 // Render
                 glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
                 glClear(GL_COLOR_BUFFER_BIT);
 
-                float time = glfwGetTime();
-                GLuint u_time_location = glGetUniformLocation(shader_program, UNIFORM_TIME);
-                GLuint u_resolution_location =
-                        glGetUniformLocation(shader_program, UNIFORM_RESOLUTION);
-                GLuint u_mouse_location =
-                        glGetUniformLocation(shader_program, UNIFORM_MOUSE);
+                GLuint shader_program = shader_programs[shader_variant(state)];
+
+                double frame_time = replay_path ? replay_time : glfwGetTime();
+                if (record_path) {
+                        record_frame(&replay, frame_time, state);
+                }
+                float time = (float)frame_time;
+
+                if (streaming) {
+                        TRACE_SCOPE("update_brick_stream");
+
+                        float camera[3];
+                        for (uint axis = 0; axis < 3; axis++) {
+                                camera[axis] = state->camera[axis] - volume_position[axis];
+                        }
+                        update_brick_stream(&stream, camera);
+                }
+
+                // Animate the pulsing primitives. The grid was built around
+                // their rest pose and stays valid, the BVH is refit.
+                if (state->instances != INSTANCES_OFF) {
+                        TRACE_SCOPE("animate_primitives");
+
+                        animate_primitives(primitives, rest_primitives, INSTANCE_ANIMATED, time);
+                        update_primitives(instance_buffers[0], primitives, INSTANCE_ANIMATED);
+
+                        if (state->instances == INSTANCES_BVH) {
+                                refit_bvh(&bvh, primitives, INSTANCE_ANIMATED);
+                                update_bvh(&instance_buffers[3], &bvh);
+                        }
+                }
+
+                // Every view is drawn by the same draw call, into its own
+                // layer when there is more than one
+                uint view_count = view_counts[state->views];
+                int multi_view = view_count > 1;
+                int screen_ao = state->ao == AO_SCREEN;
+                int proxies = state->proxies && proxy_VAO;
+                float resolution[2] = { WIDTH, HEIGHT };
+                float mouse[2] = { state->mouse[0], state->mouse[1] };
+
+                trace_begin("uniforms");
+                if (multi_view) {
+                        resize_view_targets(&view_targets, state->views, framebuffer);
+
+                        // The mouse keeps its reach across the smaller views
+                        resolution[0] = (float)view_targets.size[0];
+                        resolution[1] = (float)view_targets.size[1];
+                        mouse[0] *= resolution[0] / (float)framebuffer[0];
+                        mouse[1] *= resolution[1] / (float)framebuffer[1];
+                }
+
+                float mouse_look[2];
+                look_angles(mouse, resolution, mouse_look);
+
+                struct view views[MAX_VIEWS];
+                setup_views(views, state->views, state->camera, mouse_look);
+                upload_views(&view_targets, views, view_count);
 
                 glUseProgram(shader_program);
-                glUniform1f(u_time_location, time);
-                glUniform2f(u_resolution_location, WIDTH, HEIGHT);
-                glUniform2f(u_mouse_location, xMousePos, yMousePos);
+                set_frame_uniforms(shader_program, time, resolution);
+                trace_end();
+
+                // Size of a view, the whole window unless it is split
+                int view_size[2] = {
+                        multi_view ? view_targets.size[0] : framebuffer[0],
+                        multi_view ? view_targets.size[1] : framebuffer[1]
+                };
+
+                trace_begin("draw");
+                trace_gpu_begin("draw");
+                if (screen_ao) {
+                        resize_ao_targets(&ao_targets, view_size, view_count);
+                        glBindFramebuffer(GL_FRAMEBUFFER, ao_targets.framebuffer);
+                        glViewport(0, 0, view_size[0], view_size[1]);
+                } else if (multi_view) {
+                        glBindFramebuffer(GL_FRAMEBUFFER, view_targets.framebuffer);
+                        glViewport(0, 0, view_size[0], view_size[1]);
+                }
+
+                // The rays start near what they hit last frame
+                if (state->depth_reuse) {
+                        resize_depth_history(&history, view_size, view_count);
+                        bind_depth_history(&history);
+                }
+
+                // Every pass writes the depth it hits, the sky the far plane
+                if (proxies) {
+                        glEnable(GL_DEPTH_TEST);
+                        glDepthFunc(GL_LEQUAL);
+                        glClear(GL_DEPTH_BUFFER_BIT);
+                }
 
                 glBindVertexArray(VAO);
                 glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
                 // glDrawArrays(GL_TRIANGLES, 0, 3);
                 // glBindVertexArray(0);
 
-                // Swap buffers and pull IO events
-                glfwSwapBuffers(window);
-                glfwPollEvents();
+                // Only the pixels the volume box covers march it, from its
+                // front faces on
+                if (proxies) {
+                        GLuint proxy_program =
+                                shader_programs[SHADER_VARIANTS + shader_variant(state)];
+                        glUseProgram(proxy_program);
+                        set_frame_uniforms(proxy_program, time, resolution);
+
+                        glEnable(GL_CULL_FACE);
+                        glBindVertexArray(proxy_VAO);
+                        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+                        glDisable(GL_CULL_FACE);
+                        glDisable(GL_DEPTH_TEST);
+                        glBindVertexArray(VAO);
+                }
+                trace_gpu_end();
+                trace_end();
+
+                if (state->depth_reuse) {
+                        advance_depth_history(&history, views, view_count);
+                }
+
+                // Occlusion from the G-buffer, into the window or the view
+                // layers
+                if (screen_ao) {
+                        trace_begin("ambient_occlusion");
+                        trace_gpu_begin("ambient_occlusion");
+
+                        glBindFramebuffer(GL_FRAMEBUFFER,
+                                          multi_view ? view_targets.framebuffer : 0);
+                        float ao_resolution[2] = { (float)view_size[0], (float)view_size[1] };
+
+                        glUseProgram(ao_program);
+                        glUniform2fv(glGetUniformLocation(ao_program, UNIFORM_RESOLUTION), 1,
+                                     ao_resolution);
+                        bind_ao_textures(&ao_targets);
+                        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+                        trace_gpu_end();
+                        trace_end();
+                }
+
+                // Tile the views over the window
+                if (multi_view) {
+                        TRACE_SCOPE("present");
+
+                        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                        glViewport(0, 0, framebuffer[0], framebuffer[1]);
+
+                        int grid[2];
+                        view_grid(state->views, grid);
+                        float view_size[2] = { resolution[0], resolution[1] };
+                        float window_size[2] = { (float)framebuffer[0], (float)framebuffer[1] };
+
+                        glUseProgram(present_program);
+                        glUniform2iv(glGetUniformLocation(present_program, UNIFORM_GRID), 1, grid);
+                        glUniform2fv(glGetUniformLocation(present_program, UNIFORM_VIEW_SIZE), 1,
+                                     view_size);
+                        glUniform2fv(glGetUniformLocation(present_program, UNIFORM_RESOLUTION), 1,
+                                     window_size);
+
+                        glActiveTexture(GL_TEXTURE0 + VIEWS_UNIT);
+                        glBindTexture(GL_TEXTURE_2D_ARRAY, view_targets.texture);
+                        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                }
+
+                // Swap buffers
+                trace_begin("swap_buffers");
+                glfwSwapBuffers(renderer->window);
+                trace_end();
+
+                // Timers from earlier frames, without waiting on the GPU
+                trace_gpu_collect(FALSE);
+
+                trace_end();
+
+                if (state->trace_dumps != trace_dumps) {
+                        trace_dumps = state->trace_dumps;
+                        trace_gpu_collect(TRUE);
+                        trace_dump(TRACE_FILE);
+                }
+
+                // Frames follow each other as fast as they draw, whatever
+                // the clock says. The first one warms up and is not timed,
+                // the window closes after the last one.
+                if (replay_path) {
+                        if (replay.frames == 1) {
+                                glFinish();
+                                replay_start = glfwGetTime();
+                        }
+                        if (!replay_frame(&replay, &replay_time, &replayed)) {
+                                glFinish();
+                                double elapsed = glfwGetTime() - replay_start;
+                                uint timed = replay.frames > 1 ? replay.frames - 1 : 1;
+                                printf("Replayed %u frames, %.3f ms per frame\n", replay.frames,
+                                       elapsed * 1000. / timed);
+
+                                glfwSetWindowShouldClose(renderer->window, TRUE);
+                                glfwPostEmptyEvent();
+                                break;
+                        }
+                }
+        }
+
+        if (replay.file) {
+                close_replay(&replay);
         }
 
         // Dealocate resources
         glDeleteVertexArrays(1, &VAO);
         glDeleteBuffers(1, &VBO);
         glDeleteBuffers(1, &EBO);
+        if (proxy_VAO) {
+                glDeleteVertexArrays(1, &proxy_VAO);
+                glDeleteBuffers(2, proxy_buffers);
+        }
 
-        glDeleteProgram(shader_program);
+        for (uint i = 0; i < SHADER_PROGRAMS; i++) {
+                glDeleteProgram(shader_programs[i]);
+        }
+        glDeleteProgram(present_program);
+        glDeleteProgram(ao_program);
+        delete_view_targets(&view_targets);
+        delete_ao_targets(&ao_targets);
+        delete_depth_history(&history);
 
-        glfwTerminate();
+        delete_noise_textures(noise_textures);
+        if (volume_texture) {
+                delete_volume_texture(&volume_texture);
+        }
+        if (streaming) {
+                close_brick_stream(&stream);
+        }
 
-        return EXIT_SUCCESS;
+        glDeleteBuffers(5, instance_buffers);
+        free_bvh(&bvh);
+        free(primitives);
+        free(rest_primitives);
+
+        trace_gpu_collect(TRUE);
+        trace_dump(TRACE_FILE);
+        trace_gpu_shutdown();
+
+        glfwMakeContextCurrent(NULL);
+
+        return NULL;
+}
+
+int
+move_camera(GLFWwindow* window, float delta_time)
+{
+        float step = CAMERA_SPEED * delta_time;
+        int direction[3] = {
+                glfwGetKey(window, GLFW_KEY_RIGHT) - glfwGetKey(window, GLFW_KEY_LEFT),
+                glfwGetKey(window, GLFW_KEY_PAGE_UP) - glfwGetKey(window, GLFW_KEY_PAGE_DOWN),
+                glfwGetKey(window, GLFW_KEY_DOWN) - glfwGetKey(window, GLFW_KEY_UP)
+        };
+
+        for (uint axis = 0; axis < 3; axis++) {
+                input.camera[axis] += step * (float)direction[axis];
+        }
+
+        return direction[0] || direction[1] || direction[2];
 }
 
 void
 framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
-        glViewport(0, 0, width, height);
+        // The viewport is set by the render thread, which owns the context
+        input.framebuffer[0] = width;
+        input.framebuffer[1] = height;
 }
 
 void
-process_input(GLFWwindow* window, GLuint* shader_program)
+key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-        if (glfwGetKey(window, GLFW_KEY_ESCAPE) || glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
+        (void)scancode;
+        (void)mods;
+
+        if (action != GLFW_PRESS) {
+                return;
+        }
+
+        if (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q) {
                 glfwSetWindowShouldClose(window, TRUE);
-        } else if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
-                glDeleteProgram(*shader_program);
-                *shader_program = glCreateProgram();
+                return;
+        } else if (key == GLFW_KEY_R) {
+                input.reloads++;
+                return;
+        } else if (key >= GLFW_KEY_1 && key < GLFW_KEY_1 + QUALITY_PRESETS) {
+                input.quality = (uint)(key - GLFW_KEY_1);
+        } else if (key == GLFW_KEY_A) {
+                input.antialiasing = !input.antialiasing;
+        } else if (key == GLFW_KEY_N) {
+                // Switching the hash rebuilds every variant
+                input.noise_hash = (input.noise_hash + 1) % NOISE_HASHES;
+                input.reloads++;
+
+                printf("Noise hash: %s\n", noise_hash_names[input.noise_hash]);
+                return;
+        } else if (key == GLFW_KEY_I) {
+                input.instances = (input.instances + 1) % INSTANCE_MODES;
+                input.reloads++;
 
-                compile_shaders(shader_program);
+                printf("Instanced primitives: %s\n", instance_names[input.instances]);
+                return;
+        } else if (key == GLFW_KEY_V) {
+                // The view count is compiled into the shaders
+                input.views = (input.views + 1) % VIEW_MODES;
+                input.reloads++;
+
+                printf("Views: %s\n", view_names[input.views]);
+                return;
+        } else if (key == GLFW_KEY_O) {
+                // The march pass writes a G-buffer instead with screen space AO
+                input.ao = (input.ao + 1) % AO_MODES;
+                input.reloads++;
+
+                printf("Ambient occlusion: %s\n", ao_names[input.ao]);
+                return;
+        } else if (key == GLFW_KEY_P) {
+                // Needs a volume, the only object bounded by a box
+                input.proxies = !input.proxies;
+                input.reloads++;
+
+                printf("Proxy geometry: %s\n", input.proxies ? "on" : "off");
+                return;
+        } else if (key == GLFW_KEY_D) {
+                input.depth_reuse = !input.depth_reuse;
+                input.reloads++;
+
+                printf("Depth reuse: %s\n", input.depth_reuse ? "on" : "off");
+                return;
+        } else if (key == GLFW_KEY_T) {
+                // Written at the end of a frame, so it holds complete frames
+                input.trace_dumps++;
+                return;
+        } else {
+                return;
         }
+
+        printf("Quality: %s, anti-aliasing: %s\n", quality_names[input.quality],
+               input.antialiasing ? "on" : "off");
+}
+
+uint
+shader_variant(struct input_state const* state)
+{
+        return state->quality * 2 + (state->antialiasing ? 1 : 0);
+}
+
+// Yaw and pitch of the mouse, a quarter turn across the view
+void
+look_angles(float const* const mouse, float const* const resolution, float* const angles)
+{
+        angles[0] = (.5f - mouse[0] / resolution[0]) * resolution[0] / resolution[1];
+        angles[1] = .5f - mouse[1] / resolution[1];
+}
+
+void
+set_frame_uniforms(GLuint program, float time, float const* const resolution)
+{
+        glUniform1f(glGetUniformLocation(program, UNIFORM_TIME), time);
+        glUniform2fv(glGetUniformLocation(program, UNIFORM_RESOLUTION), 1, resolution);
 }
 
 char*
-get_shader(char* shader_file)
+get_shader(char const* shader_name)
 {
-        FILE *file = fopen(shader_file, "r");
+        char* shader_string;
+
+        if (!shader_dir) {
+                struct packed_shader const* packed = NULL;
+                for (uint i = 0; i < packed_shader_count && !packed; i++) {
+                        if (!strcmp(packed_shaders[i].name, shader_name)) {
+                                packed = &packed_shaders[i];
+                        }
+                }
+                if (!packed) {
+                        fprintf(stderr, "ERROR: No shader named %s was packed\n", shader_name);
+                        exit(EXIT_FAILURE);
+                }
+
+                // Copied, so both sources are freed the same way
+                shader_string = malloc(packed->length + 1);
+                if (!shader_string) {
+                        die("Could not alocate memory for the shader file contents");
+                }
+                memcpy(shader_string, packed->source, packed->length + 1);
+
+                return shader_string;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", shader_dir, shader_name);
+
+        FILE *file = fopen(path, "rb");
         if (!file) {
-                fprintf(stderr, "ERROR: Could not open file: %s, does it exist?\n", shader_file);
+                fprintf(stderr, "ERROR: Could not open file: %s, does it exist?\n", path);
                 exit(EXIT_FAILURE);
         }
 
@@ -156,17 +945,14 @@ get_shader(char* shader_file)
         ulint length = (ulint)ftell(file);
         fseek(file, 0, SEEK_SET);
 
-        char* shader_string = malloc(sizeof(*shader_string) * (length + 1));
+        shader_string = malloc(sizeof(*shader_string) * (length + 1));
         if (!shader_string) {
                 die("Could not alocate memory for the shader file contents");
         }
 
-        int cursor;
-        uint index = 0;
-
-        while ((cursor = fgetc(file)) != EOF) {
-                shader_string[index] = (char)cursor;
-                index++;
+        if (fread(shader_string, 1, length, file) != length) {
+                fprintf(stderr, "ERROR: Could not read file: %s\n", path);
+                exit(EXIT_FAILURE);
         }
         shader_string[length] = '\0';
 
@@ -183,66 +969,366 @@ die(char const* error)
 }
 
 void
-compile_shaders(GLuint const* const shader_program)
+append_source(struct shader_source* source, char const* text, ulint length)
+{
+        if (source->length + length + 1 > source->capacity) {
+                ulint capacity = source->capacity ? source->capacity : 4096;
+                while (source->length + length + 1 > capacity) {
+                        capacity *= 2;
+                }
+
+                char* data = realloc(source->data, capacity);
+                if (!data) {
+                        die("Could not alocate memory for the shader source");
+                }
+                source->data = data;
+                source->capacity = capacity;
+        }
+
+        memcpy(source->data + source->length, text, length);
+        source->length += length;
+        source->data[source->length] = '\0';
+}
+
+void
+include_shader(struct shader_source* source, char const* shader_file,
+               char const* defines, uint depth)
+{
+        if (depth > MAX_INCLUDE_DEPTH) {
+                die("Shader includes are nested too deep, is there a cycle?");
+        }
+
+        char* file = get_shader(shader_file);
+        uint file_index = source->files++;
+        uint line_number = 0;
+        char directive[64];
+
+        if (depth) {
+                snprintf(directive, sizeof(directive), "#line 1 %u\n", file_index);
+                append_source(source, directive, strlen(directive));
+        }
+
+        char* line = file;
+        while (*line) {
+                char* end = strchr(line, '\n');
+                ulint length = end ? (ulint)(end - line) + 1 : strlen(line);
+                line_number++;
+
+                char* text = line + strspn(line, " \t");
+
+                if (!strncmp(text, "#include", 8)) {
+                        // #include "name" names another shader, packed or in
+                        // the same directory
+                        char* open = memchr(text, '"', length - (ulint)(text - line));
+                        char* close = open ? strchr(open + 1, '"') : NULL;
+                        if (!open || !close || (end && close > end)) {
+                                fprintf(stderr, "ERROR: Malformed include in %s:%u\n",
+                                        shader_file, line_number);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        ulint name_length = (ulint)(close - open - 1);
+                        char* name = malloc(name_length + 1);
+                        if (!name) {
+                                die("Could not alocate memory for the include name");
+                        }
+                        memcpy(name, open + 1, name_length);
+                        name[name_length] = '\0';
+
+                        include_shader(source, name, "", depth + 1);
+                        free(name);
+
+                        // Keep error messages pointing at the including file
+                        snprintf(directive, sizeof(directive), "\n#line %u %u\n",
+                                 line_number + 1, file_index);
+                        append_source(source, directive, strlen(directive));
+                } else {
+                        append_source(source, line, length);
+
+                        // Defines go right after #version, which must stay first
+                        if (!strncmp(text, "#version", 8) && *defines) {
+                                append_source(source, defines, strlen(defines));
+                                snprintf(directive, sizeof(directive), "#line %u %u\n",
+                                         line_number + 1, file_index);
+                                append_source(source, directive, strlen(directive));
+                        }
+                }
+
+                line += length;
+        }
+
+        free(file);
+}
+
+char*
+preprocess_shader(char const* shader_file, char const* defines)
+{
+        struct shader_source source = { NULL, 0, 0, 0 };
+        include_shader(&source, shader_file, defines, 0);
+
+        return source.data;
+}
+
+GLuint
+compile_shader(GLenum type, char const* shader_file, char const* defines)
 {
-        char* vertex_shader_source = get_shader(VERTEX_SHADER_PATH);
+        char* shader_source = preprocess_shader(shader_file, defines);
 
-        GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex_shader, 1, (char const *const *)&vertex_shader_source,
-                       NULL);
-        glCompileShader(vertex_shader);
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, (char const *const *)&shader_source, NULL);
+        glCompileShader(shader);
 
+        free(shader_source);
+
+        return shader;
+}
+
+int
+shader_compiled(GLuint shader, char const* name)
+{
         int success;
         char info_log[512];
-        glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
 
         if (!success) {
-                glGetShaderInfoLog(vertex_shader, 512, NULL, info_log);
-                fprintf(stderr, "Vertex shader compilation error: %s\n", info_log);
-                return;
+                glGetShaderInfoLog(shader, 512, NULL, info_log);
+                fprintf(stderr, "%s shader compilation error: %s\n", name, info_log);
         }
 
-        free(vertex_shader_source);
+        return success;
+}
 
-        char* fragment_shader_source = get_shader(FRAGMENT_SHADER_PATH);
+// Everything the fragment shader is compiled with for the settings of
+// state, defines holds MAX_DEFINES_LENGTH
+void
+fragment_defines(char* const defines, char const* quality, int antialiasing, int proxy_pass,
+                 struct input_state const* state)
+{
+        char view_defines[32];
+        snprintf(view_defines, sizeof(view_defines), "#define VIEW_COUNT %u\n",
+                 view_counts[state->views]);
 
-        GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment_shader, 1,
-                       (char const *const *)&fragment_shader_source, NULL);
-        glCompileShader(fragment_shader);
+        int proxies = state->proxies && *proxy_defines;
 
-        glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
+        // A cut off block would compile a different shader, or none
+        int length = snprintf(defines, MAX_DEFINES_LENGTH,
+                              "%s%s%s%s%s%s%s%s%s%s%s"
+                              "#define NOISE_HASH %u\n"
+                              "#define NOISE_TEXTURE_SIZE %u\n"
+                              "#define NOISE_VOLUME_SIZE %u\n",
+                              quality, antialiasing ? "#define ANTI_ALIASING\n" : "",
+                              instance_defines[state->instances], bvh_defines, volume_defines,
+                              scene_defines, view_defines,
+                              state->ao == AO_SCREEN ? "#define SCREEN_SPACE_AO\n" : "",
+                              proxies ? proxy_defines : "",
+                              proxy_pass ? "#define PROXY_PASS\n" : "",
+                              state->depth_reuse && !proxy_pass ? "#define DEPTH_REUSE\n" : "",
+                              state->noise_hash,
+                              NOISE_TEXTURE_SIZE, NOISE_VOLUME_SIZE);
+        if (length < 0 || length >= MAX_DEFINES_LENGTH) {
+                die("The shader defines do not fit in MAX_DEFINES_LENGTH");
+        }
+}
 
-        if (!success) {
-                glGetShaderInfoLog(fragment_shader, 512, NULL, info_log);
-                fprintf(stderr, "Fragment shader compilation error: %s\n", info_log);
-                return;
+void
+compile_shaders(GLuint* const shader_programs, struct input_state const* state)
+{
+        TRACE_SCOPE("compile_shaders");
+
+        // Let the driver build the variants on its own threads when it can.
+        // No status is queried until every compile and link has been issued,
+        // so the variants are compiled concurrently instead of one by one.
+        if (glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+                void (*max_shader_compiler_threads)(GLuint) =
+                        (void (*)(GLuint))glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+                if (max_shader_compiler_threads) {
+                        max_shader_compiler_threads(0xFFFFFFFF);
+                }
         }
 
-        free(fragment_shader_source);
+        trace_begin("issue_compiles");
+        GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, VERTEX_SHADER, "");
 
-        glAttachShader(*shader_program, vertex_shader);
-        glAttachShader(*shader_program, fragment_shader);
-        glLinkProgram(*shader_program);
+        // Several views are drawn into layers picked by the geometry shader
+        uint view_count = view_counts[state->views];
+        char view_defines[32];
+        snprintf(view_defines, sizeof(view_defines), "#define VIEW_COUNT %u\n", view_count);
 
-        glGetProgramiv(*shader_program, GL_LINK_STATUS, &success);
+        GLuint geometry_shader = view_count > 1 ?
+                compile_shader(GL_GEOMETRY_SHADER, GEOMETRY_SHADER, view_defines) : 0;
 
-        if (!success) {
-                glGetProgramInfoLog(*shader_program, 512, NULL, info_log);
-                fprintf(stderr, "Shader program linking error: %s\n", info_log);
-                return;
+        // The proxy pass rasterizes the volume box, projected for every view
+        int proxies = state->proxies && *proxy_defines;
+        uint programs = proxies ? SHADER_PROGRAMS : SHADER_VARIANTS;
+        GLuint proxy_vertex_shader = 0, proxy_geometry_shader = 0;
+        char proxy_view_defines[64];
+        snprintf(proxy_view_defines, sizeof(proxy_view_defines), "%s#define PROXY_PASS\n",
+                 view_defines);
+
+        if (proxies) {
+                proxy_vertex_shader =
+                        compile_shader(GL_VERTEX_SHADER, PROXY_SHADER, view_defines);
+                proxy_geometry_shader = view_count > 1 ?
+                        compile_shader(GL_GEOMETRY_SHADER, GEOMETRY_SHADER,
+                                       proxy_view_defines) : 0;
+        }
+
+        GLuint fragment_shaders[SHADER_PROGRAMS];
+        char defines[MAX_DEFINES_LENGTH];
+
+        for (uint i = 0; i < programs; i++) {
+                uint variant = i % SHADER_VARIANTS;
+                fragment_defines(defines, quality_defines[variant / 2], variant % 2,
+                                 i >= SHADER_VARIANTS, state);
+                fragment_shaders[i] =
+                        compile_shader(GL_FRAGMENT_SHADER, FRAGMENT_SHADER, defines);
+        }
+
+        for (uint i = 0; i < programs; i++) {
+                int proxy = i >= SHADER_VARIANTS;
+                shader_programs[i] = glCreateProgram();
+                glAttachShader(shader_programs[i], proxy ? proxy_vertex_shader : vertex_shader);
+                if (geometry_shader) {
+                        glAttachShader(shader_programs[i],
+                                       proxy ? proxy_geometry_shader : geometry_shader);
+                }
+                glAttachShader(shader_programs[i], fragment_shaders[i]);
+                glLinkProgram(shader_programs[i]);
+        }
+        for (uint i = programs; i < SHADER_PROGRAMS; i++) {
+                shader_programs[i] = 0;
+        }
+        trace_end();
+
+        // Blocks until the driver threads are done
+        trace_begin("check_status");
+        int success;
+        char info_log[512];
+
+        shader_compiled(vertex_shader, "Vertex");
+        if (geometry_shader) {
+                shader_compiled(geometry_shader, "Geometry");
+        }
+        if (proxy_vertex_shader) {
+                shader_compiled(proxy_vertex_shader, "Proxy vertex");
+        }
+        if (proxy_geometry_shader) {
+                shader_compiled(proxy_geometry_shader, "Proxy geometry");
+        }
+
+        for (uint i = 0; i < programs; i++) {
+                uint variant = i % SHADER_VARIANTS;
+                snprintf(info_log, sizeof(info_log), "Fragment (%s%s%s)", quality_names[variant / 2],
+                         variant % 2 ? ", AA" : "", i >= SHADER_VARIANTS ? ", proxy" : "");
+                if (!shader_compiled(fragment_shaders[i], info_log)) {
+                        continue;
+                }
+
+                glGetProgramiv(shader_programs[i], GL_LINK_STATUS, &success);
+
+                if (!success) {
+                        glGetProgramInfoLog(shader_programs[i], 512, NULL, info_log);
+                        fprintf(stderr, "Shader program linking error: %s\n", info_log);
+                }
+        }
+
+        trace_end();
+
+        glDeleteShader(vertex_shader);
+        if (geometry_shader) {
+                glDeleteShader(geometry_shader);
+        }
+        if (proxy_vertex_shader) {
+                glDeleteShader(proxy_vertex_shader);
+        }
+        if (proxy_geometry_shader) {
+                glDeleteShader(proxy_geometry_shader);
+        }
+        for (uint i = 0; i < programs; i++) {
+                glDeleteShader(fragment_shaders[i]);
+        }
+}
+
+GLuint
+compile_present_shader(void)
+{
+        GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, VERTEX_SHADER, "");
+        GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, PRESENT_SHADER, "");
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, vertex_shader);
+        glAttachShader(program, fragment_shader);
+        glLinkProgram(program);
+
+        int success;
+        char info_log[512];
+
+        if (shader_compiled(vertex_shader, "Vertex") &&
+            shader_compiled(fragment_shader, "Present")) {
+                glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+                if (!success) {
+                        glGetProgramInfoLog(program, 512, NULL, info_log);
+                        fprintf(stderr, "Shader program linking error: %s\n", info_log);
+                }
+        }
+
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+
+        return program;
+}
+
+// Drawn into the view layers like the march pass when there are several
+GLuint
+compile_ao_shader(struct input_state const* state)
+{
+        uint view_count = view_counts[state->views];
+        char view_defines[32];
+        snprintf(view_defines, sizeof(view_defines), "#define VIEW_COUNT %u\n", view_count);
+
+        GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, VERTEX_SHADER, "");
+        GLuint geometry_shader = view_count > 1 ?
+                compile_shader(GL_GEOMETRY_SHADER, GEOMETRY_SHADER, view_defines) : 0;
+        GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, AO_SHADER, view_defines);
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, vertex_shader);
+        if (geometry_shader) {
+                glAttachShader(program, geometry_shader);
+        }
+        glAttachShader(program, fragment_shader);
+        glLinkProgram(program);
+
+        int success;
+        char info_log[512];
+
+        if (shader_compiled(vertex_shader, "Vertex") &&
+            (!geometry_shader || shader_compiled(geometry_shader, "Geometry")) &&
+            shader_compiled(fragment_shader, "Ambient occlusion")) {
+                glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+                if (!success) {
+                        glGetProgramInfoLog(program, 512, NULL, info_log);
+                        fprintf(stderr, "Shader program linking error: %s\n", info_log);
+                }
         }
 
         glDeleteShader(vertex_shader);
+        if (geometry_shader) {
+                glDeleteShader(geometry_shader);
+        }
         glDeleteShader(fragment_shader);
+
+        return program;
 }
 
 static void
 cursor_position_callback(GLFWwindow* window, double xPos, double yPos)
 {
         if (inWindow) {
-                xMousePos = xPos;
-                yMousePos = yPos;
+                input.mouse[0] = (float)xPos;
+                input.mouse[1] = (float)yPos;
         }
 }
 
@@ -255,3 +1341,185 @@ cursor_enter_callback(GLFWwindow* window, int inside)
                 inWindow = FALSE;
         }
 }
+
+// Single view march pass with the given quality settings, 0 if it does not
+// build
+GLuint
+compile_tune_program(struct input_state const* state, char const* quality)
+{
+        char defines[MAX_DEFINES_LENGTH];
+        fragment_defines(defines, quality, FALSE, FALSE, state);
+
+        GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, VERTEX_SHADER, "");
+        GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, FRAGMENT_SHADER, defines);
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, vertex_shader);
+        glAttachShader(program, fragment_shader);
+        glLinkProgram(program);
+
+        int success = shader_compiled(vertex_shader, "Vertex") &&
+                shader_compiled(fragment_shader, "Fragment (tuning)");
+        char info_log[512];
+
+        if (success) {
+                glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+                if (!success) {
+                        glGetProgramInfoLog(program, 512, NULL, info_log);
+                        fprintf(stderr, "Shader program linking error: %s\n", info_log);
+                }
+        }
+
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+
+        if (!success) {
+                glDeleteProgram(program);
+                return 0;
+        }
+
+        return program;
+}
+
+// Draws every frame offscreen and reads it back into pixels, returns the
+// GPU time of all of them in ms, the fastest of a few draws each
+double
+time_tune_program(GLuint program, struct input_state const* frames, double const* times,
+                  uint count, struct tune_target const* target,
+                  struct view_targets const* view_targets, uchar* const pixels)
+{
+        float resolution[2] = { WIDTH, HEIGHT };
+        ulint frame_size = (ulint)target->size[0] * (ulint)target->size[1] * 4;
+
+        GLuint query;
+        glGenQueries(1, &query);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+        glViewport(0, 0, target->size[0], target->size[1]);
+        glUseProgram(program);
+
+        double total = 0.;
+
+        for (uint i = 0; i < count; i++) {
+                float mouse_look[2];
+                look_angles(frames[i].mouse, resolution, mouse_look);
+
+                struct view views[MAX_VIEWS];
+                setup_views(views, VIEWS_SINGLE, frames[i].camera, mouse_look);
+                upload_views(view_targets, views, 1);
+                set_frame_uniforms(program, (float)times[i], resolution);
+
+                GLuint64 fastest = ~(GLuint64)0;
+                for (uint repeat = 0; repeat < TUNE_REPEATS; repeat++) {
+                        GLuint64 elapsed;
+                        glBeginQuery(GL_TIME_ELAPSED, query);
+                        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                        glEndQuery(GL_TIME_ELAPSED);
+                        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+                        fastest = elapsed < fastest ? elapsed : fastest;
+                }
+                total += (double)fastest / 1e6;
+
+                read_tune_target(target, pixels + frame_size * i);
+        }
+
+        glDeleteQueries(1, &query);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        return total;
+}
+
+// Coordinate search of the quality settings, see tune.h. The frames are the
+// one state was read for and, from a recording, a few more spread over it.
+// The settings that decide what is compiled are those of the first frame,
+// drawn with a single view and the marched AO.
+void
+tune_quality(struct input_state const* state, struct replay* const replay, double time,
+             struct view_targets const* view_targets, GLuint VAO)
+{
+        struct input_state frames[TUNE_FRAMES];
+        double times[TUNE_FRAMES];
+
+        uint length = replay ? replay_length(replay) : 1;
+        uint count = length < TUNE_FRAMES ? length : TUNE_FRAMES;
+
+        frames[0] = *state;
+        frames[0].views = VIEWS_SINGLE;
+        frames[0].ao = AO_MARCHED;
+        frames[0].proxies = FALSE;
+        frames[0].depth_reuse = FALSE;
+        times[0] = time;
+
+        struct input_state next = frames[0];
+        for (uint i = 1; i < count; i++) {
+                uint index = i * (length - 1) / (count - 1);
+                while (replay->frames <= index) {
+                        if (!replay_frame(replay, &times[i], &next)) {
+                                die("The recording ended early");
+                        }
+                }
+                frames[i] = next;
+        }
+
+        int size[2] = { (int)WIDTH, (int)HEIGHT };
+        struct tune_target target;
+        create_tune_target(&target, size);
+
+        ulint image_size = (ulint)size[0] * (ulint)size[1] * 4 * count;
+        uchar* reference = malloc(image_size);
+        uchar* pixels = malloc(image_size);
+        if (!reference || !pixels) {
+                die("Could not alocate memory for the tuning frames");
+        }
+
+        glBindVertexArray(VAO);
+
+        struct tune_search search;
+        start_tune_search(&search, tune_threshold);
+
+        char quality[512];
+        tune_defines(search.rungs, quality, sizeof(quality));
+        GLuint program = compile_tune_program(&frames[0], quality);
+        if (!program) {
+                die("The reference settings do not build");
+        }
+        double reference_time = time_tune_program(program, frames, times, count, &target,
+                                                  view_targets, reference);
+        glDeleteProgram(program);
+        search.time = reference_time;
+
+        printf("Tuning for %.1f dB on %u frames, reference %.2f ms\n", tune_threshold, count,
+               reference_time);
+
+        uint rungs[TUNE_PARAMETERS];
+        while (next_tune_candidate(&search, rungs)) {
+                tune_defines(rungs, quality, sizeof(quality));
+                program = compile_tune_program(&frames[0], quality);
+
+                double candidate_time = 0., psnr = 0.;
+                if (program) {
+                        candidate_time = time_tune_program(program, frames, times, count, &target,
+                                                           view_targets, pixels);
+                        psnr = image_psnr(reference, pixels, image_size);
+                        glDeleteProgram(program);
+                }
+
+                struct tune_parameter const* parameter = &tune_parameters[search.parameter];
+                char value[32];
+                snprintf(value, sizeof(value), parameter->format,
+                         (double)parameter->values[rungs[search.parameter]]);
+                printf("%s %s: %.2f ms, %.1f dB\n", parameter->name, value, candidate_time, psnr);
+
+                report_tune_candidate(&search, candidate_time, psnr);
+        }
+
+        write_tuned(TUNE_FILE, &search, (char const*)glGetString(GL_RENDERER));
+        printf("Tuned settings written to %s, %.2f ms, %.1f dB\n", TUNE_FILE, search.time,
+               search.psnr);
+
+        delete_tune_target(&target);
+        free(reference);
+        free(pixels);
+}
@@ -4,6 +4,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "input.h"
+#include "replay.h"
+#include "tune.h"
+#include "views.h"
+
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -18,11 +23,36 @@
 #define TITLE                   "OpenGL Template"
 
 #define UNIFORM_TIME            "u_time"
-#define UNIFORM_MOUSE           "u_mouse"
 #define UNIFORM_RESOLUTION      "u_resolution"
+#define UNIFORM_GRID            "u_grid"
+#define UNIFORM_VIEW_SIZE       "u_view_size"
+
+// Units per second
+#define CAMERA_SPEED            2.0f
+
+// Longest the event loop sleeps, in seconds, while a movement key is held
+// and while idle
+#define INPUT_INTERVAL          (1.0 / 240.0)
+#define IDLE_INTERVAL           0.1
+
+// Shaders are looked up by file name, in the pack compiled into the
+// executable or in the directory given with -s
+#define VERTEX_SHADER           "vertex_shader.glsl"
+#define FRAGMENT_SHADER         "fragment_shader.glsl"
+#define GEOMETRY_SHADER         "geometry_shader.glsl"
+#define PRESENT_SHADER          "present_shader.glsl"
+#define AO_SHADER               "ao_shader.glsl"
+#define PROXY_SHADER            "proxy_shader.glsl"
+#define MAX_INCLUDE_DEPTH       8
+#define MAX_DEFINES_LENGTH      8192
 
-#define VERTEX_SHADER_PATH      "shaders/vertex_shader.glsl"
-#define FRAGMENT_SHADER_PATH    "shaders/fragment_shader.glsl"
+// Every quality preset is compiled with and without anti-aliasing
+#define QUALITY_PRESETS         4
+#define SHADER_VARIANTS         (QUALITY_PRESETS * 2)
+
+// Followed by the same variants for the proxy pass
+#define SHADER_PROGRAMS         (SHADER_VARIANTS * 2)
+#define DEFAULT_QUALITY         2
 
 #define MAJOR_VERS 4
 #define MINOR_VERS 6
@@ -31,10 +61,48 @@ typedef unsigned int            uint;
 typedef unsigned long int       ulint;
 typedef unsigned char           uchar;
 
+// Handed to the render thread
+struct renderer {
+        GLFWwindow*             window;
+        struct input_buffer*    inputs;
+        char const*             volume_path;
+};
+
+// Growable text buffer used to assemble preprocessed shader sources
+struct shader_source {
+        char*   data;
+        ulint   length;
+        ulint   capacity;
+        uint    files;
+};
+
 void            framebuffer_size_callback(GLFWwindow* window, int width, int height);
 static void     cursor_position_callback(GLFWwindow* window, double xPos, double yPos);
 void            cursor_enter_callback(GLFWwindow* window, int inside);
-void            process_input(GLFWwindow* window, GLuint* shader_program);
-char*           get_shader(char* shader_file);
+int             move_camera(GLFWwindow* window, float delta_time);
+void            key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void*           render(void* argument);
+char*           get_shader(char const* shader_name);
+void            append_source(struct shader_source* source, char const* text, ulint length);
+void            include_shader(struct shader_source* source, char const* shader_file,
+                               char const* defines, uint depth);
+char*           preprocess_shader(char const* shader_file, char const* defines);
+GLuint          compile_shader(GLenum type, char const* shader_file, char const* defines);
+int             shader_compiled(GLuint shader, char const* name);
 void            die(char const* error);
-void            compile_shaders(GLuint const* const shader_program);
+void            compile_shaders(GLuint* const shader_programs, struct input_state const* state);
+GLuint          compile_present_shader(void);
+GLuint          compile_ao_shader(struct input_state const* state);
+uint            shader_variant(struct input_state const* state);
+void            look_angles(float const* const mouse, float const* const resolution,
+                            float* const angles);
+void            set_frame_uniforms(GLuint program, float time, float const* const resolution);
+void            fragment_defines(char* const defines, char const* quality, int antialiasing,
+                                 int proxy_pass, struct input_state const* state);
+GLuint          compile_tune_program(struct input_state const* state, char const* quality);
+double          time_tune_program(GLuint program, struct input_state const* frames,
+                                  double const* times, uint count,
+                                  struct tune_target const* target,
+                                  struct view_targets const* view_targets, uchar* const pixels);
+void            tune_quality(struct input_state const* state, struct replay* const replay,
+                             double time, struct view_targets const* view_targets, GLuint VAO);
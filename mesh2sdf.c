@@ -0,0 +1,969 @@
+// Converts an OBJ or STL triangle mesh into a signed distance volume for the
+// renderer, see volume.h for the file format.
+//
+//     mesh2sdf [-b] [-s size] <mesh.obj|mesh.stl> <out.sdf> [resolution]
+//
+// The mesh is centred on the origin and scaled to fit a cube of the given
+// size, MESH_FIT_SIZE by default. -b writes a bricked volume for streaming,
+// computed brick by brick so it never has to fit in memory.
+// Distances come from closest point queries against a triangle BVH, the sign
+// from the generalized winding number, so meshes with small holes or
+// overlapping parts still convert cleanly. Faces must wind counter clockwise
+// seen from outside.
+#include "volume.h"
+
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef unsigned int            uint;
+
+#define DEFAULT_RESOLUTION      64
+#define MIN_RESOLUTION          16
+#define MESH_FIT_SIZE           2.0f
+
+// Samples of empty space around the mesh, so the gradient at the surface
+// never reaches the clamped border of the texture
+#define VOLUME_PADDING          4
+
+#define TREE_LEAF_SIZE          4
+
+// Clusters further than this many radii away are approximated by a dipole
+// when summing the winding number
+#define WINDING_ACCURACY        2.0f
+
+#define MAX_SDF_THREADS         64
+#define LINE_LENGTH             4096
+
+struct mesh {
+        float*  vertices;       // xyz per vertex
+        uint*   triangles;      // three vertex indices per triangle
+        uint    vertex_count, vertex_capacity;
+        uint    triangle_count, triangle_capacity;
+};
+
+// Triangle BVH node, stored depth first like struct bvh_node. Every node
+// also keeps the area weighted normal and centre of its triangles for the
+// far field winding number.
+struct tree_node {
+        float   min[3];
+        float   max[3];
+        float   area_normal[3];
+        float   center[3];
+        float   area;
+        float   radius;
+        uint    offset;         // right child, or first index of a leaf
+        uint    count;          // triangles in a leaf, 0 for interior nodes
+};
+
+struct tree {
+        struct tree_node*       nodes;
+        uint*                   indices;
+        float*                  centroids;
+        uint                    node_count;
+        uint                    depth;
+};
+
+// Bricks written so far, shared by all threads
+struct brick_output {
+        int                     file;
+        uint32_t const*         counts;
+        uint64_t*               table;
+        uint64_t                next_offset;
+        uint                    stored;
+        pthread_mutex_t         lock;
+};
+
+// Samples min + i * voxel_size for i < dims, either into data or, for
+// bricked volumes, brick by brick into the output file
+struct sdf_job {
+        struct mesh const*      mesh;
+        struct tree const*      tree;
+        float const*            min;
+        float                   voxel_size;
+        uint32_t const*         dims;
+        float*                  data;
+        struct brick_output*    bricks;
+        uint                    first;
+        uint                    step;
+};
+
+static void*
+allocate(size_t size)
+{
+        void* memory = malloc(size);
+        if (!memory) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the mesh\n");
+                exit(EXIT_FAILURE);
+        }
+
+        return memory;
+}
+
+static void*
+reallocate(void* memory, size_t size)
+{
+        memory = realloc(memory, size);
+        if (!memory) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the mesh\n");
+                exit(EXIT_FAILURE);
+        }
+
+        return memory;
+}
+
+// =========================================================================================================
+// Mesh loading
+// =========================================================================================================
+
+static void
+add_vertex(struct mesh* const mesh, float x, float y, float z)
+{
+        if (mesh->vertex_count == mesh->vertex_capacity) {
+                mesh->vertex_capacity = mesh->vertex_capacity ? mesh->vertex_capacity * 2 : 1024;
+                mesh->vertices = reallocate(mesh->vertices,
+                                            sizeof(*mesh->vertices) * 3 * mesh->vertex_capacity);
+        }
+
+        float* vertex = mesh->vertices + 3 * mesh->vertex_count++;
+        vertex[0] = x;
+        vertex[1] = y;
+        vertex[2] = z;
+}
+
+static void
+add_triangle(struct mesh* const mesh, uint a, uint b, uint c)
+{
+        if (mesh->triangle_count == mesh->triangle_capacity) {
+                mesh->triangle_capacity = mesh->triangle_capacity ? mesh->triangle_capacity * 2 : 1024;
+                mesh->triangles = reallocate(mesh->triangles,
+                                             sizeof(*mesh->triangles) * 3 * mesh->triangle_capacity);
+        }
+
+        uint* triangle = mesh->triangles + 3 * mesh->triangle_count++;
+        triangle[0] = a;
+        triangle[1] = b;
+        triangle[2] = c;
+}
+
+// Reads "v" and "f" lines, faces are triangulated as fans. Only the vertex
+// index of "v/vt/vn" is used, negative indices count back from the end.
+static void
+load_obj(struct mesh* const mesh, FILE* file, char const* path)
+{
+        char line[LINE_LENGTH];
+        uint line_number = 0;
+
+        while (fgets(line, sizeof(line), file)) {
+                line_number++;
+
+                if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) {
+                        float x, y, z;
+                        if (sscanf(line + 2, "%f %f %f", &x, &y, &z) != 3) {
+                                fprintf(stderr, "ERROR: Bad vertex in %s:%u\n", path, line_number);
+                                exit(EXIT_FAILURE);
+                        }
+                        add_vertex(mesh, x, y, z);
+                } else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t')) {
+                        uint face[3];
+                        uint corners = 0;
+                        char* save;
+
+                        for (char* token = strtok_r(line + 2, " \t\r\n", &save); token;
+                             token = strtok_r(NULL, " \t\r\n", &save)) {
+                                long index = strtol(token, NULL, 10);
+                                index = index < 0 ? (long)mesh->vertex_count + index : index - 1;
+
+                                if (index < 0 || index >= (long)mesh->vertex_count) {
+                                        fprintf(stderr, "ERROR: Bad face index in %s:%u\n", path,
+                                                line_number);
+                                        exit(EXIT_FAILURE);
+                                }
+
+                                if (corners < 2) {
+                                        face[corners] = (uint)index;
+                                } else {
+                                        face[2] = (uint)index;
+                                        add_triangle(mesh, face[0], face[1], face[2]);
+                                        face[1] = face[2];
+                                }
+                                corners++;
+                        }
+                }
+        }
+}
+
+// Binary STL is recognised by its size, anything else is parsed as ASCII.
+// Vertices are not shared between facets, neither the distance nor the
+// winding number need connectivity.
+static void
+load_stl(struct mesh* const mesh, FILE* file, char const* path)
+{
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 80, SEEK_SET);
+
+        uint32_t facets = 0;
+        if (size >= 84 && fread(&facets, sizeof(facets), 1, file) == 1 &&
+            (uint64_t)size == 84 + 50 * (uint64_t)facets) {
+                for (uint32_t i = 0; i < facets; i++) {
+                        unsigned char record[50];
+                        if (fread(record, sizeof(record), 1, file) != 1) {
+                                fprintf(stderr, "ERROR: Truncated STL file %s\n", path);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        // Skip the facet normal, winding order decides the sign
+                        for (uint corner = 0; corner < 3; corner++) {
+                                float vertex[3];
+                                memcpy(vertex, record + 12 + 12 * corner, sizeof(vertex));
+                                add_vertex(mesh, vertex[0], vertex[1], vertex[2]);
+                        }
+                        add_triangle(mesh, mesh->vertex_count - 3, mesh->vertex_count - 2,
+                                     mesh->vertex_count - 1);
+                }
+                return;
+        }
+
+        fseek(file, 0, SEEK_SET);
+        char line[LINE_LENGTH];
+        uint corners = 0;
+
+        while (fgets(line, sizeof(line), file)) {
+                char* text = line + strspn(line, " \t");
+                float x, y, z;
+
+                if (!strncmp(text, "vertex", 6) && sscanf(text + 6, "%f %f %f", &x, &y, &z) == 3) {
+                        add_vertex(mesh, x, y, z);
+                        if (++corners % 3 == 0) {
+                                add_triangle(mesh, mesh->vertex_count - 3, mesh->vertex_count - 2,
+                                             mesh->vertex_count - 1);
+                        }
+                }
+        }
+}
+
+static void
+load_mesh(struct mesh* const mesh, char const* path)
+{
+        FILE* file = fopen(path, "rb");
+        if (!file) {
+                fprintf(stderr, "ERROR: Could not open file: %s, does it exist?\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        *mesh = (struct mesh){ NULL, NULL, 0, 0, 0, 0 };
+
+        char const* extension = strrchr(path, '.');
+        if (extension && !strcasecmp(extension, ".obj")) {
+                load_obj(mesh, file, path);
+        } else if (extension && !strcasecmp(extension, ".stl")) {
+                load_stl(mesh, file, path);
+        } else {
+                fprintf(stderr, "ERROR: %s is neither an OBJ nor an STL file\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        fclose(file);
+
+        if (!mesh->triangle_count) {
+                fprintf(stderr, "ERROR: %s has no triangles\n", path);
+                exit(EXIT_FAILURE);
+        }
+}
+
+// Centres the mesh on the origin and scales its longest side to size
+static void
+fit_mesh(struct mesh* const mesh, float size, float* const extent)
+{
+        float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        for (uint i = 0; i < mesh->vertex_count; i++) {
+                for (uint axis = 0; axis < 3; axis++) {
+                        min[axis] = fminf(min[axis], mesh->vertices[3 * i + axis]);
+                        max[axis] = fmaxf(max[axis], mesh->vertices[3 * i + axis]);
+                }
+        }
+
+        float longest = fmaxf(max[0] - min[0], fmaxf(max[1] - min[1], max[2] - min[2]));
+        float scale = longest > 0.0f ? size / longest : 1.0f;
+
+        for (uint i = 0; i < mesh->vertex_count; i++) {
+                for (uint axis = 0; axis < 3; axis++) {
+                        float center = .5f * (min[axis] + max[axis]);
+                        mesh->vertices[3 * i + axis] = (mesh->vertices[3 * i + axis] - center) * scale;
+                }
+        }
+
+        for (uint axis = 0; axis < 3; axis++) {
+                extent[axis] = (max[axis] - min[axis]) * scale;
+        }
+}
+
+// =========================================================================================================
+// Triangle BVH
+// =========================================================================================================
+
+static float const*
+corner(struct mesh const* const mesh, uint triangle, uint i)
+{
+        return mesh->vertices + 3 * mesh->triangles[3 * triangle + i];
+}
+
+static void
+cross(float* const out, float const* const a, float const* const b)
+{
+        out[0] = a[1] * b[2] - a[2] * b[1];
+        out[1] = a[2] * b[0] - a[0] * b[2];
+        out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float
+dot(float const* const a, float const* const b)
+{
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static float
+distance(float const* const a, float const* const b)
+{
+        float d[3] = { a[0] - b[0], a[1] - b[1], a[2] - b[2] };
+        return sqrtf(dot(d, d));
+}
+
+// Splits at the middle of the centroid bounds on their longest axis. The
+// converter runs once per asset, a midpoint split keeps the tree good enough
+// without the SAH machinery of bvh.c.
+static uint
+build_tree_node(struct tree* const tree, struct mesh const* const mesh, uint index,
+                uint first, uint count, uint depth)
+{
+        tree->depth = depth > tree->depth ? depth : tree->depth;
+
+        struct tree_node* node = &tree->nodes[index];
+        float centroid_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float centroid_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        for (uint axis = 0; axis < 3; axis++) {
+                node->min[axis] = FLT_MAX;
+                node->max[axis] = -FLT_MAX;
+        }
+
+        for (uint i = first; i < first + count; i++) {
+                uint triangle = tree->indices[i];
+                for (uint axis = 0; axis < 3; axis++) {
+                        for (uint j = 0; j < 3; j++) {
+                                node->min[axis] = fminf(node->min[axis], corner(mesh, triangle, j)[axis]);
+                                node->max[axis] = fmaxf(node->max[axis], corner(mesh, triangle, j)[axis]);
+                        }
+                        centroid_min[axis] = fminf(centroid_min[axis], tree->centroids[3 * triangle + axis]);
+                        centroid_max[axis] = fmaxf(centroid_max[axis], tree->centroids[3 * triangle + axis]);
+                }
+        }
+
+        uint axis = 0;
+        for (uint i = 1; i < 3; i++) {
+                if (centroid_max[i] - centroid_min[i] > centroid_max[axis] - centroid_min[axis]) {
+                        axis = i;
+                }
+        }
+
+        uint middle = first;
+        if (count > TREE_LEAF_SIZE) {
+                float split = .5f * (centroid_min[axis] + centroid_max[axis]);
+                uint left = first, right = first + count;
+
+                while (left < right) {
+                        if (tree->centroids[3 * tree->indices[left] + axis] < split) {
+                                left++;
+                        } else {
+                                uint swap = tree->indices[left];
+                                tree->indices[left] = tree->indices[--right];
+                                tree->indices[right] = swap;
+                        }
+                }
+
+                // Coincident centroids, split by count
+                middle = left == first || left == first + count ? first + count / 2 : left;
+        }
+
+        float* area_normal = node->area_normal;
+        float* center = node->center;
+        uint next;
+
+        if (middle == first) {
+                node->offset = first;
+                node->count = count;
+                area_normal[0] = area_normal[1] = area_normal[2] = 0.0f;
+                center[0] = center[1] = center[2] = 0.0f;
+                node->area = 0.0f;
+
+                for (uint i = first; i < first + count; i++) {
+                        uint triangle = tree->indices[i];
+                        float const* a = corner(mesh, triangle, 0);
+                        float const* b = corner(mesh, triangle, 1);
+                        float const* c = corner(mesh, triangle, 2);
+                        float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                        float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+                        float normal[3];
+                        cross(normal, ab, ac);
+
+                        float triangle_area = .5f * sqrtf(dot(normal, normal));
+                        for (uint k = 0; k < 3; k++) {
+                                area_normal[k] += .5f * normal[k];
+                                center[k] += triangle_area * tree->centroids[3 * triangle + k];
+                        }
+                        node->area += triangle_area;
+                }
+
+                next = index + 1;
+        } else {
+                node->count = 0;
+                uint right = build_tree_node(tree, mesh, index + 1, first, middle - first, depth + 1);
+                next = build_tree_node(tree, mesh, right, middle, first + count - middle, depth + 1);
+                node->offset = right;
+
+                struct tree_node const* children[2] = { &tree->nodes[index + 1], &tree->nodes[right] };
+                node->area = children[0]->area + children[1]->area;
+                for (uint k = 0; k < 3; k++) {
+                        area_normal[k] = children[0]->area_normal[k] + children[1]->area_normal[k];
+                        center[k] = children[0]->area * children[0]->center[k] +
+                                    children[1]->area * children[1]->center[k];
+                }
+        }
+
+        // Area weighted centre, the box centre for degenerate triangles
+        for (uint k = 0; k < 3; k++) {
+                center[k] = node->area > 0.0f ? center[k] / node->area : .5f * (node->min[k] + node->max[k]);
+        }
+
+        // Every corner of the box lies within this radius of the centre
+        node->radius = 0.0f;
+        for (uint k = 0; k < 8; k++) {
+                float box_corner[3] = { k & 1 ? node->max[0] : node->min[0],
+                                        k & 2 ? node->max[1] : node->min[1],
+                                        k & 4 ? node->max[2] : node->min[2] };
+                node->radius = fmaxf(node->radius, distance(center, box_corner));
+        }
+
+        return next;
+}
+
+static void
+build_tree(struct tree* const tree, struct mesh const* const mesh)
+{
+        uint count = mesh->triangle_count;
+
+        tree->indices = allocate(sizeof(*tree->indices) * count);
+        tree->centroids = allocate(sizeof(*tree->centroids) * 3 * count);
+        tree->nodes = allocate(sizeof(*tree->nodes) * 2 * count);
+
+        for (uint i = 0; i < count; i++) {
+                tree->indices[i] = i;
+                for (uint axis = 0; axis < 3; axis++) {
+                        tree->centroids[3 * i + axis] = (corner(mesh, i, 0)[axis] + corner(mesh, i, 1)[axis] +
+                                                         corner(mesh, i, 2)[axis]) / 3.0f;
+                }
+        }
+
+        tree->depth = 0;
+        tree->node_count = build_tree_node(tree, mesh, 0, 0, count, 0);
+}
+
+// =========================================================================================================
+// Distance and winding number
+// =========================================================================================================
+
+// Squared distance to the closest point of a triangle, from Ericson's
+// "Real-Time Collision Detection" 5.1.5
+static float
+triangle_distance2(float const* const p, float const* const a, float const* const b,
+                   float const* const c)
+{
+        float ab[3], ac[3], ap[3], closest[3];
+        for (uint k = 0; k < 3; k++) {
+                ab[k] = b[k] - a[k];
+                ac[k] = c[k] - a[k];
+                ap[k] = p[k] - a[k];
+        }
+
+        float d1 = dot(ab, ap), d2 = dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f) {
+                return dot(ap, ap);
+        }
+
+        float bp[3] = { p[0] - b[0], p[1] - b[1], p[2] - b[2] };
+        float d3 = dot(ab, bp), d4 = dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3) {
+                return dot(bp, bp);
+        }
+
+        float cp[3] = { p[0] - c[0], p[1] - c[1], p[2] - c[2] };
+        float d5 = dot(ab, cp), d6 = dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6) {
+                return dot(cp, cp);
+        }
+
+        float vc = d1 * d4 - d3 * d2;
+        float vb = d5 * d2 - d1 * d6;
+        float va = d3 * d6 - d5 * d4;
+
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+                float v = d1 / (d1 - d3);
+                for (uint k = 0; k < 3; k++) {
+                        closest[k] = a[k] + v * ab[k];
+                }
+        } else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+                float w = d2 / (d2 - d6);
+                for (uint k = 0; k < 3; k++) {
+                        closest[k] = a[k] + w * ac[k];
+                }
+        } else if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+                float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+                for (uint k = 0; k < 3; k++) {
+                        closest[k] = b[k] + w * (c[k] - b[k]);
+                }
+        } else {
+                float denominator = 1.0f / (va + vb + vc);
+                float v = vb * denominator, w = vc * denominator;
+                for (uint k = 0; k < 3; k++) {
+                        closest[k] = a[k] + ab[k] * v + ac[k] * w;
+                }
+        }
+
+        float d[3] = { p[0] - closest[0], p[1] - closest[1], p[2] - closest[2] };
+        return dot(d, d);
+}
+
+static float
+box_distance2(float const* const p, struct tree_node const* const node)
+{
+        float d2 = 0.0f;
+        for (uint k = 0; k < 3; k++) {
+                float d = fmaxf(fmaxf(node->min[k] - p[k], p[k] - node->max[k]), 0.0f);
+                d2 += d * d;
+        }
+
+        return d2;
+}
+
+// Unsigned distance to the mesh, nearest box first. The stack holds one
+// entry per level, tree->depth + 1 of them.
+static float
+mesh_distance(struct mesh const* const mesh, struct tree const* const tree, float const* const p,
+              uint* const stack)
+{
+        float best = FLT_MAX;
+        uint top = 0;
+        uint node = 0;
+
+        for (;;) {
+                struct tree_node const* current = &tree->nodes[node];
+
+                if (box_distance2(p, current) < best) {
+                        if (current->count) {
+                                for (uint i = current->offset; i < current->offset + current->count; i++) {
+                                        uint triangle = tree->indices[i];
+                                        best = fminf(best, triangle_distance2(p, corner(mesh, triangle, 0),
+                                                                              corner(mesh, triangle, 1),
+                                                                              corner(mesh, triangle, 2)));
+                                }
+                        } else {
+                                uint near = node + 1, far = current->offset;
+                                if (box_distance2(p, &tree->nodes[far]) <
+                                    box_distance2(p, &tree->nodes[near])) {
+                                        near = current->offset;
+                                        far = node + 1;
+                                }
+
+                                stack[top++] = far;
+                                node = near;
+                                continue;
+                        }
+                }
+
+                if (!top) {
+                        break;
+                }
+                node = stack[--top];
+        }
+
+        return sqrtf(best);
+}
+
+// Solid angle of a triangle seen from p, from Van Oosterom and Strackee
+static float
+solid_angle(float const* const p, float const* const a, float const* const b, float const* const c)
+{
+        float pa[3] = { a[0] - p[0], a[1] - p[1], a[2] - p[2] };
+        float pb[3] = { b[0] - p[0], b[1] - p[1], b[2] - p[2] };
+        float pc[3] = { c[0] - p[0], c[1] - p[1], c[2] - p[2] };
+        float la = sqrtf(dot(pa, pa)), lb = sqrtf(dot(pb, pb)), lc = sqrtf(dot(pc, pc));
+
+        float bc[3];
+        cross(bc, pb, pc);
+
+        float numerator = dot(pa, bc);
+        float denominator = la * lb * lc + dot(pa, pb) * lc + dot(pa, pc) * lb + dot(pb, pc) * la;
+
+        return 2.0f * atan2f(numerator, denominator);
+}
+
+// Sum of the solid angles of every triangle seen from p, after Barill et al.
+// "Fast Winding Numbers for Soups and Clouds". Distant clusters are
+// replaced by a dipole at their centre.
+static float
+mesh_solid_angle(struct mesh const* const mesh, struct tree const* const tree, uint index,
+                 float const* const p)
+{
+        struct tree_node const* node = &tree->nodes[index];
+        float offset[3] = { node->center[0] - p[0], node->center[1] - p[1], node->center[2] - p[2] };
+        float length = sqrtf(dot(offset, offset));
+
+        if (length > WINDING_ACCURACY * node->radius) {
+                return dot(offset, node->area_normal) / (length * length * length);
+        }
+
+        if (!node->count) {
+                return mesh_solid_angle(mesh, tree, index + 1, p) +
+                       mesh_solid_angle(mesh, tree, node->offset, p);
+        }
+
+        float angle = 0.0f;
+        for (uint i = node->offset; i < node->offset + node->count; i++) {
+                uint triangle = tree->indices[i];
+                angle += solid_angle(p, corner(mesh, triangle, 0), corner(mesh, triangle, 1),
+                                     corner(mesh, triangle, 2));
+        }
+
+        return angle;
+}
+
+static float
+signed_distance(struct sdf_job const* const job, float const* const p, uint* const stack)
+{
+        float dist = mesh_distance(job->mesh, job->tree, p, stack);
+        float winding = mesh_solid_angle(job->mesh, job->tree, 0, p) / (4.0f * (float)M_PI);
+
+        return winding > .5f ? -dist : dist;
+}
+
+// Slices are interleaved between the threads, the cost of a slice depends
+// on how much of the mesh it cuts
+static void*
+fill_volume(void* argument)
+{
+        struct sdf_job const* job = argument;
+        uint32_t const* dims = job->dims;
+        uint* stack = allocate(sizeof(*stack) * (job->tree->depth + 1));
+
+        for (uint z = job->first; z < dims[2]; z += job->step) {
+                for (uint y = 0; y < dims[1]; y++) {
+                        for (uint x = 0; x < dims[0]; x++) {
+                                float p[3] = { job->min[0] + (float)x * job->voxel_size,
+                                               job->min[1] + (float)y * job->voxel_size,
+                                               job->min[2] + (float)z * job->voxel_size };
+
+                                job->data[((uint64_t)z * dims[1] + y) * dims[0] + x] =
+                                        signed_distance(job, p, stack);
+                        }
+                }
+        }
+
+        free(stack);
+
+        return NULL;
+}
+
+// Bricks without a sample closer to the surface than a brick width are left
+// to the coarse level
+static void*
+fill_bricks(void* argument)
+{
+        struct sdf_job const* job = argument;
+        struct brick_output* output = job->bricks;
+        uint32_t const* counts = output->counts;
+        uint64_t brick_count = (uint64_t)counts[0] * counts[1] * counts[2];
+
+        uint* stack = allocate(sizeof(*stack) * (job->tree->depth + 1));
+        float samples[BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES];
+        float empty_distance = BRICK_SIZE * job->voxel_size;
+
+        for (uint64_t brick = job->first; brick < brick_count; brick += job->step) {
+                uint origin[3] = { (uint)(brick % counts[0]) * BRICK_SIZE,
+                                   (uint)(brick / counts[0] % counts[1]) * BRICK_SIZE,
+                                   (uint)(brick / counts[0] / counts[1]) * BRICK_SIZE };
+                int empty = 1;
+
+                for (uint z = 0; z < BRICK_SAMPLES; z++) {
+                        for (uint y = 0; y < BRICK_SAMPLES; y++) {
+                                for (uint x = 0; x < BRICK_SAMPLES; x++) {
+                                        float p[3] = {
+                                                job->min[0] + (float)(origin[0] + x) * job->voxel_size,
+                                                job->min[1] + (float)(origin[1] + y) * job->voxel_size,
+                                                job->min[2] + (float)(origin[2] + z) * job->voxel_size
+                                        };
+
+                                        float dist = signed_distance(job, p, stack);
+                                        samples[(z * BRICK_SAMPLES + y) * BRICK_SAMPLES + x] = dist;
+                                        empty = empty && fabsf(dist) > empty_distance;
+                                }
+                        }
+                }
+
+                if (empty) {
+                        output->table[brick] = BRICK_EMPTY;
+                        continue;
+                }
+
+                pthread_mutex_lock(&output->lock);
+                uint64_t offset = output->next_offset;
+                output->next_offset += sizeof(samples);
+                output->stored++;
+                pthread_mutex_unlock(&output->lock);
+
+                if (pwrite(output->file, samples, sizeof(samples), (off_t)offset) != sizeof(samples)) {
+                        fprintf(stderr, "ERROR: Could not write the bricks\n");
+                        exit(EXIT_FAILURE);
+                }
+                output->table[brick] = offset;
+        }
+
+        free(stack);
+
+        return NULL;
+}
+
+static void
+run_jobs(void* (*fill)(void*), struct sdf_job const* const job, uint thread_count)
+{
+        pthread_t threads[MAX_SDF_THREADS];
+        struct sdf_job jobs[MAX_SDF_THREADS];
+        int running[MAX_SDF_THREADS] = { 0 };
+
+        // The calling thread takes the first share, and any share whose
+        // thread could not be started
+        for (uint i = 0; i < thread_count; i++) {
+                jobs[i] = *job;
+                jobs[i].first = i;
+                jobs[i].step = thread_count;
+        }
+
+        for (uint i = 1; i < thread_count; i++) {
+                running[i] = !pthread_create(&threads[i], NULL, fill, &jobs[i]);
+        }
+
+        for (uint i = 0; i < thread_count; i++) {
+                if (running[i]) {
+                        pthread_join(threads[i], NULL);
+                } else {
+                        fill(&jobs[i]);
+                }
+        }
+}
+
+// =========================================================================================================
+// Output
+// =========================================================================================================
+
+// Writes the header and the samples as they are in memory, the format is
+// little endian like every host the renderer runs on
+static void
+write_volume(char const* path, struct volume_header const* const header, float const* const data)
+{
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+                fprintf(stderr, "ERROR: Could not create file: %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        char padding[VOLUME_DATA_ALIGNMENT] = { 0 };
+        size_t padding_size = header->data_offset - sizeof(*header);
+
+        if (fwrite(header, sizeof(*header), 1, file) != 1 ||
+            fwrite(padding, 1, padding_size, file) != padding_size ||
+            fwrite(data, header->data_size, 1, file) != 1 || fclose(file)) {
+                fprintf(stderr, "ERROR: Could not write file: %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+}
+
+static uint64_t
+align(uint64_t offset)
+{
+        return (offset + VOLUME_DATA_ALIGNMENT - 1) / VOLUME_DATA_ALIGNMENT * VOLUME_DATA_ALIGNMENT;
+}
+
+static void
+convert_volume(struct sdf_job* const job, float const* const extent, float size, uint resolution,
+               uint thread_count, char const* path)
+{
+        // resolution samples along the longest side, padding included
+        struct volume_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, VOLUME_MAGIC, sizeof(header.magic));
+        header.version = VOLUME_VERSION;
+        header.voxel_size = size / (float)(resolution - 1 - 2 * VOLUME_PADDING);
+
+        for (uint axis = 0; axis < 3; axis++) {
+                uint dim = (uint)ceilf(extent[axis] / header.voxel_size) + 1 + 2 * VOLUME_PADDING;
+                header.dims[axis] = dim < resolution ? dim : resolution;
+                header.min[axis] = -.5f * (float)(header.dims[axis] - 1) * header.voxel_size;
+        }
+
+        uint64_t samples = (uint64_t)header.dims[0] * header.dims[1] * header.dims[2];
+        header.data_offset = align(sizeof(header));
+        header.data_size = samples * sizeof(float);
+
+        job->min = header.min;
+        job->voxel_size = header.voxel_size;
+        job->dims = header.dims;
+        job->data = allocate(header.data_size);
+        run_jobs(fill_volume, job, thread_count);
+
+        write_volume(path, &header, job->data);
+        free(job->data);
+
+        printf("%s: %u triangles, %ux%ux%u samples, %u threads\n", path,
+               job->mesh->triangle_count, header.dims[0], header.dims[1], header.dims[2],
+               thread_count);
+}
+
+static void
+convert_bricks(struct sdf_job* const job, float const* const extent, float size, uint resolution,
+               uint thread_count, char const* path)
+{
+        struct brick_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BRICKS_MAGIC, sizeof(header.magic));
+        header.version = BRICKS_VERSION;
+        header.brick_size = BRICK_SIZE;
+        header.voxel_size = size / (float)(resolution - 1 - 2 * VOLUME_PADDING);
+
+        // Whole bricks, so the sample count is rounded up to a multiple of
+        // BRICK_SIZE plus the shared last face
+        for (uint axis = 0; axis < 3; axis++) {
+                uint cells = (uint)ceilf(extent[axis] / header.voxel_size) + 2 * VOLUME_PADDING;
+                header.counts[axis] = (cells + BRICK_SIZE - 1) / BRICK_SIZE;
+                header.dims[axis] = header.counts[axis] * BRICK_SIZE + 1;
+                header.min[axis] = -.5f * (float)(header.dims[axis] - 1) * header.voxel_size;
+        }
+
+        uint32_t coarse_dims[3] = { header.counts[0] + 1, header.counts[1] + 1, header.counts[2] + 1 };
+        uint64_t coarse_size = sizeof(float) * coarse_dims[0] * coarse_dims[1] * coarse_dims[2];
+        uint64_t brick_count = (uint64_t)header.counts[0] * header.counts[1] * header.counts[2];
+
+        header.coarse_offset = align(sizeof(header));
+        header.table_offset = align(header.coarse_offset + coarse_size);
+        header.bricks_offset = align(header.table_offset + sizeof(uint64_t) * brick_count);
+
+        int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file < 0) {
+                fprintf(stderr, "ERROR: Could not create file: %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        // The coarse level samples the brick corners, one brick is one voxel
+        job->min = header.min;
+        job->voxel_size = header.voxel_size * BRICK_SIZE;
+        job->dims = coarse_dims;
+        job->data = allocate(coarse_size);
+        run_jobs(fill_volume, job, thread_count);
+
+        struct brick_output output;
+        output.file = file;
+        output.counts = header.counts;
+        output.table = allocate(sizeof(*output.table) * brick_count);
+        output.next_offset = header.bricks_offset;
+        output.stored = 0;
+        pthread_mutex_init(&output.lock, NULL);
+
+        job->voxel_size = header.voxel_size;
+        job->dims = header.dims;
+        job->bricks = &output;
+        run_jobs(fill_bricks, job, thread_count);
+
+        if (pwrite(file, &header, sizeof(header), 0) != sizeof(header) ||
+            pwrite(file, job->data, coarse_size, (off_t)header.coarse_offset) != (ssize_t)coarse_size ||
+            pwrite(file, output.table, sizeof(*output.table) * brick_count,
+                   (off_t)header.table_offset) != (ssize_t)(sizeof(*output.table) * brick_count) ||
+            close(file)) {
+                fprintf(stderr, "ERROR: Could not write file: %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        printf("%s: %u triangles, %ux%ux%u samples, %u of %lu bricks stored, %u threads\n", path,
+               job->mesh->triangle_count, header.dims[0], header.dims[1], header.dims[2],
+               output.stored, (unsigned long)brick_count, thread_count);
+
+        pthread_mutex_destroy(&output.lock);
+        free(output.table);
+        free(job->data);
+}
+
+int
+main(int argc, char** argv)
+{
+        int bricked = 0;
+        float size = MESH_FIT_SIZE;
+        int option, usage = 0;
+
+        while ((option = getopt(argc, argv, "bs:")) != -1) {
+                if (option == 'b') {
+                        bricked = 1;
+                } else if (option == 's') {
+                        size = strtof(optarg, NULL);
+                } else {
+                        usage = 1;
+                }
+        }
+
+        if (usage || !(size > 0.0f) || argc - optind < 2 || argc - optind > 3) {
+                fprintf(stderr, "Usage: %s [-b] [-s size] <mesh.obj|mesh.stl> <out.sdf> [resolution]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        long max_resolution = bricked ? MAX_BRICKED_RESOLUTION : MAX_VOLUME_RESOLUTION;
+        long resolution = argc - optind == 3 ? strtol(argv[optind + 2], NULL, 10) : DEFAULT_RESOLUTION;
+        if (resolution < MIN_RESOLUTION || resolution > max_resolution) {
+                fprintf(stderr, "ERROR: The resolution must be between %d and %ld\n", MIN_RESOLUTION,
+                        max_resolution);
+                return EXIT_FAILURE;
+        }
+
+        struct mesh mesh;
+        load_mesh(&mesh, argv[optind]);
+
+        float extent[3];
+        fit_mesh(&mesh, size, extent);
+
+        struct tree tree;
+        build_tree(&tree, &mesh);
+
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        uint thread_count = cores < 1 ? 1 : cores > MAX_SDF_THREADS ? MAX_SDF_THREADS : (uint)cores;
+
+        struct sdf_job job = { &mesh, &tree, NULL, 0.0f, NULL, NULL, NULL, 0, 1 };
+
+        if (bricked) {
+                convert_bricks(&job, extent, size, (uint)resolution, thread_count, argv[optind + 1]);
+        } else {
+                convert_volume(&job, extent, size, (uint)resolution, thread_count, argv[optind + 1]);
+        }
+
+        free(tree.nodes);
+        free(tree.indices);
+        free(tree.centroids);
+        free(mesh.vertices);
+        free(mesh.triangles);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+#include "noise.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+typedef unsigned int            uint;
+
+// Slice of both textures filled by one thread
+struct noise_job {
+        float*  gradients;
+        float*  values;
+        uint    first_row, last_row;
+        uint    first_slice, last_slice;
+};
+
+// PCG hashes from Jarzynski and Olano, "Hash Functions for GPU Rendering".
+// Must match pcg2d() and pcg3d() in shaders/noise.glsl bit for bit.
+static void
+pcg2d(uint* x, uint* y)
+{
+        *x = *x * 1664525u + 1013904223u;
+        *y = *y * 1664525u + 1013904223u;
+
+        *x += *y * 1664525u;
+        *y += *x * 1664525u;
+
+        *x ^= *x >> 16u;
+        *y ^= *y >> 16u;
+
+        *x += *y * 1664525u;
+        *y += *x * 1664525u;
+
+        *x ^= *x >> 16u;
+        *y ^= *y >> 16u;
+}
+
+static uint
+pcg3d(uint x, uint y, uint z)
+{
+        x = x * 1664525u + 1013904223u;
+        y = y * 1664525u + 1013904223u;
+        z = z * 1664525u + 1013904223u;
+
+        x += y * z;
+        y += z * x;
+        z += x * y;
+
+        x ^= x >> 16u;
+        y ^= y >> 16u;
+        z ^= z >> 16u;
+
+        x += y * z;
+
+        return x;
+}
+
+static float
+unit_float(uint value)
+{
+        return (float)value * (1.0f / 4294967295.0f);
+}
+
+static void*
+fill_noise(void* argument)
+{
+        struct noise_job const* job = argument;
+
+        // Gradients in [-1, 1]^2, one per lattice point
+        for (uint y = job->first_row; y < job->last_row; y++) {
+                for (uint x = 0; x < NOISE_TEXTURE_SIZE; x++) {
+                        uint gx = x, gy = y;
+                        pcg2d(&gx, &gy);
+
+                        float* texel = job->gradients + 2 * (y * NOISE_TEXTURE_SIZE + x);
+                        texel[0] = -1.0f + 2.0f * unit_float(gx);
+                        texel[1] = -1.0f + 2.0f * unit_float(gy);
+                }
+        }
+
+        // Values in [0, 1], one per lattice point
+        for (uint z = job->first_slice; z < job->last_slice; z++) {
+                for (uint y = 0; y < NOISE_VOLUME_SIZE; y++) {
+                        for (uint x = 0; x < NOISE_VOLUME_SIZE; x++) {
+                                job->values[(z * NOISE_VOLUME_SIZE + y) * NOISE_VOLUME_SIZE + x] =
+                                        unit_float(pcg3d(x, y, z));
+                        }
+                }
+        }
+
+        return NULL;
+}
+
+void
+create_noise_textures(GLuint* const textures)
+{
+        float* gradients = malloc(sizeof(*gradients) * 2 * NOISE_TEXTURE_SIZE * NOISE_TEXTURE_SIZE);
+        float* values = malloc(sizeof(*values) * NOISE_VOLUME_SIZE * NOISE_VOLUME_SIZE *
+                               NOISE_VOLUME_SIZE);
+        if (!gradients || !values) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the noise textures\n");
+                exit(EXIT_FAILURE);
+        }
+
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        uint thread_count = cores < 1 ? 1 : cores > MAX_NOISE_THREADS ? MAX_NOISE_THREADS : (uint)cores;
+
+        pthread_t threads[MAX_NOISE_THREADS];
+        struct noise_job jobs[MAX_NOISE_THREADS];
+        int running[MAX_NOISE_THREADS] = { 0 };
+
+        for (uint i = 0; i < thread_count; i++) {
+                jobs[i] = (struct noise_job){
+                        gradients, values,
+                        i * NOISE_TEXTURE_SIZE / thread_count, (i + 1) * NOISE_TEXTURE_SIZE / thread_count,
+                        i * NOISE_VOLUME_SIZE / thread_count, (i + 1) * NOISE_VOLUME_SIZE / thread_count
+                };
+        }
+
+        // The calling thread fills the first slice, and any slice whose
+        // thread could not be started
+        for (uint i = 1; i < thread_count; i++) {
+                running[i] = !pthread_create(&threads[i], NULL, fill_noise, &jobs[i]);
+        }
+
+        for (uint i = 0; i < thread_count; i++) {
+                if (running[i]) {
+                        pthread_join(threads[i], NULL);
+                } else {
+                        fill_noise(&jobs[i]);
+                }
+        }
+
+        glGenTextures(2, textures);
+
+        glActiveTexture(GL_TEXTURE0 + NOISE_GRADIENT_UNIT);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, NOISE_TEXTURE_SIZE, NOISE_TEXTURE_SIZE, 0,
+                     GL_RG, GL_FLOAT, gradients);
+
+        // Linear filtering lets n3D() interpolate all eight corners in one fetch
+        glActiveTexture(GL_TEXTURE0 + NOISE_VALUE_UNIT);
+        glBindTexture(GL_TEXTURE_3D, textures[1]);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, NOISE_VOLUME_SIZE, NOISE_VOLUME_SIZE,
+                     NOISE_VOLUME_SIZE, 0, GL_RED, GL_FLOAT, values);
+
+        glActiveTexture(GL_TEXTURE0);
+
+        free(gradients);
+        free(values);
+}
+
+void
+delete_noise_textures(GLuint const* const textures)
+{
+        glDeleteTextures(2, textures);
+}
@@ -0,0 +1,26 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <glad/glad.h>
+
+// Lattice noise textures sampled by shaders/noise.glsl. Both tile, so their
+// sizes must be powers of two.
+#define NOISE_TEXTURE_SIZE      256
+#define NOISE_VOLUME_SIZE       64
+
+// Texture units, matching the binding qualifiers in shaders/noise.glsl
+#define NOISE_GRADIENT_UNIT     0
+#define NOISE_VALUE_UNIT        1
+
+#define MAX_NOISE_THREADS       16
+
+// Hash used by the noise functions, matching NOISE_HASH in shaders/noise.glsl
+#define NOISE_SIN               0
+#define NOISE_PCG               1
+#define NOISE_TEXTURE           2
+#define NOISE_HASHES            3
+
+void            create_noise_textures(GLuint* const textures);
+void            delete_noise_textures(GLuint const* const textures);
+
+#endif
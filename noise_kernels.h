@@ -0,0 +1,276 @@
+// Noise kernels of one width, included by noise_simd.c once per width with
+// LANES and KERNEL(name) defined. Comparisons of vectors give lanes of all
+// ones or zeros, used as masks.
+typedef float           KERNEL(vfloat) __attribute__((vector_size(LANES * sizeof(float))));
+typedef int32_t         KERNEL(vint) __attribute__((vector_size(LANES * sizeof(int32_t))));
+typedef uint32_t        KERNEL(vuint) __attribute__((vector_size(LANES * sizeof(uint32_t))));
+
+#define vfloat          KERNEL(vfloat)
+#define vint            KERNEL(vint)
+#define vuint           KERNEL(vuint)
+
+// Up to count lanes, the rest zero
+INLINE vfloat
+KERNEL(load)(float const* values, ulint count)
+{
+        vfloat vector = { 0.f };
+        memcpy(&vector, values, sizeof(float) * count);
+        return vector;
+}
+
+INLINE void
+KERNEL(store)(float* values, vfloat vector, ulint count)
+{
+        memcpy(values, &vector, sizeof(float) * count);
+}
+
+INLINE vfloat
+KERNEL(select)(vint mask, vfloat a, vfloat b)
+{
+        return (vfloat)((mask & (vint)a) | (~mask & (vint)b));
+}
+
+INLINE int
+KERNEL(any)(vint mask)
+{
+        for (uint lane = 0; lane < LANES; lane++) {
+                if (mask[lane]) {
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+// For |x| < 2^31, like the lattice coordinates
+INLINE vfloat
+KERNEL(floor)(vfloat x)
+{
+        vfloat truncated = __builtin_convertvector(__builtin_convertvector(x, vint), vfloat);
+        return truncated + __builtin_convertvector(truncated > x, vfloat);
+}
+
+INLINE vfloat
+KERNEL(mix)(vfloat a, vfloat b, vfloat t)
+{
+        return a * (1.f - t) + b * t;
+}
+
+INLINE vfloat
+KERNEL(smoothstep)(float edge0, float edge1, vfloat x)
+{
+        vfloat t = (x - edge0) / (edge1 - edge0);
+        t = KERNEL(select)(t < 0.f, (vfloat){ 0.f } + 0.f, t);
+        t = KERNEL(select)(t > 1.f, (vfloat){ 0.f } + 1.f, t);
+        return t * t * (3.f - 2.f * t);
+}
+
+INLINE void
+KERNEL(pcg2d)(vuint* x, vuint* y)
+{
+        *x = *x * 1664525u + 1013904223u;
+        *y = *y * 1664525u + 1013904223u;
+
+        *x += *y * 1664525u;
+        *y += *x * 1664525u;
+
+        *x ^= *x >> 16u;
+        *y ^= *y >> 16u;
+
+        *x += *y * 1664525u;
+        *y += *x * 1664525u;
+
+        *x ^= *x >> 16u;
+        *y ^= *y >> 16u;
+}
+
+// x of pcg3d()
+INLINE vuint
+KERNEL(pcg3d)(vuint x, vuint y, vuint z)
+{
+        x = x * 1664525u + 1013904223u;
+        y = y * 1664525u + 1013904223u;
+        z = z * 1664525u + 1013904223u;
+
+        x += y * z;
+        y += z * x;
+        z += x * y;
+
+        x ^= x >> 16u;
+        y ^= y >> 16u;
+        z ^= z >> 16u;
+
+        return x + y * z;
+}
+
+INLINE vuint
+KERNEL(lattice)(vfloat x)
+{
+        return (vuint)__builtin_convertvector(x, vint);
+}
+
+// hash(), the texture holds the PCG gradients of the wrapped lattice as
+// noise.c computed them
+INLINE void
+KERNEL(gradient)(vfloat x, vfloat y, uint hash, vfloat* gradient_x, vfloat* gradient_y)
+{
+        vuint ux = KERNEL(lattice)(x), uy = KERNEL(lattice)(y);
+
+        if (hash == NOISE_TEXTURE) {
+                ux &= (uint32_t)(NOISE_TEXTURE_SIZE - 1);
+                uy &= (uint32_t)(NOISE_TEXTURE_SIZE - 1);
+                KERNEL(pcg2d)(&ux, &uy);
+
+                *gradient_x = -1.f + 2.f * (__builtin_convertvector(ux, vfloat) * (1.f / 4294967295.f));
+                *gradient_y = -1.f + 2.f * (__builtin_convertvector(uy, vfloat) * (1.f / 4294967295.f));
+        } else {
+                KERNEL(pcg2d)(&ux, &uy);
+
+                *gradient_x = -1.f + 2.f * __builtin_convertvector(ux, vfloat) / 4294967295.f;
+                *gradient_y = -1.f + 2.f * __builtin_convertvector(uy, vfloat) / 4294967295.f;
+        }
+}
+
+INLINE vfloat
+KERNEL(noise_lanes)(vfloat x, vfloat y, uint hash)
+{
+        vfloat id_x = KERNEL(floor)(x), id_y = KERNEL(floor)(y);
+        vfloat gv_x = x - id_x, gv_y = y - id_y;
+
+        vfloat curve_x = gv_x * gv_x * (3.f - 2.f * gv_x);
+        vfloat curve_y = gv_y * gv_y * (3.f - 2.f * gv_y);
+
+        vfloat hash_x, hash_y;
+        KERNEL(gradient)(id_x, id_y, hash, &hash_x, &hash_y);
+        vfloat bottom_left = hash_x * gv_x + hash_y * gv_y;
+        KERNEL(gradient)(id_x + 1.f, id_y, hash, &hash_x, &hash_y);
+        vfloat bottom_right = hash_x * (gv_x - 1.f) + hash_y * gv_y;
+        KERNEL(gradient)(id_x, id_y + 1.f, hash, &hash_x, &hash_y);
+        vfloat top_left = hash_x * gv_x + hash_y * (gv_y - 1.f);
+        KERNEL(gradient)(id_x + 1.f, id_y + 1.f, hash, &hash_x, &hash_y);
+        vfloat top_right = hash_x * (gv_x - 1.f) + hash_y * (gv_y - 1.f);
+
+        vfloat bottom = KERNEL(mix)(bottom_left, bottom_right, curve_x);
+        vfloat top = KERNEL(mix)(top_left, top_right, curve_x);
+
+        return KERNEL(mix)(bottom, top, curve_y);
+}
+
+// Lanes stop adding octaves at different points, a lane whose octaves are
+// done adds them with a fade of zero until all are
+INLINE vfloat
+KERNEL(fbm_lanes)(vfloat x, vfloat y, vfloat footprint, uint hash, uint octaves)
+{
+        float amplitude = .5f;
+        float frequency = 1.f;
+        vfloat result = { 0.f };
+
+        for (uint i = 0; i < octaves; i++) {
+                vfloat fade = 1.f - KERNEL(smoothstep)(.25f, .5f, frequency * footprint);
+                if (!KERNEL(any)(fade > 0.f)) {
+                        break;
+                }
+                result += fade * amplitude * KERNEL(noise_lanes)(frequency * x, frequency * y, hash);
+                frequency *= 2.f;
+                amplitude *= .5f;
+        }
+
+        return result;
+}
+
+// The texture filtering of NOISE_TEXTURE is done by hand, on the values
+// noise.c filled the volume with
+INLINE vfloat
+KERNEL(n3d_lanes)(vfloat x, vfloat y, vfloat z, uint hash)
+{
+        vfloat ip_x = KERNEL(floor)(x), ip_y = KERNEL(floor)(y), ip_z = KERNEL(floor)(z);
+        x -= ip_x;
+        y -= ip_y;
+        z -= ip_z;
+        x *= x * x * (x * (x * 6.f - 15.f) + 10.f);
+        y *= y * y * (y * (y * 6.f - 15.f) + 10.f);
+        z *= z * z * (z * (z * 6.f - 15.f) + 10.f);
+
+        vuint i_x = KERNEL(lattice)(ip_x), i_y = KERNEL(lattice)(ip_y), i_z = KERNEL(lattice)(ip_z);
+        vuint j_x = i_x + 1u, j_y = i_y + 1u, j_z = i_z + 1u;
+
+        if (hash == NOISE_TEXTURE) {
+                uint32_t wrap = NOISE_VOLUME_SIZE - 1;
+                i_x &= wrap, i_y &= wrap, i_z &= wrap;
+                j_x &= wrap, j_y &= wrap, j_z &= wrap;
+        }
+
+        // Corners by y and z, x mixed in
+        vfloat h[4];
+        vuint corner_y[4] = { i_y, j_y, i_y, j_y };
+        vuint corner_z[4] = { i_z, i_z, j_z, j_z };
+        for (uint i = 0; i < 4; i++) {
+                vfloat h0 = __builtin_convertvector(KERNEL(pcg3d)(i_x, corner_y[i], corner_z[i]), vfloat);
+                vfloat h1 = __builtin_convertvector(KERNEL(pcg3d)(j_x, corner_y[i], corner_z[i]), vfloat);
+                if (hash == NOISE_TEXTURE) {
+                        h0 *= 1.f / 4294967295.f;
+                        h1 *= 1.f / 4294967295.f;
+                        h[i] = KERNEL(mix)(h0, h1, x);
+                } else {
+                        h[i] = KERNEL(mix)(h0, h1, x) / 4294967295.f;
+                }
+        }
+
+        vfloat h_z0 = KERNEL(mix)(h[0], h[1], y);
+        vfloat h_z1 = KERNEL(mix)(h[2], h[3], y);
+
+        return KERNEL(mix)(h_z0, h_z1, z);
+}
+
+static void
+KERNEL(hash)(float const* x, float const* y, float* gradient_x, float* gradient_y, ulint count,
+             uint hash)
+{
+        for (ulint i = 0; i < count; i += LANES) {
+                ulint lanes = count - i < LANES ? count - i : LANES;
+                vfloat vx, vy;
+                KERNEL(gradient)(KERNEL(load)(x + i, lanes), KERNEL(load)(y + i, lanes), hash, &vx, &vy);
+                KERNEL(store)(gradient_x + i, vx, lanes);
+                KERNEL(store)(gradient_y + i, vy, lanes);
+        }
+}
+
+static void
+KERNEL(noise)(float const* x, float const* y, float* result, ulint count, uint hash)
+{
+        for (ulint i = 0; i < count; i += LANES) {
+                ulint lanes = count - i < LANES ? count - i : LANES;
+                KERNEL(store)(result + i, KERNEL(noise_lanes)(KERNEL(load)(x + i, lanes),
+                                                              KERNEL(load)(y + i, lanes), hash),
+                              lanes);
+        }
+}
+
+static void
+KERNEL(fbm)(float const* x, float const* y, float const* footprint, float* result, ulint count,
+            uint hash, uint octaves)
+{
+        for (ulint i = 0; i < count; i += LANES) {
+                ulint lanes = count - i < LANES ? count - i : LANES;
+                KERNEL(store)(result + i, KERNEL(fbm_lanes)(KERNEL(load)(x + i, lanes),
+                                                            KERNEL(load)(y + i, lanes),
+                                                            KERNEL(load)(footprint + i, lanes),
+                                                            hash, octaves),
+                              lanes);
+        }
+}
+
+static void
+KERNEL(n3d)(float const* x, float const* y, float const* z, float* result, ulint count, uint hash)
+{
+        for (ulint i = 0; i < count; i += LANES) {
+                ulint lanes = count - i < LANES ? count - i : LANES;
+                KERNEL(store)(result + i, KERNEL(n3d_lanes)(KERNEL(load)(x + i, lanes),
+                                                            KERNEL(load)(y + i, lanes),
+                                                            KERNEL(load)(z + i, lanes), hash),
+                              lanes);
+        }
+}
+
+#undef vfloat
+#undef vint
+#undef vuint
@@ -0,0 +1,36 @@
+#include "noise_simd.h"
+#include "noise.h"
+
+#include <stdint.h>
+#include <string.h>
+
+typedef unsigned int            uint;
+typedef unsigned long int       ulint;
+
+// The helpers disappear into the kernels, so vectors wider than the
+// registers of the target never go through a call
+#define INLINE                  static inline __attribute__((always_inline))
+
+#define LANES                   1
+#define KERNEL(name)            name##_x1
+#include "noise_kernels.h"
+#undef LANES
+#undef KERNEL
+
+#define LANES                   8
+#define KERNEL(name)            name##_x8
+#include "noise_kernels.h"
+#undef LANES
+#undef KERNEL
+
+#define LANES                   16
+#define KERNEL(name)            name##_x16
+#include "noise_kernels.h"
+#undef LANES
+#undef KERNEL
+
+struct noise_kernels const noise_kernels[NOISE_WIDTHS] = {
+        { "x1", 1, hash_x1, noise_x1, fbm_x1, n3d_x1 },
+        { "x8", 8, hash_x8, noise_x8, fbm_x8, n3d_x8 },
+        { "x16", 16, hash_x16, noise_x16, fbm_x16, n3d_x16 },
+};
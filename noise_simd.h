@@ -0,0 +1,35 @@
+#ifndef NOISE_SIMD_H
+#define NOISE_SIMD_H
+
+// hash(), noise(), fBM() and n3D() of shaders/noise.glsl on the CPU, for a
+// renderer without a GPU. Every kernel runs over arrays of samples, any
+// count, with GCC vector extensions so the compiler picks the instructions
+// of the target it builds for. All widths are the same code, one lane is the
+// scalar baseline.
+//
+// The kernels follow the GLSL operation for operation. They match the GPU
+// up to its float rounding and, with NOISE_TEXTURE, the precision of its
+// texture filtering. NOISE_SIN is not supported, its results depend on the
+// sin() of the GPU and are not reproducible anyway.
+#define NOISE_WIDTHS            3
+
+struct noise_kernels {
+        char const*     name;
+        unsigned int    lanes;
+
+        // Gradients at integer lattice points, in [-1, 1]^2
+        void            (*hash)(float const* x, float const* y, float* gradient_x,
+                                float* gradient_y, unsigned long count, unsigned int hash);
+        void            (*noise)(float const* x, float const* y, float* result,
+                                 unsigned long count, unsigned int hash);
+        void            (*fbm)(float const* x, float const* y, float const* footprint,
+                               float* result, unsigned long count, unsigned int hash,
+                               unsigned int octaves);
+        void            (*n3d)(float const* x, float const* y, float const* z, float* result,
+                               unsigned long count, unsigned int hash);
+};
+
+// 1, 8 and 16 lanes
+extern struct noise_kernels const noise_kernels[NOISE_WIDTHS];
+
+#endif
@@ -0,0 +1,262 @@
+// Times the CPU noise kernels of noise_simd.h, in nanoseconds per sample for
+// every width, checks the wide kernels against the scalar one and every
+// kernel against values of shaders/noise.glsl.
+//
+//     noisebench [samples]
+//
+// make bench builds it once per instruction set in NOISE_ISAS, NOISE_ISA
+// names the one of this build. The samples are random points of the scale
+// the terrain samples, with footprints that end fBM() early in some lanes.
+#include "noise_simd.h"
+#include "noise.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef unsigned int            uint;
+typedef unsigned long int       ulint;
+
+#ifndef NOISE_ISA
+#define NOISE_ISA               "default"
+#endif
+
+#define DEFAULT_SAMPLES         (1ul << 18)
+#define REPEATS                 5
+#define BENCH_OCTAVES           5
+
+#define KERNEL_HASH             0
+#define KERNEL_NOISE            1
+#define KERNEL_FBM              2
+#define KERNEL_N3D              3
+#define KERNELS                 4
+
+static char const* const kernel_names[KERNELS] = { "hash", "noise", "fBM", "n3D" };
+static char const* const hash_names[NOISE_HASHES] = { "sin", "pcg", "texture" };
+
+// Inputs, outputs, and the outputs of the scalar kernel
+#define BUFFER_X                0
+#define BUFFER_Y                1
+#define BUFFER_Z                2
+#define BUFFER_FOOTPRINT        3
+#define BUFFER_LATTICE_X        4
+#define BUFFER_LATTICE_Y        5
+#define BUFFER_RESULT           6
+#define BUFFER_RESULT_Y         7
+#define BUFFER_EXPECTED         8
+#define BUFFER_EXPECTED_Y       9
+#define BUFFERS                 10
+
+// Points, footprints and the results of shaders/noise.glsl with NOISE_PCG and
+// FBM_OCTAVES 5 at them: hash(floor(p.xy)), noise(p.xy), fBM(p.xy, footprint)
+// and n3D(p), written out by a compute shader on Mesa llvmpipe.
+#define REFERENCES              8
+#define REFERENCE_TOLERANCE     1e-5
+
+struct reference {
+        float   x, y, z, footprint;
+        float   hash_x, hash_y, noise, fbm, n3d;
+};
+
+static struct reference const references[REFERENCES] = {
+        { .25f, .75f, .5f, 0.f, -.805536091f, -.958070159f, -.257986128f, -.0125176609f, .558350682f },
+        { -3.6f, 12.2f, 7.9f, .003f, .0355912447f, .204928041f, -.140499786f, -.0984310582f,
+          .422752529f },
+        { 41.37f, -17.05f, -2.5f, .011f, .325518131f, .375761271f, -.353112042f, -.126429364f,
+          .552832723f },
+        { -88.1f, -64.9f, 33.3f, 0.f, -.452691138f, .192946553f, -.0605888739f, -.0741541386f,
+          .378354847f },
+        { 5.5f, 5.5f, 5.5f, .0065f, .993222952f, .0174738169f, .108965367f, .0544826835f,
+          .532441318f },
+        { 97.02f, 3.14f, -71.7f, .019f, .43214047f, -.787916422f, -.105967604f, -.147641525f,
+          .441289186f },
+        { -.01f, -.99f, .02f, 0.f, -.764448881f, -.154107869f, .00698003545f, -.00250032078f,
+          .065278627f },
+        { 250.75f, -1023.5f, 12.125f, .0001f, .949679255f, -.354631782f, .333120763f, .193902001f,
+          .548146307f },
+};
+
+static double
+now(void)
+{
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+// xorshift32, the same points every run
+static float
+random_float(uint* state, float min, float max)
+{
+        *state ^= *state << 13;
+        *state ^= *state >> 17;
+        *state ^= *state << 5;
+        return min + (max - min) * (float)(*state >> 8) * (1.f / 16777216.f);
+}
+
+static void
+run_kernel(struct noise_kernels const* kernels, uint kernel, uint hash, float** buffers,
+           ulint count)
+{
+        if (kernel == KERNEL_HASH) {
+                kernels->hash(buffers[BUFFER_LATTICE_X], buffers[BUFFER_LATTICE_Y],
+                              buffers[BUFFER_RESULT], buffers[BUFFER_RESULT_Y], count, hash);
+        } else if (kernel == KERNEL_NOISE) {
+                kernels->noise(buffers[BUFFER_X], buffers[BUFFER_Y], buffers[BUFFER_RESULT], count,
+                               hash);
+        } else if (kernel == KERNEL_FBM) {
+                kernels->fbm(buffers[BUFFER_X], buffers[BUFFER_Y], buffers[BUFFER_FOOTPRINT],
+                             buffers[BUFFER_RESULT], count, hash, BENCH_OCTAVES);
+        } else {
+                kernels->n3d(buffers[BUFFER_X], buffers[BUFFER_Y], buffers[BUFFER_Z],
+                             buffers[BUFFER_RESULT], count, hash);
+        }
+}
+
+static double
+largest_difference(float const* a, float const* b, ulint count)
+{
+        double largest = 0.;
+        for (ulint i = 0; i < count; i++) {
+                double difference = fabs((double)a[i] - (double)b[i]);
+                largest = difference > largest ? difference : largest;
+        }
+        return largest;
+}
+
+// Largest difference of any kernel of one width to the shader, the PCG hash is
+// integer arithmetic and has to match exactly
+static double
+reference_difference(struct noise_kernels const* kernels)
+{
+        float x[REFERENCES], y[REFERENCES], z[REFERENCES], footprint[REFERENCES];
+        float lattice_x[REFERENCES], lattice_y[REFERENCES];
+        float hash_x[REFERENCES], hash_y[REFERENCES], noise[REFERENCES], fbm[REFERENCES];
+        float n3d[REFERENCES];
+        for (uint i = 0; i < REFERENCES; i++) {
+                x[i] = references[i].x;
+                y[i] = references[i].y;
+                z[i] = references[i].z;
+                footprint[i] = references[i].footprint;
+                lattice_x[i] = floorf(x[i]);
+                lattice_y[i] = floorf(y[i]);
+        }
+
+        kernels->hash(lattice_x, lattice_y, hash_x, hash_y, REFERENCES, NOISE_PCG);
+        kernels->noise(x, y, noise, REFERENCES, NOISE_PCG);
+        kernels->fbm(x, y, footprint, fbm, REFERENCES, NOISE_PCG, BENCH_OCTAVES);
+        kernels->n3d(x, y, z, n3d, REFERENCES, NOISE_PCG);
+
+        double largest = 0.;
+        for (uint i = 0; i < REFERENCES; i++) {
+                struct reference const* reference = &references[i];
+                if (hash_x[i] != reference->hash_x || hash_y[i] != reference->hash_y) {
+                        return INFINITY;
+                }
+                double differences[3] = {
+                        fabs((double)noise[i] - (double)reference->noise),
+                        fabs((double)fbm[i] - (double)reference->fbm),
+                        fabs((double)n3d[i] - (double)reference->n3d),
+                };
+                for (uint j = 0; j < 3; j++) {
+                        largest = differences[j] > largest ? differences[j] : largest;
+                }
+        }
+        return largest;
+}
+
+int
+main(int argc, char** argv)
+{
+        if (!__builtin_cpu_supports(NOISE_ISA)) {
+                printf("%s: not supported by this CPU, skipped\n", NOISE_ISA);
+                return EXIT_SUCCESS;
+        }
+
+        long samples = argc > 1 ? strtol(argv[1], NULL, 10) : (long)DEFAULT_SAMPLES;
+        if (argc > 2 || samples < 1) {
+                fprintf(stderr, "Usage: %s [samples]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+        ulint count = (ulint)samples;
+
+        int matches = 1;
+        printf("%s, largest difference to shaders/noise.glsl with pcg\n", NOISE_ISA);
+        for (uint width = 0; width < NOISE_WIDTHS; width++) {
+                double difference = reference_difference(&noise_kernels[width]);
+                printf("%-16s%8.1e%s\n", noise_kernels[width].name, difference,
+                       difference > REFERENCE_TOLERANCE ? ", MISMATCH" : "");
+                matches &= difference <= REFERENCE_TOLERANCE;
+        }
+        printf("\n");
+
+        float* buffers[BUFFERS];
+        for (uint i = 0; i < BUFFERS; i++) {
+                buffers[i] = calloc(count, sizeof(float));
+                if (!buffers[i]) {
+                        fprintf(stderr, "ERROR: Could not alocate memory for the samples\n");
+                        return EXIT_FAILURE;
+                }
+        }
+
+        uint state = 2463534242u;
+        for (ulint i = 0; i < count; i++) {
+                buffers[BUFFER_X][i] = random_float(&state, -100.f, 100.f);
+                buffers[BUFFER_Y][i] = random_float(&state, -100.f, 100.f);
+                buffers[BUFFER_Z][i] = random_float(&state, -100.f, 100.f);
+                buffers[BUFFER_FOOTPRINT][i] = random_float(&state, 0.f, .02f);
+                buffers[BUFFER_LATTICE_X][i] = floorf(buffers[BUFFER_X][i]);
+                buffers[BUFFER_LATTICE_Y][i] = floorf(buffers[BUFFER_Y][i]);
+        }
+
+        printf("%s, %lu samples, ns per sample and largest difference to x1\n", NOISE_ISA, count);
+        printf("%-16s", "");
+        for (uint width = 0; width < NOISE_WIDTHS; width++) {
+                printf("%21s", noise_kernels[width].name);
+        }
+        printf("\n");
+
+        for (uint hash = NOISE_PCG; hash <= NOISE_TEXTURE; hash++) {
+                for (uint kernel = 0; kernel < KERNELS; kernel++) {
+                        printf("%-6s %-9s", kernel_names[kernel], hash_names[hash]);
+
+                        for (uint width = 0; width < NOISE_WIDTHS; width++) {
+                                double fastest = INFINITY;
+                                for (uint repeat = 0; repeat < REPEATS; repeat++) {
+                                        double start = now();
+                                        run_kernel(&noise_kernels[width], kernel, hash, buffers,
+                                                   count);
+                                        double elapsed = now() - start;
+                                        fastest = elapsed < fastest ? elapsed : fastest;
+                                }
+
+                                double difference = 0.;
+                                if (!width) {
+                                        memcpy(buffers[BUFFER_EXPECTED], buffers[BUFFER_RESULT],
+                                               sizeof(float) * count);
+                                        memcpy(buffers[BUFFER_EXPECTED_Y], buffers[BUFFER_RESULT_Y],
+                                               sizeof(float) * count);
+                                } else {
+                                        double x = largest_difference(buffers[BUFFER_RESULT],
+                                                                      buffers[BUFFER_EXPECTED], count);
+                                        double y = largest_difference(buffers[BUFFER_RESULT_Y],
+                                                                      buffers[BUFFER_EXPECTED_Y],
+                                                                      count);
+                                        difference = x > y ? x : y;
+                                }
+
+                                printf("%10.2f ns %8.1e", fastest * 1e9 / (double)count,
+                                       difference);
+                        }
+                        printf("\n");
+                }
+        }
+
+        for (uint i = 0; i < BUFFERS; i++) {
+                free(buffers[i]);
+        }
+
+        return matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,85 @@
+// Packs shader files into a C source linked into the renderer, so it starts
+// without reading anything from disk and runs from any directory.
+//
+//     packshaders <shader.glsl>... > shader_pack.c
+//
+// Shaders are stored raw under their file name, which is what #include and
+// get_shader() look them up by. See shader_pack.h.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTES_PER_LINE          16
+
+static char const*
+file_name(char const* path)
+{
+        char const* slash = strrchr(path, '/');
+        return slash ? slash + 1 : path;
+}
+
+// Writes the file as a NUL terminated byte array, returns its length
+static unsigned long
+pack_file(char const* path, unsigned int index)
+{
+        FILE* file = fopen(path, "rb");
+        if (!file) {
+                fprintf(stderr, "ERROR: Could not open file: %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        printf("static char const shader_%u[] = {", index);
+
+        unsigned long length = 0;
+        int byte;
+        while ((byte = fgetc(file)) != EOF) {
+                printf("%s0x%02x,", length % BYTES_PER_LINE ? " " : "\n        ", byte);
+                length++;
+        }
+        printf("\n        0x00\n};\n\n");
+
+        if (ferror(file)) {
+                fprintf(stderr, "ERROR: Could not read file: %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+        fclose(file);
+
+        return length;
+}
+
+int
+main(int argc, char** argv)
+{
+        if (argc < 2) {
+                fprintf(stderr, "Usage: %s <shader.glsl>...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        unsigned int count = (unsigned int)argc - 1;
+        unsigned long* lengths = malloc(sizeof(*lengths) * count);
+        if (!lengths) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the shader lengths\n");
+                return EXIT_FAILURE;
+        }
+
+        printf("// Generated by packshaders, do not edit\n#include \"shader_pack.h\"\n\n");
+
+        for (unsigned int i = 0; i < count; i++) {
+                lengths[i] = pack_file(argv[i + 1], i);
+        }
+
+        printf("struct packed_shader const packed_shaders[] = {\n");
+        for (unsigned int i = 0; i < count; i++) {
+                printf("        { \"%s\", shader_%u, %lu },\n", file_name(argv[i + 1]), i, lengths[i]);
+        }
+        printf("};\n\nunsigned int const packed_shader_count = %u;\n", count);
+
+        free(lengths);
+
+        if (fflush(stdout) || ferror(stdout)) {
+                fprintf(stderr, "ERROR: Could not write the shader pack\n");
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
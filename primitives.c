@@ -0,0 +1,78 @@
+#include "primitives.h"
+
+#include <math.h>
+
+typedef unsigned int            uint;
+
+// xorshift32, good enough for placing pebbles and reproducible across runs
+static uint
+next_random(uint* state)
+{
+        *state ^= *state << 13;
+        *state ^= *state >> 17;
+        *state ^= *state << 5;
+
+        return *state;
+}
+
+static float
+random_range(uint* state, float min, float max)
+{
+        return min + (max - min) * (float)next_random(state) * (1.0f / 4294967295.0f);
+}
+
+void
+scatter_primitives(struct primitive* const primitives, uint count)
+{
+        uint state = INSTANCE_SEED;
+
+        for (uint i = 0; i < count; i++) {
+                float radius = random_range(&state, INSTANCE_MIN_RADIUS, INSTANCE_MAX_RADIUS);
+
+                // Resting on the ground plane at y = -1
+                primitives[i].center[0] = random_range(&state, -INSTANCE_EXTENT, INSTANCE_EXTENT);
+                primitives[i].center[1] = radius - 1.0f;
+                primitives[i].center[2] = random_range(&state, -INSTANCE_EXTENT, INSTANCE_EXTENT);
+                primitives[i].radius = radius;
+        }
+}
+
+void
+primitive_bounds(struct primitive const* const primitive, float* const min, float* const max)
+{
+        for (uint axis = 0; axis < 3; axis++) {
+                min[axis] = primitive->center[axis] - primitive->radius;
+                max[axis] = primitive->center[axis] + primitive->radius;
+        }
+}
+
+void
+animate_primitives(struct primitive* const primitives, struct primitive const* const rest,
+                   uint count, float time)
+{
+        // Pulse like sphere1, but only ever shrink from the rest pose and stay on
+        // the ground, so bounds built around the rest pose remain conservative
+        for (uint i = 0; i < count; i++) {
+                float radius = rest[i].radius * (.75f + .25f * sinf(time + (float)i));
+
+                primitives[i].center[1] = radius - 1.0f;
+                primitives[i].radius = radius;
+        }
+}
+
+void
+upload_primitives(GLuint buffer, struct primitive const* const primitives, uint count)
+{
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(sizeof(*primitives) * count),
+                     primitives, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PRIMITIVES_BINDING, buffer);
+}
+
+void
+update_primitives(GLuint buffer, struct primitive const* const primitives, uint count)
+{
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (GLsizeiptr)(sizeof(*primitives) * count),
+                        primitives);
+}
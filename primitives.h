@@ -0,0 +1,44 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <glad/glad.h>
+
+// Spheres scattered over the ground, drawn when INSTANCES is defined in
+// shaders/fragment_shader.glsl
+#define INSTANCE_COUNT          200000
+#define INSTANCE_EXTENT         25.0f
+#define INSTANCE_MIN_RADIUS     .03f
+#define INSTANCE_MAX_RADIUS     .1f
+#define INSTANCE_SEED           0x9E3779B9u
+
+// The first primitives pulse like sphere1 in the shader
+#define INSTANCE_ANIMATED       1024
+
+// Accelerator used for the instances, matching INSTANCES_MARCHER in the shader
+#define INSTANCES_OFF           0
+#define INSTANCES_GRID          1
+#define INSTANCES_BVH           2
+#define INSTANCE_MODES          3
+
+// Shader storage bindings, matching shaders/instances.glsl
+#define PRIMITIVES_BINDING      0
+#define GRID_CELLS_BINDING      1
+#define GRID_INDICES_BINDING    2
+
+// Sphere primitive, laid out as one std430 vec4
+struct primitive {
+        float   center[3];
+        float   radius;
+};
+
+void    scatter_primitives(struct primitive* const primitives, unsigned int count);
+void    primitive_bounds(struct primitive const* const primitive, float* const min,
+                         float* const max);
+void    animate_primitives(struct primitive* const primitives,
+                           struct primitive const* const rest, unsigned int count, float time);
+void    upload_primitives(GLuint buffer, struct primitive const* const primitives,
+                          unsigned int count);
+void    update_primitives(GLuint buffer, struct primitive const* const primitives,
+                          unsigned int count);
+
+#endif
@@ -0,0 +1,124 @@
+#include "replay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void
+replay_error(char const* path, char const* error)
+{
+        fprintf(stderr, "ERROR: Could not replay %s: %s\n", path, error);
+        exit(EXIT_FAILURE);
+}
+
+void
+open_recording(struct replay* const replay, char const* path)
+{
+        replay->path = path;
+        replay->frames = 0;
+        replay->file = fopen(path, "wb");
+        if (!replay->file) {
+                fprintf(stderr, "ERROR: Could not create file: %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        struct replay_header header = { REPLAY_MAGIC, REPLAY_VERSION, sizeof(struct replay_frame) };
+        if (fwrite(&header, sizeof(header), 1, replay->file) != 1) {
+                fprintf(stderr, "ERROR: Could not write the recording %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+}
+
+void
+record_frame(struct replay* const replay, double time, struct input_state const* state)
+{
+        struct replay_frame frame = {
+                .time = time,
+                .camera = { state->camera[0], state->camera[1], state->camera[2] },
+                .mouse = { state->mouse[0], state->mouse[1] },
+                .framebuffer = { state->framebuffer[0], state->framebuffer[1] },
+                .reloads = state->reloads,
+                .quality = (uint8_t)state->quality,
+                .antialiasing = (uint8_t)state->antialiasing,
+                .noise_hash = (uint8_t)state->noise_hash,
+                .instances = (uint8_t)state->instances,
+                .views = (uint8_t)state->views,
+                .ao = (uint8_t)state->ao,
+                .proxies = (uint8_t)state->proxies,
+                .depth_reuse = (uint8_t)state->depth_reuse,
+        };
+
+        if (fwrite(&frame, sizeof(frame), 1, replay->file) != 1) {
+                fprintf(stderr, "ERROR: Could not write the recording %s\n", replay->path);
+                exit(EXIT_FAILURE);
+        }
+        replay->frames++;
+}
+
+void
+open_replay(struct replay* const replay, char const* path)
+{
+        replay->path = path;
+        replay->frames = 0;
+        replay->file = fopen(path, "rb");
+        if (!replay->file) {
+                replay_error(path, "could not open the file");
+        }
+
+        struct replay_header header;
+        if (fread(&header, sizeof(header), 1, replay->file) != 1 ||
+            memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic))) {
+                replay_error(path, "not an input recording");
+        }
+        if (header.version != REPLAY_VERSION || header.frame_size != sizeof(struct replay_frame)) {
+                replay_error(path, "recorded by another version");
+        }
+}
+
+// Fills in the next frame, 0 once they are all played. Counters the render
+// thread acts on are replayed as recorded, so mode switches and reloads
+// happen on the same frames.
+int
+replay_frame(struct replay* const replay, double* const time, struct input_state* const state)
+{
+        struct replay_frame frame;
+        if (fread(&frame, sizeof(frame), 1, replay->file) != 1) {
+                return 0;
+        }
+
+        *time = frame.time;
+        memcpy(state->camera, frame.camera, sizeof(state->camera));
+        memcpy(state->mouse, frame.mouse, sizeof(state->mouse));
+        state->framebuffer[0] = frame.framebuffer[0];
+        state->framebuffer[1] = frame.framebuffer[1];
+        state->reloads = frame.reloads;
+        state->quality = frame.quality;
+        state->antialiasing = frame.antialiasing;
+        state->noise_hash = frame.noise_hash;
+        state->instances = frame.instances;
+        state->views = frame.views;
+        state->ao = frame.ao;
+        state->proxies = frame.proxies;
+        state->depth_reuse = frame.depth_reuse;
+        replay->frames++;
+
+        return 1;
+}
+
+// Frames in the whole recording, read or not
+uint32_t
+replay_length(struct replay* const replay)
+{
+        long position = ftell(replay->file);
+        fseek(replay->file, 0, SEEK_END);
+        long end = ftell(replay->file);
+        fseek(replay->file, position, SEEK_SET);
+
+        return (uint32_t)(((unsigned long)end - sizeof(struct replay_header)) /
+                          sizeof(struct replay_frame));
+}
+
+void
+close_replay(struct replay* const replay)
+{
+        fclose(replay->file);
+}
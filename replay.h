@@ -0,0 +1,55 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "input.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Input recordings, every frame the time and the input state the render
+// thread drew it with. A replay draws the same frames one after the other
+// as fast as it can, whatever the clock says, so two builds can be timed on
+// exactly the same work. The file is a header followed by the frames as
+// they are in memory, in the byte order of the machine that recorded them.
+// Their fields have fixed widths and need no padding, and the header holds
+// the frame size, so a build that lays them out differently rejects the
+// file.
+#define REPLAY_MAGIC            "RMREPLAY"
+#define REPLAY_VERSION          1
+
+struct replay_header {
+        char            magic[8];
+        uint32_t        version;
+        uint32_t        frame_size;
+};
+
+struct replay_frame {
+        double          time;
+        float           camera[3];
+        float           mouse[2];
+        int32_t         framebuffer[2];
+        uint32_t        reloads;
+        uint8_t         quality;
+        uint8_t         antialiasing;
+        uint8_t         noise_hash;
+        uint8_t         instances;
+        uint8_t         views;
+        uint8_t         ao;
+        uint8_t         proxies;
+        uint8_t         depth_reuse;
+};
+
+struct replay {
+        FILE*           file;
+        char const*     path;
+        uint32_t        frames;
+};
+
+void    open_recording(struct replay* const replay, char const* path);
+void    record_frame(struct replay* const replay, double time, struct input_state const* state);
+void    open_replay(struct replay* const replay, char const* path);
+int     replay_frame(struct replay* const replay, double* const time, struct input_state* const state);
+uint32_t replay_length(struct replay* const replay);
+void    close_replay(struct replay* const replay);
+
+#endif
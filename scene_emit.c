@@ -0,0 +1,383 @@
+#include "scene_emit.h"
+#include "cpu_scene.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned int            uint;
+
+#define NO_VALUE                (~0u)
+#define MAX_POINT_LENGTH        1024
+#define MAX_FLOAT_LENGTH        32
+
+// Of the shader, by material number
+static char const* const glsl_materials[] = {
+        "background()", "gold()", "silver()", "checkerboard(point)"
+};
+
+static void
+emit_error(char const* const error)
+{
+        fprintf(stderr, "ERROR: Could not emit the scene: %s\n", error);
+        exit(EXIT_FAILURE);
+}
+
+// Shortest text that reads back as the same float, with a point so it is a
+// float literal in both languages
+static char const*
+format_float(char* const text, float value)
+{
+        snprintf(text, MAX_FLOAT_LENGTH, "%.9g", (double)value);
+        if (!strpbrk(text, ".e")) {
+                strcat(text, ".");
+        }
+        return text;
+}
+
+// suffix is "f" for C
+static void
+write_float(FILE* const file, float value, char const* const suffix)
+{
+        char text[MAX_FLOAT_LENGTH];
+        fprintf(file, "%s%s", format_float(text, value), suffix);
+}
+
+// =========================================================================================================
+// C
+// =========================================================================================================
+
+// Every value is a vfloat of its own, v0 to v3 the inputs of the tape, and
+// materials a vint m of the value that set them
+struct emitter {
+        FILE*   file;
+        uint    values;
+        uint    footprint;
+};
+
+struct value {
+        uint    distance;
+        uint    material;
+};
+
+// Starts the statement of a new value, the caller writes the expression
+static uint
+begin_value(struct emitter* const emitter)
+{
+        fprintf(emitter->file, "                vfloat v%u = ", emitter->values);
+        return emitter->values++;
+}
+
+static uint
+emit_immediate(struct emitter* const emitter, uint a, char const* const op, float immediate)
+{
+        uint value = begin_value(emitter);
+        fprintf(emitter->file, "v%u %s ", a, op);
+        write_float(emitter->file, immediate, "f");
+        fprintf(emitter->file, ";\n");
+        return value;
+}
+
+static uint
+emit_length(struct emitter* const emitter, uint const* const xyz)
+{
+        uint value = begin_value(emitter);
+        fprintf(emitter->file, "square_root(v%u * v%u + v%u * v%u + v%u * v%u);\n", xyz[0], xyz[0],
+                xyz[1], xyz[1], xyz[2], xyz[2]);
+        return value;
+}
+
+static uint
+emit_material(struct emitter* const emitter, uint material)
+{
+        fprintf(emitter->file, "                vint m%u = (vint){ 0 } + %u;\n", emitter->values,
+                material);
+        return emitter->values++;
+}
+
+// footprint() of the tape compiler, on the camera of the call
+static uint
+emit_footprint(struct emitter* const emitter)
+{
+        if (emitter->footprint == NO_VALUE) {
+                fprintf(emitter->file, "                vfloat v%u = (vfloat){ 0.f } + lod_scale;\n",
+                        TAPE_LOD);
+
+                uint xyz[3];
+                for (uint axis = 0; axis < 3; axis++) {
+                        xyz[axis] = begin_value(emitter);
+                        fprintf(emitter->file, "v%u - lod_origin[%u];\n", TAPE_X + axis, axis);
+                }
+                uint distance = emit_length(emitter, xyz);
+                uint size = begin_value(emitter);
+                fprintf(emitter->file, "v%u * lod_pixel_angle;\n", distance);
+                emitter->footprint = begin_value(emitter);
+                fprintf(emitter->file, "v%u * v%u;\n", size, TAPE_LOD);
+        }
+
+        return emitter->footprint;
+}
+
+// Of a smooth operation: h, the blend, then the material of the winner
+static struct value
+emit_smooth(struct emitter* const emitter, struct value a, struct value b, char const* const sign,
+            float k)
+{
+        FILE* file = emitter->file;
+
+        uint h = begin_value(emitter);
+        fprintf(file, "saturate(.5f %s .5f * (v%u - v%u) / ", sign, b.distance, a.distance);
+        write_float(file, k, "f");
+        fprintf(file, ");\n");
+
+        uint distance = begin_value(emitter);
+        fprintf(file, "(v%u * (1.f - v%u) + v%u * v%u) %s ", b.distance, h, a.distance, h,
+                *sign == '+' ? "-" : "+");
+        write_float(file, k, "f");
+        fprintf(file, " * v%u * (1.f - v%u);\n", h, h);
+
+        fprintf(file, "                vint m%u = select_int(v%u > .5f, m%u, m%u);\n", distance, h,
+                a.material, b.material);
+        return (struct value){ distance, distance };
+}
+
+// compile_node() as C statements
+static struct value
+emit_c_node(struct emitter* const emitter, struct sdf_tree const* const tree, uint index,
+            uint const* const point, float scale)
+{
+        struct sdf_node const* node = &tree->nodes[index];
+        float const* parameters = node->parameters;
+        FILE* file = emitter->file;
+
+        if (node->op == SDF_SPHERE) {
+                uint xyz[3];
+                for (uint axis = 0; axis < 3; axis++) {
+                        xyz[axis] = emit_immediate(emitter, point[axis], "-", parameters[axis]);
+                }
+                uint distance = emit_length(emitter, xyz);
+                distance = emit_immediate(emitter, distance, "-", parameters[3]);
+                return (struct value){ distance, emit_material(emitter, node->material) };
+        } else if (node->op == SDF_PLANE) {
+                uint distance = emit_immediate(emitter, point[1], "+", parameters[0]);
+                return (struct value){ distance, emit_material(emitter, node->material) };
+        } else if (node->op == SDF_TERRAIN) {
+                uint lod = emit_footprint(emitter);
+                if (scale != 1.f) {
+                        lod = emit_immediate(emitter, lod, "*", scale);
+                }
+
+                uint x = emit_immediate(emitter, point[0], "*", TERRAIN_SCALE);
+                uint z = emit_immediate(emitter, point[2], "*", TERRAIN_SCALE);
+                lod = emit_immediate(emitter, lod, "*", TERRAIN_SCALE);
+                uint height = begin_value(emitter);
+                fprintf(file, "fbm(v%u, v%u, v%u, %u);\n", x, z, lod, CPU_FBM_OCTAVES);
+                height = emit_immediate(emitter, height, "*", TERRAIN_HEIGHT);
+                height = emit_immediate(emitter, height, "-", parameters[0]);
+
+                uint distance = begin_value(emitter);
+                fprintf(file, "v%u - v%u;\n", point[1], height);
+                distance = emit_immediate(emitter, distance, "*", .6f);
+                return (struct value){ distance, emit_material(emitter, node->material) };
+        } else if (node->op == SDF_TRANSLATE) {
+                uint moved[3];
+                for (uint axis = 0; axis < 3; axis++) {
+                        moved[axis] = emit_immediate(emitter, point[axis], "-", parameters[axis]);
+                }
+                return emit_c_node(emitter, tree, node->children[0], moved, scale);
+        } else if (node->op == SDF_SCALE) {
+                uint scaled[3];
+                for (uint axis = 0; axis < 3; axis++) {
+                        scaled[axis] = emit_immediate(emitter, point[axis], "*", 1.f / parameters[0]);
+                }
+                struct value child = emit_c_node(emitter, tree, node->children[0], scaled,
+                                                 scale / parameters[0]);
+                child.distance = emit_immediate(emitter, child.distance, "*", parameters[0]);
+                return child;
+        }
+
+        struct value a = emit_c_node(emitter, tree, node->children[0], point, scale);
+        struct value b = emit_c_node(emitter, tree, node->children[1], point, scale);
+
+        if (node->op == SDF_SUBTRACTION || node->op == SDF_SMOOTH_SUBTRACTION) {
+                uint negated = begin_value(emitter);
+                fprintf(file, "-v%u;\n", a.distance);
+                a.distance = negated;
+        }
+
+        if (node->op == SDF_SMOOTH_UNION) {
+                return emit_smooth(emitter, a, b, "+", parameters[0]);
+        } else if (node->op >= SDF_SMOOTH_UNION) {
+                return emit_smooth(emitter, a, b, "-", parameters[0]);
+        }
+
+        char const* compare = node->op == SDF_UNION ? "<" : ">";
+        uint distance = begin_value(emitter);
+        fprintf(file, "select_float(v%u %s v%u, v%u, v%u);\n", a.distance, compare, b.distance,
+                a.distance, b.distance);
+        fprintf(file, "                vint m%u = select_int(v%u %s v%u, m%u, m%u);\n", distance,
+                a.distance, compare, b.distance, a.material, b.material);
+        return (struct value){ distance, distance };
+}
+
+void
+emit_c_scene(FILE* const file, struct sdf_tree const* const tree, char const* const source)
+{
+        if (!tree->count) {
+                emit_error("the tree is empty");
+        }
+
+        fprintf(file, "// Generated by sdfc from %s, do not edit\n", source);
+        fprintf(file, "#include \"scene_emit.h\"\n"
+                "#include \"tape_simd.h\"\n"
+                "#include \"cpu_scene.h\"\n\n");
+
+        // The tree, for the tapes of the pruned slabs
+        fprintf(file, "struct sdf_tree const native_tree = {\n        {\n");
+        for (uint i = 0; i < tree->count; i++) {
+                struct sdf_node const* node = &tree->nodes[i];
+                fprintf(file, "                { %u, %u, { %u, %u }, { ", node->op, node->material,
+                        node->children[0], node->children[1]);
+                for (uint parameter = 0; parameter < 4; parameter++) {
+                        write_float(file, node->parameters[parameter], parameter < 3 ? "f, " : "f");
+                }
+                fprintf(file, " } },\n");
+        }
+        fprintf(file, "        },\n        %u\n};\n\n", tree->count);
+
+        // Inlined twice, the copy without materials drops their code
+        fprintf(file, "static inline __attribute__((always_inline)) void\n"
+                "evaluate(float const* x, float const* y, float const* z, float lod_scale,\n"
+                "         float const* lod_origin, float lod_pixel_angle, float* distance,\n"
+                "         unsigned int* material, unsigned long count)\n"
+                "{\n"
+                "        for (unsigned long first = 0; first < count; first += TAPE_LANES) {\n"
+                "                unsigned long lanes = count - first < TAPE_LANES ? "
+                "count - first : TAPE_LANES;\n"
+                "                vfloat v%u = load(x + first, lanes);\n"
+                "                vfloat v%u = load(y + first, lanes);\n"
+                "                vfloat v%u = load(z + first, lanes);\n\n",
+                TAPE_X, TAPE_Y, TAPE_Z);
+
+        struct emitter emitter = { file, TAPE_INPUTS, NO_VALUE };
+        uint const point[3] = { TAPE_X, TAPE_Y, TAPE_Z };
+        struct value result = emit_c_node(&emitter, tree, tree->count - 1, point, 1.f);
+
+        // Only the terrain has a LOD
+        if (emitter.footprint == NO_VALUE) {
+                fprintf(file, "                (void)lod_scale, (void)lod_origin, (void)lod_pixel_angle;\n");
+        }
+
+        fprintf(file, "\n"
+                "                for (unsigned long lane = 0; lane < lanes; lane++) {\n"
+                "                        int near = v%u[lane] < CPU_MAX_DEPTH;\n"
+                "                        distance[first + lane] = near ? v%u[lane] : CPU_MAX_DEPTH;\n"
+                "                        if (material) {\n"
+                "                                material[first + lane] =\n"
+                "                                        near ? (unsigned int)m%u[lane] : "
+                "MATERIAL_BACKGROUND;\n"
+                "                        }\n"
+                "                }\n"
+                "        }\n"
+                "}\n\n",
+                result.distance, result.distance, result.material);
+
+        fprintf(file, "void\n"
+                "native_scene(float const* x, float const* y, float const* z, float lod_scale,\n"
+                "             float const* lod_origin, float lod_pixel_angle, float* distance,\n"
+                "             unsigned int* material, unsigned long count)\n"
+                "{\n"
+                "        if (material) {\n"
+                "                evaluate(x, y, z, lod_scale, lod_origin, lod_pixel_angle, "
+                "distance, material, count);\n"
+                "        } else {\n"
+                "                evaluate(x, y, z, lod_scale, lod_origin, lod_pixel_angle, "
+                "distance, NULL, count);\n"
+                "        }\n"
+                "}\n");
+}
+
+// =========================================================================================================
+// GLSL
+// =========================================================================================================
+
+// The subtree at the point expression, the mesh helpers of SCENE_TREE in
+// shaders/fragment_shader.glsl combine the children
+static void
+emit_glsl_node(FILE* const file, struct sdf_tree const* const tree, uint index,
+               char const* const point, float scale)
+{
+        struct sdf_node const* node = &tree->nodes[index];
+        float const* parameters = node->parameters;
+        char const* material = glsl_materials[node->material];
+        char moved[MAX_POINT_LENGTH];
+
+        if (node->op == SDF_SPHERE) {
+                fprintf(file, "Mesh(sphereSdf(%s, vec3(", point);
+                write_float(file, parameters[0], ", ");
+                write_float(file, parameters[1], ", ");
+                write_float(file, parameters[2], "), ");
+                write_float(file, parameters[3], "), ");
+                fprintf(file, "%s)", material);
+        } else if (node->op == SDF_PLANE) {
+                fprintf(file, "Mesh(%s.y + ", point);
+                write_float(file, parameters[0], ", ");
+                fprintf(file, "%s)", material);
+        } else if (node->op == SDF_TERRAIN) {
+                fprintf(file, "Mesh(.6 * (%s.y - terrainHeight(%s.xz, pixelFootprint(point) * ", point,
+                        point);
+                write_float(file, scale, ") + ");
+                write_float(file, parameters[0], "), ");
+                fprintf(file, "%s)", material);
+        } else if (node->op == SDF_TRANSLATE || node->op == SDF_SCALE) {
+                char x[MAX_FLOAT_LENGTH], y[MAX_FLOAT_LENGTH], z[MAX_FLOAT_LENGTH];
+                int length = node->op == SDF_TRANSLATE ?
+                        snprintf(moved, sizeof(moved), "(%s - vec3(%s, %s, %s))", point,
+                                 format_float(x, parameters[0]), format_float(y, parameters[1]),
+                                 format_float(z, parameters[2])) :
+                        snprintf(moved, sizeof(moved), "(%s * %s)", point,
+                                 format_float(x, 1.f / parameters[0]));
+                if (length < 0 || length >= MAX_POINT_LENGTH) {
+                        emit_error("the transforms nest too deep");
+                }
+
+                if (node->op == SDF_TRANSLATE) {
+                        emit_glsl_node(file, tree, node->children[0], moved, scale);
+                } else {
+                        fprintf(file, "scaleMesh(");
+                        emit_glsl_node(file, tree, node->children[0], moved, scale / parameters[0]);
+                        fprintf(file, ", ");
+                        write_float(file, parameters[0], ")");
+                }
+        } else {
+                static char const* const operations[SDF_OPS] = {
+                        [SDF_UNION] = "minMesh(", [SDF_INTERSECTION] = "maxMesh(",
+                        [SDF_SUBTRACTION] = "maxMesh(negateMesh(",
+                        [SDF_SMOOTH_UNION] = "smoothMinMesh(",
+                        [SDF_SMOOTH_INTERSECTION] = "smoothMaxMesh(",
+                        [SDF_SMOOTH_SUBTRACTION] = "smoothMaxMesh(negateMesh("
+                };
+                int negated = node->op == SDF_SUBTRACTION || node->op == SDF_SMOOTH_SUBTRACTION;
+
+                fprintf(file, "%s", operations[node->op]);
+                emit_glsl_node(file, tree, node->children[0], point, scale);
+                fprintf(file, "%s, ", negated ? ")" : "");
+                emit_glsl_node(file, tree, node->children[1], point, scale);
+                if (node->op >= SDF_SMOOTH_UNION) {
+                        fprintf(file, ", ");
+                        write_float(file, parameters[0], "");
+                }
+                fprintf(file, ")");
+        }
+}
+
+void
+emit_glsl_scene(FILE* const file, struct sdf_tree const* const tree)
+{
+        if (!tree->count) {
+                emit_error("the tree is empty");
+        }
+
+        fprintf(file, "#define SCENE_TREE(point) ");
+        emit_glsl_node(file, tree, tree->count - 1, "point", 1.f);
+        fprintf(file, "\n");
+}
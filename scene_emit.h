@@ -0,0 +1,29 @@
+#ifndef SCENE_EMIT_H
+#define SCENE_EMIT_H
+
+#include "tape.h"
+
+#include <stdio.h>
+
+// A scene tree written out as code of its own rather than run as a tape: C
+// specialized to the tree, every instruction inlined with its constants, and
+// the same scene as GLSL for the GPU. The C keeps the operations of
+// compile_tape() in their order, its results are those of the tape bit for
+// bit.
+
+// Written by sdfc into native_scene.c, when cpurender is built with SCENE set
+extern struct sdf_tree const native_tree;
+void    native_scene(float const* x, float const* y, float const* z, float lod_scale,
+                     float const* lod_origin, float lod_pixel_angle, float* distance,
+                     unsigned int* material, unsigned long count);
+
+// A C file defining native_tree and native_scene() for the tree, a
+// native_scene_function
+void    emit_c_scene(FILE* const file, struct sdf_tree const* const tree, char const* const source);
+
+// The tree as a GLSL macro of a Mesh at point, injected into the fragment
+// shader as it is for volumes:
+//     #define SCENE_TREE(point) ...
+void    emit_glsl_scene(FILE* const file, struct sdf_tree const* const tree);
+
+#endif
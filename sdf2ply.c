@@ -0,0 +1,862 @@
+// Exports the surface of a scene file, see load_sdf_tree() in tape.h, as a
+// binary PLY mesh of quads for other tools.
+//
+//     sdf2ply [-w workers] [-s size] <scene> <out.ply> [resolution]
+//
+// The scene is sampled in a cube of the given size around the origin,
+// EXPORT_SIZE by default, with resolution cells along each side, a power of
+// two. An octree of the cube is refined down to blocks of BLOCK_SIZE cells,
+// dropping the branches further from the surface than their size. The
+// blocks are meshed on all cores with dual contouring: a vertex in every
+// cell the surface crosses, where the tangent planes at the crossings meet,
+// and a quad around every crossed edge. Every block writes its vertices and
+// faces as it finishes, only the cells on the faces between blocks are
+// kept, to stitch the quads that span two blocks once all are done.
+#include "tape.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef unsigned int            uint;
+typedef unsigned char           uchar;
+
+#define DEFAULT_RESOLUTION      256
+#define MAX_RESOLUTION          65536
+#define EXPORT_SIZE             8.f
+#define MAX_EXPORT_THREADS      64
+
+// Cells along the side of a block, and the samples at their corners
+#define BLOCK_SIZE              16
+#define BLOCK_CELLS             (BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE)
+#define BLOCK_SAMPLES           (BLOCK_SIZE + 1)
+
+// Crossings of a cell, and the samples of the gradient at each
+#define CELL_EDGES              12
+#define GRADIENT_SAMPLES        6
+
+// Pull of the vertex towards the mean of the crossings, keeps it in place
+// where the tangent planes are close to parallel
+#define QEF_WEIGHT              .05f
+
+// The header is written last, into this much space before the vertices
+#define HEADER_SIZE             512
+#define FACE_SIZE               (1 + 4 * sizeof(uint32_t))
+#define COPY_SIZE               (1 << 20)
+
+// A quad around an edge on the low faces of its block, its other cells are
+// on the high faces of the neighbours. Found ones are in vertices, the rest
+// by cells.
+struct pending_face {
+        uint64_t        vertices[4];
+        int32_t         cells[4][3];
+        uint            found;          // bit per vertex
+};
+
+struct block {
+        int32_t                 coords[3];      // in blocks
+        uint64_t                first_vertex;
+
+        // Active cells on the high faces, by ascending index in the block, and
+        // the number of their vertex in it
+        uint                    (*boundary)[2];
+        uint                    boundary_count;
+
+        struct pending_face*    pending;
+        uint                    pending_count;
+};
+
+struct export {
+        struct tape const*      tape;
+        float                   min;
+        float                   cell_size;
+        uint                    blocks_per_side;
+
+        struct block*           blocks;         // sorted by block_key()
+        uint64_t                block_count;
+
+        int                     file;
+        int                     faces;          // written here, then after the vertices
+        uint64_t                vertex_count;
+        uint64_t                face_count;
+        pthread_mutex_t         lock;
+};
+
+// Blocks are interleaved between the threads
+struct export_job {
+        struct export*  export;
+        uint            first;
+        uint            step;
+};
+
+static void
+export_error(char const* const error)
+{
+        fprintf(stderr, "ERROR: %s\n", error);
+        exit(EXIT_FAILURE);
+}
+
+static void*
+allocate(size_t size)
+{
+        void* memory = malloc(size);
+        if (!memory) {
+                export_error("Could not allocate memory for the mesh");
+        }
+
+        return memory;
+}
+
+static void*
+reallocate(void* memory, size_t size)
+{
+        memory = realloc(memory, size);
+        if (!memory) {
+                export_error("Could not allocate memory for the mesh");
+        }
+
+        return memory;
+}
+
+static void
+write_at(int file, void const* data, size_t size, uint64_t offset)
+{
+        if (pwrite(file, data, size, (off_t)offset) != (ssize_t)size) {
+                export_error("Could not write the mesh");
+        }
+}
+
+static uint64_t
+block_key(uint blocks_per_side, int32_t const* const coords)
+{
+        return ((uint64_t)coords[2] * blocks_per_side + (uint64_t)coords[1]) * blocks_per_side +
+               (uint64_t)coords[0];
+}
+
+static int
+compare_blocks(void const* a, void const* b)
+{
+        struct block const* first = a;
+        struct block const* second = b;
+        for (int axis = 2; axis >= 0; axis--) {
+                if (first->coords[axis] != second->coords[axis]) {
+                        return first->coords[axis] < second->coords[axis] ? -1 : 1;
+                }
+        }
+        return 0;
+}
+
+// =========================================================================================================
+// Octree
+// =========================================================================================================
+
+// Nodes of an octree level, by their corner in nodes of that level
+struct nodes {
+        int32_t (*coords)[3];
+        uint64_t count;
+};
+
+// Refines the cube down to blocks, every level evaluated in one run of the
+// tape. A node stays when the surface can be within it, the distance at its
+// centre against half its diagonal and a cell of slack.
+static void
+find_blocks(struct export* const export)
+{
+        struct nodes level = { allocate(sizeof(*level.coords)), 1 };
+        level.coords[0][0] = level.coords[0][1] = level.coords[0][2] = 0;
+
+        for (uint size = export->blocks_per_side * BLOCK_SIZE;; size /= 2) {
+                float world = (float)size * export->cell_size;
+                float* x = allocate(sizeof(float) * level.count);
+                float* y = allocate(sizeof(float) * level.count);
+                float* z = allocate(sizeof(float) * level.count);
+                float* distance = allocate(sizeof(float) * level.count);
+
+                for (uint64_t i = 0; i < level.count; i++) {
+                        x[i] = export->min + ((float)level.coords[i][0] + .5f) * world;
+                        y[i] = export->min + ((float)level.coords[i][1] + .5f) * world;
+                        z[i] = export->min + ((float)level.coords[i][2] + .5f) * world;
+                }
+                run_tape(export->tape, x, y, z, 1.f, distance, NULL, level.count);
+
+                float reach = .5f * sqrtf(3.f) * world + export->cell_size;
+                uint64_t kept = 0;
+                for (uint64_t i = 0; i < level.count; i++) {
+                        if (fabsf(distance[i]) <= reach) {
+                                memmove(level.coords[kept++], level.coords[i], sizeof(*level.coords));
+                        }
+                }
+
+                free(x);
+                free(y);
+                free(z);
+                free(distance);
+
+                if (size == BLOCK_SIZE) {
+                        level.count = kept;
+                        break;
+                }
+
+                struct nodes children = { allocate(sizeof(*children.coords) * (kept * 8 + 1)), kept * 8 };
+                for (uint64_t i = 0; i < kept; i++) {
+                        for (uint child = 0; child < 8; child++) {
+                                for (uint axis = 0; axis < 3; axis++) {
+                                        children.coords[i * 8 + child][axis] =
+                                                level.coords[i][axis] * 2 + (int32_t)((child >> axis) & 1);
+                                }
+                        }
+                }
+                free(level.coords);
+                level = children;
+        }
+
+        export->block_count = level.count;
+        export->blocks = allocate(sizeof(*export->blocks) * (level.count + 1));
+        for (uint64_t i = 0; i < level.count; i++) {
+                struct block* block = &export->blocks[i];
+                memset(block, 0, sizeof(*block));
+                memcpy(block->coords, level.coords[i], sizeof(block->coords));
+        }
+        free(level.coords);
+
+        qsort(export->blocks, export->block_count, sizeof(*export->blocks), compare_blocks);
+}
+
+static struct block const*
+find_block(struct export const* const export, int32_t const* const coords)
+{
+        for (uint axis = 0; axis < 3; axis++) {
+                if (coords[axis] < 0 || coords[axis] >= (int32_t)export->blocks_per_side) {
+                        return NULL;
+                }
+        }
+
+        uint64_t key = block_key(export->blocks_per_side, coords);
+        uint64_t low = 0, high = export->block_count;
+        while (low < high) {
+                uint64_t middle = (low + high) / 2;
+                uint64_t middle_key = block_key(export->blocks_per_side, export->blocks[middle].coords);
+                if (middle_key == key) {
+                        return &export->blocks[middle];
+                } else if (middle_key < key) {
+                        low = middle + 1;
+                } else {
+                        high = middle;
+                }
+        }
+
+        return NULL;
+}
+
+// =========================================================================================================
+// Dual contouring
+// =========================================================================================================
+
+// Corners of the cube by bit, x first, and the edges between them
+static uint const edge_corners[CELL_EDGES][2] = {
+        { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+        { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+        { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+};
+
+// Buffers of a thread, for one block at a time
+struct contour {
+        float           samples[BLOCK_SAMPLES * BLOCK_SAMPLES * BLOCK_SAMPLES];
+        int             ranks[BLOCK_CELLS];             // of the vertex, or -1
+        float           vertices[BLOCK_CELLS][3];
+
+        // Crossings of the active cells, and where their gradient is sampled
+        float           crossings[BLOCK_CELLS * CELL_EDGES][3];
+        uint            first_crossing[BLOCK_CELLS + 1];
+        float*          points[3];
+        float*          gradients;
+
+        uchar           faces[3 * BLOCK_CELLS][FACE_SIZE];
+};
+
+static uint
+sample_index(uint x, uint y, uint z)
+{
+        return (z * BLOCK_SAMPLES + y) * BLOCK_SAMPLES + x;
+}
+
+static uint
+cell_index(uint x, uint y, uint z)
+{
+        return (z * BLOCK_SIZE + y) * BLOCK_SIZE + x;
+}
+
+// Solves (A + w I) x = b for the symmetric A by Cramer's rule, 0 when it is
+// singular
+static int
+solve_qef(float const* const a, float const* const b, float* const x)
+{
+        float m[3][3] = {
+                { a[0] + QEF_WEIGHT, a[1], a[2] },
+                { a[1], a[3] + QEF_WEIGHT, a[4] },
+                { a[2], a[4], a[5] + QEF_WEIGHT }
+        };
+        float cofactors[3] = {
+                m[1][1] * m[2][2] - m[1][2] * m[2][1],
+                m[1][2] * m[2][0] - m[1][0] * m[2][2],
+                m[1][0] * m[2][1] - m[1][1] * m[2][0]
+        };
+        float determinant = m[0][0] * cofactors[0] + m[0][1] * cofactors[1] + m[0][2] * cofactors[2];
+        if (fabsf(determinant) < 1e-12f) {
+                return 0;
+        }
+
+        for (uint axis = 0; axis < 3; axis++) {
+                float replaced[3][3];
+                memcpy(replaced, m, sizeof(m));
+                for (uint row = 0; row < 3; row++) {
+                        replaced[row][axis] = b[row];
+                }
+                x[axis] = (replaced[0][0] * (replaced[1][1] * replaced[2][2] - replaced[1][2] * replaced[2][1]) -
+                           replaced[0][1] * (replaced[1][0] * replaced[2][2] - replaced[1][2] * replaced[2][0]) +
+                           replaced[0][2] * (replaced[1][0] * replaced[2][1] - replaced[1][1] * replaced[2][0])) /
+                          determinant;
+        }
+
+        return 1;
+}
+
+// The samples at the corners of the cells and the crossings of the active
+// ones, each set in one run of the tape
+static uint
+sample_block(struct export const* const export, struct contour* const contour,
+             struct block const* const block)
+{
+        float base[3];
+        for (uint axis = 0; axis < 3; axis++) {
+                base[axis] = export->min + (float)(block->coords[axis] * BLOCK_SIZE) * export->cell_size;
+        }
+
+        uint count = 0;
+        for (uint z = 0; z < BLOCK_SAMPLES; z++) {
+                for (uint y = 0; y < BLOCK_SAMPLES; y++) {
+                        for (uint x = 0; x < BLOCK_SAMPLES; x++, count++) {
+                                contour->points[0][count] = base[0] + (float)x * export->cell_size;
+                                contour->points[1][count] = base[1] + (float)y * export->cell_size;
+                                contour->points[2][count] = base[2] + (float)z * export->cell_size;
+                        }
+                }
+        }
+        run_tape(export->tape, contour->points[0], contour->points[1], contour->points[2], 1.f,
+                 contour->samples, NULL, count);
+
+        // Where the surface crosses the edges of every cell, linearly
+        uint crossings = 0, vertex_count = 0;
+        for (uint z = 0; z < BLOCK_SIZE; z++) {
+                for (uint y = 0; y < BLOCK_SIZE; y++) {
+                        for (uint x = 0; x < BLOCK_SIZE; x++) {
+                                uint cell = cell_index(x, y, z);
+                                contour->first_crossing[cell] = crossings;
+
+                                float corners[8];
+                                uint inside = 0;
+                                for (uint corner = 0; corner < 8; corner++) {
+                                        corners[corner] = contour->samples[sample_index(
+                                                x + (corner & 1), y + (corner >> 1 & 1), z + (corner >> 2))];
+                                        inside |= (uint)(corners[corner] < 0.f) << corner;
+                                }
+
+                                contour->ranks[cell] = inside && inside != 0xff ? (int)vertex_count++ : -1;
+                                if (contour->ranks[cell] < 0) {
+                                        continue;
+                                }
+
+                                for (uint edge = 0; edge < CELL_EDGES; edge++) {
+                                        uint a = edge_corners[edge][0], b = edge_corners[edge][1];
+                                        if (((inside >> a) & 1) == ((inside >> b) & 1)) {
+                                                continue;
+                                        }
+
+                                        float t = corners[a] / (corners[a] - corners[b]);
+                                        float* crossing = contour->crossings[crossings++];
+                                        uint const cell_corner[3] = { x, y, z };
+                                        for (uint axis = 0; axis < 3; axis++) {
+                                                float from = (float)(cell_corner[axis] + (a >> axis & 1));
+                                                float to = (float)(cell_corner[axis] + (b >> axis & 1));
+                                                crossing[axis] = base[axis] +
+                                                        (from + (to - from) * t) * export->cell_size;
+                                        }
+                                }
+                        }
+                }
+        }
+        contour->first_crossing[BLOCK_CELLS] = crossings;
+
+        // Central differences around every crossing
+        float offset = .1f * export->cell_size;
+        count = 0;
+        for (uint i = 0; i < crossings; i++) {
+                for (uint sample = 0; sample < GRADIENT_SAMPLES; sample++, count++) {
+                        for (uint axis = 0; axis < 3; axis++) {
+                                contour->points[axis][count] = contour->crossings[i][axis] +
+                                        (sample / 2 == axis ? (sample & 1 ? -offset : offset) : 0.f);
+                        }
+                }
+        }
+        run_tape(export->tape, contour->points[0], contour->points[1], contour->points[2], 1.f,
+                 contour->gradients, NULL, count);
+
+        return vertex_count;
+}
+
+// The point nearest to the tangent planes of the crossings, kept in the cell
+static void
+place_vertex(struct export const* const export, struct contour const* const contour,
+             struct block const* const block, uint x, uint y, uint z, float* const vertex)
+{
+        uint cell = cell_index(x, y, z);
+        uint first = contour->first_crossing[cell];
+        uint count = contour->first_crossing[cell + 1] - first;
+
+        float mean[3] = { 0.f, 0.f, 0.f };
+        for (uint i = first; i < first + count; i++) {
+                for (uint axis = 0; axis < 3; axis++) {
+                        mean[axis] += contour->crossings[i][axis] / (float)count;
+                }
+        }
+
+        // Normal equations of the planes, around the mean
+        float ata[6] = { 0.f }, atb[3] = { 0.f };
+        for (uint i = first; i < first + count; i++) {
+                float const* g = &contour->gradients[i * GRADIENT_SAMPLES];
+                float normal[3] = { g[0] - g[1], g[2] - g[3], g[4] - g[5] };
+                float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                if (!(length > 0.f)) {
+                        continue;
+                }
+
+                float distance = 0.f;
+                for (uint axis = 0; axis < 3; axis++) {
+                        normal[axis] /= length;
+                        distance += normal[axis] * (contour->crossings[i][axis] - mean[axis]);
+                }
+
+                ata[0] += normal[0] * normal[0];
+                ata[1] += normal[0] * normal[1];
+                ata[2] += normal[0] * normal[2];
+                ata[3] += normal[1] * normal[1];
+                ata[4] += normal[1] * normal[2];
+                ata[5] += normal[2] * normal[2];
+                for (uint axis = 0; axis < 3; axis++) {
+                        atb[axis] += normal[axis] * distance;
+                }
+        }
+
+        float solution[3];
+        if (!solve_qef(ata, atb, solution)) {
+                solution[0] = solution[1] = solution[2] = 0.f;
+        }
+
+        uint const corner[3] = { x, y, z };
+        for (uint axis = 0; axis < 3; axis++) {
+                float low = export->min +
+                        (float)(block->coords[axis] * BLOCK_SIZE + (int32_t)corner[axis]) * export->cell_size;
+                float position = mean[axis] + solution[axis];
+                vertex[axis] = position < low ? low :
+                        position > low + export->cell_size ? low + export->cell_size : position;
+        }
+}
+
+static void
+write_face(uchar* const face, uint64_t const* const vertices)
+{
+        face[0] = 4;
+        for (uint i = 0; i < 4; i++) {
+                uint32_t vertex = (uint32_t)vertices[i];
+                memcpy(face + 1 + i * sizeof(vertex), &vertex, sizeof(vertex));
+        }
+}
+
+// Vertices and faces of the block, the faces it cannot finish are left
+// pending
+static void
+contour_block(struct export* const export, struct contour* const contour, struct block* const block)
+{
+        uint vertex_count = sample_block(export, contour, block);
+        if (!vertex_count) {
+                return;
+        }
+
+        // Vertices are numbered in the order of the cells, those on the high
+        // faces are kept for the neighbours
+        block->boundary = allocate(sizeof(*block->boundary) * vertex_count);
+        for (uint z = 0; z < BLOCK_SIZE; z++) {
+                for (uint y = 0; y < BLOCK_SIZE; y++) {
+                        for (uint x = 0; x < BLOCK_SIZE; x++) {
+                                uint cell = cell_index(x, y, z);
+                                int rank = contour->ranks[cell];
+                                if (rank < 0) {
+                                        continue;
+                                }
+
+                                place_vertex(export, contour, block, x, y, z, contour->vertices[rank]);
+                                if (x == BLOCK_SIZE - 1 || y == BLOCK_SIZE - 1 || z == BLOCK_SIZE - 1) {
+                                        block->boundary[block->boundary_count][0] = cell;
+                                        block->boundary[block->boundary_count++][1] = (uint)rank;
+                                }
+                        }
+                }
+        }
+
+        pthread_mutex_lock(&export->lock);
+        block->first_vertex = export->vertex_count;
+        export->vertex_count += vertex_count;
+        pthread_mutex_unlock(&export->lock);
+
+        write_at(export->file, contour->vertices, sizeof(*contour->vertices) * vertex_count,
+                 HEADER_SIZE + block->first_vertex * sizeof(*contour->vertices));
+
+        // A quad around every crossed edge starting in the block, through the
+        // cells around it, facing out of the surface
+        uint face_count = 0;
+        uint pending_capacity = 0;
+        for (uint z = 0; z < BLOCK_SIZE; z++) {
+                for (uint y = 0; y < BLOCK_SIZE; y++) {
+                        for (uint x = 0; x < BLOCK_SIZE; x++) {
+                                uint const corner[3] = { x, y, z };
+                                float start = contour->samples[sample_index(x, y, z)];
+
+                                for (uint axis = 0; axis < 3; axis++) {
+                                        uint end_corner[3] = { x, y, z };
+                                        end_corner[axis]++;
+                                        float end = contour->samples[sample_index(end_corner[0], end_corner[1],
+                                                                                  end_corner[2])];
+                                        if ((start < 0.f) == (end < 0.f)) {
+                                                continue;
+                                        }
+
+                                        uint u = (axis + 1) % 3, v = (axis + 2) % 3;
+                                        int const steps[4][2] = { { 1, 1 }, { 0, 1 }, { 0, 0 }, { 1, 0 } };
+                                        struct pending_face face;
+                                        face.found = 0;
+                                        for (uint i = 0; i < 4; i++) {
+                                                uint around = start < 0.f ? i : 3 - i;
+                                                int32_t cell[3] = { (int32_t)corner[0], (int32_t)corner[1],
+                                                                    (int32_t)corner[2] };
+                                                cell[u] -= steps[around][0];
+                                                cell[v] -= steps[around][1];
+
+                                                if (cell[u] >= 0 && cell[v] >= 0) {
+                                                        int rank = contour->ranks[cell_index(
+                                                                (uint)cell[0], (uint)cell[1], (uint)cell[2])];
+                                                        face.vertices[i] = block->first_vertex + (uint64_t)rank;
+                                                        face.found |= 1u << i;
+                                                }
+                                                for (uint c = 0; c < 3; c++) {
+                                                        face.cells[i][c] = block->coords[c] * BLOCK_SIZE + cell[c];
+                                                }
+                                        }
+
+                                        if (face.found == 0xf) {
+                                                write_face(contour->faces[face_count++], face.vertices);
+                                                continue;
+                                        }
+
+                                        if (block->pending_count == pending_capacity) {
+                                                pending_capacity = pending_capacity ? pending_capacity * 2 : 64;
+                                                block->pending = reallocate(block->pending,
+                                                                            sizeof(*block->pending) * pending_capacity);
+                                        }
+                                        block->pending[block->pending_count++] = face;
+                                }
+                        }
+                }
+        }
+
+        pthread_mutex_lock(&export->lock);
+        uint64_t first_face = export->face_count;
+        export->face_count += face_count;
+        pthread_mutex_unlock(&export->lock);
+
+        write_at(export->faces, contour->faces, FACE_SIZE * face_count, first_face * FACE_SIZE);
+}
+
+static void*
+contour_blocks(void* argument)
+{
+        struct export_job const* job = argument;
+        struct export* export = job->export;
+
+        struct contour* contour = allocate(sizeof(*contour));
+        size_t points = BLOCK_CELLS * CELL_EDGES * GRADIENT_SAMPLES;
+        for (uint axis = 0; axis < 3; axis++) {
+                contour->points[axis] = allocate(sizeof(float) * points);
+        }
+        contour->gradients = allocate(sizeof(float) * points);
+
+        for (uint64_t i = job->first; i < export->block_count; i += job->step) {
+                contour_block(export, contour, &export->blocks[i]);
+        }
+
+        for (uint axis = 0; axis < 3; axis++) {
+                free(contour->points[axis]);
+        }
+        free(contour->gradients);
+        free(contour);
+
+        return NULL;
+}
+
+// The vertex of a cell on the high faces of its block
+static int
+find_vertex(struct export const* const export, int32_t const* const cell, uint64_t* const vertex)
+{
+        int32_t coords[3], local[3];
+        for (uint axis = 0; axis < 3; axis++) {
+                coords[axis] = cell[axis] < 0 ? -1 : cell[axis] / BLOCK_SIZE;
+                local[axis] = cell[axis] - coords[axis] * BLOCK_SIZE;
+        }
+
+        struct block const* block = find_block(export, coords);
+        if (!block) {
+                return 0;
+        }
+
+        uint key = cell_index((uint)local[0], (uint)local[1], (uint)local[2]);
+        uint low = 0, high = block->boundary_count;
+        while (low < high) {
+                uint middle = (low + high) / 2;
+                if (block->boundary[middle][0] == key) {
+                        *vertex = block->first_vertex + block->boundary[middle][1];
+                        return 1;
+                } else if (block->boundary[middle][0] < key) {
+                        low = middle + 1;
+                } else {
+                        high = middle;
+                }
+        }
+
+        return 0;
+}
+
+// Faces across the blocks, with all the vertices written. Those on the low
+// faces of the cube have no cells beyond it and are left open.
+static void*
+stitch_blocks(void* argument)
+{
+        struct export_job const* job = argument;
+        struct export* export = job->export;
+        uchar (*faces)[FACE_SIZE] = NULL;
+        uint capacity = 0;
+
+        for (uint64_t i = job->first; i < export->block_count; i += job->step) {
+                struct block* block = &export->blocks[i];
+                if (block->pending_count > capacity) {
+                        capacity = block->pending_count;
+                        faces = reallocate(faces, FACE_SIZE * capacity);
+                }
+
+                uint face_count = 0;
+                for (uint p = 0; p < block->pending_count; p++) {
+                        struct pending_face* face = &block->pending[p];
+                        for (uint corner = 0; corner < 4; corner++) {
+                                if (!(face->found >> corner & 1) &&
+                                    find_vertex(export, face->cells[corner], &face->vertices[corner])) {
+                                        face->found |= 1u << corner;
+                                }
+                        }
+                        if (face->found == 0xf) {
+                                write_face(faces[face_count++], face->vertices);
+                        }
+                }
+
+                pthread_mutex_lock(&export->lock);
+                uint64_t first_face = export->face_count;
+                export->face_count += face_count;
+                pthread_mutex_unlock(&export->lock);
+
+                write_at(export->faces, faces, FACE_SIZE * face_count, first_face * FACE_SIZE);
+        }
+
+        free(faces);
+
+        return NULL;
+}
+
+static void
+run_jobs(void* (*work)(void*), struct export* const export, uint thread_count)
+{
+        pthread_t threads[MAX_EXPORT_THREADS];
+        struct export_job jobs[MAX_EXPORT_THREADS];
+        int running[MAX_EXPORT_THREADS] = { 0 };
+
+        // The calling thread takes the first share, and any share whose
+        // thread could not be started
+        for (uint i = 0; i < thread_count; i++) {
+                jobs[i] = (struct export_job){ export, i, thread_count };
+        }
+
+        for (uint i = 1; i < thread_count; i++) {
+                running[i] = !pthread_create(&threads[i], NULL, work, &jobs[i]);
+        }
+
+        for (uint i = 0; i < thread_count; i++) {
+                if (running[i]) {
+                        pthread_join(threads[i], NULL);
+                } else {
+                        work(&jobs[i]);
+                }
+        }
+}
+
+// =========================================================================================================
+// Output
+// =========================================================================================================
+
+// The counts are only known at the end, the header is padded with a comment
+// to the space left for it
+static void
+write_header(struct export const* const export, char const* const scene)
+{
+        char header[HEADER_SIZE + 1];
+        int length = snprintf(header, sizeof(header),
+                              "ply\n"
+                              "format binary_little_endian 1.0\n"
+                              "comment Exported by sdf2ply from %.128s\n"
+                              "element vertex %llu\n"
+                              "property float x\n"
+                              "property float y\n"
+                              "property float z\n"
+                              "element face %llu\n"
+                              "property list uchar uint vertex_indices\n"
+                              "comment ",
+                              scene, (unsigned long long)export->vertex_count,
+                              (unsigned long long)export->face_count);
+
+        char const* end = "\nend_header\n";
+        size_t padding = HEADER_SIZE - (size_t)length - strlen(end);
+        memset(header + length, ' ', padding);
+        memcpy(header + (size_t)length + padding, end, strlen(end));
+
+        write_at(export->file, header, HEADER_SIZE, 0);
+}
+
+// The faces go after the vertices
+static void
+append_faces(struct export const* const export)
+{
+        uchar* buffer = allocate(COPY_SIZE);
+        uint64_t size = export->face_count * FACE_SIZE;
+        uint64_t offset = HEADER_SIZE + export->vertex_count * 3 * sizeof(float);
+
+        for (uint64_t copied = 0; copied < size;) {
+                size_t chunk = size - copied < COPY_SIZE ? (size_t)(size - copied) : COPY_SIZE;
+                if (pread(export->faces, buffer, chunk, (off_t)copied) != (ssize_t)chunk) {
+                        export_error("Could not read the faces back");
+                }
+                write_at(export->file, buffer, chunk, offset + copied);
+                copied += chunk;
+        }
+
+        free(buffer);
+}
+
+int
+main(int argc, char** argv)
+{
+        long workers = 0;
+        float size = EXPORT_SIZE;
+        int option, usage = 0;
+
+        while ((option = getopt(argc, argv, "w:s:")) != -1) {
+                if (option == 'w') {
+                        workers = strtol(optarg, NULL, 10);
+                } else if (option == 's') {
+                        size = strtof(optarg, NULL);
+                } else {
+                        usage = 1;
+                }
+        }
+
+        if (usage || !(size > 0.f) || workers < 0 || workers > MAX_EXPORT_THREADS ||
+            argc - optind < 2 || argc - optind > 3) {
+                fprintf(stderr, "Usage: %s [-w workers] [-s size] <scene> <out.ply> [resolution]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        long resolution = argc - optind == 3 ? strtol(argv[optind + 2], NULL, 10) : DEFAULT_RESOLUTION;
+        if (resolution < BLOCK_SIZE || resolution > MAX_RESOLUTION || (resolution & (resolution - 1))) {
+                fprintf(stderr, "ERROR: The resolution must be a power of two between %d and %d\n",
+                        BLOCK_SIZE, MAX_RESOLUTION);
+                return EXIT_FAILURE;
+        }
+
+        // Full detail, the LOD of the terrain needs a camera
+        struct sdf_tree tree;
+        load_sdf_tree(&tree, argv[optind]);
+        float const origin[3] = { 0.f, 0.f, 0.f };
+        struct tape tape;
+        compile_tape(&tape, &tree, origin, 0.f);
+
+        struct export export;
+        memset(&export, 0, sizeof(export));
+        export.tape = &tape;
+        export.min = -.5f * size;
+        export.cell_size = size / (float)resolution;
+        export.blocks_per_side = (uint)resolution / BLOCK_SIZE;
+        pthread_mutex_init(&export.lock, NULL);
+
+        char const* path = argv[optind + 1];
+        export.file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (export.file < 0) {
+                fprintf(stderr, "ERROR: Could not create file: %s\n", path);
+                return EXIT_FAILURE;
+        }
+
+        // The faces wait in a file of a unique name next to the mesh, on the
+        // same disk, unlinked as soon as it is open
+        char faces_path[4096];
+        char const* slash = strrchr(path, '/');
+        int directory = slash ? (int)(slash - path) + 1 : 0;
+        int length = snprintf(faces_path, sizeof(faces_path), "%.*s.sdf2ply-XXXXXX", directory, path);
+        if (length < 0 || length >= (int)sizeof(faces_path)) {
+                export_error("The path of the mesh is too long");
+        }
+        export.faces = mkstemp(faces_path);
+        if (export.faces < 0) {
+                fprintf(stderr, "ERROR: Could not create file: %s\n", faces_path);
+                return EXIT_FAILURE;
+        }
+        unlink(faces_path);
+
+        long cores = workers ? workers : sysconf(_SC_NPROCESSORS_ONLN);
+        uint thread_count = cores < 1 ? 1 : cores > MAX_EXPORT_THREADS ? MAX_EXPORT_THREADS : (uint)cores;
+
+        find_blocks(&export);
+        run_jobs(contour_blocks, &export, thread_count);
+        run_jobs(stitch_blocks, &export, thread_count);
+
+        if (export.vertex_count > UINT32_MAX) {
+                export_error("Too many vertices for the indices of the faces");
+        }
+        append_faces(&export);
+        write_header(&export, argv[optind]);
+
+        if (close(export.file) || close(export.faces)) {
+                export_error("Could not write the mesh");
+        }
+        printf("%s: %llu vertices, %llu quads from %llu of %u blocks\n", path,
+               (unsigned long long)export.vertex_count, (unsigned long long)export.face_count,
+               (unsigned long long)export.block_count,
+               export.blocks_per_side * export.blocks_per_side * export.blocks_per_side);
+
+        for (uint64_t i = 0; i < export.block_count; i++) {
+                free(export.blocks[i].boundary);
+                free(export.blocks[i].pending);
+        }
+        free(export.blocks);
+        pthread_mutex_destroy(&export.lock);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,50 @@
+// Compiles a scene file, see load_sdf_tree() in tape.h, to code of its own:
+// a C evaluator specialized to the scene, or with -g the GLSL the renderer
+// injects for -S.
+//
+//     sdfc [-g] <scene> > out
+//
+// make cpurender SCENE=<scene> builds the C into cpurender, which renders it
+// with -N. Errors in the scene are reported by line before any code is
+// written.
+#include "scene_emit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int
+main(int argc, char** argv)
+{
+        int glsl = 0;
+        int option, usage = 0;
+
+        while ((option = getopt(argc, argv, "g")) != -1) {
+                if (option == 'g') {
+                        glsl = 1;
+                } else {
+                        usage = 1;
+                }
+        }
+
+        if (usage || argc - optind != 1) {
+                fprintf(stderr, "Usage: %s [-g] <scene> > out\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        struct sdf_tree tree;
+        load_sdf_tree(&tree, argv[optind]);
+
+        if (glsl) {
+                emit_glsl_scene(stdout, &tree);
+        } else {
+                emit_c_scene(stdout, &tree, argv[optind]);
+        }
+
+        if (fflush(stdout)) {
+                perror("stdout");
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+#ifndef SHADER_PACK_H
+#define SHADER_PACK_H
+
+// Shader sources compiled into the executable, shader_pack.c is generated
+// from shaders/ by packshaders at build time
+struct packed_shader {
+        char const*     name;
+        char const*     source;         // NUL terminated
+        unsigned long   length;
+};
+
+extern struct packed_shader const packed_shaders[];
+extern unsigned int const packed_shader_count;
+
+#endif
@@ -0,0 +1,96 @@
+#version 460 core
+layout(location = 0) out vec4 FragColor;
+
+// Screen space ambient occlusion over the G-buffer the march pass wrote with
+// SCREEN_SPACE_AO, see ao.h. Every pixel looks for the horizon of the
+// surfaces around it in a few directions and darkens the occludable light by
+// how much of the hemisphere they hide. The cost depends on the resolution
+// only, not on the scene.
+layout(binding = 7) uniform sampler2DArray u_color;
+layout(binding = 8) uniform sampler2DArray u_occludable;
+layout(binding = 9) uniform sampler2DArray u_position;
+layout(binding = 10) uniform sampler2DArray u_normal;
+
+// Size of a layer
+uniform vec2 u_resolution;
+
+#include "views.glsl"
+
+#define AO_DIRECTIONS 8
+#define AO_STEPS 4
+
+#define TAU 6.28318530718
+
+// World space reach of the occluders and how dark they make it, about the
+// look of the marched AO
+#define AO_RADIUS 1.
+#define AO_STRENGTH 3.
+
+// Ignores the surface the pixel is on, tessellated or curving away
+#define AO_BIAS .1
+
+// Per pixel rotation of the directions, interleaved gradient noise
+float jitter(vec2 pixel) {
+  return fract(52.9829189 * fract(dot(pixel, vec2(.06711056, .00583715))));
+}
+
+float occlusion(ivec3 pixel, vec3 point, vec3 normal) {
+
+  // Projected reach, the image plane is forward.w half heights away
+  float distance = length(point - views[VIEW].origin.xyz);
+  float radius = AO_RADIUS * views[VIEW].forward.w * .5 * u_resolution.y / distance;
+  if (radius < 1.)
+    return 1.;
+
+  // Directions evenly around the pixel, turned by a step each time
+  float rotation = jitter(vec2(pixel.xy));
+  float angle = rotation * TAU / float(AO_DIRECTIONS);
+  vec2 direction = vec2(cos(angle), sin(angle));
+  float step_angle = TAU / float(AO_DIRECTIONS);
+  mat2 turn = mat2(cos(step_angle), sin(step_angle), -sin(step_angle), cos(step_angle));
+
+  float occluded = 0.;
+
+  for (int i = 0; i < AO_DIRECTIONS; i++, direction = turn * direction) {
+
+    // Highest elevation above the tangent plane, faded with distance
+    float horizon = 0.;
+    for (int j = 0; j < AO_STEPS; j++) {
+      vec2 offset = direction * radius * (float(j) + rotation * .5 + .5) / float(AO_STEPS);
+      ivec2 sample_pixel = pixel.xy + ivec2(round(offset));
+      if (any(lessThan(sample_pixel, ivec2(0))) ||
+          any(greaterThanEqual(sample_pixel, ivec2(u_resolution))))
+        break;
+
+      vec4 position = texelFetch(u_position, ivec3(sample_pixel, pixel.z), 0);
+      if (position.w == 0.)
+        continue;
+
+      vec3 to_sample = position.xyz - point;
+      float squared = dot(to_sample, to_sample);
+      float falloff = clamp(1. - squared / (AO_RADIUS * AO_RADIUS), 0., 1.);
+      float elevation = dot(normal, to_sample) * inversesqrt(squared + 1e-6);
+      horizon = max(horizon, (elevation - AO_BIAS) * falloff);
+    }
+
+    occluded += horizon;
+  }
+
+  return 1. - clamp(AO_STRENGTH * occluded / float(AO_DIRECTIONS), 0., 1.);
+}
+
+void main() {
+  ivec3 pixel = ivec3(gl_FragCoord.xy, VIEW);
+
+  vec3 color = texelFetch(u_color, pixel, 0).rgb;
+  vec4 position = texelFetch(u_position, pixel, 0);
+
+  if (position.w > 0.) {
+    vec3 normal = texelFetch(u_normal, pixel, 0).xyz;
+    vec3 occludable = texelFetch(u_occludable, pixel, 0).rgb;
+    color -= occludable * (1. - occlusion(pixel, position.xyz, normal));
+  }
+
+  // Gamma correction
+  FragColor = vec4(pow(max(color, 0.), vec3(.4545)), 1.);
+}
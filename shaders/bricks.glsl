@@ -0,0 +1,40 @@
+// =========================================================================================================
+// Streamed brick volume
+// =========================================================================================================
+
+// Bricked distance volume streamed by stream.c. BRICKS_MIN,
+// BRICKS_VOXEL_SIZE, BRICKS_COUNTS, BRICK_SIZE and ATLAS_SLOTS are injected
+// from the file header and stream.h.
+layout(binding = 3) uniform sampler3D u_bricks_coarse;
+layout(binding = 4) uniform sampler3D u_bricks_atlas;
+layout(binding = 5) uniform usampler3D u_bricks_table;
+
+float bricksSdf(vec3 point) {
+  vec3 samples = vec3(BRICKS_COUNTS * BRICK_SIZE);
+  vec3 grid = (point - BRICKS_MIN) / BRICKS_VOXEL_SIZE;
+  vec3 inside = clamp(grid, vec3(0.), samples);
+
+  ivec3 brick = min(ivec3(inside) / BRICK_SIZE, BRICKS_COUNTS - 1);
+  uint slot = texelFetch(u_bricks_table, brick, 0).r;
+
+  float dist;
+  if (slot > 0u) {
+    // Resident, the brick holds its own border samples so filtering never
+    // reads a neighbouring slot
+    slot -= 1u;
+    ivec3 atlas = ivec3(slot % ATLAS_SLOTS, slot / ATLAS_SLOTS % ATLAS_SLOTS,
+                        slot / (ATLAS_SLOTS * ATLAS_SLOTS));
+    vec3 local = inside - vec3(brick * BRICK_SIZE);
+    vec3 uvw = (vec3(atlas * (BRICK_SIZE + 1)) + local + .5) /
+               float(ATLAS_SLOTS * (BRICK_SIZE + 1));
+    dist = texture(u_bricks_atlas, uvw).r;
+  } else {
+    // Empty or not streamed in yet, one coarse sample per brick corner
+    vec3 uvw = (inside / float(BRICK_SIZE) + .5) / vec3(BRICKS_COUNTS + 1);
+    dist = texture(u_bricks_coarse, uvw).r;
+  }
+
+  // Outside the volume, as in volumeSdf()
+  float outside = length(grid - inside) * BRICKS_VOXEL_SIZE;
+  return outside > 0. ? max(outside, dist - outside) : dist;
+}
@@ -1,13 +1,46 @@
 #version 460 core
 layout(location = 0) out vec4 FragColor;
 
+// Screen space AO, defined by the host. The ambient occlusion is left to
+// shaders/ao_shader.glsl, this pass writes the linear colour without it, the
+// part of it AO darkens and the surface position and normal.
+#ifdef SCREEN_SPACE_AO
+layout(location = 1) out vec4 Occludable;
+layout(location = 2) out vec4 Position; // w is 1 on a hit
+layout(location = 3) out vec4 Normal;
+#endif
+
+// Proxy geometry, defined by the host with PROXY_MIN and PROXY_MAX when a
+// volume is loaded. The volume is then left out of this full screen pass
+// and drawn by rasterizing its box with PROXY_PASS, every pass writes the
+// depth it hits so the nearest surface wins.
+#ifdef PROXY_PASS
+// Hits lie behind the front faces of the box, so the depth test can reject
+// hidden fragments before they march
+layout(depth_greater) out float gl_FragDepth;
+#endif
+
 // =========================================================================================================
 // Uniforms
 // =========================================================================================================
 
 uniform float u_time;
 uniform vec2 u_resolution;
-uniform vec2 u_mouse;
+
+#include "views.glsl"
+
+// Temporal depth reuse, defined by the host, see history.h. The primary hit
+// distances of the last frame and the views it was drawn from, 0 where none
+// is known, and the image this frame writes its own to. The frame count
+// picks the rays that march in full.
+#ifdef DEPTH_REUSE
+layout(std140, binding = 1) uniform PreviousViews {
+  uint historyFrame;
+  View previousViews[VIEW_COUNT];
+};
+layout(binding = 0, r32f) uniform readonly image2DArray u_last_distance;
+layout(binding = 1, r32f) uniform writeonly image2DArray u_distance;
+#endif
 
 // =========================================================================================================
 // Global constants
@@ -16,11 +49,105 @@ uniform vec2 u_mouse;
 #define FC gl_FragCoord
 #define R u_resolution
 #define T u_time
-#define M u_mouse
 
+// Quality settings, normally injected by the host for each preset
+#ifndef MAX_MARCHING_STEPS
 #define MAX_MARCHING_STEPS 200.
+#endif
+#ifndef PRECISION
 #define PRECISION .005
+#endif
+#ifndef MAX_DEPTH
 #define MAX_DEPTH 50.
+#endif
+#ifndef SHADOW_STEPS
+#define SHADOW_STEPS 256
+#endif
+#ifndef SHADOW_SOFTNESS
+#define SHADOW_SOFTNESS .3
+#endif
+#ifndef AO_SAMPLES
+#define AO_SAMPLES 8
+#endif
+#ifndef FBM_OCTAVES
+#define FBM_OCTAVES 5
+#endif
+#ifndef HEIGHTFIELD_STEPS
+#define HEIGHTFIELD_STEPS 128
+#endif
+
+// Scatter the host generated primitives over the ground, also toggled by
+// the host at runtime
+// #define INSTANCES
+
+// Mesh converted by mesh2sdf, defined by the host when a volume file is
+// given on the command line. VOLUME_BRICKS instead when it is streamed.
+// #define VOLUME
+#ifndef VOLUME_POSITION
+#define VOLUME_POSITION vec3(-2.5, 0., 0.)
+#endif
+
+// Displace the ground plane with fBM terrain
+// #define TERRAIN
+#define TERRAIN_SCALE .5
+#define TERRAIN_HEIGHT .8
+
+// How primary rays trace an object: sphere tracing through scene(), the
+// dedicated heightfield marcher for objects that are a height over the xz
+// plane, or a closed form intersection for simple shapes. Objects blended
+// with others must stay MARCH_SDF.
+#define MARCH_SDF 0
+#define MARCH_HEIGHTFIELD 1
+#define MARCH_GRID 2
+#define MARCH_BVH 3
+#define MARCH_ANALYTIC 4
+#define MARCH_PROXY 5
+
+#ifdef SCENE_TREE
+// The tree of a scene file, injected by the host, takes the place of the
+// sphere and the ground, which are then sphere traced with it
+#define SPHERE_MARCHER MARCH_SDF
+#define PLANE_MARCHER MARCH_SDF
+#else
+#define SPHERE_MARCHER MARCH_ANALYTIC
+#ifdef TERRAIN
+#define PLANE_MARCHER MARCH_HEIGHTFIELD
+#else
+#define PLANE_MARCHER MARCH_ANALYTIC
+#endif
+#endif
+#ifndef INSTANCES_MARCHER
+#define INSTANCES_MARCHER MARCH_GRID
+#endif
+#ifdef PROXY_GEOMETRY
+#define VOLUME_MARCHER MARCH_PROXY
+#else
+#define VOLUME_MARCHER MARCH_SDF
+#endif
+
+// How an object casts shadows: marched through scene() by softShadow(), or
+// in closed form for simple shapes
+#define SHADOW_MARCHED 0
+#define SHADOW_ANALYTIC 1
+
+#ifdef SCENE_TREE
+#define SPHERE_SHADOW SHADOW_MARCHED
+#define PLANE_SHADOW SHADOW_MARCHED
+#else
+#define SPHERE_SHADOW SHADOW_ANALYTIC
+#ifdef TERRAIN
+#define PLANE_SHADOW SHADOW_MARCHED
+#else
+#define PLANE_SHADOW SHADOW_ANALYTIC
+#endif
+#endif
+
+// softShadow() only marches when some object still needs it
+#if SPHERE_SHADOW == SHADOW_MARCHED || PLANE_SHADOW == SHADOW_MARCHED ||                  \
+    defined(VOLUME) || defined(VOLUME_BRICKS) ||                                       \
+    (defined(INSTANCES) && INSTANCES_MARCHER == MARCH_SDF)
+#define SHADOW_MARCH
+#endif
 
 #define PI 3.14159265359
 
@@ -138,6 +265,57 @@ float sphereSdf(vec3 point, vec3 offset, float radius) {
   return length(point - offset) - radius;
 }
 
+// =========================================================================================================
+// Analytic intersections and shadows
+// =========================================================================================================
+
+// Distance along the ray to the first hit, MAX_DEPTH on a miss
+
+float sphereIntersect(Ray ray, vec3 center, float radius) {
+  vec3 oc = ray.ro - center;
+  float b = dot(oc, ray.rd);
+  float h = b * b - dot(oc, oc) + radius * radius;
+  if (h < 0.)
+    return MAX_DEPTH;
+
+  // The far side when starting inside
+  h = sqrt(h);
+  float t = -b - h < 0. ? -b + h : -b - h;
+  return t < 0. ? MAX_DEPTH : t;
+}
+
+float planeIntersect(Ray ray, vec3 normal, float distanceFromOrigin) {
+  float t = -planeSdf(ray.ro, normal, distanceFromOrigin) / dot(ray.rd, normal);
+  return t > 0. ? t : MAX_DEPTH;
+}
+
+// Penumbra terms on the scale softShadow() uses, the smallest distance to the
+// occluder over the distance along the ray [mint, maxt], divided by the
+// penumbra width w. 1 is fully lit, -1 fully in shadow.
+
+// Taken at the closest approach to the centre, like the march would find it
+float sphereShadow(vec3 ro, vec3 rd, float mint, float maxt, vec3 center,
+                   float radius, float w) {
+  vec3 oc = ro - center;
+  float b = dot(oc, rd);
+  float h = b * b - dot(oc, oc) + radius * radius;
+
+  if (h > 0. && -b + sqrt(h) > mint && -b - sqrt(h) < maxt)
+    return -1.;
+
+  float t = clamp(-b, mint, maxt);
+  return clamp(sphereSdf(ro + t * rd, center, radius) / (w * t), -1., 1.);
+}
+
+// Distance to a plane is linear along the ray, so the ratio is smallest at
+// one of the ends
+float planeShadow(vec3 ro, vec3 rd, float mint, float maxt, vec3 normal,
+                  float distanceFromOrigin, float w) {
+  float near = planeSdf(ro + mint * rd, normal, distanceFromOrigin) / mint;
+  float far = planeSdf(ro + maxt * rd, normal, distanceFromOrigin) / maxt;
+  return clamp(min(near, far) / w, -1., 1.);
+}
+
 // =========================================================================================================
 // Mesh operations
 // =========================================================================================================
@@ -176,101 +354,143 @@ float opSmoothSubtraction2(float d1, float d2, float k) {
   return mix(d1, -d2, h) + k * h * (1.0 - h);
 }
 
-// =========================================================================================================
-// Scene
-// =========================================================================================================
-
-vec2 hash(vec2 seed) {
-
-  vec2 r1 = vec2(4241., 3452.);
-  vec2 r2 = vec2(532., 4534.);
-
-  float m1 = 42334.;
-
-  vec2 rr = vec2(dot(seed, r1), dot(seed, r2));
-
-  return -1. + 2. * fract(sin(rr) * m1);
+#ifdef SCENE_TREE
+// The operations of SCENE_TREE, the surface that wins gives the material as
+// it does on the CPU
+Mesh maxMesh(Mesh a, Mesh b) {
+  if (a.sdf > b.sdf)
+    return a;
+  return b;
 }
 
-float noise(vec2 uv) {
-
-  vec2 id = floor(uv);
-  vec2 gv = fract(uv);
+Mesh negateMesh(Mesh a) { return Mesh(-a.sdf, a.material); }
 
-  vec2 curve = gv * gv * (3. - 2. * gv);
+Mesh scaleMesh(Mesh a, float s) { return Mesh(a.sdf * s, a.material); }
 
-  vec2 blc = vec2(0, 0);
-  vec2 brc = vec2(1, 0);
+Mesh smoothMinMesh(Mesh a, Mesh b, float k) {
+  float h = clamp(0.5 + 0.5 * (b.sdf - a.sdf) / k, 0.0, 1.0);
+  return Mesh(opSmoothUnion(a.sdf, b.sdf, k), h > .5 ? a.material : b.material);
+}
 
-  vec2 tlc = vec2(0, 1);
-  vec2 trc = vec2(1, 1);
+Mesh smoothMaxMesh(Mesh a, Mesh b, float k) {
+  float h = clamp(0.5 - 0.5 * (b.sdf - a.sdf) / k, 0.0, 1.0);
+  return Mesh(opSmoothIntersection(a.sdf, b.sdf, k), h > .5 ? a.material : b.material);
+}
+#endif
 
-  float b = mix(dot(hash(id + blc), gv - blc), dot(hash(id + brc), gv - brc),
-                curve.x);
+// =========================================================================================================
+// Scene
+// =========================================================================================================
 
-  float t = mix(dot(hash(id + tlc), gv - tlc), dot(hash(id + trc), gv - trc),
-                curve.x);
+#include "noise.glsl"
 
-  return mix(b, t, curve.y);
+float heightDisplacement(vec3 c, float footprint) {
+  return detailFade(2. / PI, footprint) * sin(2.0 * c.x) * sin(2.0 * c.y) *
+         sin(2.0 * c.z);
 }
 
-float fBM(vec2 uv) {
+float terrainHeight(vec2 p, float footprint) {
+  return TERRAIN_HEIGHT * fBM(p * TERRAIN_SCALE, footprint * TERRAIN_SCALE);
+}
 
-  // Properties
-  const int octaves = 5;
-  float lacunarity = 2.0;
-  float gain = 0.5;
-  //
-  // Initial values
-  float amplitude = 0.5;
-  float frequency = 1.;
-  float y = 0.;
-
-  // Loop of octaves
-  for (int i = 0; i < octaves; i++) {
-    y += amplitude * noise(frequency * uv);
-    frequency *= lacunarity;
-    amplitude *= gain;
-  }
+// Height of the ground plane, traced by heightfieldMarch()
+float groundHeight(vec2 p, float footprint) {
+#ifdef TERRAIN
+  return terrainHeight(p, footprint) - 1.;
+#else
+  return -1.;
+#endif
+}
 
-  return y;
+#ifdef INSTANCES
+#include "instances.glsl"
+#endif
+
+#ifdef VOLUME
+#include "volume.glsl"
+#endif
+
+#ifdef VOLUME_BRICKS
+#include "bricks.glsl"
+#endif
+
+// Set while rayMarch() sphere traces, objects with a dedicated marcher are
+// then left out of the scene.
+bool sphereTracing = false;
+
+// Set when the view starts inside the proxy box, its front faces are then
+// clipped away and the full screen pass traces the proxy objects itself
+bool insideProxy = false;
+
+bool traced(int marcher) {
+#ifdef PROXY_PASS
+  return !sphereTracing || marcher == MARCH_PROXY;
+#else
+  return !sphereTracing || marcher == MARCH_SDF ||
+         (marcher == MARCH_PROXY && insideProxy);
+#endif
 }
 
-// Compact, self-contained version of IQ's 3D value noise function.
-float n3D(vec3 p) {
+// Set while softShadow() marches, the instances are then found by their own
+// marcher instead and analytic shadow casters are left out.
+bool shadowTracing = false;
 
-  const vec3 s = vec3(113., 57., 27.);
-  vec3 ip = floor(p);
-  p -= ip;
-  vec4 h = vec4(0., s.yz, s.y + s.z) + dot(ip, s);
-  // p = p*p*(3. - 2.*p);
-  p *= p * p * (p * (p * 6. - 15.) + 10.);
-  h = mix(fract(sin(h) * 43758.5453), fract(sin(h + s.x) * 43758.5453), p.x);
-  h.xy = mix(h.xz, h.yw, p.y);
-  return mix(h.x, h.y, p.z); // Range: [0, 1].
+bool shadowMarched(int shadow) {
+  return !shadowTracing || shadow == SHADOW_MARCHED;
 }
 
-float heightDisplacement(vec3 c) {
-  return sin(2.0 * c.x) * sin(2.0 * c.y) * sin(2.0 * c.z);
-}
+float sphere1Radius() { return sin(T) * .5 + .5 + .5; }
 
 Mesh scene(vec3 point) {
 
-  float dist = sin(T) * .5 + .5 + .5;
-  Mesh sphere1 = Mesh(sphereSdf(point, vec3(0., 0., 0.), dist), gold());
+#ifdef SCENE_TREE
+  Mesh sphere1 = Mesh(MAX_DEPTH, background());
+  if (traced(MARCH_SDF))
+    sphere1 = SCENE_TREE(point);
 
-  // Mesh sphere2 = Mesh(sphereSdf(point, vec3(.5, 0., 0.), .3), gold());
+  Mesh plane = Mesh(MAX_DEPTH, background());
+#else
+  Mesh sphere1 = Mesh(MAX_DEPTH, background());
+  if (traced(SPHERE_MARCHER) && shadowMarched(SPHERE_SHADOW))
+    sphere1 = Mesh(sphereSdf(point, vec3(0., 0., 0.), sphere1Radius()), gold());
 
-  Mesh plane = Mesh(planeSdf(point, vec3(0., 1., 0.), 1.), checkerboard(point));
-  // plane.sdf += clamp(1. - heightDisplacement(point), 0., 1.);
+  // Mesh sphere2 = Mesh(sphereSdf(point, vec3(.5, 0., 0.), .3), gold());
 
-  const int MESH_NUMB = 2;
+  Mesh plane = Mesh(MAX_DEPTH, background());
+  if (traced(PLANE_MARCHER) && shadowMarched(PLANE_SHADOW)) {
+    plane = Mesh(planeSdf(point, vec3(0., 1., 0.), 1.), checkerboard(point));
+    // plane.sdf += clamp(1. - heightDisplacement(point, pixelFootprint(point)), 0., 1.);
+#ifdef TERRAIN
+    // The height field is not 1-Lipschitz, so shorten the steps
+    plane.sdf = .6 * (point.y - groundHeight(point.xz, pixelFootprint(point)));
+#endif
+  }
+#endif
+
+  Mesh instances = Mesh(MAX_DEPTH, background());
+#ifdef INSTANCES
+  if (traced(INSTANCES_MARCHER) &&
+      (!shadowTracing || INSTANCES_MARCHER == MARCH_SDF))
+    instances = Mesh(instancesSdf(point), silver());
+#endif
+
+  Mesh model = Mesh(MAX_DEPTH, background());
+#ifdef VOLUME
+  if (traced(VOLUME_MARCHER))
+    model = Mesh(volumeSdf(point - VOLUME_POSITION), silver());
+#endif
+#ifdef VOLUME_BRICKS
+  if (traced(VOLUME_MARCHER))
+    model = Mesh(bricksSdf(point - VOLUME_POSITION), silver());
+#endif
+
+  const int MESH_NUMB = 4;
 
   // Mesh sphere = Mesh(opSmoothUnion(sphere1.sdf, sphere2.sdf, .1), silver());
 
   // Mesh mesh_list[MESH_NUMB] = {sphere, plane};
 
-  Mesh mesh_list[MESH_NUMB] = {sphere1, plane};
+  Mesh mesh_list[MESH_NUMB] = {sphere1, plane, instances, model};
 
   Mesh closest_object = Mesh(MAX_DEPTH, background());
   for (int i = 0; i < MESH_NUMB; i++) {
@@ -284,24 +504,269 @@ Mesh scene(vec3 point) {
 // Raymarch algorithm
 // =========================================================================================================
 
+// Distance along the ray to the ground heightfield, MAX_DEPTH on a miss.
+float heightfieldMarch(Ray ray, float tmax) {
+
+  // Clip the ray to the slab holding the whole heightfield, fBM stays
+  // within +-TERRAIN_HEIGHT of the plane
+#ifdef TERRAIN
+  float relief = TERRAIN_HEIGHT;
+#else
+  float relief = 0.;
+#endif
+  float hmin = -1. - relief - PRECISION;
+  float hmax = -1. + relief + PRECISION;
+
+  float tmin = 0.;
+  if (abs(ray.rd.y) > 1e-6) {
+    float t0 = (hmax - ray.ro.y) / ray.rd.y;
+    float t1 = (hmin - ray.ro.y) / ray.rd.y;
+    tmin = max(tmin, min(t0, t1));
+    tmax = min(tmax, max(t0, t1));
+  } else if (ray.ro.y < hmin || ray.ro.y > hmax) {
+    return MAX_DEPTH;
+  }
+
+  if (tmin >= tmax)
+    return MAX_DEPTH;
+
+  float t = tmin;
+  float t_above = t;
+  float h_above = 0.;
+
+  for (int i = 0; i < HEIGHTFIELD_STEPS; i++) {
+
+    vec3 p = ray.ro + t * ray.rd;
+    float h = p.y - groundHeight(p.xz, pixelFootprint(p));
+
+    // Close enough to the surface for this distance
+    if (abs(h) < PRECISION * t || (h < 0. && i == 0))
+      return t;
+
+    if (h < 0.) {
+      // Secant refinement between the last sample above the surface and
+      // the first one below it
+      for (int j = 0; j < 4; j++) {
+        float tm = t_above + (t - t_above) * h_above / (h_above - h);
+        p = ray.ro + tm * ray.rd;
+        float hm = p.y - groundHeight(p.xz, pixelFootprint(p));
+        if (hm < 0.) {
+          t = tm;
+          h = hm;
+        } else {
+          t_above = tm;
+          h_above = hm;
+        }
+      }
+      return t_above + (t - t_above) * h_above / (h_above - h);
+    }
+
+    if (t >= tmax)
+      break;
+
+    // Step by the height above the surface, at least a fraction of the
+    // distance. Overshooting is fine, the secant search recovers the hit.
+    t_above = t;
+    h_above = h;
+    t = min(t + max(h, .01 * t), tmax);
+  }
+
+  return MAX_DEPTH;
+}
+
+#ifdef PROXY_GEOMETRY
+// Distances along the ray to where it enters and leaves the proxy box, the
+// entry clamped to the ray start
+vec2 proxyInterval(Ray ray) {
+  vec3 inverse = 1. / ray.rd;
+  vec3 t0 = (PROXY_MIN - ray.ro) * inverse;
+  vec3 t1 = (PROXY_MAX - ray.ro) * inverse;
+  vec3 near = min(t0, t1);
+  vec3 far = max(t0, t1);
+  return vec2(max(max(near.x, near.y), max(near.z, 0.)),
+              min(min(far.x, far.y), far.z));
+}
+#endif
+
+#ifdef DEPTH_REUSE
+// Share of the reused distance the march backs off by, for the surfaces that
+// moved or fell between the pixels of the last frame
+#define REUSE_BACKOFF .05
+
+// Spread of the distances around a reprojected pixel beyond which they
+// straddle an edge, and what it hid may now be in view
+#define REUSE_EDGE 1.2
+
+// Length in pixels of the search of the last frame for objects in front of
+// the surface beyond which nothing is reused
+#define REUSE_MAX_SEARCH 32.
+
+// One pixel in this many marches from the camera every frame, in turn, so no
+// reused start is taken as the truth for longer
+#define REUSE_REFRESH 8u
+
+// Where the primary ray through pixel of the last frame hit
+vec3 lastHit(View view, ivec2 pixel, float distance) {
+  vec2 uv = (2. * (vec2(pixel) + .5) - R.xy) / R.y;
+  vec3 rd = normalize(uv.x * view.right.xyz + uv.y * view.up.xyz +
+                      view.forward.w * view.forward.xyz);
+  return view.origin.xyz + distance * rd;
+}
+
+// Where point was on the last image, in pixels, off it behind the camera
+vec2 lastPosition(View view, vec3 point) {
+  vec3 offset = point - view.origin.xyz;
+  float depth = dot(offset, view.forward.xyz);
+  if (depth <= 0.)
+    return vec2(-1.);
+
+  vec2 uv = view.forward.w *
+            vec2(dot(offset, view.right.xyz), dot(offset, view.up.xyz)) / depth;
+  return (uv * R.y + R.xy) * .5;
+}
+
+// Distance along the ray of the last hit of pixel, -1 when unknown, MAX_DEPTH
+// on the sky
+float lastAlong(View view, ivec2 pixel, Ray ray) {
+  if (any(lessThan(pixel, ivec2(0))) ||
+      any(greaterThanEqual(pixel, imageSize(u_last_distance).xy)))
+    return -1.;
+  float distance = imageLoad(u_last_distance, ivec3(pixel, VIEW)).r;
+  if (distance <= 0.)
+    return -1.;
+  if (distance >= MAX_DEPTH)
+    return MAX_DEPTH;
+  return dot(lastHit(view, pixel, distance) - ray.ro, ray.rd);
+}
+
+// Distance along the ray the march can start from, behind the nearest of
+// the hits of the last frame it may meet. 0 marches the whole ray: without a
+// history, off the last image, on the sky, across edges, where the last frame
+// would need a longer search and for the pixels refreshed this frame.
+float reusedDistance(Ray ray) {
+  View view = previousViews[VIEW];
+  ivec2 own = ivec2(FC.xy);
+  if ((uint(own.x) + 3u * uint(own.y) + historyFrame) % REUSE_REFRESH == 0u)
+    return 0.;
+
+  // The surface this pixel hit, seen from the last view, stands in for the
+  // one the ray is about to hit
+  float guess = imageLoad(u_last_distance, ivec3(own, VIEW)).r;
+  if (guess <= 0. || guess >= MAX_DEPTH)
+    return 0.;
+
+  // The hits around the surface, and that of the pixel itself where it was
+  vec2 position = lastPosition(view, ray.ro + guess * ray.rd);
+  ivec2 base = ivec2(floor(position - .5));
+  float nearest = lastAlong(view, own, ray);
+  float farthest = 0.;
+  for (int i = 0; i < 4; i++) {
+    float along = lastAlong(view, base + ivec2(i & 1, i >> 1), ray);
+    if (along < 0. || along >= MAX_DEPTH)
+      return 0.;
+    nearest = min(nearest, along);
+    farthest = max(farthest, along);
+  }
+
+  // Nothing on the ray is nearer than the clearance of its origin. An object
+  // between there and the surface was last drawn where its point of the ray
+  // reprojects, so the search grows with the motion.
+  float clearance = scene(ray.ro).sdf;
+  if (clearance <= 0.)
+    return 0.;
+  vec2 search =
+      lastPosition(view, ray.ro + min(clearance, guess) * ray.rd) - position;
+  if (length(search) > REUSE_MAX_SEARCH)
+    return 0.;
+  int taps = int(ceil(length(search)));
+  for (int i = 1; i <= taps; i++) {
+    vec2 tap = position + search * float(i) / float(taps);
+    float along = lastAlong(view, ivec2(floor(tap)), ray);
+    if (along < 0.)
+      return 0.;
+    nearest = min(nearest, along);
+  }
+
+  if (nearest <= 0. || farthest > REUSE_EDGE * nearest)
+    return 0.;
+
+  return nearest * (1. - REUSE_BACKOFF);
+}
+
+// Nearest primary hit of the samples of this pixel
+float primaryDistance = MAX_DEPTH;
+#endif
+
 Mesh rayMarch(Ray ray) {
 
   float marched = 0.;
   float dist_scene = 0.;
+  float max_depth = MAX_DEPTH;
+
+#ifdef PROXY_PASS
+  // Only the proxy objects, between the faces of their box
+  vec2 interval = proxyInterval(ray);
+  if (interval.x >= interval.y)
+    return Mesh(MAX_DEPTH, background());
+  marched = interval.x;
+  max_depth = interval.y;
+#else
+  // Objects with a dedicated marcher first, they bound how far the sphere
+  // tracer goes
+  if (SPHERE_MARCHER == MARCH_ANALYTIC)
+    max_depth = sphereIntersect(ray, vec3(0.), sphere1Radius());
+  if (PLANE_MARCHER == MARCH_ANALYTIC)
+    max_depth = min(max_depth, planeIntersect(ray, vec3(0., 1., 0.), 1.));
+  if (PLANE_MARCHER == MARCH_HEIGHTFIELD)
+    max_depth = min(max_depth, heightfieldMarch(ray, max_depth));
+#ifdef INSTANCES
+  if (INSTANCES_MARCHER != MARCH_SDF)
+    max_depth = min(max_depth, instancesMarch(ray, max_depth));
+#endif
+#ifdef DEPTH_REUSE
+  marched = min(reusedDistance(ray), max_depth);
+#endif
+#endif
 
   Mesh closest_object = Mesh(MAX_DEPTH, background());
 
+  sphereTracing = true;
   for (int i = 0; i < MAX_MARCHING_STEPS; i++) {
 
     closest_object = scene(ray.ro + marched * ray.rd);
 
     dist_scene = closest_object.sdf;
 
+#ifdef DEPTH_REUSE
+    // A reused start inside an object skipped the surface in front of it,
+    // and one further from any surface than it backed off from the reused
+    // hit is not where the last frame saw it
+    if (i == 0 && marched > 0. &&
+        (dist_scene < 0. ||
+         dist_scene > marched * REUSE_BACKOFF / (1. - REUSE_BACKOFF))) {
+      marched = 0.;
+      continue;
+    }
+#endif
+
     marched += dist_scene;
 
-    if (abs(dist_scene) < PRECISION || marched > MAX_DEPTH)
+    if (abs(dist_scene) < PRECISION || marched > max_depth)
       break;
   }
+  sphereTracing = false;
+
+#ifdef PROXY_PASS
+  // Left the box without a hit
+  if (marched > max_depth)
+    marched = MAX_DEPTH;
+#else
+  if (marched > max_depth && max_depth < MAX_DEPTH) {
+    // Hit a dedicated marcher object, pick up its material from the full scene
+    closest_object = scene(ray.ro + max_depth * ray.rd);
+    marched = max_depth;
+  }
+#endif
   closest_object.sdf = marched;
 
   return closest_object;
@@ -354,13 +819,39 @@ vec3 getSurfaceNormal(vec3 p) {
 float softShadow(vec3 ro, vec3 rd, float mint, float maxt, float w) {
   float res = 1.0;
   float t = mint;
-  for (int i = 0; i < 256 && t < maxt; i++) {
+
+  // Closed form occluders first, a full shadow needs no march
+#if SPHERE_SHADOW == SHADOW_ANALYTIC
+  res = min(res,
+            sphereShadow(ro, rd, mint, maxt, vec3(0.), sphere1Radius(), w));
+#endif
+#if PLANE_SHADOW == SHADOW_ANALYTIC
+  res = min(res, planeShadow(ro, rd, mint, maxt, vec3(0., 1., 0.), 1., w));
+#endif
+  if (res <= -1.)
+    return 0.;
+
+#ifdef INSTANCES
+  // The instances are small enough to cast hard shadows, one traversal of
+  // their accelerator is far cheaper than querying it at every step
+  if (INSTANCES_MARCHER != MARCH_SDF &&
+      instancesMarch(Ray(ro + mint * rd, rd), maxt - mint) < maxt - mint)
+    return 0.;
+#endif
+#ifdef SHADOW_MARCH
+  // The penumbra hides fine detail, march a coarser scene
+  shadowTracing = true;
+  lodScale = 2.;
+  for (int i = 0; i < SHADOW_STEPS && t < maxt; i++) {
     float h = scene(ro + t * rd).sdf;
     res = min(res, h / (w * t));
     t += clamp(h, 0.005, 0.50);
     if (res < -1.0 || t > maxt)
       break;
   }
+  lodScale = 1.;
+  shadowTracing = false;
+#endif
   res = max(res, -1.0);
   return 0.25 * (1.0 + res) * (1.0 + res) * (2.0 - res);
 }
@@ -369,16 +860,33 @@ float softShadow(vec3 ro, vec3 rd, float mint, float maxt, float w) {
 // Ambient oclusion
 // =========================================================================================================
 
+#ifdef SCREEN_SPACE_AO
+// Light of this pixel the screen space pass darkens, summed over the lights
+// and the anti-aliasing samples
+vec3 occludable = vec3(0.);
+
+// Surface of the last sample, 0 on a miss
+vec4 surfacePosition = vec4(0.);
+vec3 surfaceNormal = vec3(0.);
+#endif
+
 float ambientOcclusion(vec3 p, vec3 normal) {
+#ifdef SCREEN_SPACE_AO
+  // Applied by the screen space pass instead
+  return 1.;
+#else
   float occ = 0.0;
   float weight = 1.0;
-  for (int i = 0; i < 8; i++) {
+  lodScale = 4.;
+  for (int i = 0; i < AO_SAMPLES; i++) {
     float len = 0.01 + 0.02 * float(i * i);
     float dist = scene(p + normal * len).sdf;
     occ += (len - dist) * weight;
     weight *= 0.85;
   }
+  lodScale = 1.;
   return 1.0 - clamp(0.6 * occ, 0.0, 1.0);
+#endif
 }
 
 // =========================================================================================================
@@ -406,8 +914,8 @@ vec3 phongLight(vec3 point, Ray ray, Material object_material, Light light) {
       k_s * pow(dotRV, object_material.alpha) * object_material.specularColor;
 
   // Shadows
-  float soft_shadow =
-      clamp(softShadow(point, light.direction, 0.02, 5.0, .3), 0.0, 1.0);
+  float soft_shadow = clamp(
+      softShadow(point, light.direction, 0.02, 5.0, SHADOW_SOFTNESS), 0.0, 1.0);
 
   // Raymarching simple shadow
   // Ray shadow_ray = Ray(point + surface_normal * .02, light.direction);
@@ -423,6 +931,11 @@ vec3 phongLight(vec3 point, Ray ray, Material object_material, Light light) {
   vec3 reflect_back = .05 * object_material.ambientColor *
                       clamp(dot(surface_normal, light.direction), 0., 1.);
 
+#ifdef SCREEN_SPACE_AO
+  occludable += light.intensity * light.color *
+                (reflect_back + ambient + specular * soft_shadow);
+#endif
+
   return (reflect_back + ambient) * ambient_occlusion +
          (specular * ambient_occlusion + diffuse) * soft_shadow;
 }
@@ -469,37 +982,45 @@ vec3 sceneLights(vec3 point, Material object_material, Ray ray) {
 }
 
 // =========================================================================================================
-// Camera translations
+// Render objects and lights
 // =========================================================================================================
 
-mat3 camera(vec3 ro, vec3 lookAt) {
-  vec3 cd = normalize(lookAt - ro);                 // camera direction
-  vec3 cr = normalize(cross(vec3(0., 1., 0.), cd)); // camera right
-  vec3 cu = normalize(cross(cd, cr));               // camera up
+#ifdef PROXY_GEOMETRY
+// Nearest depth the samples of this pixel hit, and how many did
+float surfaceDepth = 1.;
+int proxyHits = 0;
 
-  return mat3(-cr, cu, -cd);
-}
+// Views closer to the box than this may lose its front faces to the near plane
+#define PROXY_MARGIN (4. * DEPTH_NEAR)
+#endif
 
-// =========================================================================================================
-// Render objects and lights
-// =========================================================================================================
-
-vec3 render(vec2 uv, vec2 mp) {
+vec3 render(vec2 uv) {
 
   vec3 background = background().ambientColor;
 
-  vec3 ro = vec3(0., 1., 3.);
-  vec3 lookAt = vec3(0., 0., 0.);
+  View view = views[VIEW];
+  vec3 ro = view.origin.xyz;
+
+#if defined(PROXY_GEOMETRY) && !defined(PROXY_PASS)
+  insideProxy = all(greaterThan(ro, PROXY_MIN - PROXY_MARGIN)) &&
+                all(lessThan(ro, PROXY_MAX + PROXY_MARGIN));
+#endif
 
-  // Make camera to center on lookAt point
-  vec3 rd = camera(ro, lookAt) * normalize(vec3(uv, -1.5));
-  // Look around with mouse
-  rd *= rotateY(mp.x) * rotateX(mp.y);
+  // Pixel footprint for the noise LOD
+  lodOrigin = ro;
+  lodPixelAngle = 2. / (R.y * view.forward.w);
+
+  // Camera basis is built on the host, turned with the mouse
+  vec3 rd = normalize(uv.x * view.right.xyz + uv.y * view.up.xyz +
+                      view.forward.w * view.forward.xyz);
 
   Ray ray = Ray(ro, rd);
 
   // Shoot the rays and get hit scene object
   Mesh closest_object = rayMarch(ray);
+#ifdef DEPTH_REUSE
+  primaryDistance = min(primaryDistance, closest_object.sdf);
+#endif
 
   // If the closest_object sdf is smaller than the MAX_DEPTH then we hit a scene
   // object else we hit the "background object".
@@ -508,15 +1029,40 @@ vec3 render(vec2 uv, vec2 mp) {
     // Get the point where the ray hit the surface of an object
     vec3 point = ray.ro + closest_object.sdf * ray.rd;
 
+#ifdef SCREEN_SPACE_AO
+    vec3 lit = occludable;
+#endif
+
     vec3 light = sceneLights(point, closest_object.material, ray);
 
     // Fog
-    return mix(light, background,
-               1. - exp(-.001 * closest_object.sdf * closest_object.sdf));
+    float fog = 1. - exp(-.001 * closest_object.sdf * closest_object.sdf);
+
+#ifdef SCREEN_SPACE_AO
+    // Fog what this hit added the same way
+    occludable = lit + (occludable - lit) * (1. - fog);
+    surfacePosition = vec4(point, 1.);
+    surfaceNormal = getSurfaceNormal(point);
+#endif
+#ifdef PROXY_GEOMETRY
+    surfaceDepth = min(surfaceDepth, viewDepth(view, point));
+    proxyHits++;
+#endif
+
+    return mix(light, background, fog);
   }
 
+#ifdef PROXY_PASS
+  // What is behind the box is left to the full screen pass
+  return vec3(0.);
+#else
+#ifdef SCREEN_SPACE_AO
+  surfacePosition = vec4(0.);
+#endif
+
   // Fog height
   return background - max(.9 * ray.rd.y, 0.);
+#endif
 }
 
 // =========================================================================================================
@@ -525,11 +1071,10 @@ vec3 render(vec2 uv, vec2 mp) {
 
 vec2 offsetUV(vec2 offset) { return (2. * (FC.xy + offset) - R.xy) / R.y; }
 
-vec3 AAx4(vec2 mp) {
+vec3 AAx4() {
   vec4 offset = vec4(.125, -.125, .375, -.375);
-  vec3 aax4 = render(offsetUV(offset.xz), mp) +
-              render(offsetUV(offset.yw), mp) +
-              render(offsetUV(offset.wx), mp) + render(offsetUV(offset.zy), mp);
+  vec3 aax4 = render(offsetUV(offset.xz)) + render(offsetUV(offset.yw)) +
+              render(offsetUV(offset.wx)) + render(offsetUV(offset.zy));
   return aax4 / 4.;
 }
 
@@ -539,14 +1084,43 @@ void main() {
   // uv -= .5;
   // uv.x *= R.x / R.y;
 
-  vec2 mp = M.xy / R.xy;
-  mp.xy = 1. - mp.xy;
-  mp -= .5;
-  mp.x *= R.x / R.y;
-
   vec3 color = vec3(0.);
-  // color = AAx4(mp);
-  color = render(offsetUV(vec2(0.)), mp);
+#ifdef ANTI_ALIASING
+  color = AAx4();
+#else
+  color = render(offsetUV(vec2(0.)));
+#endif
+
+#ifdef PROXY_PASS
+  // Pixels of the box with no object keep what is behind, anti-aliasing
+  // averages the samples that hit
+  if (proxyHits == 0)
+    discard;
+#ifdef ANTI_ALIASING
+  color *= 4. / float(proxyHits);
+#ifdef SCREEN_SPACE_AO
+  occludable *= 4. / float(proxyHits);
+#endif
+#endif
+#endif
+#ifdef PROXY_GEOMETRY
+  gl_FragDepth = surfaceDepth;
+#endif
+#ifdef DEPTH_REUSE
+  imageStore(u_distance, ivec3(FC.xy, VIEW), vec4(primaryDistance));
+#endif
+
+#ifdef SCREEN_SPACE_AO
+  // Linear, the AO pass corrects the gamma once the occlusion is applied
+#ifdef ANTI_ALIASING
+  occludable /= 4.;
+#endif
+  FragColor = vec4(color, 1.);
+  Occludable = vec4(occludable, 1.);
+  Position = surfacePosition;
+  Normal = vec4(surfaceNormal, 0.);
+  return;
+#endif
 
   // Gamma correction
   color = pow(color, vec3(.4545));
@@ -0,0 +1,32 @@
+#version 460 core
+
+// Instances the screen quad once per view, every copy drawn into its own
+// layer of the view texture array. VIEW_COUNT is injected by the host. With
+// PROXY_PASS the triangles are proxy boxes in world space, projected here
+// for every view.
+layout(triangles, invocations = VIEW_COUNT) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+flat out int v_view;
+
+#ifdef PROXY_PASS
+uniform vec2 u_resolution;
+
+#define VIEWS_ONLY
+#include "views.glsl"
+#endif
+
+void main() {
+  for (int i = 0; i < 3; i++) {
+#ifdef PROXY_PASS
+    gl_Position = projectView(views[gl_InvocationID], gl_in[i].gl_Position.xyz,
+                              u_resolution.x / u_resolution.y);
+#else
+    gl_Position = gl_in[i].gl_Position;
+#endif
+    gl_Layer = gl_InvocationID;
+    v_view = gl_InvocationID;
+    EmitVertex();
+  }
+  EndPrimitive();
+}
@@ -0,0 +1,344 @@
+// =========================================================================================================
+// Instanced primitives
+// =========================================================================================================
+
+// Filled by primitives.c and grid.c
+layout(std430, binding = 0) readonly buffer Primitives {
+  vec4 primitives[]; // center, radius
+};
+
+layout(std430, binding = 1) readonly buffer GridCells {
+  vec4 grid_min;
+  vec4 grid_cell_size;
+  ivec4 grid_dims;
+  uint cell_offsets[];
+};
+
+layout(std430, binding = 2) readonly buffer GridIndices { uint grid_indices[]; };
+
+// Filled by bvh.c, stored depth first with the left child right after its
+// parent. offset is the right child of interior nodes (count == 0) and the
+// first index of leaves.
+struct BvhNode {
+  vec3 min;
+  uint offset;
+  vec3 max;
+  uint count;
+};
+
+layout(std430, binding = 3) readonly buffer BvhNodes { BvhNode bvh_nodes[]; };
+
+layout(std430, binding = 4) readonly buffer BvhIndices { uint bvh_indices[]; };
+
+#ifndef CELL_STEPS
+#define CELL_STEPS 16
+#endif
+// Depth of the BVH the host built, which the traversals never push more
+// than, see bvh.h
+#ifndef BVH_STACK_SIZE
+#define BVH_STACK_SIZE 32
+#endif
+#ifndef BVH_VISITS
+#define BVH_VISITS 256
+#endif
+#ifndef BVH_QUERY_RADIUS
+#define BVH_QUERY_RADIUS .25
+#endif
+
+float primitiveSdf(uint i, vec3 point) {
+  vec4 sphere = primitives[i];
+  return sphereSdf(point, sphere.xyz, sphere.w);
+}
+
+int cellIndex(ivec3 cell) {
+  return (cell.z * grid_dims.y + cell.y) * grid_dims.x + cell.x;
+}
+
+ivec3 gridCell(vec3 point) {
+  return clamp(ivec3(floor((point - grid_min.xyz) / grid_cell_size.xyz)),
+               ivec3(0), grid_dims.xyz - 1);
+}
+
+// Closest primitive listed in a cell
+float cellSdf(int cell, vec3 point) {
+  float dist = MAX_DEPTH;
+  for (uint i = cell_offsets[cell]; i < cell_offsets[cell + 1]; i++)
+    dist = min(dist, primitiveSdf(grid_indices[i], point));
+  return dist;
+}
+
+// Lower bound of the distance to the instanced primitives. A primitive that is
+// not listed in the cell of the point does not overlap it, so it lies beyond
+// the cell walls.
+float gridSdf(vec3 point) {
+
+  vec3 grid_max = grid_min.xyz + vec3(grid_dims.xyz) * grid_cell_size.xyz;
+  vec3 outside = max(grid_min.xyz - point, point - grid_max);
+  if (max(max(outside.x, outside.y), outside.z) > 0.)
+    return length(max(outside, 0.)) + PRECISION;
+
+  ivec3 cell = gridCell(point);
+  vec3 cell_min = grid_min.xyz + vec3(cell) * grid_cell_size.xyz;
+  vec3 walls = min(point - cell_min, cell_min + grid_cell_size.xyz - point);
+
+  return min(cellSdf(cellIndex(cell), point),
+             min(min(walls.x, walls.y), walls.z) + PRECISION);
+}
+
+// Distance along the ray to the instanced primitives, MAX_DEPTH on a miss
+// and the nearest unvisited box when out of visits. Walks the cells the ray crosses with a 3D DDA and sphere traces only the
+// primitives listed in each of them.
+float gridMarch(Ray ray, float tmax) {
+
+  vec3 cell_size = grid_cell_size.xyz;
+  vec3 grid_max = grid_min.xyz + vec3(grid_dims.xyz) * cell_size;
+
+  // Avoid infinities for axis aligned rays
+  vec3 rd = mix(ray.rd, vec3(1e-6), lessThan(abs(ray.rd), vec3(1e-6)));
+  vec3 inv_rd = 1. / rd;
+
+  // Clip the ray to the grid
+  vec3 t0 = (grid_min.xyz - ray.ro) * inv_rd;
+  vec3 t1 = (grid_max - ray.ro) * inv_rd;
+  vec3 t_near = min(t0, t1);
+  vec3 t_far = max(t0, t1);
+  float t = max(max(t_near.x, t_near.y), max(t_near.z, 0.));
+  float t_end = min(min(t_far.x, t_far.y), min(t_far.z, tmax));
+
+  if (t >= t_end)
+    return MAX_DEPTH;
+
+  ivec3 cell = gridCell(ray.ro + t * rd);
+  ivec3 cell_step = ivec3(sign(rd));
+  vec3 t_delta = abs(cell_size * inv_rd);
+  vec3 t_next =
+      (grid_min.xyz + (vec3(cell) + step(0., rd)) * cell_size - ray.ro) *
+      inv_rd;
+
+  // A ray crosses at most one cell per step along each axis, so no more
+  // than the sum of the grid dimensions in all
+  int steps = grid_dims.x + grid_dims.y + grid_dims.z;
+
+  for (int i = 0; i < steps; i++) {
+
+    float t_exit = min(min(t_next.x, t_next.y), min(t_next.z, t_end));
+    int index = cellIndex(cell);
+
+    if (cell_offsets[index] != cell_offsets[index + 1]) {
+      float s = t;
+      for (int j = 0; j < CELL_STEPS && s <= t_exit; j++) {
+        float dist = cellSdf(index, ray.ro + s * ray.rd);
+        if (dist < PRECISION)
+          return s;
+        s += dist;
+      }
+    }
+
+    if (t_exit >= t_end)
+      break;
+
+    // Step into the neighbouring cell the ray enters next
+    bvec3 axis = lessThanEqual(t_next, min(t_next.yzx, t_next.zxy));
+    cell += ivec3(axis) * cell_step;
+    t_next += vec3(axis) * t_delta;
+    t = t_exit;
+  }
+
+  return MAX_DEPTH;
+}
+
+// Distance from a point to a box, zero inside
+float boxDistance(vec3 point, vec3 box_min, vec3 box_max) {
+  return length(max(max(box_min - point, point - box_max), 0.));
+}
+
+// Closest primitive in a leaf
+float leafSdf(BvhNode leaf, vec3 point) {
+  float dist = MAX_DEPTH;
+  for (uint i = leaf.offset; i < leaf.offset + leaf.count; i++)
+    dist = min(dist, primitiveSdf(bvh_indices[i], point));
+  return dist;
+}
+
+// Distance to the closest instanced primitive, capped at BVH_QUERY_RADIUS or
+// the distance to the root box so points away from the primitives only touch
+// the top of the tree. Visits the
+// nearer child first and skips every box further away than the closest
+// primitive found so far.
+float bvhSdf(vec3 point) {
+
+  uint stack_node[BVH_STACK_SIZE];
+  float stack_dist[BVH_STACK_SIZE];
+  int top = 0;
+
+  uint node = 0;
+  float node_dist = boxDistance(point, bvh_nodes[0].min, bvh_nodes[0].max);
+
+  float dist = max(node_dist, BVH_QUERY_RADIUS);
+
+  for (int i = 0; i < BVH_VISITS; i++) {
+
+    if (node_dist < dist) {
+      BvhNode current = bvh_nodes[node];
+
+      if (current.count > 0) {
+        dist = min(dist, leafSdf(current, point));
+      } else {
+        uint near = node + 1;
+        uint far = current.offset;
+        float near_dist =
+            boxDistance(point, bvh_nodes[near].min, bvh_nodes[near].max);
+        float far_dist =
+            boxDistance(point, bvh_nodes[far].min, bvh_nodes[far].max);
+
+        if (far_dist < near_dist) {
+          uint swap_node = near;
+          near = far;
+          far = swap_node;
+          float swap_dist = near_dist;
+          near_dist = far_dist;
+          far_dist = swap_dist;
+        }
+
+        if (far_dist < dist && top < BVH_STACK_SIZE) {
+          stack_node[top] = far;
+          stack_dist[top] = far_dist;
+          top++;
+        }
+
+        node = near;
+        node_dist = near_dist;
+        continue;
+      }
+    }
+
+    if (top == 0)
+      return dist;
+
+    top--;
+    node = stack_node[top];
+    node_dist = stack_dist[top];
+  }
+
+  // Out of visits: the unvisited boxes still bound the distance from below
+  dist = min(dist, node_dist);
+  for (int i = 0; i < top; i++)
+    dist = min(dist, stack_dist[i]);
+  return dist;
+}
+
+// Entry and exit distances of a ray through a box, entry > exit on a miss
+vec2 rayBox(vec3 ro, vec3 inv_rd, vec3 box_min, vec3 box_max) {
+  vec3 t0 = (box_min - ro) * inv_rd;
+  vec3 t1 = (box_max - ro) * inv_rd;
+  vec3 t_near = min(t0, t1);
+  vec3 t_far = max(t0, t1);
+  return vec2(max(max(t_near.x, t_near.y), t_near.z),
+              min(min(t_far.x, t_far.y), t_far.z));
+}
+
+// Distance along the ray to the instanced primitives, MAX_DEPTH on a miss
+// and the nearest unvisited box when out of visits. Walks the leaves whose boxes the ray enters front to back and sphere traces
+// only their primitives, within the part of the ray inside the leaf box.
+float bvhMarch(Ray ray, float tmax) {
+
+  vec3 rd = mix(ray.rd, vec3(1e-6), lessThan(abs(ray.rd), vec3(1e-6)));
+  vec3 inv_rd = 1. / rd;
+
+  float hit = MAX_DEPTH;
+
+  uint stack_node[BVH_STACK_SIZE];
+  float stack_t[BVH_STACK_SIZE];
+  int top = 0;
+
+  uint node = 0;
+  vec2 span = rayBox(ray.ro, inv_rd, bvh_nodes[0].min, bvh_nodes[0].max);
+  float node_t = span.x <= span.y && span.y >= 0. ? max(span.x, 0.) : tmax;
+
+  for (int i = 0; i < BVH_VISITS; i++) {
+
+    if (node_t < tmax) {
+      BvhNode current = bvh_nodes[node];
+
+      if (current.count > 0) {
+        float t_exit = min(rayBox(ray.ro, inv_rd, current.min, current.max).y,
+                           tmax);
+        float s = node_t;
+        for (int j = 0; j < CELL_STEPS && s <= t_exit; j++) {
+          float dist = leafSdf(current, ray.ro + s * ray.rd);
+          if (dist < PRECISION) {
+            hit = s;
+            tmax = s;
+            break;
+          }
+          s += dist;
+        }
+      } else {
+        uint near = node + 1;
+        uint far = current.offset;
+        vec2 near_span =
+            rayBox(ray.ro, inv_rd, bvh_nodes[near].min, bvh_nodes[near].max);
+        vec2 far_span =
+            rayBox(ray.ro, inv_rd, bvh_nodes[far].min, bvh_nodes[far].max);
+        float near_t = near_span.x <= near_span.y && near_span.y >= 0.
+                           ? max(near_span.x, 0.)
+                           : tmax;
+        float far_t = far_span.x <= far_span.y && far_span.y >= 0.
+                          ? max(far_span.x, 0.)
+                          : tmax;
+
+        if (far_t < near_t) {
+          uint swap_node = near;
+          near = far;
+          far = swap_node;
+          float swap_t = near_t;
+          near_t = far_t;
+          far_t = swap_t;
+        }
+
+        if (far_t < tmax && top < BVH_STACK_SIZE) {
+          stack_node[top] = far;
+          stack_t[top] = far_t;
+          top++;
+        }
+
+        node = near;
+        node_t = near_t;
+        continue;
+      }
+    }
+
+    if (top == 0)
+      return hit;
+
+    top--;
+    node = stack_node[top];
+    node_t = stack_t[top];
+  }
+
+  // Out of visits: nothing is hit before the nearest unvisited box, a miss
+  // would let the instances vanish and light leak through them
+  hit = min(hit, node_t);
+  for (int i = 0; i < top; i++)
+    hit = min(hit, stack_t[i]);
+  return hit;
+}
+
+// Distance bound to the instanced primitives for the accelerator in use
+float instancesSdf(vec3 point) {
+#if INSTANCES_MARCHER == MARCH_BVH
+  return bvhSdf(point);
+#else
+  return gridSdf(point);
+#endif
+}
+
+// Distance along the ray to the instanced primitives for the accelerator in
+// use, MAX_DEPTH on a miss
+float instancesMarch(Ray ray, float tmax) {
+#if INSTANCES_MARCHER == MARCH_BVH
+  return bvhMarch(ray, tmax);
+#else
+  return gridMarch(ray, tmax);
+#endif
+}
@@ -0,0 +1,166 @@
+// =========================================================================================================
+// Level of detail
+// =========================================================================================================
+
+// Camera origin and angular size of one pixel, set by render()
+vec3 lodOrigin = vec3(0.);
+float lodPixelAngle = 0.;
+
+// Extra blur for secondary lookups (shadows, AO) that average over an area
+float lodScale = 1.;
+
+// World space size of the pixel footprint at point p
+float pixelFootprint(vec3 p) {
+  return length(p - lodOrigin) * lodPixelAngle * lodScale;
+}
+
+// Weight of a detail band of the given frequency, fading to zero before it
+// reaches the Nyquist limit of the footprint.
+float detailFade(float frequency, float footprint) {
+  return 1. - smoothstep(.25, .5, frequency * footprint);
+}
+
+// =========================================================================================================
+// Noise
+// =========================================================================================================
+
+// Lattice hash used by the noise functions, injected by the host
+#define NOISE_SIN 0
+#define NOISE_PCG 1
+#define NOISE_TEXTURE 2
+
+#ifndef NOISE_HASH
+#define NOISE_HASH NOISE_TEXTURE
+#endif
+#ifndef NOISE_TEXTURE_SIZE
+#define NOISE_TEXTURE_SIZE 256
+#endif
+#ifndef NOISE_VOLUME_SIZE
+#define NOISE_VOLUME_SIZE 64
+#endif
+
+// Lattice gradients and values, generated by noise.c
+layout(binding = 0) uniform sampler2D u_gradient_noise;
+layout(binding = 1) uniform sampler3D u_value_noise;
+
+// PCG hashes from Jarzynski and Olano, "Hash Functions for GPU Rendering".
+// noise.c fills the noise textures with the same functions.
+uvec2 pcg2d(uvec2 v) {
+  v = v * 1664525u + 1013904223u;
+  v.x += v.y * 1664525u;
+  v.y += v.x * 1664525u;
+  v = v ^ (v >> 16u);
+  v.x += v.y * 1664525u;
+  v.y += v.x * 1664525u;
+  v = v ^ (v >> 16u);
+  return v;
+}
+
+uvec3 pcg3d(uvec3 v) {
+  v = v * 1664525u + 1013904223u;
+  v.x += v.y * v.z;
+  v.y += v.z * v.x;
+  v.z += v.x * v.y;
+  v ^= v >> 16u;
+  v.x += v.y * v.z;
+  v.y += v.z * v.x;
+  v.z += v.x * v.y;
+  return v;
+}
+
+// Gradient at an integer lattice point, in [-1, 1]^2
+vec2 hash(vec2 seed) {
+#if NOISE_HASH == NOISE_TEXTURE
+  return texelFetch(u_gradient_noise,
+                    ivec2(seed) & (NOISE_TEXTURE_SIZE - 1), 0).rg;
+#elif NOISE_HASH == NOISE_PCG
+  return -1. + 2. * vec2(pcg2d(uvec2(ivec2(seed)))) / 4294967295.;
+#else
+  vec2 r1 = vec2(4241., 3452.);
+  vec2 r2 = vec2(532., 4534.);
+
+  float m1 = 42334.;
+
+  vec2 rr = vec2(dot(seed, r1), dot(seed, r2));
+
+  return -1. + 2. * fract(sin(rr) * m1);
+#endif
+}
+
+float noise(vec2 uv) {
+
+  vec2 id = floor(uv);
+  vec2 gv = fract(uv);
+
+  vec2 curve = gv * gv * (3. - 2. * gv);
+
+  vec2 blc = vec2(0, 0);
+  vec2 brc = vec2(1, 0);
+
+  vec2 tlc = vec2(0, 1);
+  vec2 trc = vec2(1, 1);
+
+  float b = mix(dot(hash(id + blc), gv - blc), dot(hash(id + brc), gv - brc),
+                curve.x);
+
+  float t = mix(dot(hash(id + tlc), gv - tlc), dot(hash(id + trc), gv - trc),
+                curve.x);
+
+  return mix(b, t, curve.y);
+}
+
+// Octaves whose detail is finer than the footprint (in uv units) are skipped,
+// and the last visible one is faded out instead of popping.
+float fBM(vec2 uv, float footprint) {
+
+  // Properties
+  const int octaves = FBM_OCTAVES;
+  float lacunarity = 2.0;
+  float gain = 0.5;
+  //
+  // Initial values
+  float amplitude = 0.5;
+  float frequency = 1.;
+  float y = 0.;
+
+  // Loop of octaves
+  for (int i = 0; i < octaves; i++) {
+    float fade = detailFade(frequency, footprint);
+    if (fade <= 0.)
+      break;
+    y += fade * amplitude * noise(frequency * uv);
+    frequency *= lacunarity;
+    amplitude *= gain;
+  }
+
+  return y;
+}
+
+// Compact, self-contained version of IQ's 3D value noise function.
+float n3D(vec3 p) {
+
+  const vec3 s = vec3(113., 57., 27.);
+  vec3 ip = floor(p);
+  p -= ip;
+  // p = p*p*(3. - 2.*p);
+  p *= p * p * (p * (p * 6. - 15.) + 10.);
+#if NOISE_HASH == NOISE_TEXTURE
+  // Trilinear filtering at the smoothed position blends all eight corners
+  return texture(u_value_noise, (ip + p + .5) / float(NOISE_VOLUME_SIZE)).r;
+#else
+#if NOISE_HASH == NOISE_PCG
+  uvec3 i = uvec3(ivec3(ip));
+  uvec2 o = uvec2(0, 1);
+  vec4 h0 = vec4(pcg3d(i).x, pcg3d(i + o.xyx).x, pcg3d(i + o.xxy).x,
+                 pcg3d(i + o.xyy).x);
+  vec4 h1 = vec4(pcg3d(i + o.yxx).x, pcg3d(i + o.yyx).x, pcg3d(i + o.yxy).x,
+                 pcg3d(i + o.yyy).x);
+  vec4 h = mix(h0, h1, p.x) / 4294967295.;
+#else
+  vec4 h = vec4(0., s.yz, s.y + s.z) + dot(ip, s);
+  h = mix(fract(sin(h) * 43758.5453), fract(sin(h + s.x) * 43758.5453), p.x);
+#endif
+  h.xy = mix(h.xz, h.yw, p.y);
+  return mix(h.x, h.y, p.z); // Range: [0, 1].
+#endif
+}
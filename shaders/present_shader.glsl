@@ -0,0 +1,24 @@
+#version 460 core
+layout(location = 0) out vec4 FragColor;
+
+// Tiles the layers of the multi-view pass over the window, left to right and
+// top to bottom, centred when they do not fill it
+layout(binding = 6) uniform sampler2DArray u_views;
+
+uniform ivec2 u_grid;
+uniform vec2 u_view_size;
+uniform vec2 u_resolution;
+
+void main() {
+  vec2 tiled = u_view_size * vec2(u_grid);
+  vec2 pixel = gl_FragCoord.xy - (u_resolution - tiled) * .5;
+  vec2 cell = floor(pixel / u_view_size);
+
+  if (any(lessThan(cell, vec2(0.))) || any(greaterThanEqual(cell, vec2(u_grid)))) {
+    FragColor = vec4(0., 0., 0., 1.);
+    return;
+  }
+
+  float layer = (float(u_grid.y) - 1. - cell.y) * float(u_grid.x) + cell.x;
+  FragColor = texture(u_views, vec3(pixel / u_view_size - cell, layer));
+}
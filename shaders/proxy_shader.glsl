@@ -0,0 +1,18 @@
+#version 460 core
+
+// Box around the objects the proxy pass traces, in world space. Projected
+// here for a single view, for every view by the geometry shader otherwise.
+layout(location = 0) in vec3 position;
+
+uniform vec2 u_resolution;
+
+#define VIEWS_ONLY
+#include "views.glsl"
+
+void main() {
+#if VIEW_COUNT > 1
+  gl_Position = vec4(position, 1.);
+#else
+  gl_Position = projectView(views[0], position, u_resolution.x / u_resolution.y);
+#endif
+}
@@ -0,0 +1,47 @@
+// Cameras of the views drawn in this pass, see views.h. With more than one
+// the geometry shader tells which layer, and so which view, this is.
+#ifndef VIEW_COUNT
+#define VIEW_COUNT 1
+#endif
+
+struct View {
+  vec4 origin;  // w is unused padding
+  vec4 right;
+  vec4 up;
+  vec4 forward; // w is the image plane distance
+};
+
+layout(std140, binding = 0) uniform Views { View views[VIEW_COUNT]; };
+
+// Vertex and geometry stages only project, VIEW is for fragments
+#ifndef VIEWS_ONLY
+#if VIEW_COUNT > 1
+flat in int v_view;
+#define VIEW v_view
+#else
+#define VIEW 0
+#endif
+#endif
+
+// Range of the depth buffer, for the passes that depth test what they hit
+// against rasterized proxies
+#define DEPTH_NEAR .05
+#define DEPTH_FAR 200.
+
+// Clip space position of a world space point, the inverse of the rays the
+// fragment shader casts. aspect is the width over the height of the view.
+vec4 projectView(View view, vec3 point, float aspect) {
+  vec3 offset = point - view.origin.xyz;
+  float depth = dot(offset, view.forward.xyz);
+  return vec4(view.forward.w * dot(offset, view.right.xyz) / aspect,
+              view.forward.w * dot(offset, view.up.xyz),
+              (depth * (DEPTH_FAR + DEPTH_NEAR) - 2. * DEPTH_FAR * DEPTH_NEAR) /
+                  (DEPTH_FAR - DEPTH_NEAR),
+              depth);
+}
+
+// Depth buffer value of a world space point, as the rasterizer writes it
+float viewDepth(View view, vec3 point) {
+  vec4 clip = projectView(view, point, 1.);
+  return clamp(clip.z / clip.w * .5 + .5, 0., 1.);
+}
@@ -0,0 +1,20 @@
+// =========================================================================================================
+// Mesh distance volume
+// =========================================================================================================
+
+// Signed distances converted from a mesh by mesh2sdf and loaded by volume.c.
+// VOLUME_MIN, VOLUME_VOXEL_SIZE and VOLUME_DIMS are injected from the file
+// header, samples sit on texel centres.
+layout(binding = 2) uniform sampler3D u_volume;
+
+float volumeSdf(vec3 point) {
+  vec3 volume_max = VOLUME_MIN + (VOLUME_DIMS - 1.) * VOLUME_VOXEL_SIZE;
+  vec3 inside = clamp(point, VOLUME_MIN, volume_max);
+  vec3 uvw = ((inside - VOLUME_MIN) / VOLUME_VOXEL_SIZE + .5) / VOLUME_DIMS;
+  float dist = texture(u_volume, uvw).r;
+
+  // Outside the volume the mesh is at least as far as the box, and no
+  // closer than the border sample allows
+  float outside = length(point - inside);
+  return outside > 0. ? max(outside, dist - outside) : dist;
+}
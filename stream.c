@@ -0,0 +1,409 @@
+#include "stream.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef unsigned int            uint;
+
+// Brick state while its samples are being read
+#define BRICK_PENDING           0xFFFF
+#define NO_SLOT                 0xFFFFFFFFu
+
+#define ATLAS_SIZE              (ATLAS_SLOTS * BRICK_SAMPLES)
+
+static void
+stream_error(char const* path, char const* error)
+{
+        fprintf(stderr, "ERROR: Could not stream volume %s: %s\n", path, error);
+        exit(EXIT_FAILURE);
+}
+
+static void*
+allocate(size_t size)
+{
+        void* memory = calloc(1, size);
+        if (!memory) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the brick stream\n");
+                exit(EXIT_FAILURE);
+        }
+
+        return memory;
+}
+
+int
+is_brick_file(char const* path)
+{
+        FILE* file = fopen(path, "rb");
+        if (!file) {
+                return 0;
+        }
+
+        char magic[8];
+        int bricked = fread(magic, sizeof(magic), 1, file) == 1 &&
+                      !memcmp(magic, BRICKS_MAGIC, sizeof(magic));
+        fclose(file);
+
+        return bricked;
+}
+
+// Reads requested bricks until told to quit. The render loop never has more
+// than STREAM_QUEUE bricks in flight, so the loaded queue cannot overflow and
+// the entry after the last loaded brick is always free to read into.
+static void*
+read_bricks(void* argument)
+{
+        struct brick_stream* stream = argument;
+        trace_thread_name("brick I/O");
+
+        pthread_mutex_lock(&stream->lock);
+        for (;;) {
+                while (!stream->request_count && !stream->quit) {
+                        pthread_cond_wait(&stream->wake, &stream->lock);
+                }
+                if (stream->quit) {
+                        break;
+                }
+
+                uint32_t brick = stream->requests[stream->request_first];
+                stream->request_first = (stream->request_first + 1) % STREAM_QUEUE;
+                stream->request_count--;
+
+                struct loaded_brick* loaded =
+                        &stream->loaded[(stream->loaded_first + stream->loaded_count) % STREAM_QUEUE];
+                pthread_mutex_unlock(&stream->lock);
+
+                loaded->brick = brick;
+                trace_begin("read_brick");
+                if (pread(stream->file, loaded->samples, sizeof(loaded->samples),
+                          (off_t)stream->table[brick]) != sizeof(loaded->samples)) {
+                        fprintf(stderr, "ERROR: Could not read brick %u\n", brick);
+                        exit(EXIT_FAILURE);
+                }
+                trace_end();
+
+                pthread_mutex_lock(&stream->lock);
+                stream->loaded_count++;
+        }
+        pthread_mutex_unlock(&stream->lock);
+
+        return NULL;
+}
+
+static void
+create_texture(GLuint texture, uint unit, GLint filter)
+{
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+void
+open_brick_stream(struct brick_stream* const stream, char const* path)
+{
+        memset(stream, 0, sizeof(*stream));
+
+        stream->file = open(path, O_RDONLY);
+        if (stream->file < 0) {
+                stream_error(path, "could not open the file");
+        }
+
+        struct brick_header* header = &stream->header;
+        struct stat info;
+        if (fstat(stream->file, &info) ||
+            pread(stream->file, header, sizeof(*header), 0) != sizeof(*header)) {
+                stream_error(path, "the file is too short");
+        }
+        if (memcmp(header->magic, BRICKS_MAGIC, sizeof(header->magic)) ||
+            header->version != BRICKS_VERSION || header->brick_size != BRICK_SIZE) {
+                stream_error(path, "not a bricked volume of this version");
+        }
+
+        for (uint axis = 0; axis < 3; axis++) {
+                uint32_t count = header->counts[axis];
+                if (!count || count > MAX_BRICKED_RESOLUTION / BRICK_SIZE + 1 ||
+                    header->dims[axis] != count * BRICK_SIZE + 1) {
+                        stream_error(path, "bad dimensions");
+                }
+        }
+
+        uint32_t const* counts = header->counts;
+        uint64_t brick_count = (uint64_t)counts[0] * counts[1] * counts[2];
+        uint64_t coarse_count = (uint64_t)(counts[0] + 1) * (counts[1] + 1) * (counts[2] + 1);
+        uint64_t table_size = sizeof(*stream->table) * brick_count;
+
+        if (header->coarse_offset + sizeof(float) * coarse_count > (uint64_t)info.st_size ||
+            header->table_offset % sizeof(*stream->table) ||
+            header->table_offset + table_size > (uint64_t)info.st_size) {
+                stream_error(path, "truncated file");
+        }
+
+        // The table is paged in as the camera moves, only the bricks are read
+        // explicitly
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t map_start = header->table_offset / page * page;
+        stream->table_map_size = (size_t)(header->table_offset - map_start + table_size);
+        stream->table_map = mmap(NULL, stream->table_map_size, PROT_READ, MAP_PRIVATE, stream->file,
+                                 (off_t)map_start);
+        if (stream->table_map == MAP_FAILED) {
+                stream_error(path, "could not map the brick table");
+        }
+        stream->table = (uint64_t const*)((char const*)stream->table_map +
+                                          (header->table_offset - map_start));
+
+        float* coarse = allocate(sizeof(*coarse) * coarse_count);
+        if (pread(stream->file, coarse, sizeof(*coarse) * coarse_count,
+                  (off_t)header->coarse_offset) != (ssize_t)(sizeof(*coarse) * coarse_count)) {
+                stream_error(path, "could not read the coarse level");
+        }
+
+        stream->state = allocate(sizeof(*stream->state) * brick_count);
+        stream->slots = allocate(sizeof(*stream->slots) * ATLAS_SLOTS * ATLAS_SLOTS * ATLAS_SLOTS);
+        stream->loaded = allocate(sizeof(*stream->loaded) * STREAM_QUEUE);
+        stream->lru_first = stream->lru_last = NO_SLOT;
+
+        glGenTextures(3, stream->textures);
+
+        // Coarse level, always resident and used wherever a brick is missing
+        create_texture(stream->textures[0], BRICKS_COARSE_UNIT, GL_LINEAR);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, (GLsizei)counts[0] + 1, (GLsizei)counts[1] + 1,
+                     (GLsizei)counts[2] + 1, 0, GL_RED, GL_FLOAT, coarse);
+
+        create_texture(stream->textures[1], BRICKS_ATLAS_UNIT, GL_LINEAR);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, ATLAS_SIZE, ATLAS_SIZE, ATLAS_SIZE, 0, GL_RED,
+                     GL_FLOAT, NULL);
+
+        // Indirection from brick to atlas slot + 1, every brick starts missing
+        create_texture(stream->textures[2], BRICKS_TABLE_UNIT, GL_NEAREST);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R16UI, (GLsizei)counts[0], (GLsizei)counts[1],
+                     (GLsizei)counts[2], 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, stream->state);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        glActiveTexture(GL_TEXTURE0);
+        free(coarse);
+
+        pthread_mutex_init(&stream->lock, NULL);
+        pthread_cond_init(&stream->wake, NULL);
+        if (pthread_create(&stream->thread, NULL, read_bricks, stream)) {
+                stream_error(path, "could not start the I/O thread");
+        }
+}
+
+static void
+unlink_slot(struct brick_stream* const stream, uint32_t slot)
+{
+        struct atlas_slot* entry = &stream->slots[slot];
+
+        if (entry->previous != NO_SLOT) {
+                stream->slots[entry->previous].next = entry->next;
+        } else {
+                stream->lru_first = entry->next;
+        }
+
+        if (entry->next != NO_SLOT) {
+                stream->slots[entry->next].previous = entry->previous;
+        } else {
+                stream->lru_last = entry->previous;
+        }
+}
+
+// Moves a slot to the front of the LRU list and marks it used this frame
+static void
+use_slot(struct brick_stream* const stream, uint32_t slot)
+{
+        struct atlas_slot* entry = &stream->slots[slot];
+
+        entry->frame = stream->frame;
+        entry->previous = NO_SLOT;
+        entry->next = stream->lru_first;
+
+        if (stream->lru_first != NO_SLOT) {
+                stream->slots[stream->lru_first].previous = slot;
+        } else {
+                stream->lru_last = slot;
+        }
+        stream->lru_first = slot;
+}
+
+static void
+set_table(struct brick_stream* const stream, uint32_t brick, uint16_t value)
+{
+        uint32_t const* counts = stream->header.counts;
+
+        stream->state[brick] = value;
+        glTexSubImage3D(GL_TEXTURE_3D, 0, (GLint)(brick % counts[0]),
+                        (GLint)(brick / counts[0] % counts[1]), (GLint)(brick / counts[0] / counts[1]),
+                        1, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &value);
+}
+
+// Free slot, or the least recently used one unless it is needed this frame
+static uint32_t
+take_slot(struct brick_stream* const stream)
+{
+        if (stream->slots_used < ATLAS_SLOTS * ATLAS_SLOTS * ATLAS_SLOTS) {
+                return stream->slots_used++;
+        }
+
+        uint32_t slot = stream->lru_last;
+        if (stream->slots[slot].frame == stream->frame) {
+                return NO_SLOT;
+        }
+
+        unlink_slot(stream, slot);
+        set_table(stream, stream->slots[slot].brick, 0);
+
+        return slot;
+}
+
+void
+update_brick_stream(struct brick_stream* const stream, float const* const camera)
+{
+        struct brick_header const* header = &stream->header;
+        uint32_t const* counts = header->counts;
+
+        stream->frame++;
+
+        // Upload what the I/O thread read since the last frame. Entries up
+        // to loaded_count are complete and left alone by the thread.
+        pthread_mutex_lock(&stream->lock);
+        uint32_t first = stream->loaded_first;
+        uint32_t count = stream->loaded_count;
+        pthread_mutex_unlock(&stream->lock);
+
+        glActiveTexture(GL_TEXTURE0 + BRICKS_ATLAS_UNIT);
+        glBindTexture(GL_TEXTURE_3D, stream->textures[1]);
+        glActiveTexture(GL_TEXTURE0 + BRICKS_TABLE_UNIT);
+        glBindTexture(GL_TEXTURE_3D, stream->textures[2]);
+
+        for (uint32_t i = 0; i < count; i++) {
+                struct loaded_brick const* loaded = &stream->loaded[(first + i) % STREAM_QUEUE];
+                stream->in_flight--;
+
+                uint32_t slot = take_slot(stream);
+                if (slot == NO_SLOT) {
+                        stream->state[loaded->brick] = 0;
+                        continue;
+                }
+
+                glActiveTexture(GL_TEXTURE0 + BRICKS_ATLAS_UNIT);
+                glTexSubImage3D(GL_TEXTURE_3D, 0, (GLint)(slot % ATLAS_SLOTS * BRICK_SAMPLES),
+                                (GLint)(slot / ATLAS_SLOTS % ATLAS_SLOTS * BRICK_SAMPLES),
+                                (GLint)(slot / ATLAS_SLOTS / ATLAS_SLOTS * BRICK_SAMPLES),
+                                BRICK_SAMPLES, BRICK_SAMPLES, BRICK_SAMPLES, GL_RED, GL_FLOAT,
+                                loaded->samples);
+
+                glActiveTexture(GL_TEXTURE0 + BRICKS_TABLE_UNIT);
+                set_table(stream, loaded->brick, (uint16_t)(slot + 1));
+                stream->slots[slot].brick = loaded->brick;
+                use_slot(stream, slot);
+        }
+
+        glActiveTexture(GL_TEXTURE0);
+
+        pthread_mutex_lock(&stream->lock);
+        stream->loaded_first = (first + count) % STREAM_QUEUE;
+        stream->loaded_count -= count;
+        pthread_mutex_unlock(&stream->lock);
+
+        // Bricks in a ball around the camera: resident ones are kept from
+        // eviction, the nearest missing ones are requested
+        float brick_width = header->voxel_size * BRICK_SIZE;
+        float center[3];
+        int low[3], high[3];
+
+        for (uint axis = 0; axis < 3; axis++) {
+                center[axis] = (camera[axis] - header->min[axis]) / brick_width;
+                low[axis] = (int)floorf(center[axis] - STREAM_RADIUS);
+                high[axis] = (int)ceilf(center[axis] + STREAM_RADIUS);
+                low[axis] = low[axis] < 0 ? 0 : low[axis];
+                high[axis] = high[axis] > (int)counts[axis] ? (int)counts[axis] : high[axis];
+        }
+
+        uint32_t wanted[STREAM_REQUESTS];
+        float wanted_distance[STREAM_REQUESTS];
+        uint wanted_count = 0;
+
+        for (int z = low[2]; z < high[2]; z++) {
+                for (int y = low[1]; y < high[1]; y++) {
+                        for (int x = low[0]; x < high[0]; x++) {
+                                float dx = (float)x + .5f - center[0];
+                                float dy = (float)y + .5f - center[1];
+                                float dz = (float)z + .5f - center[2];
+                                float distance = dx * dx + dy * dy + dz * dz;
+                                if (distance > STREAM_RADIUS * STREAM_RADIUS) {
+                                        continue;
+                                }
+
+                                uint32_t brick = ((uint32_t)z * counts[1] + (uint32_t)y) * counts[0] +
+                                                 (uint32_t)x;
+                                uint16_t state = stream->state[brick];
+
+                                if (stream->table[brick] == BRICK_EMPTY || state == BRICK_PENDING) {
+                                        continue;
+                                }
+                                if (state) {
+                                        unlink_slot(stream, state - 1u);
+                                        use_slot(stream, state - 1u);
+                                        continue;
+                                }
+
+                                // Keep the nearest STREAM_REQUESTS, sorted
+                                uint i = wanted_count < STREAM_REQUESTS ? wanted_count++ : STREAM_REQUESTS;
+                                for (; i > 0 && wanted_distance[i - 1] > distance; i--) {
+                                        if (i < STREAM_REQUESTS) {
+                                                wanted[i] = wanted[i - 1];
+                                                wanted_distance[i] = wanted_distance[i - 1];
+                                        }
+                                }
+                                if (i < STREAM_REQUESTS) {
+                                        wanted[i] = brick;
+                                        wanted_distance[i] = distance;
+                                }
+                        }
+                }
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        for (uint i = 0; i < wanted_count && stream->in_flight < STREAM_QUEUE; i++) {
+                stream->requests[(stream->request_first + stream->request_count) % STREAM_QUEUE] =
+                        wanted[i];
+                stream->request_count++;
+                stream->in_flight++;
+                stream->state[wanted[i]] = BRICK_PENDING;
+        }
+        pthread_cond_signal(&stream->wake);
+        pthread_mutex_unlock(&stream->lock);
+}
+
+void
+close_brick_stream(struct brick_stream* const stream)
+{
+        pthread_mutex_lock(&stream->lock);
+        stream->quit = 1;
+        pthread_cond_signal(&stream->wake);
+        pthread_mutex_unlock(&stream->lock);
+        pthread_join(stream->thread, NULL);
+
+        pthread_cond_destroy(&stream->wake);
+        pthread_mutex_destroy(&stream->lock);
+
+        glDeleteTextures(3, stream->textures);
+        munmap(stream->table_map, stream->table_map_size);
+        close(stream->file);
+
+        free(stream->state);
+        free(stream->slots);
+        free(stream->loaded);
+}
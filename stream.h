@@ -0,0 +1,75 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <glad/glad.h>
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "volume.h"
+
+// Resident bricks live in a fixed atlas of ATLAS_SLOTS^3 slots, 16^3 slots
+// of 9^3 floats is 12 MB whatever the size of the volume
+#define ATLAS_SLOTS             16
+
+// Bricks within this many brick widths of the camera are kept resident. The
+// ball must fit in the atlas, or bricks in use would evict each other.
+#define STREAM_RADIUS           8
+
+// New bricks asked for per frame, and bricks in flight between the render
+// loop and the I/O thread
+#define STREAM_REQUESTS         32
+#define STREAM_QUEUE            128
+
+// Texture units, matching the binding qualifiers in shaders/bricks.glsl
+#define BRICKS_COARSE_UNIT      3
+#define BRICKS_ATLAS_UNIT       4
+#define BRICKS_TABLE_UNIT       5
+
+// Atlas slot in the LRU list, most recently used first
+struct atlas_slot {
+        uint32_t        brick;
+        uint32_t        frame;
+        uint32_t        previous;
+        uint32_t        next;
+};
+
+struct loaded_brick {
+        uint32_t        brick;
+        float           samples[BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES];
+};
+
+// Bricked volume streamed from disk. The render loop decides which bricks
+// it wants and owns the GL objects, the I/O thread only reads files.
+struct brick_stream {
+        int                     file;
+        struct brick_header     header;
+        uint64_t const*         table;          // mapped brick table of the file
+        void*                   table_map;
+        size_t                  table_map_size;
+        uint16_t*               state;          // per brick: 0, BRICK_PENDING or slot + 1
+
+        struct atlas_slot*      slots;
+        uint32_t                slots_used;
+        uint32_t                lru_first;
+        uint32_t                lru_last;
+        uint32_t                frame;
+        uint32_t                in_flight;
+        GLuint                  textures[3];
+
+        pthread_t               thread;
+        pthread_mutex_t         lock;
+        pthread_cond_t          wake;
+        uint32_t                requests[STREAM_QUEUE];
+        uint32_t                request_first, request_count;
+        struct loaded_brick*    loaded;         // STREAM_QUEUE entries
+        uint32_t                loaded_first, loaded_count;
+        int                     quit;
+};
+
+int     is_brick_file(char const* path);
+void    open_brick_stream(struct brick_stream* const stream, char const* path);
+void    update_brick_stream(struct brick_stream* const stream, float const* const camera);
+void    close_brick_stream(struct brick_stream* const stream);
+
+#endif
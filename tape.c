@@ -0,0 +1,648 @@
+#include "tape.h"
+#include "tape_simd.h"
+#include "cpu_scene.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned int            uint;
+typedef unsigned long int       ulint;
+
+#define NO_VALUE                (~0u)
+
+// Operands read by every instruction
+static uint const operand_counts[TAPE_OPS] = { 2, 2, 2, 1, 1, 1, 1, 3, 1, 2, 2, 2, 2, 3 };
+
+static char const* const node_names[SDF_OPS] = {
+        "sphere", "plane", "terrain", "translate", "scale", "union", "intersection",
+        "subtraction", "smooth_union", "smooth_intersection", "smooth_subtraction"
+};
+
+// Numbers and children every node takes, in the order of the scene file.
+// Transforms take their numbers first, the operations their children.
+static uint const node_numbers[SDF_OPS] = { 4, 1, 1, 3, 1, 0, 0, 0, 1, 1, 1 };
+static uint const node_children[SDF_OPS] = { 0, 0, 0, 1, 1, 2, 2, 2, 2, 2, 2 };
+
+static char const* const material_names[] = { "background", "gold", "silver", "checkerboard" };
+#define MATERIALS               (sizeof(material_names) / sizeof(*material_names))
+
+static void
+tape_error(char const* const error)
+{
+        fprintf(stderr, "ERROR: Could not compile the scene: %s\n", error);
+        exit(EXIT_FAILURE);
+}
+
+// =========================================================================================================
+// Compiler
+// =========================================================================================================
+
+// Instructions are emitted on value numbers, every result a new one, and get
+// their registers once all are known
+struct compiler {
+        struct tape*    tape;
+        uint            results[MAX_TAPE_LENGTH];
+        uint            operands[MAX_TAPE_LENGTH][3];
+        uint            values;
+
+        uint            footprint;      // of the pixel, once a terrain needs it
+        float const*    lod_origin;
+        float           lod_pixel_angle;
+};
+
+static uint
+emit(struct compiler* const compiler, uint op, uint a, uint b, uint c, float immediate,
+     uint integer)
+{
+        struct tape* tape = compiler->tape;
+        if (tape->length == MAX_TAPE_LENGTH) {
+                tape_error("too many instructions");
+        }
+
+        struct tape_instruction* instruction = &tape->instructions[tape->length];
+        instruction->op = (unsigned char)op;
+        instruction->immediate = immediate;
+        instruction->integer = integer;
+
+        uint const operands[3] = { a, b, c };
+        for (uint i = 0; i < 3; i++) {
+                compiler->operands[tape->length][i] = i < operand_counts[op] ? operands[i] : NO_VALUE;
+        }
+        compiler->results[tape->length++] = compiler->values;
+
+        return compiler->values++;
+}
+
+static uint
+emit_immediate(struct compiler* const compiler, uint op, uint a, float immediate)
+{
+        return emit(compiler, op, a, NO_VALUE, NO_VALUE, immediate, 0);
+}
+
+static uint
+emit_binary(struct compiler* const compiler, uint op, uint a, uint b, float immediate)
+{
+        return emit(compiler, op, a, b, NO_VALUE, immediate, 0);
+}
+
+// pixelFootprint() with lodScale, in world units
+static uint
+footprint(struct compiler* const compiler)
+{
+        if (compiler->footprint == NO_VALUE) {
+                float const* origin = compiler->lod_origin;
+                uint x = emit_immediate(compiler, TAPE_SUB_IMM, TAPE_X, origin[0]);
+                uint y = emit_immediate(compiler, TAPE_SUB_IMM, TAPE_Y, origin[1]);
+                uint z = emit_immediate(compiler, TAPE_SUB_IMM, TAPE_Z, origin[2]);
+                uint distance = emit(compiler, TAPE_LENGTH, x, y, z, 0.f, 0);
+                uint size = emit_immediate(compiler, TAPE_MUL_IMM, distance, compiler->lod_pixel_angle);
+                compiler->footprint = emit_binary(compiler, TAPE_MUL, size, TAPE_LOD, 0.f);
+        }
+
+        return compiler->footprint;
+}
+
+// Distance to the subtree at point, in the space scale times the world
+static uint
+compile_node(struct compiler* const compiler, struct sdf_tree const* const tree, uint index,
+             uint const* const point, float scale)
+{
+        struct sdf_node const* node = &tree->nodes[index];
+        float const* parameters = node->parameters;
+
+        if (node->op == SDF_SPHERE) {
+                uint x = emit_immediate(compiler, TAPE_SUB_IMM, point[0], parameters[0]);
+                uint y = emit_immediate(compiler, TAPE_SUB_IMM, point[1], parameters[1]);
+                uint z = emit_immediate(compiler, TAPE_SUB_IMM, point[2], parameters[2]);
+                uint distance = emit(compiler, TAPE_LENGTH, x, y, z, 0.f, 0);
+                distance = emit_immediate(compiler, TAPE_SUB_IMM, distance, parameters[3]);
+                return emit(compiler, TAPE_MATERIAL, distance, NO_VALUE, NO_VALUE, 0.f, node->material);
+        } else if (node->op == SDF_PLANE) {
+                uint distance = emit_immediate(compiler, TAPE_ADD_IMM, point[1], parameters[0]);
+                return emit(compiler, TAPE_MATERIAL, distance, NO_VALUE, NO_VALUE, 0.f, node->material);
+        } else if (node->op == SDF_TERRAIN) {
+                uint lod = footprint(compiler);
+                if (scale != 1.f) {
+                        lod = emit_immediate(compiler, TAPE_MUL_IMM, lod, scale);
+                }
+
+                uint x = emit_immediate(compiler, TAPE_MUL_IMM, point[0], TERRAIN_SCALE);
+                uint z = emit_immediate(compiler, TAPE_MUL_IMM, point[2], TERRAIN_SCALE);
+                lod = emit_immediate(compiler, TAPE_MUL_IMM, lod, TERRAIN_SCALE);
+                uint height = emit(compiler, TAPE_FBM, x, z, lod, 0.f, CPU_FBM_OCTAVES);
+                height = emit_immediate(compiler, TAPE_MUL_IMM, height, TERRAIN_HEIGHT);
+                height = emit_immediate(compiler, TAPE_SUB_IMM, height, parameters[0]);
+
+                // The height field is not 1-Lipschitz, so shorten the steps
+                uint distance = emit_binary(compiler, TAPE_SUB, point[1], height, 0.f);
+                distance = emit_immediate(compiler, TAPE_MUL_IMM, distance, .6f);
+                return emit(compiler, TAPE_MATERIAL, distance, NO_VALUE, NO_VALUE, 0.f, node->material);
+        } else if (node->op == SDF_TRANSLATE) {
+                uint moved[3];
+                for (uint axis = 0; axis < 3; axis++) {
+                        moved[axis] = emit_immediate(compiler, TAPE_SUB_IMM, point[axis], parameters[axis]);
+                }
+                return compile_node(compiler, tree, node->children[0], moved, scale);
+        } else if (node->op == SDF_SCALE) {
+                uint scaled[3];
+                for (uint axis = 0; axis < 3; axis++) {
+                        scaled[axis] = emit_immediate(compiler, TAPE_MUL_IMM, point[axis], 1.f / parameters[0]);
+                }
+                uint distance = compile_node(compiler, tree, node->children[0], scaled,
+                                             scale / parameters[0]);
+                return emit_immediate(compiler, TAPE_MUL_IMM, distance, parameters[0]);
+        }
+
+        uint a = compile_node(compiler, tree, node->children[0], point, scale);
+        uint b = compile_node(compiler, tree, node->children[1], point, scale);
+
+        if (node->op == SDF_SUBTRACTION || node->op == SDF_SMOOTH_SUBTRACTION) {
+                a = emit_immediate(compiler, TAPE_NEG, a, 0.f);
+        }
+
+        if (node->op == SDF_UNION) {
+                return emit_binary(compiler, TAPE_MIN, a, b, 0.f);
+        } else if (node->op == SDF_INTERSECTION || node->op == SDF_SUBTRACTION) {
+                return emit_binary(compiler, TAPE_MAX, a, b, 0.f);
+        } else if (node->op == SDF_SMOOTH_UNION) {
+                return emit_binary(compiler, TAPE_SMOOTH_MIN, a, b, parameters[0]);
+        }
+        return emit_binary(compiler, TAPE_SMOOTH_MAX, a, b, parameters[0]);
+}
+
+// Every value gets a register from its instruction to its last use, and
+// results can take the register of an operand read for the last time
+static void
+allocate_registers(struct compiler* const compiler)
+{
+        struct tape* tape = compiler->tape;
+        uint values = compiler->values;
+
+        uint* last_uses = malloc(sizeof(uint) * values);
+        uint* registers = malloc(sizeof(uint) * values);
+        uint free_registers[MAX_TAPE_REGISTERS];
+        if (!last_uses || !registers) {
+                tape_error("out of memory");
+        }
+
+        for (uint value = 0; value < values; value++) {
+                last_uses[value] = NO_VALUE;
+                registers[value] = value;
+        }
+        for (uint i = 0; i < tape->length; i++) {
+                for (uint operand = 0; operand < 3; operand++) {
+                        if (compiler->operands[i][operand] != NO_VALUE) {
+                                last_uses[compiler->operands[i][operand]] = i;
+                        }
+                }
+        }
+
+        uint free_count = 0;
+        tape->registers = TAPE_INPUTS;
+        for (uint i = 0; i < tape->length; i++) {
+                struct tape_instruction* instruction = &tape->instructions[i];
+
+                for (uint operand = 0; operand < 3; operand++) {
+                        uint value = compiler->operands[i][operand];
+                        instruction->operands[operand] = 0;
+                        if (value == NO_VALUE) {
+                                continue;
+                        }
+                        instruction->operands[operand] = (unsigned char)registers[value];
+
+                        // Freed once, an instruction can read a value twice
+                        if (value >= TAPE_INPUTS && last_uses[value] == i) {
+                                free_registers[free_count++] = registers[value];
+                                last_uses[value] = NO_VALUE;
+                        }
+                }
+
+                uint result = free_count ? free_registers[--free_count] : tape->registers++;
+                if (result >= MAX_TAPE_REGISTERS) {
+                        tape_error("too many registers");
+                }
+                registers[compiler->results[i]] = result;
+                instruction->result = (unsigned char)result;
+        }
+
+        tape->result = registers[compiler->results[tape->length - 1]];
+
+        free(registers);
+        free(last_uses);
+}
+
+void
+compile_tape(struct tape* const tape, struct sdf_tree const* const tree,
+             float const* const lod_origin, float lod_pixel_angle)
+{
+        tape->length = 0;
+        tape->registers = TAPE_INPUTS;
+        tape->result = 0;
+        tape->tree.count = 0;
+        if (!tree->count) {
+                return;
+        }
+
+        struct compiler compiler;
+        compiler.tape = tape;
+        compiler.values = TAPE_INPUTS;
+        compiler.footprint = NO_VALUE;
+        compiler.lod_origin = lod_origin;
+        compiler.lod_pixel_angle = lod_pixel_angle;
+
+        uint const point[3] = { TAPE_X, TAPE_Y, TAPE_Z };
+        compile_node(&compiler, tree, tree->count - 1, point, 1.f);
+        allocate_registers(&compiler);
+
+        if (tape->length <= TAPE_TREE_LENGTH && compiler.footprint == NO_VALUE) {
+                tape->tree = *tree;
+        }
+}
+
+// =========================================================================================================
+// Interpreter
+// =========================================================================================================
+
+// The material of the result of an instruction, of the operand that wins.
+// Only needed by the callers that ask for materials, the rest skip it.
+static vint
+select_material(struct tape_instruction const* const instruction, vfloat const* const values,
+                vint const* const materials)
+{
+        vint a = materials[instruction->operands[0]];
+        vint b = materials[instruction->operands[1]];
+        vfloat x = values[instruction->operands[0]], y = values[instruction->operands[1]];
+        uint op = instruction->op;
+
+        if (op == TAPE_MATERIAL) {
+                return (vint){ 0 } + (int32_t)instruction->integer;
+        } else if (op == TAPE_MIN) {
+                return select_int(x < y, a, b);
+        } else if (op == TAPE_MAX) {
+                return select_int(x > y, a, b);
+        } else if (op == TAPE_SMOOTH_MIN) {
+                return select_int(.5f + .5f * (y - x) / instruction->immediate > .5f, a, b);
+        } else if (op == TAPE_SMOOTH_MAX) {
+                return select_int(.5f - .5f * (y - x) / instruction->immediate > .5f, a, b);
+        }
+
+        return a;
+}
+
+// compile_node() evaluated at one point, the same operations in the same
+// order, so a short tape gives the distances and materials of a long one
+static float
+walk_node(struct sdf_tree const* const tree, uint index, float const* const point,
+          uint* const material)
+{
+        struct sdf_node const* node = &tree->nodes[index];
+        float const* parameters = node->parameters;
+
+        if (node->op == SDF_SPHERE) {
+                float x = point[0] - parameters[0], y = point[1] - parameters[1];
+                float z = point[2] - parameters[2];
+                *material = node->material;
+                return sqrtf(x * x + y * y + z * z) - parameters[3];
+        } else if (node->op == SDF_PLANE) {
+                *material = node->material;
+                return point[1] + parameters[0];
+        } else if (node->op == SDF_TRANSLATE) {
+                float const moved[3] = { point[0] - parameters[0], point[1] - parameters[1],
+                                         point[2] - parameters[2] };
+                return walk_node(tree, node->children[0], moved, material);
+        } else if (node->op == SDF_SCALE) {
+                float inverse = 1.f / parameters[0];
+                float const scaled[3] = { point[0] * inverse, point[1] * inverse, point[2] * inverse };
+                return walk_node(tree, node->children[0], scaled, material) * parameters[0];
+        }
+
+        uint materials[2];
+        float a = walk_node(tree, node->children[0], point, &materials[0]);
+        float b = walk_node(tree, node->children[1], point, &materials[1]);
+        float k = parameters[0];
+
+        if (node->op == SDF_SUBTRACTION || node->op == SDF_SMOOTH_SUBTRACTION) {
+                a = -a;
+        }
+
+        int first;
+        float result;
+        if (node->op == SDF_UNION) {
+                first = a < b;
+                result = first ? a : b;
+        } else if (node->op == SDF_INTERSECTION || node->op == SDF_SUBTRACTION) {
+                first = a > b;
+                result = first ? a : b;
+        } else if (node->op == SDF_SMOOTH_UNION) {
+                float h = .5f + .5f * (b - a) / k;
+                first = h > .5f;
+                h = h < 0.f ? 0.f : h > 1.f ? 1.f : h;
+                result = (b * (1.f - h) + a * h) - k * h * (1.f - h);
+        } else {
+                float h = .5f - .5f * (b - a) / k;
+                first = h > .5f;
+                h = h < 0.f ? 0.f : h > 1.f ? 1.f : h;
+                result = (b * (1.f - h) + a * h) + k * h * (1.f - h);
+        }
+
+        *material = materials[first ? 0 : 1];
+        return result;
+}
+
+void
+run_tape(struct tape const* const tape, float const* x, float const* y, float const* z,
+         float lod_scale, float* distance, uint* material, ulint count)
+{
+        if (!tape->length) {
+                for (ulint i = 0; i < count; i++) {
+                        distance[i] = CPU_MAX_DEPTH;
+                        if (material) {
+                                material[i] = MATERIAL_BACKGROUND;
+                        }
+                }
+                return;
+        }
+
+        if (tape->tree.count) {
+                struct sdf_tree const* tree = &tape->tree;
+                for (ulint i = 0; i < count; i++) {
+                        float const point[3] = { x[i], y[i], z[i] };
+                        uint kind;
+                        float closest = walk_node(tree, tree->count - 1, point, &kind);
+                        int near = closest < CPU_MAX_DEPTH;
+                        distance[i] = near ? closest : CPU_MAX_DEPTH;
+                        if (material) {
+                                material[i] = near ? kind : MATERIAL_BACKGROUND;
+                        }
+                }
+                return;
+        }
+
+        vfloat values[MAX_TAPE_REGISTERS];
+        vint materials[MAX_TAPE_REGISTERS];
+
+        for (ulint first = 0; first < count; first += TAPE_LANES) {
+                ulint lanes = count - first < TAPE_LANES ? count - first : TAPE_LANES;
+                values[TAPE_X] = load(x + first, lanes);
+                values[TAPE_Y] = load(y + first, lanes);
+                values[TAPE_Z] = load(z + first, lanes);
+                values[TAPE_LOD] = (vfloat){ 0.f } + lod_scale;
+                for (uint input = 0; input < TAPE_INPUTS; input++) {
+                        materials[input] = (vint){ 0 };
+                }
+
+                for (uint i = 0; i < tape->length; i++) {
+                        struct tape_instruction const* instruction = &tape->instructions[i];
+                        vfloat a = values[instruction->operands[0]];
+                        vfloat b = values[instruction->operands[1]];
+                        vfloat c = values[instruction->operands[2]];
+                        float k = instruction->immediate;
+                        vfloat result, h;
+
+                        switch (instruction->op) {
+                        case TAPE_ADD:
+                                result = a + b;
+                                break;
+                        case TAPE_SUB:
+                                result = a - b;
+                                break;
+                        case TAPE_MUL:
+                                result = a * b;
+                                break;
+                        case TAPE_ADD_IMM:
+                                result = a + k;
+                                break;
+                        case TAPE_SUB_IMM:
+                                result = a - k;
+                                break;
+                        case TAPE_MUL_IMM:
+                                result = a * k;
+                                break;
+                        case TAPE_NEG:
+                                result = -a;
+                                break;
+                        case TAPE_LENGTH:
+                                result = square_root(a * a + b * b + c * c);
+                                break;
+                        case TAPE_MATERIAL:
+                                result = a;
+                                break;
+                        case TAPE_MIN:
+                                result = select_float(a < b, a, b);
+                                break;
+                        case TAPE_MAX:
+                                result = select_float(a > b, a, b);
+                                break;
+                        case TAPE_SMOOTH_MIN:
+                                h = saturate(.5f + .5f * (b - a) / k);
+                                result = (b * (1.f - h) + a * h) - k * h * (1.f - h);
+                                break;
+                        case TAPE_SMOOTH_MAX:
+                                h = saturate(.5f - .5f * (b - a) / k);
+                                result = (b * (1.f - h) + a * h) + k * h * (1.f - h);
+                                break;
+                        default:
+                                result = fbm(a, b, c, instruction->integer);
+                                break;
+                        }
+
+                        // Before the result can take the register of an operand
+                        if (material) {
+                                materials[instruction->result] =
+                                        select_material(instruction, values, materials);
+                        }
+                        values[instruction->result] = result;
+                }
+
+                // Nothing is further than the far plane, as in scene()
+                vfloat closest = values[tape->result];
+                vint kind = materials[tape->result];
+                for (ulint lane = 0; lane < lanes; lane++) {
+                        int near = closest[lane] < CPU_MAX_DEPTH;
+                        distance[first + lane] = near ? closest[lane] : CPU_MAX_DEPTH;
+                        if (material) {
+                                material[first + lane] = near ? (uint)kind[lane] : MATERIAL_BACKGROUND;
+                        }
+                }
+        }
+}
+
+// =========================================================================================================
+// Scene files
+// =========================================================================================================
+
+struct parser {
+        char const*     path;
+        char const*     cursor;
+        uint            line;
+        struct sdf_tree* tree;
+};
+
+static void
+parse_error(struct parser const* const parser, char const* const error)
+{
+        fprintf(stderr, "ERROR: Could not read scene %s: %s on line %u\n", parser->path, error,
+                parser->line);
+        exit(EXIT_FAILURE);
+}
+
+// Spaces and # comments
+static void
+skip_space(struct parser* const parser)
+{
+        for (;;) {
+                char character = *parser->cursor;
+                if (character == '\n') {
+                        parser->line++;
+                }
+
+                if (character == '#') {
+                        while (*parser->cursor && *parser->cursor != '\n') {
+                                parser->cursor++;
+                        }
+                } else if (character && isspace((unsigned char)character)) {
+                        parser->cursor++;
+                } else {
+                        return;
+                }
+        }
+}
+
+static void
+expect(struct parser* const parser, char character)
+{
+        skip_space(parser);
+        if (*parser->cursor != character) {
+                char error[32];
+                snprintf(error, sizeof(error), "expected '%c'", character);
+                parse_error(parser, error);
+        }
+        parser->cursor++;
+}
+
+static uint
+read_name(struct parser* const parser, char* const name, uint size)
+{
+        skip_space(parser);
+        uint length = 0;
+        while (isalnum((unsigned char)*parser->cursor) || *parser->cursor == '_') {
+                if (length + 1 < size) {
+                        name[length++] = *parser->cursor;
+                }
+                parser->cursor++;
+        }
+        name[length] = '\0';
+
+        return length;
+}
+
+static uint
+lookup(char const* const name, char const* const* const names, uint count)
+{
+        for (uint i = 0; i < count; i++) {
+                if (!strcmp(name, names[i])) {
+                        return i;
+                }
+        }
+        return count;
+}
+
+static uint
+parse_node(struct parser* const parser)
+{
+        char name[32];
+        if (!read_name(parser, name, sizeof(name))) {
+                parse_error(parser, "expected a node");
+        }
+
+        uint op = lookup(name, node_names, SDF_OPS);
+        if (op == SDF_OPS) {
+                parse_error(parser, "unknown node");
+        }
+        expect(parser, '(');
+
+        struct sdf_node node = { op, MATERIAL_BACKGROUND, { 0, 0 }, { 0.f, 0.f, 0.f, 0.f } };
+        if (op == SDF_SPHERE) {
+                node.material = MATERIAL_GOLD;
+        } else if (op == SDF_PLANE || op == SDF_TERRAIN) {
+                node.material = MATERIAL_CHECKERBOARD;
+        }
+
+        // Transforms take their numbers before the child
+        uint numbers = 0, children = 0;
+        uint argument_count = node_numbers[op] + node_children[op];
+        for (uint argument = 0; argument < argument_count; argument++) {
+                if (argument) {
+                        expect(parser, ',');
+                }
+
+                int number = op < SDF_UNION ? argument < node_numbers[op] : argument >= node_children[op];
+                if (number) {
+                        skip_space(parser);
+                        char* end;
+                        node.parameters[numbers++] = strtof(parser->cursor, &end);
+                        if (end == parser->cursor) {
+                                parse_error(parser, "expected a number");
+                        }
+                        parser->cursor = end;
+                } else {
+                        node.children[children++] = parse_node(parser);
+                }
+        }
+
+        skip_space(parser);
+        if (op <= SDF_TERRAIN && *parser->cursor == ',') {
+                parser->cursor++;
+                read_name(parser, name, sizeof(name));
+                node.material = lookup(name, material_names, MATERIALS);
+                if (node.material == MATERIALS || node.material == MATERIAL_BACKGROUND) {
+                        parse_error(parser, "unknown material");
+                }
+        }
+        expect(parser, ')');
+
+        if ((op == SDF_SCALE || op >= SDF_SMOOTH_UNION) && !(node.parameters[0] > 0.f)) {
+                parse_error(parser, "the factor must be above 0");
+        }
+        if (parser->tree->count == MAX_SDF_NODES) {
+                parse_error(parser, "too many nodes");
+        }
+        parser->tree->nodes[parser->tree->count] = node;
+
+        return parser->tree->count++;
+}
+
+void
+load_sdf_tree(struct sdf_tree* const tree, char const* const path)
+{
+        FILE* file = fopen(path, "rb");
+        if (!file) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+
+        fseek(file, 0, SEEK_END);
+        long length = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        char* text = malloc((size_t)length + 1);
+        if (!text || fread(text, 1, (size_t)length, file) != (size_t)length) {
+                fprintf(stderr, "ERROR: Could not read scene %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+        text[length] = '\0';
+        fclose(file);
+
+        struct parser parser = { path, text, 1, tree };
+        tree->count = 0;
+        parse_node(&parser);
+
+        skip_space(&parser);
+        if (*parser.cursor) {
+                parse_error(&parser, "expected the end of the file");
+        }
+
+        free(text);
+}
@@ -0,0 +1,124 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+// Scenes for the CPU renderer as data: a CSG tree built at run time or read
+// from a file, compiled to a flat tape of instructions on registers. One run
+// of a tape evaluates the distance and material at many points, TAPE_LANES
+// at a time with GCC vector extensions, so the dispatch of every
+// instruction is shared by a packet of rays.
+
+// Scene tree, scene() of shaders/fragment_shader.glsl as nodes. Leaves are
+// primitives, transforms have one child and the operations two, combined as
+// opUnion(), opSmoothUnion() and the rest do. The surface that wins gives
+// the material.
+#define SDF_SPHERE              0       // center xyz, radius
+#define SDF_PLANE               1       // y + distance from the origin
+#define SDF_TERRAIN             2       // the plane displaced by fBM
+#define SDF_TRANSLATE           3       // the child moved by xyz
+#define SDF_SCALE               4       // the child scaled by a factor above 0
+#define SDF_UNION               5
+#define SDF_INTERSECTION        6
+#define SDF_SUBTRACTION         7       // the first child cut out of the second
+#define SDF_SMOOTH_UNION        8       // blended over a distance k
+#define SDF_SMOOTH_INTERSECTION 9
+#define SDF_SMOOTH_SUBTRACTION  10
+#define SDF_OPS                 11
+
+#define MATERIAL_BACKGROUND     0
+#define MATERIAL_GOLD           1
+#define MATERIAL_SILVER         2
+#define MATERIAL_CHECKERBOARD   3
+
+#define MAX_SDF_NODES           32
+
+// Of the terrain, as in shaders/fragment_shader.glsl
+#define TERRAIN_SCALE           .5f
+#define TERRAIN_HEIGHT          .8f
+
+struct sdf_node {
+        unsigned int    op;
+        unsigned int    material;
+        unsigned int    children[2];
+        float           parameters[4];
+};
+
+// Children come before their parents, the root is last. An empty tree is
+// nothing closer than CPU_MAX_DEPTH.
+struct sdf_tree {
+        struct sdf_node nodes[MAX_SDF_NODES];
+        unsigned int    count;
+};
+
+// Tape instructions. Every result carries the material of the first operand,
+// except where noted.
+#define TAPE_ADD                0       // a + b
+#define TAPE_SUB                1       // a - b
+#define TAPE_MUL                2       // a * b
+#define TAPE_ADD_IMM            3       // a + immediate
+#define TAPE_SUB_IMM            4       // a - immediate
+#define TAPE_MUL_IMM            5       // a * immediate
+#define TAPE_NEG                6       // -a
+#define TAPE_LENGTH             7       // length(vec3(a, b, c))
+#define TAPE_MATERIAL           8       // a, with the material in integer
+#define TAPE_MIN                9       // a < b ? a : b, with its material
+#define TAPE_MAX                10      // a > b ? a : b, with its material
+#define TAPE_SMOOTH_MIN         11      // opSmoothUnion(a, b, immediate)
+#define TAPE_SMOOTH_MAX         12      // opSmoothIntersection(a, b, immediate)
+#define TAPE_FBM                13      // fBM(vec2(a, b), c) of integer octaves
+#define TAPE_OPS                14
+
+// Registers the points are loaded into, the first instructions read them
+#define TAPE_X                  0
+#define TAPE_Y                  1
+#define TAPE_Z                  2
+#define TAPE_LOD                3       // lodScale
+#define TAPE_INPUTS             4
+
+#define TAPE_LANES              8
+#define TAPE_TREE_LENGTH        16
+#define MAX_TAPE_LENGTH         256
+#define MAX_TAPE_REGISTERS      256
+
+struct tape_instruction {
+        unsigned char   op;
+        unsigned char   result;
+        unsigned char   operands[3];
+        float           immediate;
+        unsigned int    integer;
+};
+
+// Tapes of at most TAPE_TREE_LENGTH instructions and no terrain cost more to
+// dispatch than to evaluate, run_tape() walks their tree point by point
+// instead. The tree is empty for the rest.
+struct tape {
+        struct tape_instruction instructions[MAX_TAPE_LENGTH];
+        unsigned int            length;         // 0 for an empty tree
+        unsigned int            registers;
+        unsigned int            result;
+        struct sdf_tree         tree;
+};
+
+// The noise LOD needs the camera, the footprint of a pixel grows with its
+// distance to lod_origin
+void    compile_tape(struct tape* const tape, struct sdf_tree const* const tree,
+                     float const* const lod_origin, float lod_pixel_angle);
+
+// Distances and materials of the scene at count points. As in scene(),
+// distances are at most CPU_MAX_DEPTH, with the background material there.
+// material can be NULL when only the distances are needed, which is faster.
+void    run_tape(struct tape const* const tape, float const* x, float const* y, float const* z,
+                 float lod_scale, float* distance, unsigned int* material, unsigned long count);
+
+// run_tape() of a tree compiled to C by sdfc, see scene_emit.h, which takes
+// the LOD compile_tape() builds into the tape
+typedef void (*native_scene_function)(float const* x, float const* y, float const* z,
+                                      float lod_scale, float const* lod_origin, float lod_pixel_angle,
+                                      float* distance, unsigned int* material, unsigned long count);
+
+// A scene file is one expression of the nodes by name, like
+//     smooth_union(sphere(0, 0, 0, 1, gold), plane(1), .3)
+// Transforms take their numbers first, as in scale(.5, sphere(0, 0, 0, 1)),
+// the operations last. Leaves can name their material last.
+void    load_sdf_tree(struct sdf_tree* const tree, char const* const path);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef TAPE_SIMD_H
+#define TAPE_SIMD_H
+
+#include "tape.h"
+#include "noise_simd.h"
+#include "noise.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Vectors of TAPE_LANES points, the registers of run_tape() and the values
+// of the evaluators sdfc writes. Comparisons give lanes of all ones or zeros.
+// They never cross a call outside the file, build with -Wno-psabi.
+typedef float                   vfloat __attribute__((vector_size(TAPE_LANES * sizeof(float))));
+typedef int32_t                 vint __attribute__((vector_size(TAPE_LANES * sizeof(int32_t))));
+
+// The first count values, the rest of the lanes zero
+static inline vfloat
+load(float const* values, unsigned long count)
+{
+        vfloat vector = { 0.f };
+        memcpy(&vector, values, sizeof(float) * count);
+        return vector;
+}
+
+static inline vfloat
+select_float(vint mask, vfloat a, vfloat b)
+{
+        return (vfloat)((mask & (vint)a) | (~mask & (vint)b));
+}
+
+static inline vint
+select_int(vint mask, vint a, vint b)
+{
+        return (mask & a) | (~mask & b);
+}
+
+static inline vfloat
+saturate(vfloat x)
+{
+        x = select_float(x < 0.f, (vfloat){ 0.f } + 0.f, x);
+        return select_float(x > 1.f, (vfloat){ 0.f } + 1.f, x);
+}
+
+static inline vfloat
+square_root(vfloat x)
+{
+        for (unsigned int lane = 0; lane < TAPE_LANES; lane++) {
+                x[lane] = sqrtf(x[lane]);
+        }
+        return x;
+}
+
+// fBM() of the noise kernels as wide as the vectors
+static inline vfloat
+fbm(vfloat x, vfloat y, vfloat footprint, unsigned int octaves)
+{
+        static struct noise_kernels const* kernels;
+        if (!kernels) {
+                kernels = &noise_kernels[0];
+                for (unsigned int width = 0; width < NOISE_WIDTHS; width++) {
+                        if (noise_kernels[width].lanes == TAPE_LANES) {
+                                kernels = &noise_kernels[width];
+                        }
+                }
+        }
+
+        float values[4][TAPE_LANES];
+        memcpy(values[0], &x, sizeof(x));
+        memcpy(values[1], &y, sizeof(y));
+        memcpy(values[2], &footprint, sizeof(footprint));
+        kernels->fbm(values[0], values[1], values[2], values[3], TAPE_LANES, NOISE_TEXTURE, octaves);
+
+        return load(values[3], TAPE_LANES);
+}
+
+#endif
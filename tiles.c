@@ -0,0 +1,521 @@
+// For the CPU affinity calls
+#define _GNU_SOURCE
+
+#include "tiles.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef unsigned int            uint;
+
+#define MAX_NUMA_NODES          64
+
+#define STEAL_EMPTY             0
+#define STEAL_TAKEN             1
+#define STEAL_LOST              2       // to another thief, try again
+
+static double
+now(void)
+{
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static void
+tile_error(char const* const error)
+{
+        fprintf(stderr, "ERROR: Could not start the tile workers: %s\n", error);
+        exit(EXIT_FAILURE);
+}
+
+// =========================================================================================================
+// Topology
+// =========================================================================================================
+
+// Adds the CPUs of a sysfs cpulist, "0-31,64-95", that the process may run on
+static uint
+read_cpu_list(FILE* const file, cpu_set_t const* const allowed, cpu_set_t* const placed,
+              int* const cpus, uint* const nodes, uint count, uint node)
+{
+        int first, last, separator;
+        while (fscanf(file, "%d", &first) == 1) {
+                last = first;
+                separator = fgetc(file);
+                if (separator == '-') {
+                        if (fscanf(file, "%d", &last) != 1) {
+                                break;
+                        }
+                        separator = fgetc(file);
+                }
+
+                for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+                        if (CPU_ISSET((size_t)cpu, allowed) && !CPU_ISSET((size_t)cpu, placed)) {
+                                CPU_SET((size_t)cpu, placed);
+                                cpus[count] = cpu;
+                                nodes[count++] = node;
+                        }
+                }
+
+                if (separator != ',') {
+                        break;
+                }
+        }
+
+        return count;
+}
+
+// CPUs the process may run on, grouped by NUMA node. Nodes are numbered from
+// 0 in the order found, and without NUMA everything is node 0.
+static uint
+find_cpus(int* const cpus, uint* const nodes)
+{
+        cpu_set_t allowed, placed;
+        CPU_ZERO(&placed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+                return 0;
+        }
+
+        uint count = 0, node = 0;
+        for (uint id = 0; id < MAX_NUMA_NODES; id++) {
+                char path[64];
+                snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", id);
+
+                // Node numbers can have gaps
+                FILE* file = fopen(path, "r");
+                if (!file) {
+                        continue;
+                }
+
+                uint found = read_cpu_list(file, &allowed, &placed, cpus, nodes, count, node);
+                fclose(file);
+
+                if (found > count) {
+                        count = found;
+                        node++;
+                }
+        }
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET((size_t)cpu, &allowed) && !CPU_ISSET((size_t)cpu, &placed)) {
+                        cpus[count] = cpu;
+                        nodes[count++] = 0;
+                }
+        }
+
+        return count;
+}
+
+// Workers on the node of the thief come first, both groups starting after it
+// so the thieves spread over the victims
+static void
+order_victims(struct tile_worker* const workers, uint count, uint thief)
+{
+        uint* victims = workers[thief].victims;
+        uint victim_count = 0;
+
+        for (uint near = 1; near <= 2; near++) {
+                for (uint i = 1; i < count; i++) {
+                        uint victim = (thief + i) % count;
+                        if ((workers[victim].node == workers[thief].node) == (near == 1)) {
+                                victims[victim_count++] = victim;
+                        }
+                }
+        }
+}
+
+// =========================================================================================================
+// Deque
+// =========================================================================================================
+
+static int
+pop_tile(struct tile_deque* const deque, struct tile* const tile)
+{
+        long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+        atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+        if (top > bottom) {
+                atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+                return 0;
+        }
+
+        *tile = deque->tiles[bottom];
+        if (top < bottom) {
+                return 1;
+        }
+
+        // The last tile, the thieves may be after it too
+        int won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                          memory_order_seq_cst,
+                                                          memory_order_relaxed);
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return won;
+}
+
+static int
+steal_tile(struct tile_deque* const deque, struct tile* const tile)
+{
+        long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+        if (top >= bottom) {
+                return STEAL_EMPTY;
+        }
+
+        *tile = deque->tiles[top];
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed)) {
+                return STEAL_LOST;
+        }
+
+        return STEAL_TAKEN;
+}
+
+// =========================================================================================================
+// Cost estimates
+// =========================================================================================================
+
+static void
+tile_cells(struct tile const* const tile, int* const first, int* const last)
+{
+        first[0] = tile->x / MIN_TILE_SIZE;
+        first[1] = tile->y / MIN_TILE_SIZE;
+        last[0] = (tile->x + tile->width + MIN_TILE_SIZE - 1) / MIN_TILE_SIZE;
+        last[1] = (tile->y + tile->height + MIN_TILE_SIZE - 1) / MIN_TILE_SIZE;
+}
+
+static float
+estimate_cost(struct tile_scheduler const* const scheduler, struct tile const* const tile)
+{
+        int first[2], last[2];
+        tile_cells(tile, first, last);
+
+        float cost = 0.f;
+        for (int y = first[1]; y < last[1]; y++) {
+                for (int x = first[0]; x < last[0]; x++) {
+                        cost += scheduler->costs[y * scheduler->cells[0] + x];
+                }
+        }
+
+        return cost;
+}
+
+// Spread over the cells of the tile, which no other tile of the frame covers
+static void
+record_cost(struct tile_scheduler* const scheduler, struct tile const* const tile, double seconds)
+{
+        int first[2], last[2];
+        tile_cells(tile, first, last);
+
+        float cost = (float)(seconds / (double)((last[0] - first[0]) * (last[1] - first[1])));
+        for (int y = first[1]; y < last[1]; y++) {
+                for (int x = first[0]; x < last[0]; x++) {
+                        scheduler->costs[y * scheduler->cells[0] + x] = cost;
+                }
+        }
+}
+
+static void
+add_tile(struct tile_scheduler* const scheduler, int x, int y, int size, float budget)
+{
+        struct tile tile = { x, y, size, size, size, 0.f };
+        if (x + size > scheduler->size[0]) {
+                tile.width = scheduler->size[0] - x;
+        }
+        if (y + size > scheduler->size[1]) {
+                tile.height = scheduler->size[1] - y;
+        }
+        tile.cost = estimate_cost(scheduler, &tile);
+
+        if (tile.cost > budget && size > MIN_TILE_SIZE) {
+                int half = size / 2;
+                scheduler->splits++;
+
+                for (int quadrant = 0; quadrant < 4; quadrant++) {
+                        int corner[2] = { x + (quadrant & 1) * half, y + (quadrant >> 1) * half };
+                        if (corner[0] < scheduler->size[0] && corner[1] < scheduler->size[1]) {
+                                add_tile(scheduler, corner[0], corner[1], half, budget);
+                        }
+                }
+                return;
+        }
+
+        scheduler->tiles[scheduler->tile_count++] = tile;
+}
+
+// Most expensive first, then in image order so the frames without a cost
+// estimate stay deterministic
+static int
+compare_tiles(void const* a, void const* b)
+{
+        struct tile const* first = a;
+        struct tile const* second = b;
+
+        if (first->cost != second->cost) {
+                return first->cost > second->cost ? -1 : 1;
+        }
+        if (first->y != second->y) {
+                return first->y - second->y;
+        }
+        return first->x - second->x;
+}
+
+static void
+plan_tiles(struct tile_scheduler* const scheduler)
+{
+        float total = 0.f;
+        for (int cell = 0; cell < scheduler->cells[0] * scheduler->cells[1]; cell++) {
+                total += scheduler->costs[cell];
+        }
+
+        // Nothing splits before the first frame is measured
+        float budget = total / (float)(scheduler->worker_count * TILES_PER_WORKER);
+        if (!(total > 0.f)) {
+                budget = 1e30f;
+        }
+
+        scheduler->tile_count = 0;
+        scheduler->splits = 0;
+        for (int y = 0; y < scheduler->size[1]; y += TILE_SIZE) {
+                for (int x = 0; x < scheduler->size[0]; x += TILE_SIZE) {
+                        add_tile(scheduler, x, y, TILE_SIZE, budget);
+                }
+        }
+
+        qsort(scheduler->tiles, scheduler->tile_count, sizeof(*scheduler->tiles), compare_tiles);
+}
+
+// =========================================================================================================
+// Workers
+// =========================================================================================================
+
+static void
+run_tile(struct tile_worker* const worker, struct tile const* const tile)
+{
+        double start = now();
+        worker->scheduler->function(worker->scheduler->context, tile);
+        double seconds = now() - start;
+
+        worker->busy += seconds;
+        record_cost(worker->scheduler, tile, seconds);
+}
+
+// Dealt round robin, so every deque gets its share of the expensive tiles.
+// The most expensive go to the bottom, where the owner starts, and the
+// cheapest end up with the thieves.
+static void
+fill_deque(struct tile_worker* const worker)
+{
+        struct tile_scheduler const* scheduler = worker->scheduler;
+        uint count = 0;
+        for (uint i = worker->index; i < scheduler->tile_count; i += scheduler->worker_count) {
+                count++;
+        }
+
+        uint slot = count;
+        for (uint i = worker->index; i < scheduler->tile_count; i += scheduler->worker_count) {
+                worker->deque.tiles[--slot] = scheduler->tiles[i];
+        }
+
+        atomic_store_explicit(&worker->deque.top, 0, memory_order_relaxed);
+        atomic_store_explicit(&worker->deque.bottom, (long)count, memory_order_relaxed);
+}
+
+static void
+work(struct tile_worker* const worker)
+{
+        struct tile_scheduler* scheduler = worker->scheduler;
+        struct tile tile;
+
+        for (;;) {
+                if (pop_tile(&worker->deque, &tile)) {
+                        run_tile(worker, &tile);
+                        continue;
+                }
+
+                // No tile is added during a frame, so once every deque is
+                // seen empty the frame is done
+                int stolen = 0, contended = 0;
+                for (uint i = 0; i + 1 < scheduler->worker_count && !stolen; i++) {
+                        int result = steal_tile(&scheduler->workers[worker->victims[i]].deque, &tile);
+                        stolen = result == STEAL_TAKEN;
+                        contended |= result == STEAL_LOST;
+                }
+
+                if (stolen) {
+                        worker->steals++;
+                        run_tile(worker, &tile);
+                } else if (!contended) {
+                        break;
+                }
+        }
+}
+
+static void*
+worker_thread(void* data)
+{
+        struct tile_worker* worker = data;
+        struct tile_scheduler* scheduler = worker->scheduler;
+
+        if (worker->cpu >= 0) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET((size_t)worker->cpu, &cpus);
+                if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+                        worker->cpu = -1;
+                }
+        }
+
+        // Allocated once pinned, so the first touch puts the deque on the
+        // node of its owner
+        uint capacity = (uint)(scheduler->cells[0] * scheduler->cells[1]);
+        worker->deque.tiles = malloc(sizeof(*worker->deque.tiles) *
+                                     (capacity / scheduler->worker_count + 1));
+        if (!worker->deque.tiles) {
+                tile_error("out of memory");
+        }
+
+        for (;;) {
+                pthread_barrier_wait(&scheduler->start);
+                if (scheduler->quit) {
+                        break;
+                }
+
+                fill_deque(worker);
+                pthread_barrier_wait(&scheduler->filled);
+
+                work(worker);
+                pthread_barrier_wait(&scheduler->done);
+        }
+
+        free(worker->deque.tiles);
+        return NULL;
+}
+
+// =========================================================================================================
+// Scheduler
+// =========================================================================================================
+
+void
+create_tile_scheduler(struct tile_scheduler* const scheduler, int const* const size,
+                      uint worker_count, tile_function function, void* context)
+{
+        static int cpus[CPU_SETSIZE];
+        static uint nodes[CPU_SETSIZE];
+
+        uint cpu_count = find_cpus(cpus, nodes);
+
+        if (worker_count == 0) {
+                worker_count = cpu_count ? cpu_count : 1;
+        }
+        if (worker_count > MAX_TILE_WORKERS) {
+                worker_count = MAX_TILE_WORKERS;
+        }
+
+        scheduler->size[0] = size[0];
+        scheduler->size[1] = size[1];
+        scheduler->function = function;
+        scheduler->context = context;
+        scheduler->worker_count = worker_count;
+        scheduler->quit = 0;
+
+        scheduler->cells[0] = (size[0] + MIN_TILE_SIZE - 1) / MIN_TILE_SIZE;
+        scheduler->cells[1] = (size[1] + MIN_TILE_SIZE - 1) / MIN_TILE_SIZE;
+        size_t cell_count = (size_t)(scheduler->cells[0] * scheduler->cells[1]);
+
+        // A fully split frame has a tile per cell
+        scheduler->costs = calloc(cell_count, sizeof(*scheduler->costs));
+        scheduler->tiles = malloc(sizeof(*scheduler->tiles) * cell_count);
+        scheduler->workers = calloc(worker_count, sizeof(*scheduler->workers));
+        if (!scheduler->costs || !scheduler->tiles || !scheduler->workers) {
+                tile_error("out of memory");
+        }
+        scheduler->tile_count = 0;
+        scheduler->splits = 0;
+        scheduler->nodes = 1;
+
+        // Workers past the core count share the cores from the first again
+        for (uint i = 0; i < worker_count; i++) {
+                struct tile_worker* worker = &scheduler->workers[i];
+                worker->scheduler = scheduler;
+                worker->index = i;
+                worker->cpu = cpu_count ? cpus[i % cpu_count] : -1;
+                worker->node = cpu_count ? nodes[i % cpu_count] : 0;
+                if (worker->node + 1 > scheduler->nodes) {
+                        scheduler->nodes = worker->node + 1;
+                }
+        }
+
+        for (uint i = 0; i < worker_count; i++) {
+                scheduler->workers[i].victims = malloc(sizeof(uint) * worker_count);
+                if (!scheduler->workers[i].victims) {
+                        tile_error("out of memory");
+                }
+                order_victims(scheduler->workers, worker_count, i);
+        }
+
+        pthread_barrier_init(&scheduler->start, NULL, worker_count + 1);
+        pthread_barrier_init(&scheduler->filled, NULL, worker_count);
+        pthread_barrier_init(&scheduler->done, NULL, worker_count + 1);
+
+        for (uint i = 0; i < worker_count; i++) {
+                if (pthread_create(&scheduler->workers[i].thread, NULL, worker_thread,
+                                   &scheduler->workers[i])) {
+                        tile_error("pthread_create failed");
+                }
+        }
+}
+
+void
+render_tiles(struct tile_scheduler* const scheduler, struct tile_stats* const stats)
+{
+        plan_tiles(scheduler);
+
+        for (uint i = 0; i < scheduler->worker_count; i++) {
+                scheduler->workers[i].steals = 0;
+                scheduler->workers[i].busy = 0.;
+        }
+
+        pthread_barrier_wait(&scheduler->start);
+        pthread_barrier_wait(&scheduler->done);
+
+        stats->tiles = scheduler->tile_count;
+        stats->splits = scheduler->splits;
+        stats->nodes = scheduler->nodes;
+        stats->steals = 0;
+        stats->busy = 0.;
+        stats->slowest = 0.;
+        for (uint i = 0; i < scheduler->worker_count; i++) {
+                struct tile_worker const* worker = &scheduler->workers[i];
+                stats->steals += worker->steals;
+                stats->busy += worker->busy;
+                if (worker->busy > stats->slowest) {
+                        stats->slowest = worker->busy;
+                }
+        }
+}
+
+void
+delete_tile_scheduler(struct tile_scheduler* const scheduler)
+{
+        scheduler->quit = 1;
+        pthread_barrier_wait(&scheduler->start);
+
+        for (uint i = 0; i < scheduler->worker_count; i++) {
+                pthread_join(scheduler->workers[i].thread, NULL);
+                free(scheduler->workers[i].victims);
+        }
+
+        pthread_barrier_destroy(&scheduler->start);
+        pthread_barrier_destroy(&scheduler->filled);
+        pthread_barrier_destroy(&scheduler->done);
+
+        free(scheduler->workers);
+        free(scheduler->tiles);
+        free(scheduler->costs);
+}
@@ -0,0 +1,95 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Work stealing tile scheduler for rendering frames on the CPU. Every worker
+// is pinned to a core and owns a deque of tiles: it pops its own from the
+// bottom, and once they run out steals from the top of the others, those on
+// its NUMA node first.
+//
+// The cost of every tile is measured and kept per cell of MIN_TILE_SIZE
+// pixels. Before a frame, the TILE_SIZE tiles whose cells took longest in
+// the last frame are split into quadrants until none is estimated above its
+// share of the work, and the tiles are dealt out most expensive first.
+#define TILE_SIZE               64
+#define MIN_TILE_SIZE           8
+
+// Tiles per worker the split aims for, the finer the better the balance and
+// the higher the scheduling overhead
+#define TILES_PER_WORKER        8
+
+#define MAX_TILE_WORKERS        256
+
+struct tile {
+        int     x, y;
+        int     width, height;  // clipped to the frame
+        int     size;           // before clipping
+        float   cost;           // estimate from the last frame, in seconds
+};
+
+struct tile_scheduler;
+
+// Called by the workers for every tile, concurrently
+typedef void    (*tile_function)(void* context, struct tile const* tile);
+
+// Chase-Lev deque. Only the owner fills it, between frames, so it never
+// grows.
+struct tile_deque {
+        _Alignas(64) atomic_long        top;
+        _Alignas(64) atomic_long        bottom;
+        struct tile*                    tiles;
+};
+
+struct tile_worker {
+        struct tile_deque       deque;
+        struct tile_scheduler*  scheduler;
+        pthread_t               thread;
+        unsigned int            index;
+        int                     cpu;            // -1 when not pinned
+        unsigned int            node;
+        unsigned int*           victims;        // the other workers, nearest first
+
+        // Of the last frame
+        unsigned int            steals;
+        double                  busy;           // seconds spent in tiles
+};
+
+struct tile_stats {
+        unsigned int    tiles;
+        unsigned int    splits;
+        unsigned int    steals;
+        unsigned int    nodes;
+        double          busy;           // seconds, summed over the workers
+        double          slowest;        // busy seconds of the busiest worker
+};
+
+struct tile_scheduler {
+        int                     size[2];
+        tile_function           function;
+        void*                   context;
+
+        unsigned int            worker_count;
+        struct tile_worker*     workers;
+        pthread_barrier_t       start, filled, done;
+        int                     quit;
+
+        // Seconds per MIN_TILE_SIZE cell in the last frame
+        int                     cells[2];
+        float*                  costs;
+
+        // Of the next frame, most expensive first
+        struct tile*            tiles;
+        unsigned int            tile_count;
+        unsigned int            splits;
+        unsigned int            nodes;
+};
+
+// worker_count 0 starts a worker per core the process may run on
+void    create_tile_scheduler(struct tile_scheduler* const scheduler, int const* const size,
+                              unsigned int worker_count, tile_function function, void* context);
+void    render_tiles(struct tile_scheduler* const scheduler, struct tile_stats* const stats);
+void    delete_tile_scheduler(struct tile_scheduler* const scheduler);
+
+#endif
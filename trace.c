@@ -0,0 +1,322 @@
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef unsigned int            uint;
+
+struct trace_event {
+        char const*     name;
+        uint64_t        start;          // nanoseconds on the CPU clock
+        uint64_t        duration;
+};
+
+// Written only by its thread. count is published with release semantics
+// after each event, so a dump from another thread reads complete events.
+struct trace_buffer {
+        struct trace_buffer*    next;
+        char const*             name;
+        uint                    tid;
+        _Atomic uint64_t        count;
+        uint                    depth;
+        char const*             open_names[TRACE_DEPTH];
+        uint64_t                open_starts[TRACE_DEPTH];
+        struct trace_event      events[TRACE_EVENTS];
+};
+
+// GPU timer pair, both timestamps are written by the GPU
+struct gpu_timer {
+        GLuint          queries[2];
+        char const*     name;
+        int             pending;
+};
+
+// Buffers are only ever pushed, never removed, until shutdown
+static _Atomic(struct trace_buffer*) buffers;
+static atomic_uint next_tid = 1;
+static _Thread_local struct trace_buffer* thread_buffer;
+
+// GPU events live in their own buffer, drawn as a separate track
+static struct trace_buffer* gpu_buffer;
+static struct gpu_timer gpu_timers[TRACE_GPU_QUERIES];
+static uint gpu_next, gpu_open = TRACE_GPU_QUERIES;
+static int64_t gpu_offset;
+
+static uint64_t
+now(void)
+{
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+
+        return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+static struct trace_buffer*
+create_buffer(char const* name)
+{
+        struct trace_buffer* buffer = calloc(1, sizeof(*buffer));
+        if (!buffer) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the trace buffer\n");
+                exit(EXIT_FAILURE);
+        }
+
+        buffer->name = name;
+        buffer->tid = atomic_fetch_add(&next_tid, 1);
+
+        buffer->next = atomic_load(&buffers);
+        while (!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer)) {
+        }
+
+        return buffer;
+}
+
+static struct trace_buffer*
+get_buffer(void)
+{
+        if (!thread_buffer) {
+                thread_buffer = create_buffer(NULL);
+        }
+
+        return thread_buffer;
+}
+
+static void
+record(struct trace_buffer* const buffer, char const* name, uint64_t start, uint64_t duration)
+{
+        uint64_t count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+        struct trace_event* event = &buffer->events[count % TRACE_EVENTS];
+
+        event->name = name;
+        event->start = start;
+        event->duration = duration;
+
+        atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+void
+trace_thread_name(char const* name)
+{
+        get_buffer()->name = name;
+}
+
+void
+trace_begin(char const* name)
+{
+        struct trace_buffer* buffer = get_buffer();
+
+        if (buffer->depth < TRACE_DEPTH) {
+                buffer->open_names[buffer->depth] = name;
+                buffer->open_starts[buffer->depth] = now();
+        }
+        buffer->depth++;
+}
+
+void
+trace_end(void)
+{
+        struct trace_buffer* buffer = get_buffer();
+        uint64_t end = now();
+
+        if (!buffer->depth) {
+                return;
+        }
+
+        buffer->depth--;
+        if (buffer->depth < TRACE_DEPTH) {
+                uint64_t start = buffer->open_starts[buffer->depth];
+                record(buffer, buffer->open_names[buffer->depth], start, end - start);
+        }
+}
+
+void
+trace_gpu_init(void)
+{
+        gpu_buffer = create_buffer("GPU");
+
+        for (uint i = 0; i < TRACE_GPU_QUERIES; i++) {
+                glGenQueries(2, gpu_timers[i].queries);
+        }
+
+        // GPU timestamps count from an unrelated origin, line them up with
+        // the CPU clock once. Drift over a session is far below a frame.
+        GLint64 gpu_time;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_time);
+        gpu_offset = (int64_t)now() - (int64_t)gpu_time;
+}
+
+// Records a finished timer, or leaves it pending unless told to wait
+static void
+read_timer(struct gpu_timer* const timer, int wait)
+{
+        GLuint available = GL_TRUE;
+        if (!wait) {
+                glGetQueryObjectuiv(timer->queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        }
+        if (!available) {
+                return;
+        }
+
+        GLuint64 start, end;
+        glGetQueryObjectui64v(timer->queries[0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(timer->queries[1], GL_QUERY_RESULT, &end);
+
+        record(gpu_buffer, timer->name, (uint64_t)((int64_t)start + gpu_offset), end - start);
+        timer->pending = 0;
+}
+
+void
+trace_gpu_begin(char const* name)
+{
+        if (!gpu_buffer || gpu_open != TRACE_GPU_QUERIES) {
+                return;
+        }
+
+        // The oldest timer is reused, it was issued TRACE_GPU_QUERIES scopes ago
+        struct gpu_timer* timer = &gpu_timers[gpu_next];
+        if (timer->pending) {
+                read_timer(timer, 1);
+        }
+
+        timer->name = name;
+        glQueryCounter(timer->queries[0], GL_TIMESTAMP);
+
+        gpu_open = gpu_next;
+        gpu_next = (gpu_next + 1) % TRACE_GPU_QUERIES;
+}
+
+void
+trace_gpu_end(void)
+{
+        if (gpu_open == TRACE_GPU_QUERIES) {
+                return;
+        }
+
+        glQueryCounter(gpu_timers[gpu_open].queries[1], GL_TIMESTAMP);
+        gpu_timers[gpu_open].pending = 1;
+        gpu_open = TRACE_GPU_QUERIES;
+}
+
+void
+trace_gpu_collect(int wait)
+{
+        if (!gpu_buffer) {
+                return;
+        }
+
+        for (uint i = 0; i < TRACE_GPU_QUERIES; i++) {
+                if (gpu_timers[i].pending) {
+                        read_timer(&gpu_timers[i], wait);
+                }
+        }
+}
+
+static void
+write_string(FILE* file, char const* text)
+{
+        fputc('"', file);
+        for (; *text; text++) {
+                if (*text == '"' || *text == '\\') {
+                        fputc('\\', file);
+                }
+                fputc(*text, file);
+        }
+        fputc('"', file);
+}
+
+void
+trace_dump(char const* path)
+{
+        TRACE_SCOPE("trace_dump");
+
+        FILE* file = fopen(path, "w");
+        if (!file) {
+                fprintf(stderr, "ERROR: Could not create trace file: %s\n", path);
+                return;
+        }
+
+        struct trace_event* events = malloc(sizeof(*events) * TRACE_EVENTS);
+        if (!events) {
+                fprintf(stderr, "ERROR: Could not alocate memory for the trace dump\n");
+                fclose(file);
+                return;
+        }
+
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        int first = 1;
+
+        for (struct trace_buffer* buffer = atomic_load(&buffers); buffer; buffer = buffer->next) {
+                // The next event goes into the slot of the oldest, which its
+                // thread may be writing over already
+                uint64_t count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+                uint64_t begin = count >= TRACE_EVENTS ? count - TRACE_EVENTS + 1 : 0;
+
+                for (uint64_t i = begin; i < count; i++) {
+                        events[i % TRACE_EVENTS] = buffer->events[i % TRACE_EVENTS];
+                }
+
+                // Slots the thread reached during the copy may be torn, only
+                // those still behind it are kept
+                atomic_thread_fence(memory_order_acquire);
+                uint64_t after = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+                if (after >= TRACE_EVENTS && after - TRACE_EVENTS + 1 > begin) {
+                        begin = after - TRACE_EVENTS + 1 < count ? after - TRACE_EVENTS + 1 : count;
+                }
+
+                if (buffer->name) {
+                        fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,"
+                                "\"args\":{\"name\":", first ? "" : ",\n", buffer->tid);
+                        write_string(file, buffer->name);
+                        fprintf(file, "}}");
+                        first = 0;
+                }
+
+                for (uint64_t i = begin; i < count; i++) {
+                        struct trace_event const* event = &events[i % TRACE_EVENTS];
+
+                        fprintf(file, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+                                first ? "" : ",\n", buffer->tid, (double)event->start / 1000.0,
+                                (double)event->duration / 1000.0);
+                        write_string(file, event->name);
+                        fputc('}', file);
+                        first = 0;
+                }
+        }
+
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        free(events);
+
+        printf("Trace written to %s\n", path);
+}
+
+// Called on the thread owning the GL context, before it is released
+void
+trace_gpu_shutdown(void)
+{
+        if (!gpu_buffer) {
+                return;
+        }
+
+        for (uint i = 0; i < TRACE_GPU_QUERIES; i++) {
+                glDeleteQueries(2, gpu_timers[i].queries);
+        }
+        gpu_open = TRACE_GPU_QUERIES;
+}
+
+// Called once every other thread has stopped tracing
+void
+trace_shutdown(void)
+{
+        struct trace_buffer* buffer = atomic_exchange(&buffers, NULL);
+        while (buffer) {
+                struct trace_buffer* next = buffer->next;
+                free(buffer);
+                buffer = next;
+        }
+
+        thread_buffer = NULL;
+        gpu_buffer = NULL;
+}
@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glad/glad.h>
+
+// Scoped CPU and GPU timing, dumped as Chrome trace JSON that loads in
+// chrome://tracing and ui.perfetto.dev. Every thread records into its own
+// buffer without locks, event names must be string literals.
+#define TRACE_FILE              "trace.json"
+
+// Events kept per thread, the oldest are overwritten
+#define TRACE_EVENTS            65536
+#define TRACE_DEPTH             32
+
+// GPU timer pairs in flight, read back a few frames after they were issued
+#define TRACE_GPU_QUERIES       64
+
+void    trace_thread_name(char const* name);
+void    trace_begin(char const* name);
+void    trace_end(void);
+void    trace_gpu_init(void);
+void    trace_gpu_begin(char const* name);
+void    trace_gpu_end(void);
+void    trace_gpu_collect(int wait);
+void    trace_gpu_shutdown(void);
+void    trace_dump(char const* path);
+void    trace_shutdown(void);
+
+static inline void
+trace_scope_end(int* scope)
+{
+        (void)scope;
+        trace_end();
+}
+
+#define TRACE_CONCAT_(a, b)     a##b
+#define TRACE_CONCAT(a, b)      TRACE_CONCAT_(a, b)
+
+// Traces from here to the end of the enclosing block
+#define TRACE_SCOPE(name)                                                               \
+        int TRACE_CONCAT(trace_scope_, __LINE__) __attribute__((cleanup(trace_scope_end))) = \
+                (trace_begin(name), 0)
+
+#endif
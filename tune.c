@@ -0,0 +1,207 @@
+#include "tune.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned int            uint;
+typedef unsigned long int       ulint;
+typedef unsigned char           uchar;
+
+// The last value of every ladder is the reference, at or above the ultra
+// preset. The shadow softness is the penumbra width, narrower ones leave
+// the shadow march earlier.
+struct tune_parameter const tune_parameters[TUNE_PARAMETERS] = {
+        { "MAX_MARCHING_STEPS", "%.0f.", 11,
+          { 32.f, 48.f, 64.f, 96.f, 128.f, 160.f, 200.f, 256.f, 320.f, 400.f, 512.f } },
+        { "PRECISION", "%g", 7, { .02f, .01f, .0075f, .005f, .0025f, .001f, .0005f } },
+        { "SHADOW_STEPS", "%.0f", 12,
+          { 16.f, 24.f, 32.f, 48.f, 64.f, 96.f, 128.f, 192.f, 256.f, 384.f, 512.f, 768.f } },
+        { "SHADOW_SOFTNESS", "%g", 5, { .1f, .15f, .2f, .25f, .3f } },
+        { "AO_SAMPLES", "%.0f", 9, { 2.f, 3.f, 4.f, 5.f, 6.f, 8.f, 10.f, 12.f, 16.f } },
+        { "FBM_OCTAVES", "%.0f", 6, { 2.f, 3.f, 4.f, 5.f, 6.f, 7.f } },
+        { "HEIGHTFIELD_STEPS", "%.0f", 8, { 32.f, 48.f, 64.f, 96.f, 128.f, 160.f, 192.f, 256.f } },
+};
+
+// Not tuned, it decides what is in view rather than how well it is drawn
+static char const fixed_defines[] = "#define MAX_DEPTH 100.\n";
+
+void
+start_tune_search(struct tune_search* const search, double threshold)
+{
+        for (uint i = 0; i < TUNE_PARAMETERS; i++) {
+                search->rungs[i] = tune_parameters[i].count - 1;
+        }
+        search->parameter = 0;
+        search->best = TUNE_PARAMETERS;
+        search->time = 0.;
+        search->psnr = TUNE_PSNR_MAX;
+        search->threshold = threshold;
+}
+
+// Fills in the settings to try next, 0 once the search is over
+int
+next_tune_candidate(struct tune_search* const search, uint* const rungs)
+{
+        for (;;) {
+                while (search->parameter < TUNE_PARAMETERS && !search->rungs[search->parameter]) {
+                        search->parameter++;
+                }
+                if (search->parameter < TUNE_PARAMETERS) {
+                        break;
+                }
+
+                // End of a round, take its best step and start over
+                if (search->best == TUNE_PARAMETERS) {
+                        return 0;
+                }
+                search->rungs[search->best]--;
+                search->time = search->best_time;
+                search->psnr = search->best_psnr;
+                search->best = TUNE_PARAMETERS;
+                search->parameter = 0;
+        }
+
+        memcpy(rungs, search->rungs, sizeof(search->rungs));
+        rungs[search->parameter]--;
+
+        return 1;
+}
+
+// A step has to be faster than the settings it leaves, the reference in the
+// first round
+void
+report_tune_candidate(struct tune_search* const search, double time, double psnr)
+{
+        if (psnr >= search->threshold && time < search->time &&
+            (search->best == TUNE_PARAMETERS || time < search->best_time)) {
+                search->best = search->parameter;
+                search->best_time = time;
+                search->best_psnr = psnr;
+        }
+        search->parameter++;
+}
+
+void
+tune_defines(uint const* const rungs, char* const defines, ulint size)
+{
+        ulint length = (ulint)snprintf(defines, size, "%s", fixed_defines);
+
+        for (uint i = 0; i < TUNE_PARAMETERS && length < size; i++) {
+                struct tune_parameter const* parameter = &tune_parameters[i];
+                length += (ulint)snprintf(defines + length, size - length, "#define %s ",
+                                          parameter->name);
+                if (length < size) {
+                        length += (ulint)snprintf(defines + length, size - length, parameter->format,
+                                                  (double)parameter->values[rungs[i]]);
+                }
+                if (length < size) {
+                        length += (ulint)snprintf(defines + length, size - length, "\n");
+                }
+        }
+}
+
+// Over the 8 bit colour channels of RGBA pixels, the alpha is always opaque
+// and would only dilute the error
+double
+image_psnr(uchar const* a, uchar const* b, ulint length)
+{
+        double error = 0.;
+        ulint samples = 0;
+        for (ulint i = 0; i < length; i++) {
+                if (i % 4 == 3) {
+                        continue;
+                }
+                double difference = (double)a[i] - (double)b[i];
+                error += difference * difference;
+                samples++;
+        }
+        if (error == 0.) {
+                return TUNE_PSNR_MAX;
+        }
+
+        double psnr = 10. * log10(255. * 255. * (double)samples / error);
+        return psnr < TUNE_PSNR_MAX ? psnr : TUNE_PSNR_MAX;
+}
+
+void
+create_tune_target(struct tune_target* const target, int const* const size)
+{
+        target->size[0] = size[0];
+        target->size[1] = size[1];
+
+        glGenFramebuffers(1, &target->framebuffer);
+        glGenTextures(1, &target->texture);
+
+        glBindTexture(GL_TEXTURE_2D, target->texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, size[0], size[1]);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               target->texture, 0);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                fprintf(stderr, "ERROR: The tuning framebuffer is incomplete\n");
+                exit(EXIT_FAILURE);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// RGBA, size[0] * size[1] * 4 bytes
+void
+read_tune_target(struct tune_target const* const target, uchar* const pixels)
+{
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target->framebuffer);
+        glReadPixels(0, 0, target->size[0], target->size[1], GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void
+delete_tune_target(struct tune_target* const target)
+{
+        glDeleteFramebuffers(1, &target->framebuffer);
+        glDeleteTextures(1, &target->texture);
+}
+
+void
+write_tuned(char const* path, struct tune_search const* search, char const* renderer)
+{
+        FILE* file = fopen(path, "w");
+        if (!file) {
+                fprintf(stderr, "ERROR: Could not create file: %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        char defines[512];
+        tune_defines(search->rungs, defines, sizeof(defines));
+
+        fprintf(file, "// %s, %.2f ms, %.1f dB\n%s", renderer, search->time, search->psnr, defines);
+        fclose(file);
+}
+
+// Read back to replace a preset, see -q
+char*
+load_tuned(char const* path)
+{
+        FILE* file = fopen(path, "rb");
+        if (!file) {
+                fprintf(stderr, "ERROR: Could not open file: %s, does it exist?\n", path);
+                exit(EXIT_FAILURE);
+        }
+
+        fseek(file, 0, SEEK_END);
+        ulint length = (ulint)ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        char* defines = malloc(length + 1);
+        if (!defines || fread(defines, 1, length, file) != length) {
+                fprintf(stderr, "ERROR: Could not read the tuned settings %s\n", path);
+                exit(EXIT_FAILURE);
+        }
+        defines[length] = '\0';
+        fclose(file);
+
+        return defines;
+}
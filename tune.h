@@ -0,0 +1,63 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <glad/glad.h>
+
+// Offline search for the cheapest quality settings that still look like a
+// reference drawn with all of them at their highest. Starting from the
+// reference, every round tries one step down the ladder of each parameter,
+// draws the frames with it and keeps the fastest step whose PSNR against
+// the reference stays above the threshold. The search ends when no step
+// does. The result is a preset for the GPU it ran on, written as defines.
+#define TUNE_PARAMETERS         7
+#define TUNE_MAX_VALUES         12
+
+// Frames taken evenly from a recording, and draws of each, the fastest counts
+#define TUNE_FRAMES             4
+#define TUNE_REPEATS            5
+
+// Identical images
+#define TUNE_PSNR_MAX           99.
+
+#define TUNE_FILE               "tuned.glsl"
+
+struct tune_parameter {
+        char const*     name;
+        char const*     format;
+        unsigned int    count;
+        float           values[TUNE_MAX_VALUES];        // cheapest first
+};
+
+struct tune_search {
+        unsigned int    rungs[TUNE_PARAMETERS];         // accepted, into the values
+        unsigned int    parameter;                      // stepped down by the candidate
+        unsigned int    best;                           // of this round, or TUNE_PARAMETERS
+        double          best_time;
+        double          best_psnr;
+        double          time;                           // of the accepted settings
+        double          psnr;
+        double          threshold;
+};
+
+// Offscreen colour target, read back after every frame
+struct tune_target {
+        GLuint          framebuffer;
+        GLuint          texture;
+        int             size[2];
+};
+
+extern struct tune_parameter const tune_parameters[TUNE_PARAMETERS];
+
+void    start_tune_search(struct tune_search* const search, double threshold);
+int     next_tune_candidate(struct tune_search* const search, unsigned int* const rungs);
+void    report_tune_candidate(struct tune_search* const search, double time, double psnr);
+void    tune_defines(unsigned int const* const rungs, char* const defines, unsigned long size);
+// Of length bytes of RGBA pixels, over their colour
+double  image_psnr(unsigned char const* a, unsigned char const* b, unsigned long length);
+void    create_tune_target(struct tune_target* const target, int const* const size);
+void    read_tune_target(struct tune_target const* const target, unsigned char* const pixels);
+void    delete_tune_target(struct tune_target* const target);
+void    write_tuned(char const* path, struct tune_search const* search, char const* renderer);
+char*   load_tuned(char const* path);
+
+#endif
@@ -0,0 +1,243 @@
+#include "views.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef unsigned int            uint;
+
+unsigned int const view_counts[VIEW_MODES] = { 1, 2, 4, 6 };
+
+char const* const view_names[VIEW_MODES] = {
+        "single", "stereo", "quad", "cube"
+};
+
+// Columns and rows of the layers on screen
+static int const view_grids[VIEW_MODES][2] = {
+        { 1, 1 }, { 2, 1 }, { 2, 2 }, { 3, 2 }
+};
+
+// Cube faces, +X -X +Y -Y +Z -Z, upright for display rather than in the GL
+// cube map orientation
+static float const cube_directions[6][3] = {
+        { 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f },
+        { 0.f, -1.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f }
+};
+
+static float const cube_ups[6][3] = {
+        { 0.f, 1.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f },
+        { 0.f, 0.f, -1.f }, { 0.f, 1.f, 0.f }, { 0.f, 1.f, 0.f }
+};
+
+// The main camera looks at a point this far below and in front of it
+static float const camera_target[3] = { 0.f, -1.f, -3.f };
+
+static void
+normalize(float* const vector)
+{
+        float length = sqrtf(vector[0] * vector[0] + vector[1] * vector[1] + vector[2] * vector[2]);
+        for (uint axis = 0; axis < 3; axis++) {
+                vector[axis] /= length;
+        }
+}
+
+static void
+cross(float const* const a, float const* const b, float* const result)
+{
+        result[0] = a[1] * b[2] - a[2] * b[1];
+        result[1] = a[2] * b[0] - a[0] * b[2];
+        result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Turns a vector by the yaw and pitch of the mouse, v * rotateY(yaw) *
+// rotateX(pitch) as the shader used to turn every ray
+static void
+turn(float* const vector, float const* const mouse_look)
+{
+        float c = cosf(mouse_look[0]), s = sinf(mouse_look[0]);
+        float x = c * vector[0] + s * vector[2];
+        float z = c * vector[2] - s * vector[0];
+        vector[0] = x;
+        vector[2] = z;
+
+        c = cosf(mouse_look[1]);
+        s = sinf(mouse_look[1]);
+        float y = c * vector[1] - s * vector[2];
+        z = s * vector[1] + c * vector[2];
+        vector[1] = y;
+        vector[2] = z;
+}
+
+// Same basis as camera() used to build in the shader. Views that follow the
+// camera also turn with the mouse, when mouse_look is given.
+static void
+look(struct view* const view, float const* const origin, float const* const direction,
+     float const* const up, float focal_length, float const* const mouse_look)
+{
+        for (uint axis = 0; axis < 3; axis++) {
+                view->origin[axis] = origin[axis];
+                view->forward[axis] = direction[axis];
+        }
+        normalize(view->forward);
+
+        cross(view->forward, up, view->right);
+        normalize(view->right);
+        cross(view->right, view->forward, view->up);
+
+        if (mouse_look) {
+                turn(view->right, mouse_look);
+                turn(view->up, mouse_look);
+                turn(view->forward, mouse_look);
+        }
+
+        view->origin[3] = 0.f;
+        view->right[3] = 0.f;
+        view->up[3] = 0.f;
+        view->forward[3] = focal_length;
+}
+
+// Looks from target + offset back at target
+static void
+look_at(struct view* const view, float const* const target, float const* const offset,
+        float const* const up)
+{
+        float origin[3], direction[3];
+        for (uint axis = 0; axis < 3; axis++) {
+                origin[axis] = target[axis] + offset[axis];
+                direction[axis] = -offset[axis];
+        }
+
+        look(view, origin, direction, up, VIEW_FOCAL_LENGTH, NULL);
+}
+
+void
+setup_views(struct view* const views, uint mode, float const* const camera,
+            float const* const mouse_look)
+{
+        static float const y_up[3] = { 0.f, 1.f, 0.f };
+        static float const z_back[3] = { 0.f, 0.f, -1.f };
+
+        float target[3];
+        for (uint axis = 0; axis < 3; axis++) {
+                target[axis] = camera[axis] + camera_target[axis];
+        }
+
+        look(&views[0], camera, camera_target, y_up, VIEW_FOCAL_LENGTH, mouse_look);
+
+        if (mode == VIEWS_STEREO) {
+                // Left eye first
+                views[1] = views[0];
+                for (uint axis = 0; axis < 3; axis++) {
+                        float offset = views[0].right[axis] * STEREO_SEPARATION * .5f;
+                        views[0].origin[axis] -= offset;
+                        views[1].origin[axis] += offset;
+                }
+        } else if (mode == VIEWS_QUAD) {
+                // The camera, then its target from above, the side and the front
+                static float const above[3] = { 0.f, 8.f, 0.f };
+                static float const side[3] = { 6.f, 2.f, 0.f };
+                static float const front[3] = { 0.f, 2.f, -6.f };
+
+                look_at(&views[1], target, above, z_back);
+                look_at(&views[2], target, side, y_up);
+                look_at(&views[3], target, front, y_up);
+        } else if (mode == VIEWS_CUBE) {
+                for (uint face = 0; face < 6; face++) {
+                        look(&views[face], camera, cube_directions[face], cube_ups[face], 1.f,
+                             mouse_look);
+                }
+        }
+}
+
+void
+create_view_targets(struct view_targets* const targets)
+{
+        glGenFramebuffers(1, &targets->framebuffer);
+        glGenTextures(1, &targets->texture);
+        glGenTextures(1, &targets->depth);
+        glGenBuffers(1, &targets->buffer);
+
+        targets->mode = VIEWS_SINGLE;
+        targets->size[0] = 0;
+        targets->size[1] = 0;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, targets->buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(struct view) * MAX_VIEWS, NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, VIEWS_BINDING, targets->buffer);
+}
+
+void
+view_grid(uint mode, int* const grid)
+{
+        grid[0] = view_grids[mode][0];
+        grid[1] = view_grids[mode][1];
+}
+
+// Layers tile the window, cube faces stay square
+void
+resize_view_targets(struct view_targets* const targets, uint mode, int const* const framebuffer)
+{
+        int size[2] = {
+                framebuffer[0] / view_grids[mode][0],
+                framebuffer[1] / view_grids[mode][1]
+        };
+        if (mode == VIEWS_CUBE) {
+                size[0] = size[1] = size[0] < size[1] ? size[0] : size[1];
+        }
+
+        if (mode == VIEWS_SINGLE || (mode == targets->mode && size[0] == targets->size[0] &&
+                                     size[1] == targets->size[1])) {
+                return;
+        }
+        targets->mode = mode;
+        targets->size[0] = size[0];
+        targets->size[1] = size[1];
+
+        // Immutable storage, so a new size needs a new texture
+        glDeleteTextures(1, &targets->texture);
+        glDeleteTextures(1, &targets->depth);
+        glGenTextures(1, &targets->texture);
+        glGenTextures(1, &targets->depth);
+
+        glActiveTexture(GL_TEXTURE0 + VIEWS_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, targets->texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, size[0] < 1 ? 1 : size[0],
+                       size[1] < 1 ? 1 : size[1], (GLsizei)view_counts[mode]);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, targets->depth);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, size[0] < 1 ? 1 : size[0],
+                       size[1] < 1 ? 1 : size[1], (GLsizei)view_counts[mode]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, targets->texture);
+
+        // Attaching the whole array makes the framebuffer layered
+        glBindFramebuffer(GL_FRAMEBUFFER, targets->framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, targets->texture, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targets->depth, 0);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                fprintf(stderr, "ERROR: The layered view framebuffer is incomplete\n");
+                exit(EXIT_FAILURE);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void
+upload_views(struct view_targets const* const targets, struct view const* const views, uint count)
+{
+        glBindBuffer(GL_UNIFORM_BUFFER, targets->buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, (GLsizeiptr)(sizeof(*views) * count), views);
+}
+
+void
+delete_view_targets(struct view_targets* const targets)
+{
+        glDeleteFramebuffers(1, &targets->framebuffer);
+        glDeleteTextures(1, &targets->texture);
+        glDeleteTextures(1, &targets->depth);
+        glDeleteBuffers(1, &targets->buffer);
+}
@@ -0,0 +1,62 @@
+#ifndef VIEWS_H
+#define VIEWS_H
+
+#include <glad/glad.h>
+
+// Several cameras rendered in one draw. Every view is a layer of a texture
+// array, the geometry shader instances the quad once per layer and the
+// present pass tiles the layers over the window.
+#define MAX_VIEWS               6
+
+#define VIEWS_SINGLE            0
+#define VIEWS_STEREO            1
+#define VIEWS_QUAD              2
+#define VIEWS_CUBE              3
+#define VIEW_MODES              4
+
+// Matching the Views block in shaders/fragment_shader.glsl and the sampler
+// in shaders/present_shader.glsl
+#define VIEWS_BINDING           0
+#define VIEWS_UNIT              6
+
+// Distance between the eyes of the stereo pair
+#define STEREO_SEPARATION       .1f
+
+// Image plane distance, 1.5 is the main camera, 1 gives the 90 degree cube
+// map faces
+#define VIEW_FOCAL_LENGTH       1.5f
+
+// Camera laid out as std140, every vector padded to a vec4. The ray through
+// image plane point uv is uv.x * right + uv.y * up + forward.w * forward, the
+// mouse look is already applied to the basis.
+struct view {
+        float   origin[4];
+        float   right[4];
+        float   up[4];
+        float   forward[4];
+};
+
+// Render targets for the layered pass, GL objects of the render thread
+struct view_targets {
+        GLuint          framebuffer;
+        GLuint          texture;
+        GLuint          depth;          // for the proxy pass
+        GLuint          buffer;
+        unsigned int    mode;
+        int             size[2];        // per layer, 0 until first resized
+};
+
+extern unsigned int const view_counts[VIEW_MODES];
+extern char const* const view_names[VIEW_MODES];
+
+void    setup_views(struct view* const views, unsigned int mode, float const* const camera,
+                    float const* const mouse_look);
+void    create_view_targets(struct view_targets* const targets);
+void    resize_view_targets(struct view_targets* const targets, unsigned int mode,
+                            int const* const framebuffer);
+void    upload_views(struct view_targets const* const targets, struct view const* const views,
+                     unsigned int count);
+void    view_grid(unsigned int mode, int* const grid);
+void    delete_view_targets(struct view_targets* const targets);
+
+#endif
@@ -0,0 +1,109 @@
+#include "volume.h"
+
+#include <glad/glad.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void
+volume_error(char const* path, char const* error)
+{
+        fprintf(stderr, "ERROR: Could not load volume %s: %s\n", path, error);
+        exit(EXIT_FAILURE);
+}
+
+void
+map_volume(struct volume* const volume, char const* path)
+{
+        int file = open(path, O_RDONLY);
+        if (file < 0) {
+                volume_error(path, "could not open the file");
+        }
+
+        struct stat info;
+        if (fstat(file, &info) || (uint64_t)info.st_size < sizeof(struct volume_header)) {
+                volume_error(path, "the file is too short");
+        }
+
+        // The samples are read straight out of the page cache, nothing is
+        // copied until the driver takes them
+        void* map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if (map == MAP_FAILED) {
+                volume_error(path, "could not map the file");
+        }
+
+        struct volume_header const* header = map;
+
+        if (memcmp(header->magic, VOLUME_MAGIC, sizeof(header->magic))) {
+                volume_error(path, "not a volume file");
+        }
+        if (header->version != VOLUME_VERSION) {
+                volume_error(path, "unsupported version");
+        }
+        for (uint32_t axis = 0; axis < 3; axis++) {
+                if (header->dims[axis] < 2 || header->dims[axis] > MAX_VOLUME_RESOLUTION) {
+                        volume_error(path, "bad dimensions");
+                }
+        }
+
+        uint64_t samples = (uint64_t)header->dims[0] * header->dims[1] * header->dims[2];
+        if (header->data_offset % sizeof(float) || header->data_size != samples * sizeof(float) ||
+            header->data_offset + header->data_size > (uint64_t)info.st_size) {
+                volume_error(path, "truncated sample data");
+        }
+
+        // The whole file is uploaded right away, start reading it in
+        madvise(map, (size_t)info.st_size, MADV_WILLNEED);
+
+        volume->map = map;
+        volume->map_size = (uint64_t)info.st_size;
+        volume->header = header;
+        volume->data = (float const*)((char const*)map + header->data_offset);
+}
+
+void
+unmap_volume(struct volume* const volume)
+{
+        if (volume->map) {
+                munmap(volume->map, (size_t)volume->map_size);
+        }
+
+        volume->map = NULL;
+        volume->header = NULL;
+        volume->data = NULL;
+}
+
+void
+create_volume_texture(unsigned int* const texture, struct volume const* const volume)
+{
+        uint32_t const* dims = volume->header->dims;
+
+        glGenTextures(1, texture);
+
+        // Trilinear filtering interpolates the distances between samples,
+        // outside the volume the shader falls back to the bounding box
+        glActiveTexture(GL_TEXTURE0 + VOLUME_UNIT);
+        glBindTexture(GL_TEXTURE_3D, *texture);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, (GLsizei)dims[0], (GLsizei)dims[1],
+                     (GLsizei)dims[2], 0, GL_RED, GL_FLOAT, volume->data);
+
+        glActiveTexture(GL_TEXTURE0);
+}
+
+void
+delete_volume_texture(unsigned int const* const texture)
+{
+        glDeleteTextures(1, texture);
+}
@@ -0,0 +1,73 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <stdint.h>
+
+// Signed distance volumes written by mesh2sdf and sampled by
+// shaders/volume.glsl. The file is a header followed by dims[0] * dims[1] *
+// dims[2] little endian floats, x fastest, starting at data_offset. It is
+// mapped as is, so the layout must not depend on the compiler.
+#define VOLUME_MAGIC            "RMSDFVOL"
+#define VOLUME_VERSION          1
+#define VOLUME_DATA_ALIGNMENT   64
+
+// Largest side accepted, 512^3 floats is already half a gigabyte
+#define MAX_VOLUME_RESOLUTION   512
+
+// Texture unit, matching the binding qualifier in shaders/volume.glsl
+#define VOLUME_UNIT             2
+
+struct volume_header {
+        char            magic[8];
+        uint32_t        version;
+        uint32_t        dims[3];
+        float           min[3];         // position of the first sample
+        float           voxel_size;     // distance between samples
+        uint64_t        data_offset;
+        uint64_t        data_size;
+};
+
+// Bricked volumes for data that does not fit in memory, streamed by
+// stream.c. The samples are cut into bricks of BRICK_SIZE^3 cells that each
+// store their (BRICK_SIZE + 1)^3 corner samples, so neighbours share a face
+// and every brick interpolates on its own. The file holds, in order:
+// - the header,
+// - the coarse level, one sample per brick corner, (counts + 1)^3 floats,
+// - the brick table, one uint64_t file offset per brick, BRICK_EMPTY for
+//   bricks far enough from the surface for the coarse level to stand in,
+// - the stored bricks, BRICK_SAMPLES^3 floats each, in no particular order.
+#define BRICKS_MAGIC            "RMSDFBRK"
+#define BRICKS_VERSION          1
+#define BRICK_SIZE              8
+#define BRICK_SAMPLES           (BRICK_SIZE + 1)
+#define BRICK_EMPTY             0
+
+#define MAX_BRICKED_RESOLUTION  2048
+
+struct brick_header {
+        char            magic[8];
+        uint32_t        version;
+        uint32_t        dims[3];        // samples of the whole volume
+        float           min[3];
+        float           voxel_size;
+        uint32_t        counts[3];      // bricks along each axis
+        uint32_t        brick_size;
+        uint64_t        coarse_offset;
+        uint64_t        table_offset;
+        uint64_t        bricks_offset;
+};
+
+// Volume file mapped into memory, data points into the mapping
+struct volume {
+        void*                           map;
+        uint64_t                        map_size;
+        struct volume_header const*     header;
+        float const*                    data;
+};
+
+void    map_volume(struct volume* const volume, char const* path);
+void    unmap_volume(struct volume* const volume);
+void    create_volume_texture(unsigned int* const texture, struct volume const* const volume);
+void    delete_volume_texture(unsigned int const* const texture);
+
+#endif